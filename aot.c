@@ -0,0 +1,1692 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _POSIX_C_SOURCE 200809L
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+
+enum {
+  // Limits on a compiled function: its parameters and `let` locals, and the
+  // arguments of any one call in it.
+  VariableLimit = 256,
+  ArgumentLimit = 64,
+  NameSize = 256,
+  // C compilers need only accept string literals of about this length.
+  StringLimit = 4000,
+  // The analysis of variable kinds only ever demotes them to objects, so it
+  // settles quickly; this is a backstop.
+  PassLimit = 32,
+};
+
+// The C representation of a value: an `FeObject*`, an unboxed `FeDouble`, or a
+// `bool` (for `nil` or not). `KindAny` asks for whichever the expression
+// produces naturally, and `KindNone` for no value at all.
+typedef enum Kind {
+  KindObject,
+  KindDouble,
+  KindBool,
+  KindAny,
+  KindNone,
+} Kind;
+
+// What the head of a call form names, as far as the compiler can tell.
+typedef enum Form {
+  FormLet,
+  FormSet,
+  FormIf,
+  FormWhile,
+  FormQuote,
+  FormAnd,
+  FormOr,
+  FormDo,
+  FormCons,
+  FormCar,
+  FormCdr,
+  FormSetCar,
+  FormSetCdr,
+  FormList,
+  FormNot,
+  FormIs,
+  FormAtom,
+  FormLess,
+  FormLessEqual,
+  FormAdd,
+  FormSub,
+  FormMul,
+  FormDiv,
+  // Primitives that cannot be compiled, since they make closures or evaluate
+  // their arguments repeatedly:
+  FormFn,
+  FormMacro,
+  FormBench,
+  // Any other callable, which `FeInvoke` calls:
+  FormCall,
+  // An `FeTDoubleFn`, which `FeInvokeDoubles` calls:
+  FormDoubleFn,
+  // A compiled function of the same scripts, which is called directly while
+  // it is still bound to its name:
+  FormFunction,
+} Form;
+
+static const char* const form_names[] = {
+    [FormLet] = "let",       [FormSet] = "=",       [FormIf] = "if",
+    [FormWhile] = "while",   [FormQuote] = "quote", [FormAnd] = "and",
+    [FormOr] = "or",         [FormDo] = "do",       [FormCons] = "cons",
+    [FormCar] = "car",       [FormCdr] = "cdr",     [FormSetCar] = "setcar",
+    [FormSetCdr] = "setcdr", [FormList] = "list",   [FormNot] = "not",
+    [FormIs] = "is",         [FormAtom] = "atom",   [FormLess] = "<",
+    [FormLessEqual] = "<=",  [FormAdd] = "+",       [FormSub] = "-",
+    [FormMul] = "*",         [FormDiv] = "/",       [FormFn] = "fn",
+    [FormMacro] = "macro",   [FormBench] = "bench",
+};
+
+// A top-level `(= name (fn (params ...) body ...))`. Its parameters and then
+// its `let` locals, in the order the compiler meets them, are its variables,
+// each of which is an unboxed double if the analysis allows.
+typedef struct Function {
+  FeObject* name;
+  FeObject* params;
+  FeObject* body;
+  size_t form;
+  size_t param_count;
+  // The indices of `name`, and of the name of the interpreted original, in the
+  // generated symbol table:
+  size_t symbol;
+  size_t original;
+  char id[NameSize];
+  bool compiled;
+  bool calls_directly;
+  Kind result;
+  Kind kinds[VariableLimit];
+  // Whether a parameter is used as a number, and whether a variable is ever
+  // given a value that is not certainly a number:
+  bool numeric[VariableLimit];
+  bool demoted[VariableLimit];
+  char* code;
+  size_t code_size;
+} Function;
+
+typedef struct Aot {
+  FeContext* ctx;
+  FeObject** forms;
+  size_t form_count;
+  Function* functions;
+  size_t function_count;
+  char** symbols;
+  size_t symbol_count;
+  // The symbols that the scripts assign anywhere, or define as macros, which
+  // the compiler must not assume still name what they name in `ctx`:
+  FeObject** assigned;
+  size_t assigned_count;
+  FeObject** macros;
+  size_t macro_count;
+} Aot;
+
+typedef struct Variable {
+  FeObject* name;
+  size_t index;
+} Variable;
+
+typedef struct Compiler {
+  Aot* aot;
+  Function* fn;
+  FILE* out;
+  size_t indent;
+  Variable scope[VariableLimit];
+  size_t scope_count;
+  size_t declared;
+  size_t temps;
+  bool failed;
+  // Whether the code emitted since the start of the current statement may
+  // have pushed objects onto the GC stack:
+  bool allocated;
+  bool uses_gc;
+  bool uses_symbols;
+} Compiler;
+
+typedef struct Value {
+  Kind kind;
+  char text[64];
+} Value;
+
+static void* Allocate(FeContext* ctx, void* p, size_t count, size_t size) {
+  p = count <= SIZE_MAX / size ? realloc(p, count * size) : NULL;
+  if (p == NULL) {
+    FeHandleError(ctx, "out of memory");
+  }
+  return p;
+}
+
+static void GetName(Aot* aot, FeObject* symbol, char* name) {
+  (void)FeToString(aot->ctx, symbol, name, NameSize);
+}
+
+// Returns the number of forms in `list`, or `SIZE_MAX` if it is not a list.
+static size_t CountForms(Aot* aot, FeObject* list) {
+  size_t count = 0;
+  for (; FeGetType(list) == FeTPair; list = FeCdr(aot->ctx, list)) {
+    count++;
+  }
+  return FeIsNil(list) ? count : SIZE_MAX;
+}
+
+static bool IsListed(FeObject** list, size_t count, FeObject* x) {
+  for (size_t i = 0; i < count; i++) {
+    if (list[i] == x) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t AddSymbol(Aot* aot, const char* name) {
+  for (size_t i = 0; i < aot->symbol_count; i++) {
+    if (strcmp(aot->symbols[i], name) == 0) {
+      return i;
+    }
+  }
+  aot->symbols =
+      Allocate(aot->ctx, aot->symbols, aot->symbol_count + 1, sizeof(char*));
+  char* copy = strdup(name);
+  if (copy == NULL) {
+    FeHandleError(aot->ctx, "out of memory");
+  }
+  aot->symbols[aot->symbol_count] = copy;
+  return aot->symbol_count++;
+}
+
+// Writes `bytes` as the contents of a C string literal.
+static void WriteEscaped(FILE* out, const char* bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    const unsigned char b = (unsigned char)bytes[i];
+    if (b == '"' || b == '\\' || b == '?') {
+      fprintf(out, "\\%c", b);
+    } else if (isprint(b)) {
+      fputc(b, out);
+    } else {
+      fprintf(out, "\\%03o", b);
+    }
+  }
+}
+
+// Emission
+
+static void Line(Compiler* c, const char* format, ...)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wgcc-compat"
+    __attribute((format(printf, 2, 3))) {
+#pragma clang diagnostic pop
+  fprintf(c->out, "%*s", (int)(2 * c->indent), "");
+  va_list arguments;
+  va_start(arguments, format);
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+  vfprintf(c->out, format, arguments);
+#pragma clang diagnostic pop
+  va_end(arguments);
+  fputc('\n', c->out);
+}
+
+static Value MakeValue(Kind kind, const char* text) {
+  Value v = {.kind = kind};
+  snprintf(v.text, sizeof(v.text), "%s", text);
+  return v;
+}
+
+static const Value nil_value = {.kind = KindObject, .text = "(&nil)"};
+
+static Value Fail(Compiler* c) {
+  c->failed = true;
+  return nil_value;
+}
+
+static Value NewTemp(Compiler* c, Kind kind) {
+  Value v = {.kind = kind};
+  snprintf(v.text, sizeof(v.text), "t%zu", c->temps++);
+  return v;
+}
+
+static const char* GetTypeName(Kind kind) {
+  return kind == KindDouble ? "FeDouble"
+         : kind == KindBool ? "bool"
+                            : "FeObject*";
+}
+
+static const char* GetDefault(Kind kind) {
+  return kind == KindDouble ? "0" : kind == KindBool ? "false" : "&nil";
+}
+
+static void NoteAllocation(Compiler* c) {
+  c->allocated = true;
+  c->uses_gc = true;
+}
+
+// Returns the C expression for `symbol` in the generated symbol table.
+static Value GetSymbol(Compiler* c, FeObject* symbol) {
+  char name[NameSize];
+  GetName(c->aot, symbol, name);
+  c->uses_symbols = true;
+  Value v = {.kind = KindObject};
+  snprintf(v.text, sizeof(v.text), "s[%zu]", AddSymbol(c->aot, name));
+  return v;
+}
+
+static Value MakeDouble(FeDouble d) {
+  Value v = {.kind = KindDouble};
+  if (isnan(d)) {
+    snprintf(v.text, sizeof(v.text), "__builtin_nan(\"\")");
+  } else if (isinf(d)) {
+    snprintf(v.text, sizeof(v.text), "%s__builtin_inf()", d < 0 ? "-" : "");
+  } else {
+    snprintf(v.text, sizeof(v.text), "%a", d);
+  }
+  return v;
+}
+
+static void EmitArray(Compiler* c,
+                      const char* type,
+                      const Value* name,
+                      const Value* values,
+                      size_t count) {
+  fprintf(c->out, "%*s%s %s[%zu] = {", (int)(2 * c->indent), "", type,
+          name->text, count);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(c->out, "%s%s", i == 0 ? "" : ", ", values[i].text);
+  }
+  fprintf(c->out, "};\n");
+}
+
+// Restores the GC stack to `g`, and pushes the object variables in scope,
+// which may have been given values that are reachable only from above `g`.
+static void Restore(Compiler* c, const Value* g) {
+  Line(c, "FeRestoreGC(ctx, %s);", g->text);
+  for (size_t i = 0; i < c->scope_count; i++) {
+    const size_t index = c->scope[i].index;
+    if (c->fn->kinds[index] == KindObject) {
+      Line(c, "FePushGC(ctx, v%zu);", index);
+    }
+  }
+  c->uses_gc = true;
+}
+
+// Code that must be preceded by a declaration that it turns out to need, such
+// as of the GC stack index that a loop restores, is emitted to a capture.
+typedef struct Capture {
+  FILE* out;
+  char* text;
+  size_t size;
+} Capture;
+
+static void BeginCapture(Compiler* c, Capture* capture) {
+  capture->out = c->out;
+  capture->text = NULL;
+  capture->size = 0;
+  c->out = open_memstream(&capture->text, &capture->size);
+  if (c->out == NULL) {
+    FeHandleError(c->aot->ctx, "out of memory");
+  }
+}
+
+static void EndCapture(Compiler* c, Capture* capture) {
+  fclose(c->out);
+  c->out = capture->out;
+}
+
+static void WriteCapture(Compiler* c, Capture* capture) {
+  fwrite(capture->text, 1, capture->size, c->out);
+  free(capture->text);
+}
+
+static Value Convert(Compiler* c, Value v, Kind want) {
+  if (want == KindAny || want == v.kind) {
+    return v;
+  }
+  if (want == KindNone) {
+    Line(c, "(void)%s;", v.text);
+    return v;
+  }
+  if (want == KindBool && v.kind == KindDouble) {
+    // Numbers are true.
+    Line(c, "(void)%s;", v.text);
+    return MakeValue(KindBool, "true");
+  }
+  const Value t = NewTemp(c, want);
+  if (want == KindObject) {
+    if (v.kind == KindDouble) {
+      Line(c, "FeObject* %s = FeMakeDouble(ctx, %s);", t.text, v.text);
+      NoteAllocation(c);
+    } else {
+      Line(c, "FeObject* %s = FeMakeBool(ctx, %s);", t.text, v.text);
+    }
+  } else if (want == KindDouble) {
+    if (v.kind == KindObject) {
+      Line(c, "FeDouble %s = FeToDouble(ctx, %s);", t.text, v.text);
+    } else {
+      Line(c, "FeDouble %s = FeToDouble(ctx, FeMakeBool(ctx, %s));", t.text,
+           v.text);
+    }
+  } else {
+    Line(c, "bool %s = !FeIsNil(%s);", t.text, v.text);
+  }
+  return t;
+}
+
+// Analysis
+
+static const Variable* FindVariable(const Compiler* c, FeObject* name) {
+  for (size_t i = c->scope_count; i > 0; i--) {
+    if (c->scope[i - 1].name == name) {
+      return &c->scope[i - 1];
+    }
+  }
+  return NULL;
+}
+
+// Returns the last definition of `name`, or `NULL`.
+static Function* FindFunction(Aot* aot, FeObject* name) {
+  for (size_t i = aot->function_count; i > 0; i--) {
+    if (aot->functions[i - 1].name == name) {
+      return &aot->functions[i - 1];
+    }
+  }
+  return NULL;
+}
+
+static Form GetPrimitiveForm(Aot* aot, FeObject* symbol) {
+  char name[NameSize];
+  GetName(aot, symbol, name);
+  for (Form f = FormLet; f < FormCall; f++) {
+    if (strcmp(form_names[f], name) == 0) {
+      return f;
+    }
+  }
+  return FormCall;
+}
+
+// Returns what `head` calls. Primitives and `FeTDoubleFn`s are recognized by
+// their values in the compiling context, unless the scripts rebind them.
+static Form ClassifyHead(Compiler* c, FeObject* head, Function** function) {
+  Aot* aot = c->aot;
+  if (FeGetType(head) != FeTSymbol || FindVariable(c, head) != NULL) {
+    return FormCall;
+  }
+  Function* f = FindFunction(aot, head);
+  if (f != NULL) {
+    *function = f;
+    return f->compiled ? FormFunction : FormCall;
+  }
+  if (IsListed(aot->macros, aot->macro_count, head)) {
+    return FormMacro;
+  }
+  if (IsListed(aot->assigned, aot->assigned_count, head)) {
+    return FormCall;
+  }
+  FeObject* value = FeEvaluate(aot->ctx, head);
+  switch (FeGetType(value)) {
+    case FeTPrimitive:
+      return GetPrimitiveForm(aot, head);
+    case FeTDoubleFn:
+      return FormDoubleFn;
+    case FeTMacro:
+      return FormMacro;
+    case FeTPair:
+    case FeTFree:
+    case FeTNil:
+    case FeTDouble:
+    case FeTSymbol:
+    case FeTString:
+    case FeTFn:
+    case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+    case FeTSentinel:
+      return FormCall;
+  }
+  return FormCall;
+}
+
+// Returns the kind of value that `x` produces without conversion. Variables
+// that are declared within `x` are unknown, and taken to be objects.
+static Kind GetNaturalKind(Compiler* c, FeObject* x) {
+  FeContext* ctx = c->aot->ctx;
+  const FeType type = FeGetType(x);
+  if (type == FeTDouble) {
+    return KindDouble;
+  }
+  if (type == FeTSymbol) {
+    const Variable* v = FindVariable(c, x);
+    return v == NULL ? KindObject : c->fn->kinds[v->index];
+  }
+  if (type != FeTPair) {
+    return KindObject;
+  }
+
+  Function* function = NULL;
+  FeObject* args = FeCdr(ctx, x);
+  switch (ClassifyHead(c, FeCar(ctx, x), &function)) {
+    case FormAdd:
+    case FormSub:
+    case FormMul:
+    case FormDiv:
+    case FormDoubleFn:
+      return KindDouble;
+    case FormLess:
+    case FormLessEqual:
+    case FormNot:
+    case FormIs:
+    case FormAtom:
+      return KindBool;
+    case FormIf: {
+      // A number only if every outcome is, including an `else`:
+      const size_t count = CountForms(c->aot, args);
+      if (count == SIZE_MAX || count % 2 == 0) {
+        return KindObject;
+      }
+      for (; !FeIsNil(FeCdr(ctx, args)); args = FeCdr(ctx, FeCdr(ctx, args))) {
+        if (GetNaturalKind(c, FeCar(ctx, FeCdr(ctx, args))) != KindDouble) {
+          return KindObject;
+        }
+      }
+      return GetNaturalKind(c, FeCar(ctx, args)) == KindDouble ? KindDouble
+                                                               : KindObject;
+    }
+    case FormDo: {
+      FeObject* last = &nil;
+      for (; FeGetType(args) == FeTPair; args = FeCdr(ctx, args)) {
+        last = FeCar(ctx, args);
+      }
+      const Kind kind = GetNaturalKind(c, last);
+      return kind == KindBool ? KindObject : kind;
+    }
+    case FormLet:
+    case FormSet:
+    case FormWhile:
+    case FormQuote:
+    case FormAnd:
+    case FormOr:
+    case FormCons:
+    case FormCar:
+    case FormCdr:
+    case FormSetCar:
+    case FormSetCdr:
+    case FormList:
+    case FormFn:
+    case FormMacro:
+    case FormBench:
+    case FormCall:
+    case FormFunction:
+      return KindObject;
+  }
+  return KindObject;
+}
+
+// Forms
+
+static Value Emit(Compiler* c, FeObject* x, Kind want);
+static Value EmitSequence(Compiler* c, FeObject* list, Kind want);
+
+static Value EmitString(Compiler* c, FeObject* x) {
+  char* text = NULL;
+  size_t size = 0;
+  FILE* literal = open_memstream(&text, &size);
+  if (literal == NULL) {
+    FeHandleError(c->aot->ctx, "out of memory");
+  }
+  while (!FeIsNil(x)) {
+    const char* chunk;
+    const size_t count = FeGetStringChunk(c->aot->ctx, &x, &chunk);
+    WriteEscaped(literal, chunk, count);
+  }
+  fclose(literal);
+  const Value t = NewTemp(c, KindObject);
+  if (size > StringLimit) {
+    free(text);
+    return Fail(c);
+  }
+  Line(c, "FeObject* %s = FeMakeString(ctx, \"%s\");", t.text, text);
+  free(text);
+  NoteAllocation(c);
+  return t;
+}
+
+static Value EmitSymbol(Compiler* c, FeObject* x, Kind want) {
+  const Variable* v = FindVariable(c, x);
+  if (v == NULL) {
+    const Value t = NewTemp(c, KindObject);
+    Line(c, "FeObject* %s = FeEvaluate(ctx, %s);", t.text,
+         GetSymbol(c, x).text);
+    return Convert(c, t, want);
+  }
+  const Kind kind = c->fn->kinds[v->index];
+  if (want == KindDouble) {
+    c->fn->numeric[v->index] = true;
+  }
+  // Copied, since the variable may change before the value is used.
+  const Value t = NewTemp(c, kind);
+  Line(c, "%s %s = v%zu;", GetTypeName(kind), t.text, v->index);
+  return Convert(c, t, want);
+}
+
+// `(let symbol value)` in a sequence declares a variable for the forms after
+// it. Elsewhere, it does nothing.
+static void EmitLet(Compiler* c, FeObject* args) {
+  FeContext* ctx = c->aot->ctx;
+  if (CountForms(c->aot, args) < 2 ||
+      FeGetType(FeCar(ctx, args)) != FeTSymbol ||
+      c->declared == VariableLimit || c->scope_count == VariableLimit) {
+    (void)Fail(c);
+    return;
+  }
+  FeObject* value = FeCar(ctx, FeCdr(ctx, args));
+  const size_t index = c->declared++;
+  if (GetNaturalKind(c, value) != KindDouble) {
+    c->fn->demoted[index] = true;
+  }
+  const Kind kind = c->fn->kinds[index];
+  const Value v = Emit(c, value, kind);
+  Line(c, "%s v%zu = %s;", GetTypeName(kind), index, v.text);
+  Line(c, "(void)v%zu;", index);
+  c->scope[c->scope_count++] =
+      (Variable){.name = FeCar(ctx, args), .index = index};
+}
+
+static Value EmitSet(Compiler* c, FeObject* args, Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  FeObject* symbol = FeCar(ctx, args);
+  if (CountForms(c->aot, args) != 2 || FeGetType(symbol) != FeTSymbol) {
+    return Fail(c);
+  }
+  FeObject* value = FeCar(ctx, FeCdr(ctx, args));
+  const Variable* v = FindVariable(c, symbol);
+  if (v == NULL) {
+    const Value r = Emit(c, value, KindObject);
+    Line(c, "FeSet(ctx, %s, %s);", GetSymbol(c, symbol).text, r.text);
+  } else {
+    const size_t index = v->index;
+    if (GetNaturalKind(c, value) != KindDouble) {
+      c->fn->demoted[index] = true;
+    }
+    const Value r = Emit(c, value, c->fn->kinds[index]);
+    Line(c, "v%zu = %s;", index, r.text);
+  }
+  return Convert(c, nil_value, want);
+}
+
+// `(if condition then ... [else])` assigns the outcome to `result`.
+static void EmitIfChain(Compiler* c, FeObject* args, const Value* result) {
+  FeContext* ctx = c->aot->ctx;
+  if (FeIsNil(args)) {
+    // Without an `else`, the outcome is `nil`.
+    if (result->kind == KindDouble) {
+      Line(c, "%s = FeToDouble(ctx, &nil);", result->text);
+    }
+    return;
+  }
+  FeObject* rest = FeCdr(ctx, args);
+  if (FeIsNil(rest)) {
+    const Value v = Emit(c, FeCar(ctx, args), result->kind);
+    Line(c, "%s = %s;", result->text, v.text);
+    return;
+  }
+  const Value condition = Emit(c, FeCar(ctx, args), KindBool);
+  Line(c, "if (%s) {", condition.text);
+  c->indent++;
+  const Value v = Emit(c, FeCar(ctx, rest), result->kind);
+  Line(c, "%s = %s;", result->text, v.text);
+  c->indent--;
+  FeObject* next = FeCdr(ctx, rest);
+  if (FeIsNil(next) && result->kind != KindDouble) {
+    Line(c, "}");
+    return;
+  }
+  Line(c, "} else {");
+  c->indent++;
+  EmitIfChain(c, next, result);
+  c->indent--;
+  Line(c, "}");
+}
+
+static Value EmitIf(Compiler* c, FeObject* args, Kind want) {
+  if (CountForms(c->aot, args) == SIZE_MAX) {
+    return Fail(c);
+  }
+  const Value result = NewTemp(c, want);
+  Line(c, "%s %s = %s;", GetTypeName(want), result.text, GetDefault(want));
+  EmitIfChain(c, args, &result);
+  return result;
+}
+
+// `and` and `or` stop at the first operand that is `nil`, or not `nil`, and
+// return the last one they evaluated.
+static void EmitLogicChain(Compiler* c,
+                           FeObject* args,
+                           bool is_and,
+                           const Value* result) {
+  FeContext* ctx = c->aot->ctx;
+  const Value v = Emit(c, FeCar(ctx, args), result->kind);
+  Line(c, "%s = %s;", result->text, v.text);
+  if (FeIsNil(FeCdr(ctx, args))) {
+    return;
+  }
+  if (result->kind == KindBool) {
+    Line(c, "if (%s%s) {", is_and ? "" : "!", result->text);
+  } else {
+    Line(c, "if (%sFeIsNil(%s)) {", is_and ? "!" : "", result->text);
+  }
+  c->indent++;
+  EmitLogicChain(c, FeCdr(ctx, args), is_and, result);
+  c->indent--;
+  Line(c, "}");
+}
+
+static Value EmitLogic(Compiler* c, FeObject* args, bool is_and, Kind want) {
+  const size_t count = CountForms(c->aot, args);
+  if (count == SIZE_MAX) {
+    return Fail(c);
+  }
+  const Kind kind = want == KindBool ? KindBool : KindObject;
+  const Value result = NewTemp(c, kind);
+  Line(c, "%s %s = %s;", GetTypeName(kind), result.text, GetDefault(kind));
+  if (count > 0) {
+    EmitLogicChain(c, args, is_and, &result);
+  }
+  return Convert(c, result, want);
+}
+
+static Value EmitWhile(Compiler* c, FeObject* args, Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  if (FeIsNil(args) || CountForms(c->aot, args) == SIZE_MAX) {
+    return Fail(c);
+  }
+  const Value g = NewTemp(c, KindObject);
+  const bool allocated = c->allocated;
+  c->allocated = false;
+  Capture capture;
+  BeginCapture(c, &capture);
+  Line(c, "for (;;) {");
+  c->indent++;
+  const Value condition = Emit(c, FeCar(ctx, args), KindBool);
+  Line(c, "if (!%s) {", condition.text);
+  Line(c, "  break;");
+  Line(c, "}");
+  (void)EmitSequence(c, FeCdr(ctx, args), KindNone);
+  if (c->allocated) {
+    Restore(c, &g);
+  }
+  c->indent--;
+  Line(c, "}");
+  EndCapture(c, &capture);
+  if (c->allocated) {
+    Line(c, "size_t %s = FeSaveGC(ctx);", g.text);
+  }
+  WriteCapture(c, &capture);
+  c->allocated = c->allocated || allocated;
+  return Convert(c, nil_value, want);
+}
+
+static Value EmitQuote(Compiler* c, FeObject* args, Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  if (CountForms(c->aot, args) != 1) {
+    return Fail(c);
+  }
+  FeObject* x = FeCar(ctx, args);
+  switch (FeGetType(x)) {
+    case FeTNil:
+      return Convert(c, nil_value, want);
+    case FeTDouble:
+      return Convert(c, MakeDouble(FeToDouble(ctx, x)), want);
+    case FeTSymbol:
+      return Convert(c, GetSymbol(c, x), want);
+    case FeTString:
+      return Convert(c, EmitString(c, x), want);
+    case FeTPair:
+    case FeTFree:
+    case FeTPrimitive:
+    case FeTFn:
+    case FeTMacro:
+    case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+    case FeTSentinel:
+      // Quoted lists are shared, mutable objects, which the interpreter
+      // returns each time.
+      return Fail(c);
+  }
+  return Fail(c);
+}
+
+// Emits each of the `count` forms of `args` as `kind`, in order, to `values`.
+static void EmitArguments(Compiler* c,
+                          FeObject* args,
+                          size_t count,
+                          Kind kind,
+                          Value* values) {
+  FeContext* ctx = c->aot->ctx;
+  for (size_t i = 0; i < count; i++, args = FeCdr(ctx, args)) {
+    values[i] = Emit(c, FeCar(ctx, args), kind);
+  }
+}
+
+static Value EmitArithmetic(Compiler* c, FeObject* args, size_t count, Form f) {
+  static const char* const operators[] = {
+      [FormAdd] = "+", [FormSub] = "-", [FormMul] = "*", [FormDiv] = "/"};
+  FeContext* ctx = c->aot->ctx;
+  if (count == 0) {
+    return Fail(c);
+  }
+  Value x = Emit(c, FeCar(ctx, args), KindDouble);
+  for (args = FeCdr(ctx, args); !FeIsNil(args); args = FeCdr(ctx, args)) {
+    const Value y = Emit(c, FeCar(ctx, args), KindDouble);
+    const Value t = NewTemp(c, KindDouble);
+    Line(c, "FeDouble %s = %s %s %s;", t.text, x.text, operators[f], y.text);
+    x = t;
+  }
+  return x;
+}
+
+// Calls the value of `head` with `FeInvoke`, or with `FeInvokeDoubles` if a
+// number is wanted and the arguments are numbers.
+static Value EmitCall(Compiler* c,
+                      FeObject* head,
+                      FeObject* args,
+                      size_t count,
+                      Kind want) {
+  if (count > ArgumentLimit) {
+    return Fail(c);
+  }
+  const Value f = Emit(c, head, KindObject);
+  bool doubles = want == KindDouble && count > 0;
+  FeObject* a = args;
+  for (size_t i = 0; i < count && doubles; i++, a = FeCdr(c->aot->ctx, a)) {
+    doubles = GetNaturalKind(c, FeCar(c->aot->ctx, a)) == KindDouble;
+  }
+
+  Value values[ArgumentLimit];
+  EmitArguments(c, args, count, doubles ? KindDouble : KindObject, values);
+  const Value array = NewTemp(c, KindObject);
+  if (count > 0) {
+    EmitArray(c, doubles ? "FeDouble" : "FeObject*", &array, values, count);
+  }
+  const Value t = NewTemp(c, doubles ? KindDouble : KindObject);
+  if (doubles) {
+    Line(c, "FeDouble %s = FeInvokeDoubles(ctx, %s, %zu, %s);", t.text, f.text,
+         count, array.text);
+  } else {
+    Line(c, "FeObject* %s = FeInvoke(ctx, %s, %zu, %s);", t.text, f.text, count,
+         count > 0 ? array.text : "NULL");
+    NoteAllocation(c);
+  }
+  return Convert(c, t, want);
+}
+
+static Value EmitDoubleFnCall(Compiler* c,
+                              FeObject* head,
+                              FeObject* args,
+                              size_t count,
+                              Kind want) {
+  if (count < 1 || count > 2) {
+    return Fail(c);
+  }
+  // The function is pure, and keeps its value unless the scripts rebind it, so
+  // a call with constant arguments is replaced with its result.
+  FeContext* ctx = c->aot->ctx;
+  FeDouble constants[2];
+  size_t n = 0;
+  for (FeObject* a = args; n < count && FeGetType(FeCar(ctx, a)) == FeTDouble;
+       a = FeCdr(ctx, a)) {
+    constants[n++] = FeToDouble(ctx, FeCar(ctx, a));
+  }
+  if (n == count) {
+    const size_t gc = FeSaveGC(ctx);
+    FeObject* fn = FePrepareCall(ctx, head);
+    const FeDouble result = FeInvokeDoubles(ctx, fn, count, constants);
+    FeReleaseCall(ctx, fn);
+    FeRestoreGC(ctx, gc);
+    return Convert(c, MakeDouble(result), want);
+  }
+  const Value f = Emit(c, head, KindObject);
+  Value values[2];
+  EmitArguments(c, args, count, KindDouble, values);
+  const Value array = NewTemp(c, KindDouble);
+  EmitArray(c, "FeDouble", &array, values, count);
+  const Value t = NewTemp(c, KindDouble);
+  Line(c, "FeDouble %s = FeInvokeDoubles(ctx, %s, %zu, %s);", t.text, f.text,
+       count, array.text);
+  return Convert(c, t, want);
+}
+
+// Calls `function`'s body directly, passing numbers unboxed, so long as its
+// name is still bound to its native function and the arguments suit it.
+static Value EmitDirectCall(Compiler* c,
+                            FeObject* head,
+                            FeObject* args,
+                            Function* function,
+                            Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  const size_t count = function->param_count;
+  if (count > ArgumentLimit) {
+    return Fail(c);
+  }
+  c->fn->calls_directly = true;
+  const Value f = Emit(c, head, KindObject);
+  Value values[ArgumentLimit];
+  FeObject* a = args;
+  for (size_t i = 0; i < count; i++, a = FeCdr(ctx, a)) {
+    FeObject* x = FeCar(ctx, a);
+    const bool unboxed =
+        function->kinds[i] == KindDouble && GetNaturalKind(c, x) == KindDouble;
+    values[i] = Emit(c, x, unboxed ? KindDouble : KindObject);
+  }
+
+  char condition[ArgumentLimit * 48 + 64];
+  size_t size = (size_t)snprintf(condition, sizeof(condition),
+                                 "%s == module.natives[%zu]", f.text,
+                                 (size_t)(function - c->aot->functions));
+  for (size_t i = 0; i < count; i++) {
+    if (function->kinds[i] == KindDouble && values[i].kind == KindObject) {
+      size +=
+          (size_t)snprintf(condition + size, sizeof(condition) - size,
+                           " && FeGetType(%s) == FeTDouble", values[i].text);
+    }
+  }
+  const Value result = NewTemp(c, want);
+  Line(c, "%s %s = %s;", GetTypeName(want), result.text, GetDefault(want));
+  Line(c, "if (%s) {", condition);
+  c->indent++;
+  const Value r = NewTemp(c, function->result);
+  fprintf(c->out, "%*s%s %s = %sBody(ctx", (int)(2 * c->indent), "",
+          GetTypeName(r.kind), r.text, function->id);
+  for (size_t i = 0; i < count; i++) {
+    if (function->kinds[i] == KindDouble && values[i].kind == KindObject) {
+      fprintf(c->out, ", FeToDouble(ctx, %s)", values[i].text);
+    } else {
+      fprintf(c->out, ", %s", values[i].text);
+    }
+  }
+  fprintf(c->out, ");\n");
+  Line(c, "%s = %s;", result.text, Convert(c, r, want).text);
+  c->indent--;
+  Line(c, "} else {");
+  c->indent++;
+  Value boxed[ArgumentLimit];
+  for (size_t i = 0; i < count; i++) {
+    boxed[i] = Convert(c, values[i], KindObject);
+  }
+  const Value array = NewTemp(c, KindObject);
+  if (count > 0) {
+    EmitArray(c, "FeObject*", &array, boxed, count);
+  }
+  const Value o = NewTemp(c, KindObject);
+  Line(c, "FeObject* %s = FeInvoke(ctx, %s, %zu, %s);", o.text, f.text, count,
+       count > 0 ? array.text : "NULL");
+  Line(c, "%s = %s;", result.text, Convert(c, o, want).text);
+  c->indent--;
+  Line(c, "}");
+  NoteAllocation(c);
+  return result;
+}
+
+static Value EmitForm(Compiler* c, FeObject* x, Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  FeObject* head = FeCar(ctx, x);
+  FeObject* args = FeCdr(ctx, x);
+  const size_t count = CountForms(c->aot, args);
+  if (count == SIZE_MAX) {
+    return Fail(c);
+  }
+  Value values[2];
+  Value t;
+  Function* function = NULL;
+  const Form f = ClassifyHead(c, head, &function);
+  switch (f) {
+    case FormLet:
+      // Outside a sequence, `let` evaluates nothing.
+      if (count < 1 || FeGetType(FeCar(ctx, args)) != FeTSymbol) {
+        return Fail(c);
+      }
+      return Convert(c, nil_value, want);
+    case FormSet:
+      return EmitSet(c, args, want);
+    case FormIf:
+      return EmitIf(c, args, want);
+    case FormWhile:
+      return EmitWhile(c, args, want);
+    case FormQuote:
+      return EmitQuote(c, args, want);
+    case FormAnd:
+    case FormOr:
+      return EmitLogic(c, args, f == FormAnd, want);
+    case FormDo:
+      return EmitSequence(c, args, want);
+    case FormCons:
+      if (count != 2) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 2, KindObject, values);
+      t = NewTemp(c, KindObject);
+      Line(c, "FeObject* %s = FeCons(ctx, %s, %s);", t.text, values[0].text,
+           values[1].text);
+      NoteAllocation(c);
+      return Convert(c, t, want);
+    case FormCar:
+    case FormCdr:
+      if (count != 1) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 1, KindObject, values);
+      t = NewTemp(c, KindObject);
+      Line(c, "FeObject* %s = FeC%sr(ctx, %s);", t.text,
+           f == FormCar ? "a" : "d", values[0].text);
+      return Convert(c, t, want);
+    case FormSetCar:
+    case FormSetCdr: {
+      if (count != 2) {
+        return Fail(c);
+      }
+      const char* field = f == FormSetCar ? "Car" : "Cdr";
+      values[0] = Emit(c, FeCar(ctx, args), KindObject);
+      // As in the interpreter, a non-pair is an error before the value is
+      // evaluated.
+      Line(c, "if (FeGetType(%s) != FeTPair) {", values[0].text);
+      Line(c, "  FeSet%s(ctx, %s, &nil);", field, values[0].text);
+      Line(c, "}");
+      values[1] = Emit(c, FeCar(ctx, FeCdr(ctx, args)), KindObject);
+      Line(c, "FeSet%s(ctx, %s, %s);", field, values[0].text, values[1].text);
+      return Convert(c, nil_value, want);
+    }
+    case FormList: {
+      if (count == 0) {
+        return Convert(c, nil_value, want);
+      }
+      if (count > ArgumentLimit) {
+        return Fail(c);
+      }
+      Value items[ArgumentLimit];
+      EmitArguments(c, args, count, KindObject, items);
+      const Value array = NewTemp(c, KindObject);
+      EmitArray(c, "FeObject*", &array, items, count);
+      t = NewTemp(c, KindObject);
+      Line(c, "FeObject* %s = FeMakeList(ctx, %s, %zu);", t.text, array.text,
+           count);
+      NoteAllocation(c);
+      return Convert(c, t, want);
+    }
+    case FormNot:
+      if (count != 1) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 1, KindBool, values);
+      t = NewTemp(c, KindBool);
+      Line(c, "bool %s = !%s;", t.text, values[0].text);
+      return Convert(c, t, want);
+    case FormIs:
+      if (count != 2) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 2, KindObject, values);
+      t = NewTemp(c, KindBool);
+      Line(c, "bool %s = FeIsEqual(%s, %s);", t.text, values[0].text,
+           values[1].text);
+      return Convert(c, t, want);
+    case FormAtom:
+      if (count != 1) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 1, KindObject, values);
+      t = NewTemp(c, KindBool);
+      Line(c, "bool %s = FeGetType(%s) != FeTPair;", t.text, values[0].text);
+      return Convert(c, t, want);
+    case FormLess:
+    case FormLessEqual:
+      if (count != 2) {
+        return Fail(c);
+      }
+      EmitArguments(c, args, 2, KindDouble, values);
+      t = NewTemp(c, KindBool);
+      Line(c, "bool %s = %s %s %s;", t.text, values[0].text,
+           f == FormLess ? "<" : "<=", values[1].text);
+      return Convert(c, t, want);
+    case FormAdd:
+    case FormSub:
+    case FormMul:
+    case FormDiv:
+      return Convert(c, EmitArithmetic(c, args, count, f), want);
+    case FormFn:
+    case FormMacro:
+    case FormBench:
+      return Fail(c);
+    case FormDoubleFn:
+      return EmitDoubleFnCall(c, head, args, count, want);
+    case FormFunction:
+      if (count == function->param_count) {
+        return EmitDirectCall(c, head, args, function, want);
+      }
+      return EmitCall(c, head, args, count, want);
+    case FormCall:
+      return EmitCall(c, head, args, count, want);
+  }
+  return Fail(c);
+}
+
+static Value Emit(Compiler* c, FeObject* x, Kind want) {
+  if (want == KindNone) {
+    const Value v = Emit(c, x, KindAny);
+    Line(c, "(void)%s;", v.text);
+    return v;
+  }
+  if (want == KindAny) {
+    want = GetNaturalKind(c, x);
+  }
+  switch (FeGetType(x)) {
+    case FeTNil:
+      return Convert(c, nil_value, want);
+    case FeTDouble:
+      return Convert(c, MakeDouble(FeToDouble(c->aot->ctx, x)), want);
+    case FeTString:
+      return Convert(c, EmitString(c, x), want);
+    case FeTSymbol:
+      return EmitSymbol(c, x, want);
+    case FeTPair:
+      return EmitForm(c, x, want);
+    case FeTFree:
+    case FeTPrimitive:
+    case FeTFn:
+    case FeTMacro:
+    case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+    case FeTSentinel:
+      return Fail(c);
+  }
+  return Fail(c);
+}
+
+// Emits a body, in which `let` declares variables for the forms after it. As
+// in the interpreter, the GC stack is restored after each form.
+static Value EmitSequence(Compiler* c, FeObject* list, Kind want) {
+  FeContext* ctx = c->aot->ctx;
+  const size_t count = CountForms(c->aot, list);
+  if (count == SIZE_MAX) {
+    return Fail(c);
+  }
+  if (count == 0) {
+    return Convert(c, nil_value, want);
+  }
+  const size_t scope_count = c->scope_count;
+  const Value g = NewTemp(c, KindObject);
+  bool restores = false;
+  Value result = nil_value;
+  Capture capture;
+  BeginCapture(c, &capture);
+  for (size_t i = 0; i < count; i++, list = FeCdr(ctx, list)) {
+    FeObject* x = FeCar(ctx, list);
+    const bool last = i + 1 == count;
+    const bool allocated = c->allocated;
+    c->allocated = false;
+    Function* function = NULL;
+    if (FeGetType(x) == FeTPair &&
+        ClassifyHead(c, FeCar(ctx, x), &function) == FormLet) {
+      EmitLet(c, FeCdr(ctx, x));
+      result = last ? Convert(c, nil_value, want) : nil_value;
+    } else {
+      result = Emit(c, x, last ? want : KindNone);
+    }
+    if (!last && c->allocated) {
+      Restore(c, &g);
+      restores = true;
+    }
+    c->allocated = c->allocated || allocated;
+  }
+  EndCapture(c, &capture);
+  if (restores) {
+    Line(c, "size_t %s = FeSaveGC(ctx);", g.text);
+  }
+  WriteCapture(c, &capture);
+  c->scope_count = scope_count;
+  return result;
+}
+
+// Functions
+
+static void WriteParameters(FILE* out, const Function* fn) {
+  fprintf(out, "FeContext* ctx");
+  for (size_t i = 0; i < fn->param_count; i++) {
+    fprintf(out, ", %s v%zu", GetTypeName(fn->kinds[i]), i);
+  }
+}
+
+// Emits the body of `fn` with the current kinds of its variables, or marks it
+// as not compiled.
+static void CompileFunction(Aot* aot, Function* fn) {
+  FeContext* ctx = aot->ctx;
+  Compiler c = {.aot = aot, .fn = fn, .declared = fn->param_count, .indent = 1};
+  FeObject* p = fn->params;
+  for (size_t i = 0; i < fn->param_count; i++, p = FeCdr(ctx, p)) {
+    c.scope[c.scope_count++] = (Variable){.name = FeCar(ctx, p), .index = i};
+  }
+  fn->calls_directly = false;
+  char* body = NULL;
+  size_t body_size = 0;
+  c.out = open_memstream(&body, &body_size);
+  if (c.out == NULL) {
+    FeHandleError(ctx, "out of memory");
+  }
+  Value v = EmitSequence(&c, fn->body, KindAny);
+  if (v.kind == KindBool) {
+    v = Convert(&c, v, KindObject);
+  }
+  fclose(c.out);
+  free(fn->code);
+  fn->code = NULL;
+  if (c.failed) {
+    free(body);
+    fn->compiled = false;
+    return;
+  }
+  fn->result = v.kind;
+
+  FILE* out = open_memstream(&fn->code, &fn->code_size);
+  if (out == NULL) {
+    FeHandleError(ctx, "out of memory");
+  }
+  fprintf(out, "static %s %sBody(", GetTypeName(fn->result), fn->id);
+  WriteParameters(out, fn);
+  fprintf(out, ") {\n  (void)ctx;\n");
+  for (size_t i = 0; i < fn->param_count; i++) {
+    fprintf(out, "  (void)v%zu;\n", i);
+  }
+  if (fn->calls_directly) {
+    fprintf(out,
+            "  void* frame = __builtin_frame_address(0);\n"
+            "  if ((uintptr_t)frame < stack_limit) {\n"
+            "    FeHandleError(ctx, \"stack overflow\");\n"
+            "  }\n");
+  }
+  if (c.uses_gc) {
+    fprintf(out, "  size_t gc = FeSaveGC(ctx);\n");
+  }
+  if (c.uses_symbols) {
+    fprintf(out, "  FeObject** s = GetSymbols(ctx);\n");
+  }
+  fwrite(body, 1, body_size, out);
+  free(body);
+  if (c.uses_gc) {
+    fprintf(out, "  FeRestoreGC(ctx, gc);\n");
+    if (fn->result == KindObject) {
+      fprintf(out, "  FePushGC(ctx, %s);\n", v.text);
+    }
+  }
+  fprintf(out, "  return %s;\n}\n\n", v.text);
+  fclose(out);
+}
+
+// Compiles every function until the kinds of their variables settle. Each
+// pass only demotes variables to objects, and functions to not compiled.
+static void CompileFunctions(Aot* aot) {
+  for (size_t pass = 0; pass < PassLimit; pass++) {
+    bool changed = false;
+    for (size_t i = 0; i < aot->function_count; i++) {
+      Function* fn = &aot->functions[i];
+      if (!fn->compiled) {
+        continue;
+      }
+      const Kind result = fn->result;
+      memset(fn->numeric, 0, sizeof(fn->numeric));
+      CompileFunction(aot, fn);
+      changed = changed || !fn->compiled || fn->result != result;
+    }
+    for (size_t i = 0; i < aot->function_count; i++) {
+      Function* fn = &aot->functions[i];
+      for (size_t j = 0; j < VariableLimit && fn->compiled; j++) {
+        const bool number =
+            !fn->demoted[j] && (j >= fn->param_count || fn->numeric[j]);
+        if (fn->kinds[j] == KindDouble && !number) {
+          fn->kinds[j] = KindObject;
+          changed = true;
+        }
+      }
+    }
+    if (!changed) {
+      return;
+    }
+  }
+  for (size_t i = 0; i < aot->function_count; i++) {
+    aot->functions[i].compiled = false;
+  }
+}
+
+// Scripts
+
+static void NoteAssignments(Aot* aot, FeObject* set, FeObject* x) {
+  FeContext* ctx = aot->ctx;
+  for (; FeGetType(x) == FeTPair; x = FeCdr(ctx, x)) {
+    FeObject* head = FeCar(ctx, x);
+    if (head == set && FeGetType(FeCdr(ctx, x)) == FeTPair) {
+      FeObject* symbol = FeCar(ctx, FeCdr(ctx, x));
+      if (FeGetType(symbol) == FeTSymbol &&
+          !IsListed(aot->assigned, aot->assigned_count, symbol)) {
+        aot->assigned = Allocate(ctx, aot->assigned, aot->assigned_count + 1,
+                                 sizeof(FeObject*));
+        aot->assigned[aot->assigned_count++] = symbol;
+      }
+    }
+    NoteAssignments(aot, set, head);
+  }
+}
+
+static void MakeId(Aot* aot, Function* fn) {
+  char name[NameSize];
+  GetName(aot, fn->name, name);
+  size_t size = (size_t)snprintf(fn->id, 3, "Fn");
+  bool upper = true;
+  for (const char* p = name; *p != '\0' && size < 64; p++) {
+    if (isalnum((unsigned char)*p)) {
+      fn->id[size++] = upper ? (char)toupper((unsigned char)*p) : *p;
+      upper = false;
+    } else {
+      upper = true;
+    }
+  }
+  fn->id[size] = '\0';
+  for (size_t i = 0; i < aot->function_count; i++) {
+    if (&aot->functions[i] != fn && strcmp(aot->functions[i].id, fn->id) == 0) {
+      snprintf(fn->id + size, sizeof(fn->id) - size, "%zu",
+               aot->function_count);
+      break;
+    }
+  }
+}
+
+// Records the top-level `(= name (fn (params ...) ...))` and
+// `(= name (macro ...))` forms.
+static void FindDefinitions(Aot* aot) {
+  FeContext* ctx = aot->ctx;
+  FeObject* set = FeMakeSymbol(ctx, "=");
+  FeObject* fn_symbol = FeMakeSymbol(ctx, "fn");
+  FeObject* macro_symbol = FeMakeSymbol(ctx, "macro");
+  for (size_t i = 0; i < aot->form_count; i++) {
+    NoteAssignments(aot, set, aot->forms[i]);
+  }
+  for (size_t i = 0; i < aot->form_count; i++) {
+    FeObject* x = aot->forms[i];
+    if (FeGetType(x) != FeTPair || FeCar(ctx, x) != set ||
+        CountForms(aot, x) != 3) {
+      continue;
+    }
+    FeObject* name = FeCar(ctx, FeCdr(ctx, x));
+    FeObject* value = FeCar(ctx, FeCdr(ctx, FeCdr(ctx, x)));
+    if (FeGetType(name) != FeTSymbol || FeGetType(value) != FeTPair) {
+      continue;
+    }
+    if (FeCar(ctx, value) == macro_symbol) {
+      aot->macros =
+          Allocate(ctx, aot->macros, aot->macro_count + 1, sizeof(FeObject*));
+      aot->macros[aot->macro_count++] = name;
+      continue;
+    }
+    if (FeCar(ctx, value) != fn_symbol ||
+        FeGetType(FeCdr(ctx, value)) != FeTPair) {
+      continue;
+    }
+    FeObject* params = FeCar(ctx, FeCdr(ctx, value));
+    const size_t param_count = CountForms(aot, params);
+    bool symbols = param_count <= ArgumentLimit;
+    for (FeObject* p = params; symbols && !FeIsNil(p); p = FeCdr(ctx, p)) {
+      symbols = FeGetType(FeCar(ctx, p)) == FeTSymbol;
+    }
+    if (!symbols || CountForms(aot, FeCdr(ctx, value)) == SIZE_MAX) {
+      continue;
+    }
+
+    aot->functions = Allocate(ctx, aot->functions, aot->function_count + 1,
+                              sizeof(Function));
+    Function* fn = &aot->functions[aot->function_count];
+    *fn = (Function){.name = name,
+                     .params = params,
+                     .body = FeCdr(ctx, FeCdr(ctx, value)),
+                     .form = i,
+                     .param_count = param_count,
+                     .compiled = true,
+                     .result = KindObject};
+    for (size_t j = 0; j < VariableLimit; j++) {
+      fn->kinds[j] = KindDouble;
+    }
+    MakeId(aot, fn);
+    aot->function_count++;
+  }
+}
+
+typedef struct Text {
+  const char* bytes;
+  size_t size;
+  size_t next;
+} Text;
+
+static char ReadText(FeContext*, void* udata) {
+  Text* t = udata;
+  return t->next < t->size ? t->bytes[t->next++] : '\0';
+}
+
+// Reads the scripts into one text, each followed by a newline.
+static bool ReadScripts(char* const pathnames[],
+                        size_t count,
+                        char** text,
+                        size_t* size) {
+  FILE* out = open_memstream(text, size);
+  if (out == NULL) {
+    perror("open_memstream");
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    FILE* f = fopen(pathnames[i], "rb");
+    if (f == NULL) {
+      fprintf(stderr, "could not open %s\n", pathnames[i]);
+      fclose(out);
+      free(*text);
+      return false;
+    }
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+      fwrite(buffer, 1, n, out);
+    }
+    fclose(f);
+    fputc('\n', out);
+  }
+  fclose(out);
+  return true;
+}
+
+// Output
+
+static void WriteSource(FILE* out, const char* text, size_t size) {
+  fprintf(out, "static const unsigned char source[] = {");
+  for (size_t i = 0; i < size; i++) {
+    fprintf(out, "%s%u,", i % 16 == 0 ? "\n    " : " ", (unsigned char)text[i]);
+  }
+  fprintf(out,
+          "\n    0};\n\n"
+          "static char ReadSource(FeContext*, void* udata) {\n"
+          "  size_t* next = udata;\n"
+          "  return *next + 1 < sizeof(source) ? (char)source[(*next)++] : "
+          "'\\0';\n"
+          "}\n\n");
+}
+
+static void WriteModule(FILE* out, const Aot* aot, bool calls_directly) {
+  fprintf(out, "enum {\n  SymbolCount = %zu,\n  FunctionCount = %zu,\n",
+          aot->symbol_count, aot->function_count);
+  if (calls_directly) {
+    fprintf(out, "  StackBudget = 256 * 1024,\n");
+  }
+  fprintf(out, "};\n\nstatic const char* const symbol_names[] = {\n");
+  for (size_t i = 0; i < aot->symbol_count; i++) {
+    fprintf(out, "    \"");
+    WriteEscaped(out, aot->symbols[i], strlen(aot->symbols[i]));
+    fprintf(out, "\",\n");
+  }
+  fprintf(out,
+          "};\n\n"
+          "// The symbols and native functions of the context that last ran\n"
+          "// compiled code on this thread.\n"
+          "typedef struct Module {\n"
+          "  FeContext* ctx;\n"
+          "  FeObject* symbols[SymbolCount];\n"
+          "  FeObject* natives[FunctionCount];\n"
+          "} Module;\n\n"
+          "static _Thread_local Module module;\n");
+  if (calls_directly) {
+    fprintf(out,
+            "// Direct calls below this address raise `stack overflow`.\n"
+            "static _Thread_local uintptr_t stack_limit;\n");
+  }
+  fprintf(out,
+          "\n"
+          "static FeObject** GetSymbols(FeContext* ctx) {\n"
+          "  if (module.ctx != ctx) {\n"
+          "    module = (Module){.ctx = ctx};\n"
+          "    for (size_t i = 0; i < SymbolCount; i++) {\n"
+          "      module.symbols[i] = FeMakeSymbol(ctx, symbol_names[i]);\n"
+          "    }\n"
+          "  }\n"
+          "  return module.symbols;\n"
+          "}\n\n");
+}
+
+// The native function calls the body if the arguments suit it, and otherwise
+// the interpreted original, which behaves the same for any arguments. The
+// globals that the body uses belong to the context that installed it, so
+// copies of the native in other contexts, such as those of `pmap`'s workers,
+// cannot run.
+static void WriteNative(FILE* out, const Function* fn, bool calls_directly) {
+  fprintf(out,
+          "static FeObject* %s(FeContext* ctx, size_t argc, FeObject** argv) "
+          "{\n"
+          "  FeObject* original = FeEvaluate(ctx, GetSymbols(ctx)[%zu]);\n"
+          "  if (FeIsNil(original)) {\n"
+          "    FeHandleError(ctx, \"compiled function called in another "
+          "context\");\n"
+          "  }\n"
+          "  if (argc != %zu",
+          fn->id, fn->original, fn->param_count);
+  for (size_t i = 0; i < fn->param_count; i++) {
+    if (fn->kinds[i] == KindDouble) {
+      fprintf(out, " || FeGetType(argv[%zu]) != FeTDouble", i);
+    }
+  }
+  fprintf(out,
+          ") {\n"
+          "    return FeInvoke(ctx, original, argc, argv);\n"
+          "  }\n");
+  if (calls_directly) {
+    fprintf(out,
+            "  const uintptr_t limit = stack_limit;\n"
+            "  void* frame = __builtin_frame_address(0);\n"
+            "  stack_limit = (uintptr_t)frame - StackBudget;\n");
+  }
+  fprintf(out, "  %s r = %sBody(ctx", GetTypeName(fn->result), fn->id);
+  for (size_t i = 0; i < fn->param_count; i++) {
+    if (fn->kinds[i] == KindDouble) {
+      fprintf(out, ", FeToDouble(ctx, argv[%zu])", i);
+    } else {
+      fprintf(out, ", argv[%zu]", i);
+    }
+  }
+  fprintf(out, ");\n");
+  if (calls_directly) {
+    fprintf(out, "  stack_limit = limit;\n");
+  }
+  fprintf(out, "  return %s;\n}\n\n",
+          fn->result == KindDouble ? "FeMakeDouble(ctx, r)" : "r");
+}
+
+static void WriteInstall(FILE* out, const Aot* aot, size_t compiled) {
+  if (compiled > 0) {
+    fprintf(out,
+            "typedef struct Definition {\n"
+            "  size_t form;\n"
+            "  size_t name;\n"
+            "  size_t original;\n"
+            "  size_t function;\n"
+            "  FeNativeArrayFn* fn;\n"
+            "} Definition;\n\n"
+            "static const Definition definitions[] = {\n");
+    for (size_t i = 0; i < aot->function_count; i++) {
+      const Function* fn = &aot->functions[i];
+      if (fn->compiled) {
+        fprintf(out, "    {%zu, %zu, %zu, %zu, %s},\n", fn->form, fn->symbol,
+                fn->original, i, fn->id);
+      }
+    }
+    fprintf(out, "};\n\n");
+  }
+  fprintf(out,
+          "// Runs the scripts, binding each compiled function's name to its\n"
+          "// native function once its definition has run, and keeping the\n"
+          "// interpreted original for the arguments that the native does "
+          "not\n// handle.\n"
+          "void FexInstallCompiled(FeContext* ctx) {\n"
+          "  const size_t gc = FeSaveGC(ctx);\n");
+  if (compiled > 0) {
+    fprintf(out,
+            "  module.ctx = NULL;\n"
+            "  FeObject** s = GetSymbols(ctx);\n"
+            "  size_t d = 0;\n");
+  }
+  fprintf(out,
+          "  size_t next = 0;\n"
+          "  for (size_t form = 0;; form++) {\n"
+          "    FeRestoreGC(ctx, gc);\n"
+          "    FeObject* x = FeRead(ctx, ReadSource, &next);\n"
+          "    if (x == NULL) {\n"
+          "      break;\n"
+          "    }\n"
+          "    (void)FeEvaluate(ctx, x);\n");
+  if (compiled > 0) {
+    fprintf(out,
+            "    for (; d < sizeof(definitions) / sizeof(definitions[0]) &&\n"
+            "           definitions[d].form == form;\n"
+            "         d++) {\n"
+            "      const Definition* def = &definitions[d];\n"
+            "      FeSet(ctx, s[def->original], FeEvaluate(ctx, "
+            "s[def->name]));\n"
+            "      FeObject* native = FeMakeNativeArrayFn(ctx, def->fn, 0);\n"
+            "      FePin(ctx, native);\n"
+            "      module.natives[def->function] = native;\n"
+            "      FeSet(ctx, s[def->name], native);\n"
+            "    }\n");
+  }
+  fprintf(out,
+          "  }\n"
+          "  FeRestoreGC(ctx, gc);\n"
+          "}\n");
+}
+
+bool AotCompile(FeContext* ctx,
+                char* const pathnames[],
+                size_t count,
+                FILE* output) {
+  char* text;
+  size_t size;
+  if (!ReadScripts(pathnames, count, &text, &size)) {
+    return false;
+  }
+
+  // Read the forms, keeping them reachable from a list on the GC stack:
+  Aot aot = {.ctx = ctx};
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* list = &nil;
+  Text reader = {.bytes = text, .size = size};
+  while (true) {
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, list);
+    FeObject* x = FeRead(ctx, ReadText, &reader);
+    if (x == NULL) {
+      break;
+    }
+    list = FeCons(ctx, x, list);
+    aot.form_count++;
+  }
+  aot.forms = Allocate(ctx, NULL, aot.form_count + 1, sizeof(FeObject*));
+  for (size_t i = aot.form_count; i > 0; i--, list = FeCdr(ctx, list)) {
+    aot.forms[i - 1] = FeCar(ctx, list);
+  }
+
+  FindDefinitions(&aot);
+  CompileFunctions(&aot);
+  size_t compiled = 0;
+  bool calls_directly = false;
+  for (size_t i = 0; i < aot.function_count; i++) {
+    Function* fn = &aot.functions[i];
+    if (fn->compiled) {
+      char name[NameSize];
+      char original[NameSize + 16];
+      GetName(&aot, fn->name, name);
+      snprintf(original, sizeof(original), "%s (interpreted)", name);
+      fn->symbol = AddSymbol(&aot, name);
+      fn->original = AddSymbol(&aot, original);
+      calls_directly = calls_directly || fn->calls_directly;
+      compiled++;
+    }
+  }
+
+  fprintf(output, "// Generated by `fe -c` from");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(output, " %s", pathnames[i]);
+  }
+  fprintf(output,
+          ". Do not edit.\n\n"
+          "#include <stdbool.h>\n"
+          "#include <stddef.h>\n"
+          "#include <stdint.h>\n\n"
+          "#include \"fe.h\"\n\n"
+          "void FexInstallCompiled(FeContext* ctx);\n\n");
+  WriteSource(output, text, size);
+  if (compiled > 0) {
+    WriteModule(output, &aot, calls_directly);
+    for (size_t i = 0; i < aot.function_count; i++) {
+      const Function* fn = &aot.functions[i];
+      if (fn->compiled) {
+        fprintf(output, "static %s %sBody(", GetTypeName(fn->result), fn->id);
+        WriteParameters(output, fn);
+        fprintf(output, ");\n");
+      }
+    }
+    fprintf(output, "\n");
+    for (size_t i = 0; i < aot.function_count; i++) {
+      const Function* fn = &aot.functions[i];
+      if (fn->compiled) {
+        fwrite(fn->code, 1, fn->code_size, output);
+        WriteNative(output, fn, calls_directly);
+      }
+    }
+  }
+  WriteInstall(output, &aot, compiled);
+
+  FeRestoreGC(ctx, gc);
+  for (size_t i = 0; i < aot.function_count; i++) {
+    free(aot.functions[i].code);
+  }
+  for (size_t i = 0; i < aot.symbol_count; i++) {
+    free(aot.symbols[i]);
+  }
+  free(aot.functions);
+  free(aot.symbols);
+  free(aot.assigned);
+  free(aot.macros);
+  free(aot.forms);
+  free(text);
+  return true;
+}
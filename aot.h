@@ -0,0 +1,27 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "fe.h"
+
+// Translates the scripts at `pathnames` to C, written to `output`, that
+// defines `FexInstallCompiled`. Installing the result has the same effect as
+// running the scripts in order, except that each top-level `(= name (fn ...))`
+// whose body the compiler understands binds `name` to a native function. `ctx`
+// holds the globals the scripts will run with, such as the Fex extensions.
+// Returns false, having reported why on `stderr`, if a script cannot be read.
+bool AotCompile(FeContext* ctx,
+                char* const pathnames[],
+                size_t count,
+                FILE* output);
+
+// Defined by the output of `AotCompile`.
+void FexInstallCompiled(FeContext* ctx);
+
+#endif
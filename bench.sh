@@ -34,6 +34,100 @@ times_to_csv() {
     }' "$times" >> "$csv"
 }
 
+# Times the DFA regex engine against regex.h at the current revision: common
+# patterns over 10MB of generated text, and a pattern that makes regex.h take
+# time quadratic in the subject, once where the match is short and once where it
+# covers the whole subject, so that its submatches must be found in all of it.
+bench_re() {
+  local dir
+  dir=$(mktemp -d)
+  awk 'BEGIN {
+    srand(1)
+    for (i = 0; i < 300000; i++) {
+      w = ""
+      n = 3 + int(rand() * 8)
+      for (j = 0; j < n; j++) {
+        w = w sprintf("%c", 97 + int(rand() * 26))
+      }
+      if (rand() < 0.1) {
+        printf("%s@%s.com ", w, w)
+      } else {
+        printf("%s lorem ipsum dolor sit amet ", w)
+      }
+      if (i % 8 == 7) {
+        printf("\n")
+      }
+    }
+  }' > "$dir/text.txt"
+  (head -c 20000 /dev/zero | tr '\0' a; printf 'xb\n') > "$dir/adversarial.txt"
+  (head -c 20000 /dev/zero | tr '\0' a; printf 'b\n') > "$dir/covered.txt"
+  cat > "$dir/re.fe" << EOF
+(= seconds-since (fn (start)
+  (let now (get-time))
+  (+ (- (car now) (car start))
+     (/ (- (car (cdr now)) (car (cdr start))) 1000000000))))
+(= time-matches (fn (pattern subject)
+  (let engines '("dfa" "posix"))
+  (while engines
+    (let re (compile-re pattern (car engines)))
+    (let count 0)
+    (let start (get-time))
+    (for-each-match re subject (fn (m) (= count (+ count 1))))
+    (print pattern (car engines) count (seconds-since start))
+    (= engines (cdr engines)))))
+(= text (map-file "$dir/text.txt"))
+(time-matches "[a-z]+@[a-z]+\\\\.com" text)
+(time-matches "dolor sit" text)
+(time-matches "(ipsum|amet) [a-z]+" text)
+(time-matches "(a|aa)*b" (map-file "$dir/adversarial.txt"))
+(time-matches "(a|aa)*b" (map-file "$dir/covered.txt"))
+EOF
+  ./fe -s 64000000 "$dir/re.fe"
+  rm -r "$dir"
+}
+
+# Times parsing and writing a generated 10MB JSON document.
+bench_json() {
+  local dir
+  dir=$(mktemp -d)
+  awk 'BEGIN {
+    srand(1)
+    printf("[")
+    for (i = 0; i < 60000; i++) {
+      printf("%s{\"id\": %d, \"name\": \"user %d\", \"score\": %.6f, ",
+             i > 0 ? "," : "", i, i, rand() * 1000)
+      printf("\"active\": %s, \"tags\": [\"a\", \"b\\n\", null], ",
+             rand() < 0.5 ? "true" : "false")
+      printf("\"address\": {\"street\": \"%d Main St\", \"zip\": \"%05d\"}}\n",
+             i, int(rand() * 100000))
+    }
+    printf("]\n")
+  }' > "$dir/doc.json"
+  cat > "$dir/json.fe" << EOF
+(= start (get-monotonic-time))
+(= f (open-file "$dir/doc.json" "r"))
+(= doc (parse-json f))
+(close-file f)
+(print "parse" (/ (- (get-monotonic-time) start) 1000000000))
+(= start (get-monotonic-time))
+(= f (open-file "$dir/copy.json" "w"))
+(write-json doc f)
+(close-file f)
+(print "write" (/ (- (get-monotonic-time) start) 1000000000))
+EOF
+  wc -c "$dir/doc.json"
+  ./fe -s 256000000 "$dir/json.fe"
+  rm -r "$dir"
+}
+
+case "${1:-}" in
+  re | json)
+    RELEASE=1 make fe
+    "bench_$1"
+    exit
+    ;;
+esac
+
 for revision in $(git log | awk '/^commit/ { print $2 }'); do
   git checkout "$revision"
   # Unfortunately, some revisions don't build. Arrrgggh
@@ -0,0 +1,1214 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dfa.h"
+
+enum {
+  // Patterns bigger than these are left to regex.h. Counted repetitions are
+  // expanded into copies of what they repeat, so they are bounded, too.
+  MaxNodes = 1 << 14,
+  MaxInstructions = 1 << 15,
+  MaxRepeat = 255,
+  // The memory that each machine may use for cached states. When it is used
+  // up, the cache is emptied and the search carries on.
+  CacheLimit = 1 << 21,
+  MaxPrefix = 16,
+  // Separates the groups of NFA states in a DFA state; see `Machine`.
+  Mark = -1,
+};
+
+typedef uint8_t ByteSet[32];
+
+static void AddByte(uint8_t* set, unsigned byte) {
+  set[byte >> 3] = (uint8_t)(set[byte >> 3] | 1u << (byte & 7));
+}
+
+static bool HasByte(const uint8_t* set, unsigned byte) {
+  return (set[byte >> 3] >> (byte & 7)) & 1;
+}
+
+// Parsing
+
+typedef enum NodeType {
+  NodeEmpty,
+  NodeSet,
+  NodeConcat,
+  NodeAlternate,
+  NodeStar,
+  NodePlus,
+  NodeQuestion,
+  NodeRepeat,
+  NodeBegin,
+  NodeEnd,
+  NodeGroup,
+} NodeType;
+
+typedef struct Node {
+  NodeType type;
+  int left;
+  int right;
+  // The bounds of a `NodeRepeat`, where `max` is -1 if there is none, or the
+  // number of a `NodeGroup` in `min`, counting from 0.
+  int min;
+  int max;
+  ByteSet set;
+} Node;
+
+// Nodes refer to each other by index, since `nodes` may be reallocated. Parse
+// functions return the index of the node they parsed, or -1 if the pattern is
+// too large or not supported.
+typedef struct Parser {
+  const char* p;
+  Node* nodes;
+  size_t count;
+  size_t capacity;
+  int groups;
+} Parser;
+
+static int NewNode(Parser* ps, NodeType type, int left, int right) {
+  if (ps->count == ps->capacity) {
+    const size_t capacity = ps->capacity == 0 ? 64 : ps->capacity * 2;
+    Node* nodes = capacity > MaxNodes
+                      ? NULL
+                      : realloc(ps->nodes, capacity * sizeof(Node));
+    if (nodes == NULL) {
+      return -1;
+    }
+    ps->nodes = nodes;
+    ps->capacity = capacity;
+  }
+  ps->nodes[ps->count] = (Node){.type = type, .left = left, .right = right};
+  return (int)ps->count++;
+}
+
+static int NewSet(Parser* ps, const uint8_t* set) {
+  const int n = NewNode(ps, NodeSet, -1, -1);
+  if (n >= 0) {
+    memcpy(ps->nodes[n].set, set, sizeof(ByteSet));
+  }
+  return n;
+}
+
+static bool AddClass(uint8_t* set, const char* name, size_t length) {
+  static const struct {
+    const char* name;
+    int (*is)(int);
+  } classes[] = {
+      {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+      {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+      {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+      {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+  };
+  for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+    if (strlen(classes[i].name) == length &&
+        memcmp(classes[i].name, name, length) == 0) {
+      for (unsigned b = 0; b < 256; b++) {
+        if (classes[i].is((int)b)) {
+          AddByte(set, b);
+        }
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+static void Complement(uint8_t* set) {
+  for (size_t i = 0; i < sizeof(ByteSet); i++) {
+    set[i] = (uint8_t)~set[i];
+  }
+}
+
+static int ParseAlternate(Parser* ps);
+
+static int ParseBracket(Parser* ps) {
+  ByteSet set = {0};
+  const bool negate = *ps->p == '^';
+  if (negate) {
+    ps->p++;
+  }
+  for (bool first = true;; first = false) {
+    const unsigned char c = (unsigned char)*ps->p;
+    if (c == '\0') {
+      return -1;
+    }
+    if (c == ']' && !first) {
+      ps->p++;
+      break;
+    }
+    if (c == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) {
+      return -1;
+    }
+    if (c == '[' && ps->p[1] == ':') {
+      const char* end = strstr(ps->p + 2, ":]");
+      if (end == NULL || !AddClass(set, ps->p + 2, (size_t)(end - ps->p - 2))) {
+        return -1;
+      }
+      ps->p = end + 2;
+      continue;
+    }
+    ps->p++;
+    unsigned last = c;
+    if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+      if (ps->p[1] == '[') {
+        return -1;
+      }
+      last = (unsigned char)ps->p[1];
+      ps->p += 2;
+      if (last < c) {
+        return -1;
+      }
+    }
+    for (unsigned b = c; b <= last; b++) {
+      AddByte(set, b);
+    }
+  }
+  if (negate) {
+    Complement(set);
+  }
+  return NewSet(ps, set);
+}
+
+static int ParseEscape(Parser* ps) {
+  const unsigned char c = (unsigned char)*ps->p;
+  if (c == '\0' || isdigit(c) || strchr("bB<>`'", c) != NULL) {
+    return -1;
+  }
+  ps->p++;
+  ByteSet set = {0};
+  switch (c) {
+    case 'w':
+    case 'W':
+      (void)AddClass(set, "alnum", 5);
+      AddByte(set, '_');
+      break;
+    case 's':
+    case 'S':
+      (void)AddClass(set, "space", 5);
+      break;
+    default:
+      AddByte(set, c);
+      return NewSet(ps, set);
+  }
+  if (isupper(c)) {
+    Complement(set);
+  }
+  return NewSet(ps, set);
+}
+
+static int ParseAtom(Parser* ps) {
+  const unsigned char c = (unsigned char)*ps->p++;
+  ByteSet set = {0};
+  switch (c) {
+    case '(': {
+      const int group = ps->groups++;
+      int n = ParseAlternate(ps);
+      if (n < 0 || *ps->p != ')') {
+        return -1;
+      }
+      ps->p++;
+      n = NewNode(ps, NodeGroup, n, -1);
+      if (n >= 0) {
+        ps->nodes[n].min = group;
+      }
+      return n;
+    }
+    case '.':
+      Complement(set);
+      set[0] = (uint8_t)(set[0] & ~1u);
+      return NewSet(ps, set);
+    case '^':
+      return NewNode(ps, NodeBegin, -1, -1);
+    case '$':
+      return NewNode(ps, NodeEnd, -1, -1);
+    case '[':
+      return ParseBracket(ps);
+    case '\\':
+      return ParseEscape(ps);
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+      return -1;
+    default:
+      AddByte(set, c);
+      return NewSet(ps, set);
+  }
+}
+
+static bool ParseCount(Parser* ps, int* n) {
+  if (!isdigit((unsigned char)*ps->p)) {
+    return false;
+  }
+  *n = 0;
+  while (isdigit((unsigned char)*ps->p)) {
+    *n = *n * 10 + (*ps->p++ - '0');
+    if (*n > MaxRepeat) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int ParseRepeat(Parser* ps) {
+  int n = ParseAtom(ps);
+  while (n >= 0) {
+    switch (*ps->p) {
+      case '*':
+        n = NewNode(ps, NodeStar, n, -1);
+        break;
+      case '+':
+        n = NewNode(ps, NodePlus, n, -1);
+        break;
+      case '?':
+        n = NewNode(ps, NodeQuestion, n, -1);
+        break;
+      case '{': {
+        ps->p++;
+        int min;
+        int max;
+        if (!ParseCount(ps, &min)) {
+          return -1;
+        }
+        max = min;
+        if (*ps->p == ',') {
+          ps->p++;
+          max = -1;
+          if (*ps->p != '}' && (!ParseCount(ps, &max) || max < min)) {
+            return -1;
+          }
+        }
+        if (*ps->p != '}') {
+          return -1;
+        }
+        n = NewNode(ps, NodeRepeat, n, -1);
+        if (n >= 0) {
+          ps->nodes[n].min = min;
+          ps->nodes[n].max = max;
+        }
+        break;
+      }
+      default:
+        return n;
+    }
+    ps->p++;
+  }
+  return n;
+}
+
+static int ParseConcat(Parser* ps) {
+  int n = NewNode(ps, NodeEmpty, -1, -1);
+  while (n >= 0 && *ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+    const int right = ParseRepeat(ps);
+    n = right < 0 ? -1 : NewNode(ps, NodeConcat, n, right);
+  }
+  return n;
+}
+
+static int ParseAlternate(Parser* ps) {
+  int n = ParseConcat(ps);
+  while (n >= 0 && *ps->p == '|') {
+    ps->p++;
+    const int right = ParseConcat(ps);
+    n = right < 0 ? -1 : NewNode(ps, NodeAlternate, n, right);
+  }
+  return n;
+}
+
+static int Parse(Parser* ps, const char* pattern) {
+  ps->p = pattern;
+  const int n = ParseAlternate(ps);
+  return *ps->p == '\0' ? n : -1;
+}
+
+// Stores in `prefix` the bytes that every match of node `n` begins with.
+// Returns whether they are all of what `n` matches, so that what follows `n`
+// continues the prefix.
+static bool Prefix(const Parser* ps, int n, char* prefix, size_t* size) {
+  const Node* node = &ps->nodes[n];
+  switch (node->type) {
+    case NodeEmpty:
+      return true;
+    case NodeSet: {
+      unsigned byte = 256;
+      for (unsigned b = 0; b < 256; b++) {
+        if (HasByte(node->set, b)) {
+          if (byte != 256) {
+            return false;
+          }
+          byte = b;
+        }
+      }
+      if (byte == 256 || *size == MaxPrefix) {
+        return false;
+      }
+      prefix[(*size)++] = (char)byte;
+      return true;
+    }
+    case NodeConcat:
+      return Prefix(ps, node->left, prefix, size) &&
+             Prefix(ps, node->right, prefix, size);
+    case NodeGroup:
+      return Prefix(ps, node->left, prefix, size);
+    case NodePlus:
+      (void)Prefix(ps, node->left, prefix, size);
+      return false;
+    case NodeRepeat:
+      if (node->min > 0) {
+        (void)Prefix(ps, node->left, prefix, size);
+      }
+      return false;
+    case NodeAlternate:
+    case NodeStar:
+    case NodeQuestion:
+    case NodeBegin:
+    case NodeEnd:
+      return false;
+  }
+  return false;
+}
+
+// Compiling
+
+typedef enum InstType {
+  // Consumes a byte in `set`, and goes on to `out`.
+  InstByte,
+  // Goes on to both `out` and `out1`.
+  InstSplit,
+  // Go on to `out` at the beginning or end of the subject.
+  InstBegin,
+  InstEnd,
+  // Saves the offset in submatch slot `out1`, and goes on to `out`.
+  InstSave,
+  // A match of pattern `out`.
+  InstMatch,
+} InstType;
+
+typedef struct Inst {
+  InstType type;
+  int out;
+  int out1;
+  ByteSet set;
+} Inst;
+
+// Programs for searching backward, from the end of a match to its start, have
+// their concatenations reversed, and `^` and `$` swapped. Only programs for
+// finding submatches save offsets.
+typedef struct Program {
+  Inst* insts;
+  size_t count;
+  size_t capacity;
+  int start;
+  bool reverse;
+  bool save;
+} Program;
+
+static int NewInst(Program* prog, InstType type, int out, int out1) {
+  if (prog->count == prog->capacity) {
+    const size_t capacity = prog->capacity == 0 ? 64 : prog->capacity * 2;
+    Inst* insts = capacity > MaxInstructions
+                      ? NULL
+                      : realloc(prog->insts, capacity * sizeof(Inst));
+    if (insts == NULL) {
+      return -1;
+    }
+    prog->insts = insts;
+    prog->capacity = capacity;
+  }
+  prog->insts[prog->count] = (Inst){.type = type, .out = out, .out1 = out1};
+  return (int)prog->count++;
+}
+
+static int Emit(Program* prog, const Parser* ps, int n, int next);
+
+// Emits `n*`, going on to `next`. In programs that save offsets, each
+// repetition goes back to a split of its own rather than the first, so that,
+// as in `regexec`, `n` may match empty once before the loop ends: the first
+// split is then already taken, and only the second can go on to `next`.
+static int EmitStar(Program* prog, const Parser* ps, int n, int next) {
+  const int split = NewInst(prog, InstSplit, -1, next);
+  const int loop =
+      split < 0 || !prog->save ? split : NewInst(prog, InstSplit, -1, next);
+  const int body = loop < 0 ? -1 : Emit(prog, ps, n, loop);
+  if (body < 0) {
+    return -1;
+  }
+  prog->insts[split].out = body;
+  prog->insts[loop].out = body;
+  return split;
+}
+
+// Emits the instructions for node `n`, which go on to instruction `next`, and
+// returns the first.
+static int Emit(Program* prog, const Parser* ps, int n, int next) {
+  if (next < 0) {
+    return -1;
+  }
+  const Node* node = &ps->nodes[n];
+  switch (node->type) {
+    case NodeEmpty:
+      return next;
+    case NodeSet: {
+      const int i = NewInst(prog, InstByte, next, -1);
+      if (i >= 0) {
+        memcpy(prog->insts[i].set, node->set, sizeof(ByteSet));
+      }
+      return i;
+    }
+    case NodeBegin:
+      return NewInst(prog, prog->reverse ? InstEnd : InstBegin, next, -1);
+    case NodeEnd:
+      return NewInst(prog, prog->reverse ? InstBegin : InstEnd, next, -1);
+    case NodeConcat:
+      return prog->reverse
+                 ? Emit(prog, ps, node->right, Emit(prog, ps, node->left, next))
+                 : Emit(prog, ps, node->left,
+                        Emit(prog, ps, node->right, next));
+    case NodeAlternate: {
+      const int left = Emit(prog, ps, node->left, next);
+      const int right = Emit(prog, ps, node->right, next);
+      return left < 0 || right < 0 ? -1 : NewInst(prog, InstSplit, left, right);
+    }
+    case NodeQuestion: {
+      const int body = Emit(prog, ps, node->left, next);
+      return body < 0 ? -1 : NewInst(prog, InstSplit, body, next);
+    }
+    case NodeStar:
+      return EmitStar(prog, ps, node->left, next);
+    case NodePlus: {
+      const int split = NewInst(prog, InstSplit, -1, next);
+      const int body = split < 0 ? -1 : Emit(prog, ps, node->left, split);
+      if (body >= 0) {
+        prog->insts[split].out = body;
+      }
+      return body;
+    }
+    case NodeRepeat: {
+      // `x{2,4}` is `xx(x(x)?)?`, and `x{2,}` is `xxx*`.
+      int i = next;
+      if (node->max < 0) {
+        i = EmitStar(prog, ps, node->left, i);
+      }
+      for (int k = node->min; k < node->max && i >= 0; k++) {
+        const int body = Emit(prog, ps, node->left, i);
+        i = body < 0 ? -1 : NewInst(prog, InstSplit, body, next);
+      }
+      for (int k = 0; k < node->min && i >= 0; k++) {
+        i = Emit(prog, ps, node->left, i);
+      }
+      return i;
+    }
+    case NodeGroup: {
+      if (!prog->save) {
+        return Emit(prog, ps, node->left, next);
+      }
+      const int close = NewInst(prog, InstSave, next, 2 * node->min + 1);
+      const int body = Emit(prog, ps, node->left, close);
+      return body < 0 ? -1 : NewInst(prog, InstSave, body, 2 * node->min);
+    }
+  }
+  return -1;
+}
+
+// Searching
+
+// A DFA state is a set of NFA states. For leftmost-longest matching, it is a
+// list of sets, one for each position at which a match may still start, in
+// order of position, and separated by `Mark`s; an NFA state is kept only in the
+// first set that reaches it. Once a set reaches a match, the later ones are
+// dropped, since any match they could make would start further right, and no
+// more are begun. States are kept in a hash table, and their transitions are
+// computed as searches need them.
+typedef struct State {
+  struct State* chain;
+  uint32_t hash;
+  // Whether a match has been found, so that no more matches are begun.
+  bool matched;
+  // Whether a match ends here.
+  bool match;
+  size_t size;
+  int* key;
+  // The states that each class of byte leads to, or `NULL` until computed.
+  struct State* next[];
+} State;
+
+typedef enum Mode {
+  ModeLeftmost,
+  ModeAnchored,
+  ModeSet,
+} Mode;
+
+typedef struct Machine {
+  Program prog;
+  Mode mode;
+  // Bytes that no instruction tells apart are in the same class.
+  uint8_t classes[256];
+  uint8_t bytes[256];
+  size_t class_count;
+  State** table;
+  size_t table_size;
+  size_t state_count;
+  size_t memory;
+  bool flushed;
+  // The start states, elsewhere and at the beginning of the subject.
+  State* start[2];
+  // Scratch space for computing states.
+  int* key;
+  size_t key_size;
+  int* stack;
+  uint32_t* seen;
+  uint32_t generation;
+} Machine;
+
+static void Flush(Machine* m) {
+  for (size_t i = 0; i < m->table_size; i++) {
+    for (State* s = m->table[i]; s != NULL;) {
+      State* chain = s->chain;
+      free(s);
+      s = chain;
+    }
+    m->table[i] = NULL;
+  }
+  m->state_count = 0;
+  m->memory = 0;
+  m->start[0] = m->start[1] = NULL;
+  m->flushed = true;
+}
+
+static void FreeMachine(Machine* m) {
+  if (m->table != NULL) {
+    Flush(m);
+  }
+  free(m->table);
+  free(m->prog.insts);
+  free(m->key);
+  free(m->stack);
+  free(m->seen);
+}
+
+static void NextGeneration(Machine* m) {
+  m->key_size = 0;
+  if (++m->generation == 0) {
+    memset(m->seen, 0, m->prog.count * sizeof(uint32_t));
+    m->generation = 1;
+  }
+}
+
+// Adds to the key the NFA states that `i` leads to without consuming a byte,
+// at a position that may be the beginning or end of the subject.
+static void Add(Machine* m, int i, bool at_begin, bool at_end) {
+  size_t top = 0;
+  if (m->seen[i] != m->generation) {
+    m->seen[i] = m->generation;
+    m->stack[top++] = i;
+  }
+  while (top > 0) {
+    const Inst* inst = &m->prog.insts[m->stack[--top]];
+    int out[2] = {-1, -1};
+    switch (inst->type) {
+      case InstSplit:
+        out[0] = inst->out1;
+        out[1] = inst->out;
+        break;
+      case InstBegin:
+        out[0] = at_begin ? inst->out : -1;
+        break;
+      case InstSave:
+        out[0] = inst->out;
+        break;
+      case InstEnd:
+        if (at_end) {
+          out[0] = inst->out;
+        } else {
+          m->key[m->key_size++] = (int)(inst - m->prog.insts);
+        }
+        break;
+      case InstByte:
+      case InstMatch:
+        m->key[m->key_size++] = (int)(inst - m->prog.insts);
+        break;
+    }
+    for (size_t k = 0; k < 2; k++) {
+      if (out[k] >= 0 && m->seen[out[k]] != m->generation) {
+        m->seen[out[k]] = m->generation;
+        m->stack[top++] = out[k];
+      }
+    }
+  }
+}
+
+static bool IsMatch(const Machine* m, int i) {
+  return i != Mark && m->prog.insts[i].type == InstMatch;
+}
+
+static int CompareInts(const void* a, const void* b) {
+  const int x = *(const int*)a;
+  const int y = *(const int*)b;
+  return (x > y) - (x < y);
+}
+
+static bool Rehash(Machine* m) {
+  const size_t size = m->table_size * 2;
+  State** table = calloc(size, sizeof(State*));
+  if (table == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < m->table_size; i++) {
+    for (State* s = m->table[i]; s != NULL;) {
+      State* chain = s->chain;
+      s->chain = table[s->hash & (size - 1)];
+      table[s->hash & (size - 1)] = s;
+      s = chain;
+    }
+  }
+  free(m->table);
+  m->table = table;
+  m->table_size = size;
+  return true;
+}
+
+// Returns the state for the key, creating it if need be, or `NULL` if there is
+// no memory.
+static State* Intern(Machine* m, bool matched, bool match) {
+  uint32_t hash = matched ? 0x9e3779b9u : 2166136261u;
+  for (size_t i = 0; i < m->key_size; i++) {
+    hash = (hash ^ (uint32_t)m->key[i]) * 16777619u;
+  }
+  const size_t key_bytes = m->key_size * sizeof(int);
+  for (State* s = m->table[hash & (m->table_size - 1)]; s != NULL;
+       s = s->chain) {
+    if (s->hash == hash && s->matched == matched && s->size == m->key_size &&
+        memcmp(s->key, m->key, key_bytes) == 0) {
+      return s;
+    }
+  }
+  const size_t size =
+      sizeof(State) + m->class_count * sizeof(State*) + key_bytes;
+  if (m->memory + size > CacheLimit) {
+    Flush(m);
+  }
+  if (m->state_count >= m->table_size && !Rehash(m)) {
+    return NULL;
+  }
+  State* s = calloc(1, size);
+  if (s == NULL) {
+    return NULL;
+  }
+  s->hash = hash;
+  s->matched = matched;
+  s->match = match;
+  s->size = m->key_size;
+  s->key = (int*)&s->next[m->class_count];
+  memcpy(s->key, m->key, key_bytes);
+  s->chain = m->table[hash & (m->table_size - 1)];
+  m->table[hash & (m->table_size - 1)] = s;
+  m->state_count++;
+  m->memory += size;
+  return s;
+}
+
+// Puts the key in canonical form and returns its state: empty sets are
+// dropped, and in leftmost mode, so are the sets after the first that reaches
+// a match.
+static State* Finish(Machine* m, bool matched) {
+  size_t n = 0;
+  size_t group = 0;
+  bool match = false;
+  for (size_t i = 0; i <= m->key_size; i++) {
+    if (i < m->key_size && m->key[i] != Mark) {
+      match = match || IsMatch(m, m->key[i]);
+      m->key[n++] = m->key[i];
+      continue;
+    }
+    if (n == group) {
+      continue;
+    }
+    qsort(m->key + group, n - group, sizeof(int), CompareInts);
+    if (m->mode != ModeLeftmost) {
+      continue;
+    }
+    if (match) {
+      matched = true;
+      break;
+    }
+    m->key[n++] = Mark;
+    group = n;
+  }
+  if (n > 0 && m->key[n - 1] == Mark) {
+    n--;
+  }
+  m->key_size = n;
+  return Intern(m, matched, match);
+}
+
+static State* StartState(Machine* m, bool at_begin) {
+  if (m->start[at_begin] == NULL) {
+    NextGeneration(m);
+    Add(m, m->prog.start, at_begin, false);
+    State* s = Finish(m, false);
+    m->start[at_begin] = s;
+  }
+  return m->start[at_begin];
+}
+
+static State* Transition(Machine* m, State* s, size_t c) {
+  const unsigned byte = m->bytes[c];
+  NextGeneration(m);
+  for (size_t i = 0; i < s->size; i++) {
+    const int j = s->key[i];
+    if (j == Mark) {
+      m->key[m->key_size++] = Mark;
+      continue;
+    }
+    const Inst* inst = &m->prog.insts[j];
+    if (inst->type == InstByte && HasByte(inst->set, byte)) {
+      Add(m, inst->out, false, false);
+    }
+  }
+  if (m->mode == ModeSet || (m->mode == ModeLeftmost && !s->matched)) {
+    if (m->mode == ModeLeftmost) {
+      m->key[m->key_size++] = Mark;
+    }
+    Add(m, m->prog.start, false, false);
+  }
+  m->flushed = false;
+  State* next = Finish(m, s->matched);
+  if (next != NULL && !m->flushed) {
+    s->next[c] = next;
+  }
+  return next;
+}
+
+// Leaves in the key the NFA states that `s` leads to at the end of the
+// subject, where `$` matches.
+static void End(Machine* m, const State* s, bool at_begin) {
+  NextGeneration(m);
+  for (size_t i = 0; i < s->size; i++) {
+    const int j = s->key[i];
+    if (j != Mark && m->prog.insts[j].type == InstEnd) {
+      Add(m, m->prog.insts[j].out, at_begin, true);
+    }
+  }
+}
+
+static bool KeyHasMatch(const Machine* m) {
+  for (size_t i = 0; i < m->key_size; i++) {
+    if (IsMatch(m, m->key[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool Build(Machine* m,
+                  const Parser* ps,
+                  const int* roots,
+                  size_t count,
+                  bool reverse,
+                  Mode mode) {
+  m->mode = mode;
+  Program* prog = &m->prog;
+  prog->start = -1;
+  prog->reverse = reverse;
+  for (size_t i = 0; i < count; i++) {
+    const int match = NewInst(prog, InstMatch, (int)i, -1);
+    const int start = Emit(prog, ps, roots[i], match);
+    prog->start = start < 0 ? -1
+                  : prog->start < 0
+                      ? start
+                      : NewInst(prog, InstSplit, start, prog->start);
+    if (prog->start < 0) {
+      return false;
+    }
+  }
+
+  bool boundary[256] = {false};
+  for (size_t i = 0; i < prog->count; i++) {
+    if (prog->insts[i].type == InstByte) {
+      for (unsigned b = 1; b < 256; b++) {
+        if (HasByte(prog->insts[i].set, b) !=
+            HasByte(prog->insts[i].set, b - 1)) {
+          boundary[b] = true;
+        }
+      }
+    }
+  }
+  size_t c = 0;
+  for (unsigned b = 0; b < 256; b++) {
+    if (b > 0 && boundary[b]) {
+      c++;
+      m->bytes[c] = (uint8_t)b;
+    }
+    m->classes[b] = (uint8_t)c;
+  }
+  m->class_count = c + 1;
+
+  m->table_size = 64;
+  m->table = calloc(m->table_size, sizeof(State*));
+  m->key = malloc((2 * prog->count + 2) * sizeof(int));
+  m->stack = malloc(prog->count * sizeof(int));
+  m->seen = calloc(prog->count, sizeof(uint32_t));
+  return m->table != NULL && m->key != NULL && m->stack != NULL &&
+         m->seen != NULL;
+}
+
+// Submatches
+
+// A step in following the instructions that consume no byte. A step whose
+// `inst` is -1 restores `slot` to `offset`.
+typedef struct Step {
+  int inst;
+  int slot;
+  size_t offset;
+} Step;
+
+// Finds the submatches of a match with a Pike VM: it runs a program that saves
+// offsets as a list of threads, in order of priority, each with its own copy of
+// the submatch slots. Each instruction is in the list at most once, so the time
+// is linear in the length of the match. Of the ways that the match can be
+// made, the VM takes the one that prefers the earlier alternative and the
+// longer repetition at each choice.
+typedef struct Submatcher {
+  Program prog;
+  size_t slot_count;
+  // The instruction of each thread, and its slots, in the current list and the
+  // next, with the number of threads in each.
+  int* threads[2];
+  size_t* slots[2];
+  size_t sizes[2];
+  Step* stack;
+  uint32_t* seen;
+  uint32_t generation;
+} Submatcher;
+
+static void FreeSubmatcher(Submatcher* v) {
+  free(v->prog.insts);
+  for (size_t i = 0; i < 2; i++) {
+    free(v->threads[i]);
+    free(v->slots[i]);
+  }
+  free(v->stack);
+  free(v->seen);
+}
+
+static bool BuildSubmatcher(Submatcher* v, const Parser* ps, int root) {
+  Program* prog = &v->prog;
+  prog->save = true;
+  const int match = NewInst(prog, InstMatch, 0, -1);
+  prog->start = Emit(prog, ps, root, match);
+  v->slot_count = 2 * (size_t)ps->groups;
+  return prog->start >= 0;
+}
+
+// Allocates the scratch space of `v` when it is first used, since most
+// searches do not ask for submatches.
+static bool AllocateSubmatcher(Submatcher* v) {
+  const size_t count = v->prog.count;
+  for (size_t i = 0; i < 2; i++) {
+    v->threads[i] = malloc(count * sizeof(int));
+    v->slots[i] = malloc((count * v->slot_count + 1) * sizeof(size_t));
+  }
+  v->stack = malloc((2 * count + 1) * sizeof(Step));
+  v->seen = calloc(count, sizeof(uint32_t));
+  return v->threads[0] != NULL && v->threads[1] != NULL &&
+         v->slots[0] != NULL && v->slots[1] != NULL && v->stack != NULL &&
+         v->seen != NULL;
+}
+
+// Adds to list `list` the threads that instruction `i` leads to at offset `p`
+// without consuming a byte, given the thread's `slots`, which are left as they
+// were.
+static void AddThreads(Submatcher* v,
+                       size_t list,
+                       int i,
+                       size_t* slots,
+                       size_t p,
+                       bool at_begin,
+                       bool at_end) {
+  size_t top = 0;
+  v->stack[top++] = (Step){.inst = i};
+  while (top > 0) {
+    const Step step = v->stack[--top];
+    if (step.inst < 0) {
+      slots[step.slot] = step.offset;
+      continue;
+    }
+    if (v->seen[step.inst] == v->generation) {
+      continue;
+    }
+    v->seen[step.inst] = v->generation;
+    const Inst* inst = &v->prog.insts[step.inst];
+    switch (inst->type) {
+      case InstSplit:
+        v->stack[top++] = (Step){.inst = inst->out1};
+        v->stack[top++] = (Step){.inst = inst->out};
+        break;
+      case InstBegin:
+      case InstEnd:
+        if (inst->type == InstBegin ? at_begin : at_end) {
+          v->stack[top++] = (Step){.inst = inst->out};
+        }
+        break;
+      case InstSave:
+        v->stack[top++] =
+            (Step){.inst = -1, .slot = inst->out1, .offset = slots[inst->out1]};
+        slots[inst->out1] = p;
+        v->stack[top++] = (Step){.inst = inst->out};
+        break;
+      case InstByte:
+      case InstMatch: {
+        const size_t n = v->sizes[list]++;
+        v->threads[list][n] = step.inst;
+        memcpy(&v->slots[list][n * v->slot_count], slots,
+               v->slot_count * sizeof(size_t));
+        break;
+      }
+    }
+  }
+}
+
+static void NextSubmatchGeneration(Submatcher* v, size_t list) {
+  v->sizes[list] = 0;
+  if (++v->generation == 0) {
+    memset(v->seen, 0, v->prog.count * sizeof(uint32_t));
+    v->generation = 1;
+  }
+}
+
+struct Dfa {
+  size_t count;
+  Machine forward;
+  // Finds where a match starts, given where it ends.
+  Machine reverse;
+  Submatcher submatcher;
+  // What every match begins with, to skip to with `memchr`.
+  char prefix[MaxPrefix];
+  size_t prefix_size;
+};
+
+static Dfa* Compile(const char* const* patterns, size_t count, bool set) {
+  Dfa* dfa = calloc(1, sizeof(Dfa));
+  int* roots = calloc(count, sizeof(int));
+  Parser ps = {0};
+  bool ok = dfa != NULL && roots != NULL;
+  for (size_t i = 0; ok && i < count; i++) {
+    roots[i] = Parse(&ps, patterns[i]);
+    ok = roots[i] >= 0;
+  }
+  if (ok && set) {
+    ok = Build(&dfa->forward, &ps, roots, count, false, ModeSet);
+  } else if (ok) {
+    ok = Build(&dfa->forward, &ps, roots, 1, false, ModeLeftmost) &&
+         Build(&dfa->reverse, &ps, roots, 1, true, ModeAnchored) &&
+         BuildSubmatcher(&dfa->submatcher, &ps, roots[0]);
+    (void)Prefix(&ps, roots[0], dfa->prefix, &dfa->prefix_size);
+  }
+  free(roots);
+  free(ps.nodes);
+  if (!ok) {
+    DfaFree(dfa);
+    return NULL;
+  }
+  dfa->count = count;
+  return dfa;
+}
+
+Dfa* DfaCompile(const char* pattern) {
+  return Compile(&pattern, 1, false);
+}
+
+Dfa* DfaCompileSet(const char* const* patterns, size_t count) {
+  return Compile(patterns, count, true);
+}
+
+void DfaFree(Dfa* dfa) {
+  if (dfa != NULL) {
+    FreeMachine(&dfa->forward);
+    FreeMachine(&dfa->reverse);
+    FreeSubmatcher(&dfa->submatcher);
+    free(dfa);
+  }
+}
+
+// Returns the offset of the next possible start of a match at or after `p`.
+static size_t Skip(const Dfa* dfa,
+                   const unsigned char* data,
+                   size_t p,
+                   size_t size) {
+  while (size - p >= dfa->prefix_size) {
+    const unsigned char* q = memchr(data + p, dfa->prefix[0], size - p);
+    if (q == NULL) {
+      break;
+    }
+    p = (size_t)(q - data);
+    if (size - p >= dfa->prefix_size &&
+        memcmp(q, dfa->prefix, dfa->prefix_size) == 0) {
+      return p;
+    }
+    p++;
+  }
+  return size;
+}
+
+DfaResult DfaSearch(Dfa* dfa,
+                    const char* data,
+                    size_t size,
+                    size_t offset,
+                    size_t* start,
+                    size_t* end) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  Machine* m = &dfa->forward;
+  if (StartState(m, false) == NULL) {
+    return DfaOutOfMemory;
+  }
+  State* s = StartState(m, offset == 0);
+  if (s == NULL) {
+    return DfaOutOfMemory;
+  }
+  bool found = s->match;
+  size_t last = offset;
+  size_t p = offset;
+  while (p < size && s->size > 0) {
+    if (s == m->start[0] && dfa->prefix_size > 0) {
+      p = Skip(dfa, bytes, p, size);
+      if (p == size) {
+        break;
+      }
+    }
+    const size_t c = m->classes[bytes[p]];
+    State* next = s->next[c];
+    if (next == NULL && (next = Transition(m, s, c)) == NULL) {
+      return DfaOutOfMemory;
+    }
+    s = next;
+    p++;
+    if (s->match) {
+      found = true;
+      last = p;
+    }
+  }
+  if (p == size && s->size > 0) {
+    End(m, s, size == 0);
+    if (KeyHasMatch(m)) {
+      found = true;
+      last = size;
+    }
+  }
+  if (!found) {
+    return DfaNoMatch;
+  }
+
+  // The match starts as far left of its end as the reversed pattern reaches.
+  Machine* r = &dfa->reverse;
+  s = StartState(r, last == size);
+  if (s == NULL) {
+    return DfaOutOfMemory;
+  }
+  size_t first = last;
+  for (p = last; p > offset && s->size > 0; p--) {
+    const size_t c = r->classes[bytes[p - 1]];
+    State* next = s->next[c];
+    if (next == NULL && (next = Transition(r, s, c)) == NULL) {
+      return DfaOutOfMemory;
+    }
+    s = next;
+    if (s->match) {
+      first = p - 1;
+    }
+  }
+  if (p == 0 && s->size > 0) {
+    End(r, s, size == 0);
+    if (KeyHasMatch(r)) {
+      first = 0;
+    }
+  }
+  *start = first;
+  *end = last;
+  return DfaMatched;
+}
+
+DfaResult DfaSubmatch(Dfa* dfa,
+                      const char* data,
+                      size_t size,
+                      size_t start,
+                      size_t end,
+                      size_t* submatches) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  Submatcher* v = &dfa->submatcher;
+  if (v->seen == NULL && !AllocateSubmatcher(v)) {
+    return DfaOutOfMemory;
+  }
+  for (size_t i = 0; i < v->slot_count; i++) {
+    submatches[i] = SIZE_MAX;
+  }
+  size_t list = 0;
+  NextSubmatchGeneration(v, list);
+  AddThreads(v, list, v->prog.start, submatches, start, start == 0,
+             start == size);
+  for (size_t p = start; v->sizes[list] > 0; p++) {
+    NextSubmatchGeneration(v, 1 - list);
+    for (size_t i = 0; i < v->sizes[list]; i++) {
+      const Inst* inst = &v->prog.insts[v->threads[list][i]];
+      size_t* slots = &v->slots[list][i * v->slot_count];
+      if (inst->type == InstMatch) {
+        // The threads after this one have lower priority.
+        if (p == end) {
+          memcpy(submatches, slots, v->slot_count * sizeof(size_t));
+          return DfaMatched;
+        }
+      } else if (p < end && HasByte(inst->set, bytes[p])) {
+        AddThreads(v, 1 - list, inst->out, slots, p + 1, false, p + 1 == size);
+      }
+    }
+    list = 1 - list;
+  }
+  return DfaNoMatch;
+}
+
+// Marks the patterns whose matches are in the key of `s` or, if `s` is `NULL`,
+// in the machine's key.
+static size_t Collect(const Machine* m, const State* s, bool* matched) {
+  const int* key = s != NULL ? s->key : m->key;
+  const size_t size = s != NULL ? s->size : m->key_size;
+  size_t count = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (IsMatch(m, key[i]) && !matched[m->prog.insts[key[i]].out]) {
+      matched[m->prog.insts[key[i]].out] = true;
+      count++;
+    }
+  }
+  return count;
+}
+
+DfaResult DfaMatchSet(Dfa* dfa, const char* data, size_t size, bool* matched) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  Machine* m = &dfa->forward;
+  memset(matched, 0, dfa->count * sizeof(bool));
+  State* s = StartState(m, true);
+  if (s == NULL) {
+    return DfaOutOfMemory;
+  }
+  size_t found = Collect(m, s, matched);
+  size_t p = 0;
+  for (; p < size && found < dfa->count; p++) {
+    const size_t c = m->classes[bytes[p]];
+    State* next = s->next[c];
+    if (next == NULL && (next = Transition(m, s, c)) == NULL) {
+      return DfaOutOfMemory;
+    }
+    s = next;
+    if (s->match) {
+      found += Collect(m, s, matched);
+    }
+  }
+  if (p == size) {
+    End(m, s, size == 0);
+    found += Collect(m, NULL, matched);
+  }
+  return found > 0 ? DfaMatched : DfaNoMatch;
+}
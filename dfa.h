@@ -0,0 +1,60 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef DFA_H
+#define DFA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A regular expression engine for the POSIX extended syntax, whose searches
+// take time linear in the length of the subject. It compiles patterns into
+// Thompson NFAs, and builds the states of the equivalent DFA lazily, as
+// searches reach them, keeping a bounded cache of them. It finds where matches
+// start and end, and then, if asked, their submatches, also in linear time.
+typedef struct Dfa Dfa;
+
+typedef enum DfaResult {
+  DfaNoMatch,
+  DfaMatched,
+  DfaOutOfMemory,
+} DfaResult;
+
+// Compiles `pattern`, which must be valid (as `regcomp` with `REG_EXTENDED`
+// would have it). Returns `NULL` if the pattern is too large, or uses syntax
+// that the engine does not support: back-references, word boundaries,
+// collating elements, and equivalence classes.
+Dfa* DfaCompile(const char* pattern);
+// Compiles a set of patterns, to be matched all at once with `DfaMatchSet`.
+Dfa* DfaCompileSet(const char* const* patterns, size_t count);
+void DfaFree(Dfa* dfa);
+
+// Finds the leftmost-longest match in `data[offset, size)` and stores its
+// bounds. As with `regexec` given `REG_STARTEND`, and `REG_NOTBOL` when
+// `offset` is not 0, `^` matches only at the beginning of `data` and `$` only
+// at `size`.
+DfaResult DfaSearch(Dfa* dfa,
+                    const char* data,
+                    size_t size,
+                    size_t offset,
+                    size_t* start,
+                    size_t* end);
+
+// Stores the bounds of each parenthesized submatch of the match that
+// `DfaSearch` found in `data[start, end)` in `submatches`, which has room for
+// two offsets for each: `SIZE_MAX` if the submatch did not participate. Where
+// the match can be made in more than one way, the submatches are those of the
+// way that prefers the earlier alternative and the longer repetition at each
+// choice, which is not always the one `regexec` finds.
+DfaResult DfaSubmatch(Dfa* dfa,
+                      const char* data,
+                      size_t size,
+                      size_t start,
+                      size_t end,
+                      size_t* submatches);
+
+// Sets `matched[i]` to whether pattern `i` of a set matches anywhere in
+// `data[0, size)`, in a single pass over it.
+DfaResult DfaMatchSet(Dfa* dfa, const char* data, size_t size, bool* matched);
+
+#endif
@@ -2,17 +2,24 @@
 // Copyright 2024 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: MIT
 
+#define _POSIX_C_SOURCE 200809L
 #include <assert.h>
 #include <float.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <time.h>
 
 #include "fe.h"
+#include "jit.h"
 
 const char* FeVersion = "1.1";
 
@@ -27,6 +34,7 @@ typedef enum Primitive {
   PFn,
   PMacro,
   PWhile,
+  PBench,
   PQuote,
   PAnd,
   POr,
@@ -61,9 +69,9 @@ static const char* primitive_names[] = {
     [PNot] = "not",       [PIs] = "is",         [PAtom] = "atom",
     [PPrint] = "print",   [PLess] = "<",        [PLessEqual] = "<=",
     [PAdd] = "+",         [PSub] = "-",         [PMul] = "*",
-    [PDiv] = "/"};
+    [PDiv] = "/",         [PBench] = "bench"};
 
-const char* type_names[] = {
+static const char* const type_names[] = {
     [FeTPair] = "pair",
     [FeTFree] = "free",
     [FeTNil] = "nil",
@@ -74,15 +82,25 @@ const char* type_names[] = {
     [FeTMacro] = "macro",
     [FeTPrimitive] = "primitive",
     [FeTNativeFn] = "native-fn",
+    [FeTNativeArrayFn] = "native-fn",
+    [FeTDoubleFn] = "native-fn",
     [FeTPtr] = "ptr",
     [FeTFex0] = "fex0",
     [FeTFex1] = "fex1",
     [FeTFex2] = "fex2",
+    [FeTFex3] = "fex3",
+    [FeTFex4] = "fex4",
+    [FeTFex5] = "fex5",
+    [FeTFex6] = "fex6",
+    [FeTFex7] = "fex7",
 };
 
 typedef union {
   FeObject* o;
   FeNativeFn* f;
+  FeNativeArrayFn* a;
+  FeUnaryDoubleFn* d1;
+  FeBinaryDoubleFn* d2;
   FeDouble n;
   // TODO: Might need/want to make this `uintptr_t` someday.
   char c;
@@ -103,6 +121,8 @@ struct FeObject {
   Value car, cdr;
 };
 
+// `nil` is shared by every context. It is never written to (in particular, the
+// GC never marks it), which is what makes it safe to share across threads.
 FeObject nil = {.car = {.c = FeTNil << GcMarkBit | OtherCell},
                 .cdr = {.o = NULL}};
 
@@ -112,6 +132,10 @@ FeObject nil = {.car = {.c = FeTNil << GcMarkBit | OtherCell},
 #define DOUBLE(x) ((x)->cdr.n)
 #define PRIM(x) ((x)->cdr.c)
 #define NATIVE_FN(x) ((x)->cdr.f)
+#define NATIVE_ARRAY_FN(x) ((x)->cdr.a)
+// The minimum argument count of an `FeTNativeArrayFn`, or the arity of an
+// `FeTDoubleFn`, after the tag byte:
+#define MIN_ARGC(x) (((unsigned char*)&(x)->car.c)[1])
 #define STRING_BUFFER(x) (&(x)->car.c + 1)
 
 static FeDouble GetDouble(const FeObject* o) {
@@ -122,6 +146,10 @@ static FeNativeFn* GetNativeFn(const FeObject* o) {
   return o->cdr.f;
 }
 
+static FeNativeArrayFn* GetNativeArrayFn(const FeObject* o) {
+  return o->cdr.a;
+}
+
 static char GetPrimitive(const FeObject* o) {
   return o->cdr.c;
 }
@@ -130,16 +158,100 @@ static void SetType(FeObject* o, FeType type) {
   o->car.c = (char)((type) << GcMarkBit | OtherCell);
 }
 
+// An `FeTFn` keeps its JIT state after the tag byte: whether it could not be
+// compiled, its call count, and the index of its `Compiled` plus 1, or 0.
+enum {
+  JitFailedOffset = 1,
+  JitCallsOffset = 2,
+  JitCompiledOffset = 4,
+};
+
+static void ResetJitState(FeObject* fn) {
+  memset(&fn->car.c + 1, 0, sizeof(Value) - 1);
+}
+
+static bool GetJitFailed(const FeObject* fn) {
+  return (&fn->car.c)[JitFailedOffset] != 0;
+}
+
+static void SetJitFailed(FeObject* fn) {
+  (&fn->car.c)[JitFailedOffset] = 1;
+}
+
+static uint16_t GetJitCalls(const FeObject* fn) {
+  uint16_t calls;
+  memcpy(&calls, &fn->car.c + JitCallsOffset, sizeof(calls));
+  return calls;
+}
+
+static void SetJitCalls(FeObject* fn, uint16_t calls) {
+  memcpy(&fn->car.c + JitCallsOffset, &calls, sizeof(calls));
+}
+
+static uint32_t GetJitCompiled(const FeObject* fn) {
+  uint32_t index;
+  memcpy(&index, &fn->car.c + JitCompiledOffset, sizeof(index));
+  return index;
+}
+
+static void SetJitCompiled(FeObject* fn, uint32_t index) {
+  memcpy(&fn->car.c + JitCompiledOffset, &index, sizeof(index));
+}
+
+// A guard on a binding that compiled code relies on: the callee that a symbol
+// named when the code was compiled. `fn` is set for calls of the function to
+// itself; otherwise, the value must have `type` and the same `cdr`.
+typedef struct Guard {
+  FeObject* binding;
+  FeObject* fn;
+  FeType type;
+  Value cdr;
+} Guard;
+
+// The machine code of an `FeTFn`. `fn` is `NULL` once the GC has freed it.
+typedef struct Compiled {
+  FeObject* fn;
+  JitCode* code;
+  size_t parameter_count;
+  Guard* guards;
+  size_t guard_count;
+} Compiled;
+
 struct FeContext {
   FeHandlers handlers;
-  FeObject* gc_stack[GcStackSize];
+  FeStreams streams;
+  const char* type_names[FeTSentinel];
+  FeTypeHooks type_hooks[FeTSentinel];
+  // The current GC stack: `gc_stack_storage`, or one entered with
+  // `FeEnterStack`. The stacks it replaced are linked from `saved_stacks`,
+  // and remain GC roots.
+  FeObject** gc_stack;
+  size_t gc_stack_size;
   size_t gc_stack_index;
+  FeStack* saved_stacks;
+  FeObject* gc_stack_storage[GcStackSize];
   FeObject* objects;
   size_t object_count;
   FeObject* call_list;
   FeObject* free_list;
   FeObject* symbol_list;
+  // The objects whose types have a `finalize` hook. The GC does not mark this
+  // list; it unlinks the unreachable objects from it as it finalizes them.
+  FeObject* finalizable;
+  // The objects pinned with `FePin`, including the callables prepared with
+  // `FePrepareCall`, which are GC roots.
+  FeObject* pinned;
   FeObject* t;
+  size_t gc_thread_count;
+  // Counts of the objects made and collections run, for `bench`.
+  size_t allocation_count;
+  size_t collection_count;
+  // `FeTFn`s are compiled after this many calls, or never if it is 0.
+  size_t jit_threshold;
+  Compiled* compiled;
+  size_t compiled_count;
+  // A sentinel returned by `Read` for `)`; compared only by address.
+  FeObject rparen;
   char nextchr;
 };
 
@@ -147,6 +259,10 @@ FeHandlers* FeGetHandlers(FeContext* ctx) {
   return &ctx->handlers;
 }
 
+FeStreams* FeGetStreams(FeContext* ctx) {
+  return &ctx->streams;
+}
+
 static void Format(char* result, size_t size, const char* format, ...)
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wgcc-compat"
@@ -176,11 +292,11 @@ void noreturn FeHandleError(FeContext* ctx, const char* msg) {
   if (ctx->handlers.error) {
     ctx->handlers.error(ctx, msg, cl);
   }
-  fprintf(stderr, "error: %s\n", msg);
+  fprintf(ctx->streams.error, "error: %s\n", msg);
   for (; !FeIsNil(cl); cl = CDR(cl)) {
     char buf[64];
     FeToString(ctx, CAR(cl), buf, sizeof(buf));
-    fprintf(stderr, "=> %s\n", buf);
+    fprintf(ctx->streams.error, "=> %s\n", buf);
   }
   exit(EXIT_FAILURE);
 }
@@ -197,15 +313,34 @@ FeObject* FeGetNextArgument(FeContext* ctx, FeObject** arg) {
   return CAR(a);
 }
 
-static const char* GetTypeName(FeType type) {
-  return type < COUNT(type_names) ? type_names[type] : "unknown";
+const char* FeGetTypeName(FeContext* ctx, FeType type) {
+  const char* name = type < FeTSentinel ? ctx->type_names[type] : NULL;
+  return name != NULL ? name : "unknown";
+}
+
+void FeSetTypeName(FeContext* ctx, FeType type, const char* name) {
+  if (type >= FeTSentinel) {
+    abort();
+  }
+  ctx->type_names[type] = name;
+}
+
+void FeSetTypeHooks(FeContext* ctx, FeType type, const FeTypeHooks* hooks) {
+  if (type < FeTPtr || type >= FeTSentinel) {
+    abort();
+  }
+  ctx->type_hooks[type] = *hooks;
+}
+
+void* FeGetTypeData(FeContext* ctx, FeType type) {
+  return type < FeTSentinel ? ctx->type_hooks[type].data : NULL;
 }
 
 static FeObject* CheckType(FeContext* ctx, FeObject* obj, FeType type) {
   if (FeGetType(obj) != type) {
     char message[64];
-    Format(message, sizeof(message), "expected %s, got %s", GetTypeName(type),
-           GetTypeName(FeGetType(obj)));
+    Format(message, sizeof(message), "expected %s, got %s",
+           FeGetTypeName(ctx, type), FeGetTypeName(ctx, FeGetType(obj)));
     FeHandleError(ctx, message);
   }
   return obj;
@@ -220,7 +355,7 @@ bool FeIsNil(FeObject* obj) {
 }
 
 void FePushGC(FeContext* ctx, FeObject* obj) {
-  if (ctx->gc_stack_index == GcStackSize) {
+  if (ctx->gc_stack_index == ctx->gc_stack_size) {
     FeHandleError(ctx, "GC stack overflow");
   }
   ctx->gc_stack[ctx->gc_stack_index++] = obj;
@@ -234,10 +369,235 @@ size_t FeSaveGC(FeContext* ctx) {
   return ctx->gc_stack_index;
 }
 
+void FeEnterStack(FeContext* ctx, FeStack* saved, const FeStack* stack) {
+  *saved = (FeStack){.objects = ctx->gc_stack,
+                     .size = ctx->gc_stack_size,
+                     .index = ctx->gc_stack_index,
+                     .call_list = ctx->call_list,
+                     .next = ctx->saved_stacks};
+  ctx->saved_stacks = saved;
+  ctx->gc_stack = stack->objects;
+  ctx->gc_stack_size = stack->size;
+  ctx->gc_stack_index = stack->index;
+  ctx->call_list = stack->call_list;
+}
+
+void FeLeaveStack(FeContext* ctx, FeStack* stack, FeStack* saved) {
+  assert(ctx->saved_stacks == saved);
+  stack->objects = ctx->gc_stack;
+  stack->size = ctx->gc_stack_size;
+  stack->index = ctx->gc_stack_index;
+  stack->call_list = ctx->call_list;
+  ctx->saved_stacks = saved->next;
+  ctx->gc_stack = saved->objects;
+  ctx->gc_stack_size = saved->size;
+  ctx->gc_stack_index = saved->index;
+  ctx->call_list = saved->call_list;
+}
+
+// Parallel collection
+//
+// With `FeSetGCThreads`, large arenas are collected by several threads. Each
+// marking thread has a Chase-Lev work-stealing deque of gray (marked, but not
+// yet scanned) objects, and sets mark bits atomically. Sweeping splits the
+// arena into one partition per thread, and splices the partitions' free lists
+// together such that the free list is the same as a serial sweep would make.
+//
+// The deques live on the marking threads' stacks, so no thread returns from
+// marking until every thread has finished marking.
+
+enum {
+  GCThreadLimit = 16,
+  // Must be a power of 2.
+  GrayDequeCapacity = 4096,
+  // Smaller arenas are always collected serially; starting the threads would
+  // cost more than it saves.
+  ParallelGCThreshold = 1 << 16,
+};
+
+typedef struct GrayDeque {
+  _Atomic(int64_t) top;
+  _Atomic(int64_t) bottom;
+  _Atomic(FeObject*) objects[GrayDequeCapacity];
+} GrayDeque;
+
+typedef struct Collection {
+  FeContext* ctx;
+  size_t thread_count;
+  _Atomic(GrayDeque*) deques[GCThreadLimit];
+  atomic_size_t active;
+  atomic_size_t finished;
+  atomic_bool marking;
+  atomic_bool sweeping;
+  // Serializes calls to the `mark` and `gc` handlers:
+  pthread_mutex_t lock;
+  // Each partition's free list:
+  FeObject* heads[GCThreadLimit];
+  FeObject* tails[GCThreadLimit];
+} Collection;
+
+typedef struct GCThread {
+  Collection* collection;
+  size_t index;
+  pthread_t thread;
+} GCThread;
+
+// Set while the current thread is marking in parallel:
+static _Thread_local Collection* collection;
+static _Thread_local GrayDeque* gray;
+
+static size_t GetDequeIndex(int64_t i) {
+  return (size_t)(i & (GrayDequeCapacity - 1));
+}
+
+static bool PushGray(GrayDeque* d, FeObject* obj) {
+  const int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  const int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  if (b - t >= GrayDequeCapacity) {
+    return false;
+  }
+  atomic_store_explicit(&d->objects[GetDequeIndex(b)], obj,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  return true;
+}
+
+static FeObject* PopGray(GrayDeque* d) {
+  const int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  int64_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (t > b) {
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  FeObject* obj =
+      atomic_load_explicit(&d->objects[GetDequeIndex(b)], memory_order_relaxed);
+  if (t == b) {
+    // Racing with thieves for the last object:
+    if (!atomic_compare_exchange_strong_explicit(
+            &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      obj = NULL;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return obj;
+}
+
+static FeObject* StealGray(GrayDeque* d) {
+  int64_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  const int64_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) {
+    return NULL;
+  }
+  FeObject* obj =
+      atomic_load_explicit(&d->objects[GetDequeIndex(t)], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(
+          &d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL;
+  }
+  return obj;
+}
+
+static FeObject* StealGrayFromAny(Collection* c, size_t index) {
+  for (size_t i = 1; i < c->thread_count; i++) {
+    GrayDeque* d = atomic_load_explicit(
+        &c->deques[(index + i) % c->thread_count], memory_order_acquire);
+    FeObject* obj = d != NULL ? StealGray(d) : NULL;
+    if (obj != NULL) {
+      return obj;
+    }
+  }
+  return NULL;
+}
+
+// Atomically sets the mark bit, returning true if this call set it.
+static bool TryMark(FeObject* obj) {
+  return !FeIsNil(obj) &&
+         !(__atomic_fetch_or(&TAG(obj), (char)GcMarkBit, __ATOMIC_RELAXED) &
+           GcMarkBit);
+}
+
+static void ScanGray(Collection* c, FeObject* obj);
+
+static void MarkPtr(FeContext* ctx, FeObject* obj, FeType type) {
+  FeMarkFn* mark = ctx->type_hooks[type].mark;
+  if (mark != NULL) {
+    mark(ctx, obj);
+  }
+  if (ctx->handlers.mark != NULL) {
+    ctx->handlers.mark(ctx, obj);
+  }
+}
+
+static void Shade(Collection* c, FeObject* obj) {
+  if (TryMark(obj) && !PushGray(gray, obj)) {
+    ScanGray(c, obj);
+  }
+}
+
+static void ScanGray(Collection* c, FeObject* obj) {
+  while (true) {
+    const char tag = __atomic_load_n(&TAG(obj), __ATOMIC_RELAXED);
+    const FeType type = (FeType)(tag & OtherCell ? tag >> GcMarkBit : FeTPair);
+    switch (type) {
+      case FeTPair: {
+        // Other threads may be setting the mark bit in the `car`:
+        const uintptr_t car =
+            (uintptr_t)__atomic_load_n(&CAR(obj), __ATOMIC_RELAXED);
+        Shade(c, (FeObject*)(car & ~(uintptr_t)GcMarkBit));
+      }
+        // fall through
+      case FeTFn:
+      case FeTMacro:
+      case FeTSymbol:
+      case FeTString:
+        obj = CDR(obj);
+        if (!TryMark(obj)) {
+          return;
+        }
+        continue;
+
+      case FeTPtr:
+      case FeTFex0:
+      case FeTFex1:
+      case FeTFex2:
+      case FeTFex3:
+      case FeTFex4:
+      case FeTFex5:
+      case FeTFex6:
+      case FeTFex7:
+        pthread_mutex_lock(&c->lock);
+        MarkPtr(c->ctx, obj, type);
+        pthread_mutex_unlock(&c->lock);
+        return;
+
+      case FeTFree:
+      case FeTNil:
+      case FeTDouble:
+      case FeTPrimitive:
+      case FeTNativeFn:
+      case FeTNativeArrayFn:
+      case FeTDoubleFn:
+        return;
+
+      case FeTSentinel:
+        abort();
+    }
+  }
+}
+
 void FeMark(FeContext* ctx, FeObject* obj) {
+  if (gray != NULL) {
+    Shade(collection, obj);
+    return;
+  }
+
   FeObject* car;
 begin:
-  if (TAG(obj) & GcMarkBit) {
+  if (FeIsNil(obj) || TAG(obj) & GcMarkBit) {
     return;
   }
   car = CAR(obj);  // Store car before modifying it with GcMarkBit
@@ -258,9 +618,12 @@ begin:
     case FeTFex0:
     case FeTFex1:
     case FeTFex2:
-      if (ctx->handlers.mark) {
-        ctx->handlers.mark(ctx, obj);
-      }
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+      MarkPtr(ctx, obj, FeGetType(obj));
       break;
 
     case FeTFree:
@@ -268,6 +631,8 @@ begin:
     case FeTDouble:
     case FeTPrimitive:
     case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
       // Do nothing.
       break;
 
@@ -276,32 +641,216 @@ begin:
   }
 }
 
-static void CollectGarbage(FeContext* ctx) {
-  // Mark:
+// Finalizes the unreachable objects on the finalizable list, and unlinks them.
+// The rest of the list's pairs are marked, so that they survive the sweep.
+static void Finalize(FeContext* ctx) {
+  FeObject** link = &ctx->finalizable;
+  while (!FeIsNil(*link)) {
+    FeObject* entry = *link;
+    FeObject* obj = CAR(entry);
+    if (TAG(obj) & GcMarkBit) {
+      TAG(entry) |= GcMarkBit;
+      link = &CDR(entry);
+    } else {
+      ctx->type_hooks[FeGetType(obj)].finalize(ctx, obj);
+      *link = CDR(entry);
+    }
+  }
+}
+
+static void MarkRoots(FeContext* ctx) {
   for (size_t i = 0; i < ctx->gc_stack_index; i++) {
     FeMark(ctx, ctx->gc_stack[i]);
   }
+  for (const FeStack* s = ctx->saved_stacks; s != NULL; s = s->next) {
+    for (size_t i = 0; i < s->index; i++) {
+      FeMark(ctx, s->objects[i]);
+    }
+  }
   FeMark(ctx, ctx->symbol_list);
+  FeMark(ctx, ctx->pinned);
+}
 
-  // Sweep and unmark:
-  for (size_t i = 0; i < ctx->object_count; i++) {
+// Sweeps and unmarks `objects[begin, end)`, returning the newly freed objects
+// as a list from `*head` to `*tail`. `lock`, if not `NULL`, serializes the
+// `gc` handler calls.
+static void SweepPartition(FeContext* ctx,
+                           size_t begin,
+                           size_t end,
+                           FeObject** head,
+                           FeObject** tail,
+                           pthread_mutex_t* lock) {
+  *head = &nil;
+  *tail = NULL;
+  for (size_t i = begin; i < end; i++) {
     FeObject* obj = &ctx->objects[i];
     if (FeGetType(obj) == FeTFree) {
       continue;
     }
     if (~TAG(obj) & GcMarkBit) {
       if (ctx->handlers.gc != NULL) {
+        if (lock != NULL) {
+          pthread_mutex_lock(lock);
+        }
         ctx->handlers.gc(ctx, obj);
+        if (lock != NULL) {
+          pthread_mutex_unlock(lock);
+        }
+      }
+      if (FeGetType(obj) == FeTFn) {
+        // Each `Compiled` belongs to one function, so partitions swept
+        // concurrently write to distinct ones. Its code is freed later.
+        const uint32_t index = GetJitCompiled(obj);
+        if (index != 0 && index <= ctx->compiled_count &&
+            ctx->compiled[index - 1].fn == obj) {
+          ctx->compiled[index - 1].fn = NULL;
+        }
       }
       SetType(obj, FeTFree);
-      CDR(obj) = ctx->free_list;
-      ctx->free_list = obj;
+      CDR(obj) = *head;
+      if (*tail == NULL) {
+        *tail = obj;
+      }
+      *head = obj;
     } else {
       TAG(obj) &= ~GcMarkBit;
     }
   }
 }
 
+static void Yield(void) {
+  sched_yield();
+}
+
+static void MarkInParallel(Collection* c, size_t index) {
+  GrayDeque deque;
+  atomic_init(&deque.top, 0);
+  atomic_init(&deque.bottom, 0);
+  collection = c;
+  gray = &deque;
+  atomic_store_explicit(&c->deques[index], &deque, memory_order_release);
+  if (index == 0) {
+    MarkRoots(c->ctx);
+  }
+
+  while (true) {
+    FeObject* obj;
+    while ((obj = PopGray(&deque)) != NULL) {
+      ScanGray(c, obj);
+    }
+    if ((obj = StealGrayFromAny(c, index)) != NULL) {
+      ScanGray(c, obj);
+      continue;
+    }
+    // Out of work. We are done when every thread is out of work.
+    atomic_fetch_sub_explicit(&c->active, 1, memory_order_acq_rel);
+    while (obj == NULL &&
+           atomic_load_explicit(&c->active, memory_order_acquire) != 0) {
+      if ((obj = StealGrayFromAny(c, index)) == NULL) {
+        Yield();
+      }
+    }
+    if (obj == NULL) {
+      break;
+    }
+    atomic_fetch_add_explicit(&c->active, 1, memory_order_acq_rel);
+    ScanGray(c, obj);
+  }
+
+  gray = NULL;
+  collection = NULL;
+  // Keep `deque` alive until nobody can steal from it:
+  atomic_fetch_add_explicit(&c->finished, 1, memory_order_acq_rel);
+  while (atomic_load_explicit(&c->finished, memory_order_acquire) <
+         c->thread_count) {
+    Yield();
+  }
+}
+
+static void SweepInParallel(Collection* c, size_t index) {
+  const size_t count = c->ctx->object_count;
+  SweepPartition(c->ctx, index * count / c->thread_count,
+                 (index + 1) * count / c->thread_count, &c->heads[index],
+                 &c->tails[index], &c->lock);
+}
+
+static void* RunGCThread(void* t) {
+  GCThread* thread = t;
+  Collection* c = thread->collection;
+  while (!atomic_load_explicit(&c->marking, memory_order_acquire)) {
+    Yield();
+  }
+  MarkInParallel(c, thread->index);
+  while (!atomic_load_explicit(&c->sweeping, memory_order_acquire)) {
+    Yield();
+  }
+  SweepInParallel(c, thread->index);
+  return NULL;
+}
+
+static void CollectGarbageInParallel(FeContext* ctx) {
+  Collection c = {.ctx = ctx};
+  pthread_mutex_init(&c.lock, NULL);
+  atomic_init(&c.marking, false);
+  atomic_init(&c.sweeping, false);
+  atomic_init(&c.finished, 0);
+  for (size_t i = 0; i < GCThreadLimit; i++) {
+    atomic_init(&c.deques[i], NULL);
+  }
+
+  GCThread threads[GCThreadLimit];
+  size_t count = 1;
+  for (; count < ctx->gc_thread_count; count++) {
+    threads[count] = (GCThread){.collection = &c, .index = count};
+    if (pthread_create(&threads[count].thread, NULL, RunGCThread,
+                       &threads[count]) != 0) {
+      break;
+    }
+  }
+  c.thread_count = count;
+  atomic_init(&c.active, count);
+  atomic_store_explicit(&c.marking, true, memory_order_release);
+  MarkInParallel(&c, 0);
+  Finalize(ctx);
+  atomic_store_explicit(&c.sweeping, true, memory_order_release);
+  SweepInParallel(&c, 0);
+  for (size_t i = 1; i < count; i++) {
+    pthread_join(threads[i].thread, NULL);
+  }
+  pthread_mutex_destroy(&c.lock);
+
+  for (size_t i = 0; i < count; i++) {
+    if (c.tails[i] != NULL) {
+      CDR(c.tails[i]) = ctx->free_list;
+      ctx->free_list = c.heads[i];
+    }
+  }
+}
+
+static void CollectGarbage(FeContext* ctx) {
+  ctx->collection_count++;
+  if (ctx->gc_thread_count > 1 && ctx->object_count >= ParallelGCThreshold) {
+    CollectGarbageInParallel(ctx);
+    return;
+  }
+
+  MarkRoots(ctx);
+  Finalize(ctx);
+  FeObject* head;
+  FeObject* tail;
+  SweepPartition(ctx, 0, ctx->object_count, &head, &tail, NULL);
+  if (tail != NULL) {
+    CDR(tail) = ctx->free_list;
+    ctx->free_list = head;
+  }
+}
+
+void FeSetGCThreads(FeContext* ctx, size_t count) {
+  ctx->gc_thread_count = count < 1               ? 1
+                         : count > GCThreadLimit ? GCThreadLimit
+                                                 : count;
+}
+
 // Translated from [the original
 // Java](https://floating-point-gui.de/errors/comparison/).
 //
@@ -348,6 +897,10 @@ static bool Equal(FeObject* a, FeObject* b) {
   return false;
 }
 
+bool FeIsEqual(FeObject* a, FeObject* b) {
+  return Equal(a, b);
+}
+
 static int IsStringEqual(FeObject* obj, const char* str) {
   while (!FeIsNil(obj)) {
     for (size_t i = 0; i < StringBufferSize; i++) {
@@ -374,6 +927,7 @@ static FeObject* MakeObject(FeContext* ctx) {
   // Get object from free_list and push it onto the GC stack:
   FeObject* obj = ctx->free_list;
   ctx->free_list = CDR(obj);
+  ctx->allocation_count++;
   FePushGC(ctx, obj);
   return obj;
 }
@@ -412,13 +966,51 @@ static FeObject* BuildString(FeContext* ctx, FeObject* tail, char chr) {
 
 FeObject* FeMakeString(FeContext* ctx, const char* str) {
   FeObject* obj = BuildString(ctx, NULL, '\0');
-  FeObject* tail = obj;
-  while (*str) {
-    tail = BuildString(ctx, tail, *str++);
-  }
+  (void)FeAppendString(ctx, obj, str, strlen(str));
   return obj;
 }
 
+FeObject* FeAppendString(FeContext* ctx,
+                         FeObject* tail,
+                         const char* str,
+                         size_t size) {
+  (void)CheckType(ctx, tail, FeTString);
+  const char* end = memchr(str, '\0', size);
+  if (end != NULL) {
+    size = (size_t)(end - str);
+  }
+  char* buffer = STRING_BUFFER(tail);
+  const char* used_end = memchr(buffer, '\0', StringBufferSize);
+  size_t used = used_end ? (size_t)(used_end - buffer) : StringBufferSize;
+  while (size > 0) {
+    if (used == StringBufferSize) {
+      // As in `BuildString`, the new chunk is reachable once it is linked.
+      FeObject* obj = FeCons(ctx, NULL, &nil);
+      SetType(obj, FeTString);
+      CDR(tail) = obj;
+      ctx->gc_stack_index--;
+      tail = obj;
+      buffer = STRING_BUFFER(tail);
+      used = 0;
+    }
+    const size_t n =
+        size < StringBufferSize - used ? size : StringBufferSize - used;
+    memcpy(buffer + used, str, n);
+    used += n;
+    str += n;
+    size -= n;
+  }
+  return tail;
+}
+
+size_t FeGetStringChunk(FeContext* ctx, FeObject** str, const char** chunk) {
+  FeObject* obj = CheckType(ctx, *str, FeTString);
+  *chunk = STRING_BUFFER(obj);
+  *str = CDR(obj);
+  const char* end = memchr(*chunk, '\0', StringBufferSize);
+  return end ? (size_t)(end - *chunk) : StringBufferSize;
+}
+
 FeObject* FeMakeSymbol(FeContext* ctx, const char* name) {
   FeObject* obj;
   // Try to find in symbol_list:
@@ -442,10 +1034,47 @@ FeObject* FeMakeNativeFn(FeContext* ctx, FeNativeFn fn) {
   return obj;
 }
 
+FeObject* FeMakeNativeArrayFn(FeContext* ctx,
+                              FeNativeArrayFn fn,
+                              size_t min_argc) {
+  if (min_argc > UCHAR_MAX) {
+    abort();
+  }
+  FeObject* obj = MakeObject(ctx);
+  SetType(obj, FeTNativeArrayFn);
+  MIN_ARGC(obj) = (unsigned char)min_argc;
+  NATIVE_ARRAY_FN(obj) = fn;
+  return obj;
+}
+
+FeObject* FeMakeUnaryDoubleFn(FeContext* ctx, FeUnaryDoubleFn fn) {
+  FeObject* obj = MakeObject(ctx);
+  SetType(obj, FeTDoubleFn);
+  MIN_ARGC(obj) = 1;
+  obj->cdr.d1 = fn;
+  return obj;
+}
+
+FeObject* FeMakeBinaryDoubleFn(FeContext* ctx, FeBinaryDoubleFn fn) {
+  FeObject* obj = MakeObject(ctx);
+  SetType(obj, FeTDoubleFn);
+  MIN_ARGC(obj) = 2;
+  obj->cdr.d2 = fn;
+  return obj;
+}
+
 FeObject* FeMakePtr(FeContext* ctx, FeType type, void* ptr) {
   FeObject* obj = MakeObject(ctx);
   SetType(obj, type);
   CDR(obj) = ptr;
+  if (ctx->type_hooks[type].finalize != NULL) {
+    // Read `finalizable` only after allocating, since collecting may unlink
+    // its head.
+    FeObject* entry = FeCons(ctx, obj, &nil);
+    ctx->gc_stack_index--;
+    CDR(entry) = ctx->finalizable;
+    ctx->finalizable = entry;
+  }
   return obj;
 }
 
@@ -457,6 +1086,154 @@ FeObject* FeMakeList(FeContext* ctx, FeObject** objs, size_t n) {
   return res;
 }
 
+enum {
+  // Bounds the recursion on `car`s in `CopyInto`.
+  CopyDepthLimit = 1024,
+};
+
+static void CopyInto(FeContext* ctx,
+                     FeObject** slot,
+                     FeObject* obj,
+                     bool code,
+                     size_t depth);
+
+// Interns the symbol `sym`, which may belong to another context, in `ctx`.
+static FeObject* CopySymbol(FeContext* ctx, FeObject* sym) {
+  FeObject* name = CAR(CDR(sym));
+  for (FeObject* obj = ctx->symbol_list; !FeIsNil(obj); obj = CDR(obj)) {
+    if (Equal(CAR(CDR(CAR(obj))), name)) {
+      return CAR(obj);
+    }
+  }
+  FeObject* copy = MakeObject(ctx);
+  SetType(copy, FeTSymbol);
+  CDR(copy) = FeCons(ctx, &nil, &nil);
+  ctx->symbol_list = FeCons(ctx, copy, ctx->symbol_list);
+  CopyInto(ctx, &CAR(CDR(copy)), name, false, 0);
+  return copy;
+}
+
+// Copies `obj` into `*slot`. Each new object is linked into the (reachable)
+// slot before anything else is allocated, so only the root of the copy needs
+// to be on the GC stack.
+//
+// When copying code (the insides of an `fn` or `macro`), symbols that are
+// unbound in `ctx` also get a copy of their global value, so that functions
+// bring along the functions and constants they refer to. `FePtr`s are not
+// brought along; they are left unbound.
+static void CopyInto(FeContext* ctx,
+                     FeObject** slot,
+                     FeObject* obj,
+                     bool code,
+                     size_t depth) {
+  if (depth > CopyDepthLimit) {
+    FeHandleError(ctx, "structure too deep to copy");
+  }
+  const size_t gc = FeSaveGC(ctx);
+  // Detects cycles along `cdr`s with Brent's algorithm:
+  FeObject* lap = obj;
+  size_t power = 1;
+  size_t length = 0;
+  while (true) {
+    const FeType type = FeGetType(obj);
+    FeObject* copy;
+    switch (type) {
+      case FeTNil:
+        *slot = &nil;
+        return;
+
+      case FeTPair:
+        copy = FeCons(ctx, &nil, &nil);
+        *slot = copy;
+        FeRestoreGC(ctx, gc);
+        CopyInto(ctx, &CAR(copy), CAR(obj), code, depth + 1);
+        slot = &CDR(copy);
+        obj = CDR(obj);
+        if (obj == lap) {
+          FeHandleError(ctx, "cannot copy cyclic structure");
+        }
+        if (++length == power) {
+          lap = obj;
+          power *= 2;
+          length = 0;
+        }
+        continue;
+
+      case FeTString:
+        for (; !FeIsNil(obj); obj = CDR(obj)) {
+          copy = MakeObject(ctx);
+          copy->car = obj->car;
+          CDR(copy) = &nil;
+          *slot = copy;
+          slot = &CDR(copy);
+          FeRestoreGC(ctx, gc);
+        }
+        return;
+
+      case FeTSymbol: {
+        copy = CopySymbol(ctx, obj);
+        *slot = copy;
+        FeRestoreGC(ctx, gc);
+        FeObject* value = CDR(CDR(obj));
+        if (code && FeIsNil(CDR(CDR(copy))) && FeGetType(value) < FeTPtr) {
+          CopyInto(ctx, &CDR(CDR(copy)), value, true, depth + 1);
+        }
+        return;
+      }
+
+      case FeTFn:
+      case FeTMacro:
+        copy = MakeObject(ctx);
+        SetType(copy, type);
+        ResetJitState(copy);
+        CDR(copy) = &nil;
+        *slot = copy;
+        FeRestoreGC(ctx, gc);
+        CopyInto(ctx, &CDR(copy), CDR(obj), true, depth + 1);
+        return;
+
+      case FeTDouble:
+      case FeTPrimitive:
+      case FeTNativeFn:
+      case FeTNativeArrayFn:
+      case FeTDoubleFn:
+        copy = MakeObject(ctx);
+        *copy = *obj;
+        *slot = copy;
+        FeRestoreGC(ctx, gc);
+        return;
+
+      case FeTPtr:
+      case FeTFex0:
+      case FeTFex1:
+      case FeTFex2:
+      case FeTFex3:
+      case FeTFex4:
+      case FeTFex5:
+      case FeTFex6:
+      case FeTFex7: {
+        char message[64];
+        Format(message, sizeof(message), "cannot copy %s",
+               FeGetTypeName(ctx, type));
+        FeHandleError(ctx, message);
+      }
+
+      case FeTFree:
+      case FeTSentinel:
+        abort();
+    }
+  }
+}
+
+FeObject* FeCopy(FeContext* ctx, FeObject* obj) {
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* root = FeCons(ctx, &nil, &nil);
+  CopyInto(ctx, &CAR(root), obj, false, 0);
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, CAR(root));
+  return CAR(root);
+}
+
 FeObject* FeCar(FeContext* ctx, FeObject* obj) {
   if (FeIsNil(obj)) {
     return obj;
@@ -471,6 +1248,14 @@ FeObject* FeCdr(FeContext* ctx, FeObject* obj) {
   return CDR(CheckType(ctx, obj, FeTPair));
 }
 
+void FeSetCar(FeContext* ctx, FeObject* pair, FeObject* v) {
+  CAR(CheckType(ctx, pair, FeTPair)) = v;
+}
+
+void FeSetCdr(FeContext* ctx, FeObject* pair, FeObject* v) {
+  CDR(CheckType(ctx, pair, FeTPair)) = v;
+}
+
 static void WriteString(FeContext* ctx,
                         FeWriteFn fn,
                         void* udata,
@@ -551,7 +1336,9 @@ void FeWrite(FeContext* ctx, FeObject* obj, FeWriteFn fn, void* udata, int qt) {
 
     case FeTPrimitive:
     case FeTNativeFn:
-      Format(buf, sizeof(buf), "[%s]", GetTypeName(FeGetType(obj)));
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
+      Format(buf, sizeof(buf), "[%s]", FeGetTypeName(ctx, FeGetType(obj)));
       WriteString(ctx, fn, udata, buf);
       break;
 
@@ -559,9 +1346,20 @@ void FeWrite(FeContext* ctx, FeObject* obj, FeWriteFn fn, void* udata, int qt) {
     case FeTFex0:
     case FeTFex1:
     case FeTFex2:
-      Format(buf, sizeof(buf), "[%s]", GetTypeName(FeGetType(obj)));
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7: {
+      const FeType type = FeGetType(obj);
+      if (ctx->type_hooks[type].write != NULL) {
+        ctx->type_hooks[type].write(ctx, obj, fn, udata);
+        break;
+      }
+      Format(buf, sizeof(buf), "[%s]", FeGetTypeName(ctx, type));
       WriteString(ctx, fn, udata, buf);
       break;
+    }
 
     case FeTFree:
     case FeTSentinel:
@@ -599,6 +1397,19 @@ size_t FeToString(FeContext* ctx, FeObject* obj, char* dst, size_t size) {
   return size - s.size - 1;
 }
 
+int FeCompareStrings(FeContext* ctx, FeObject* a, FeObject* b) {
+  (void)CheckType(ctx, a, FeTString);
+  (void)CheckType(ctx, b, FeTString);
+  // Unused bytes in the last chunk are 0, so chunks compare like C strings.
+  for (; !FeIsNil(a) && !FeIsNil(b); a = CDR(a), b = CDR(b)) {
+    const int c = memcmp(STRING_BUFFER(a), STRING_BUFFER(b), StringBufferSize);
+    if (c != 0) {
+      return c;
+    }
+  }
+  return FeIsNil(a) ? (FeIsNil(b) ? 0 : -1) : 1;
+}
+
 FeDouble FeToDouble(FeContext* ctx, FeObject* obj) {
   return GetDouble(CheckType(ctx, obj, FeTDouble));
 }
@@ -611,6 +1422,14 @@ void* FeToPtr(FeContext*, FeObject* obj) {
   return CDR(obj);
 }
 
+void FeSetPtr(FeContext*, FeObject* obj, void* ptr) {
+  const FeType type = FeGetType(obj);
+  if (type < FeTPtr || type >= FeTSentinel) {
+    abort();
+  }
+  CDR(obj) = ptr;
+}
+
 static FeObject* GetBound(FeObject* sym, FeObject* env) {
   // Try to find the symbol in the environment:
   for (; !FeIsNil(env); env = CDR(env)) {
@@ -627,8 +1446,6 @@ void FeSet(FeContext*, FeObject* sym, FeObject* v) {
   CDR(GetBound(sym, &nil)) = v;
 }
 
-static FeObject rparen;
-
 static FeObject* Read(FeContext* ctx, FeReadFn fn, void* udata) {
   // Get next character:
   char chr = ctx->nextchr ? ctx->nextchr : fn(ctx, udata);
@@ -650,7 +1467,7 @@ static FeObject* Read(FeContext* ctx, FeReadFn fn, void* udata) {
       return Read(ctx, fn, udata);
 
     case ')':
-      return &rparen;
+      return &ctx->rparen;
 
     case '(': {
       FeObject* res = &nil;
@@ -658,7 +1475,7 @@ static FeObject* Read(FeContext* ctx, FeReadFn fn, void* udata) {
       size_t gc = FeSaveGC(ctx);
       FePushGC(ctx, res);  // To cause error on too-deep nesting
       FeObject* v;
-      while ((v = Read(ctx, fn, udata)) != &rparen) {
+      while ((v = Read(ctx, fn, udata)) != &ctx->rparen) {
         if (v == NULL) {
           FeHandleError(ctx, "unclosed list");
         }
@@ -734,7 +1551,7 @@ static FeObject* Read(FeContext* ctx, FeReadFn fn, void* udata) {
 
 FeObject* FeRead(FeContext* ctx, FeReadFn fn, void* udata) {
   FeObject* obj = Read(ctx, fn, udata);
-  if (obj == &rparen) {
+  if (obj == &ctx->rparen) {
     FeHandleError(ctx, "stray ')'");
   }
   return obj;
@@ -765,6 +1582,30 @@ static FeObject* EvaluateList(FeContext* ctx, FeObject* lst, FeObject* env) {
   return res;
 }
 
+// Evaluates `lst` onto the top of the GC stack, which serves as the argument
+// array of `FeTNativeArrayFn`s. Returns the argument count.
+static size_t EvaluateArguments(FeContext* ctx, FeObject* lst, FeObject* env) {
+  const size_t save = FeSaveGC(ctx);
+  size_t argc = 0;
+  while (!FeIsNil(lst)) {
+    FeObject* v = Evaluate(ctx, FeGetNextArgument(ctx, &lst), env, NULL);
+    FeRestoreGC(ctx, save + argc);
+    FePushGC(ctx, v);
+    argc++;
+  }
+  return argc;
+}
+
+static FeObject* CallNativeArrayFn(FeContext* ctx,
+                                   FeObject* fn,
+                                   size_t argc,
+                                   FeObject** argv) {
+  if (argc < MIN_ARGC(fn)) {
+    FeHandleError(ctx, "too few arguments");
+  }
+  return GetNativeArrayFn(fn)(ctx, argc, argv);
+}
+
 static FeObject* DoList(FeContext* ctx, FeObject* lst, FeObject* env) {
   FeObject* res = &nil;
   const size_t save = FeSaveGC(ctx);
@@ -795,39 +1636,699 @@ static FeObject* ArgsToEnv(FeContext* ctx,
 
 #define EVAL_ARG() Evaluate(ctx, FeGetNextArgument(ctx, &arg), env, NULL)
 
-#define ARITH_OP(op)                          \
-  {                                           \
-    FeDouble x = FeToDouble(ctx, EVAL_ARG()); \
-    while (!FeIsNil(arg)) {                   \
-      x = x op FeToDouble(ctx, EVAL_ARG());   \
-    }                                         \
-    res = FeMakeDouble(ctx, x);               \
+#define EVAL_DOUBLE_ARG() EvaluateDouble(ctx, FeGetNextArgument(ctx, &arg), env)
+
+#define NUM_CMP_OP(op)                    \
+  {                                       \
+    const FeDouble x = EVAL_DOUBLE_ARG(); \
+    const FeDouble y = EVAL_DOUBLE_ARG(); \
+    res = FeMakeBool(ctx, x op y);        \
   }
 
-#define NUM_CMP_OP(op)                                     \
-  {                                                        \
-    va = CheckType(ctx, EVAL_ARG(), FeTDouble);            \
-    vb = CheckType(ctx, EVAL_ARG(), FeTDouble);            \
-    res = FeMakeBool(ctx, GetDouble(va) op GetDouble(vb)); \
+static FeDouble EvaluateDouble(FeContext* ctx, FeObject* obj, FeObject* env);
+
+static FeDouble Arithmetic(FeContext* ctx,
+                           char op,
+                           FeObject* arg,
+                           FeObject* env) {
+  FeDouble x = EVAL_DOUBLE_ARG();
+  while (!FeIsNil(arg)) {
+    const FeDouble y = EVAL_DOUBLE_ARG();
+    switch (op) {
+      case PAdd:
+        x = x + y;
+        break;
+      case PSub:
+        x = x - y;
+        break;
+      case PMul:
+        x = x * y;
+        break;
+      case PDiv:
+        x = x / y;
+        break;
+    }
   }
+  return x;
+}
 
-static FeObject* EvaluatePrimitive(FeContext* ctx,
-                                   FeObject* obj,
-                                   FeObject* env,
-                                   FeObject** newenv,
-                                   FeObject* fn) {
-  FeObject* res = &nil;
+static bool IsArithmetic(char op) {
+  return op == PAdd || op == PSub || op == PMul || op == PDiv;
+}
+
+// Calls the `FeTDoubleFn` `fn` for the call form `obj`. The form is left as it
+// is, even if the arguments are constants, since the symbol it names may be
+// rebound; only the compilers fold such calls.
+static FeDouble CallDoubleFn(FeContext* ctx,
+                             FeObject* obj,
+                             FeObject* fn,
+                             FeObject* env) {
   FeObject* arg = CDR(obj);
-  FeObject* va;
-  FeObject* vb;
-  switch (GetPrimitive(fn)) {
-    case PAssert:
-      va = EVAL_ARG();
-      if (FeIsNil(va)) {
-        FeHandleError(ctx, "assertion failure");
-      }
+  const FeDouble x = EvaluateDouble(ctx, FeGetNextArgument(ctx, &arg), env);
+  if (MIN_ARGC(fn) == 1) {
+    return fn->cdr.d1(x);
+  }
+  const FeDouble y = EvaluateDouble(ctx, FeGetNextArgument(ctx, &arg), env);
+  return fn->cdr.d2(x, y);
+}
+
+// Evaluates `obj`, which must result in a number, without boxing the numbers
+// that calls to `FeTDoubleFn`s and arithmetic primitives produce along the way.
+static FeDouble EvaluateDouble(FeContext* ctx, FeObject* obj, FeObject* env) {
+  if (FeGetType(obj) == FeTDouble) {
+    return GetDouble(obj);
+  }
+  if (FeGetType(obj) == FeTPair && FeGetType(CAR(obj)) == FeTSymbol) {
+    FeObject* fn = CDR(GetBound(CAR(obj), env));
+    const FeType type = FeGetType(fn);
+    if (type == FeTDoubleFn ||
+        (type == FeTPrimitive && IsArithmetic(GetPrimitive(fn)))) {
+      FeObject cl;
+      CAR(&cl) = obj;
+      CDR(&cl) = ctx->call_list;
+      ctx->call_list = &cl;
+      const FeDouble res =
+          type == FeTDoubleFn
+              ? CallDoubleFn(ctx, obj, fn, env)
+              : Arithmetic(ctx, GetPrimitive(fn), CDR(obj), env);
+      ctx->call_list = CDR(&cl);
       return res;
-    case PEnv:
+    }
+  }
+  const size_t gc = FeSaveGC(ctx);
+  const FeDouble res = FeToDouble(ctx, Evaluate(ctx, obj, env, NULL));
+  FeRestoreGC(ctx, gc);
+  return res;
+}
+
+// Compilation
+
+enum {
+  CompilerVariableLimit = 64,
+  CompilerGuardLimit = 16,
+  // Call counts are kept in 16 bits.
+  JitThresholdLimit = UINT16_MAX,
+};
+
+typedef struct Variable {
+  FeObject* name;
+  size_t slot;
+} Variable;
+
+// Compiles the body of an `FeTFn` whose parameters and locals are all numbers
+// to JIT templates, or gives up on any form it does not handle. It handles
+// number literals; references and assignments (`=`) to parameters and `let`
+// locals; `+`, `-`, `*`, `/`, `FeTDoubleFn`s, and calls of the function to
+// itself; `if`, `do`, and `while`; and `<`, `<=`, `not`, `and`, and `or` as
+// conditions. Since such code can fail no type check once its parameters are
+// numbers, the compiled function needs guards only on entry.
+typedef struct Compiler {
+  FeObject* fn;
+  FeObject* env;
+  size_t parameter_count;
+  Jit* jit;
+  Variable variables[CompilerVariableLimit];
+  size_t variable_count;
+  size_t slot_count;
+  size_t max_slot_count;
+  Guard guards[CompilerGuardLimit];
+  size_t guard_count;
+} Compiler;
+
+static bool CompileNumber(Compiler* c, FeObject* x);
+static bool CompileStatement(Compiler* c, FeObject* x);
+static bool CompileSequence(Compiler* c, FeObject* list, bool value);
+
+// Returns the number of forms in `list`, or `SIZE_MAX` if it is not a list.
+static size_t CountForms(FeObject* list) {
+  size_t count = 0;
+  for (; FeGetType(list) == FeTPair; list = CDR(list)) {
+    count++;
+  }
+  return FeIsNil(list) ? count : SIZE_MAX;
+}
+
+static size_t AllocateSlot(Compiler* c) {
+  const size_t slot = c->slot_count++;
+  if (c->slot_count > c->max_slot_count) {
+    c->max_slot_count = c->slot_count;
+  }
+  return slot;
+}
+
+static const Variable* FindVariable(const Compiler* c, FeObject* name) {
+  for (size_t i = c->variable_count; i > 0; i--) {
+    if (c->variables[i - 1].name == name) {
+      return &c->variables[i - 1];
+    }
+  }
+  return NULL;
+}
+
+static bool AddVariable(Compiler* c, FeObject* name, size_t slot) {
+  if (FeGetType(name) != FeTSymbol ||
+      c->variable_count == CompilerVariableLimit) {
+    return false;
+  }
+  c->variables[c->variable_count++] = (Variable){.name = name, .slot = slot};
+  return true;
+}
+
+static bool CheckGuard(const Guard* g) {
+  FeObject* v = CDR(g->binding);
+  if (g->fn != NULL) {
+    return v == g->fn;
+  }
+  if (FeGetType(v) != g->type) {
+    return false;
+  }
+  return g->type == FeTPrimitive ? GetPrimitive(v) == g->cdr.c
+                                 : v->cdr.o == g->cdr.o;
+}
+
+// Sets `*callee` to the value of `head`, the first element of a form, and
+// guards the binding it came from. Locals are numbers, so are not callees.
+static bool ResolveCallee(Compiler* c, FeObject* head, FeObject** callee) {
+  if (FeGetType(head) != FeTSymbol || FindVariable(c, head) != NULL) {
+    return false;
+  }
+  FeObject* binding = GetBound(head, c->env);
+  *callee = CDR(binding);
+  for (size_t i = 0; i < c->guard_count; i++) {
+    if (c->guards[i].binding == binding) {
+      return true;
+    }
+  }
+  if (c->guard_count == CompilerGuardLimit) {
+    return false;
+  }
+  FeObject* v = *callee;
+  c->guards[c->guard_count++] = (Guard){.binding = binding,
+                                        .fn = v == c->fn ? v : NULL,
+                                        .type = FeGetType(v),
+                                        .cdr = v->cdr};
+  return true;
+}
+
+// Returns the primitive that form `x` calls, or `PSentinel`.
+static char GetFormPrimitive(Compiler* c, FeObject* x) {
+  FeObject* callee;
+  if (FeGetType(x) != FeTPair || !ResolveCallee(c, CAR(x), &callee) ||
+      FeGetType(callee) != FeTPrimitive) {
+    return PSentinel;
+  }
+  return GetPrimitive(callee);
+}
+
+// Compiles `args[0]`, and then each of the rest into the accumulator, with
+// the result so far in a slot; `JitArithmetic` or `JitBranch` combines them.
+static bool CompileArithmetic(Compiler* c, JitOperator op, FeObject* args) {
+  if (FeIsNil(args) || !CompileNumber(c, CAR(args))) {
+    return false;
+  }
+  for (args = CDR(args); !FeIsNil(args); args = CDR(args)) {
+    const size_t slot = AllocateSlot(c);
+    JitStore(c->jit, slot);
+    if (!CompileNumber(c, CAR(args))) {
+      return false;
+    }
+    JitArithmetic(c->jit, op, slot);
+    c->slot_count--;
+  }
+  return true;
+}
+
+// Jumps to `label` if condition `x` is `jump_if`.
+static bool CompileBranch(Compiler* c,
+                          FeObject* x,
+                          bool jump_if,
+                          JitLabel label) {
+  const char p = GetFormPrimitive(c, x);
+  FeObject* args = FeGetType(x) == FeTPair ? CDR(x) : &nil;
+  const size_t count = CountForms(args);
+  switch (p) {
+    case PLess:
+    case PLessEqual: {
+      if (count != 2 || !CompileNumber(c, CAR(args))) {
+        return false;
+      }
+      const size_t slot = AllocateSlot(c);
+      JitStore(c->jit, slot);
+      if (!CompileNumber(c, CAR(CDR(args)))) {
+        return false;
+      }
+      JitBranch(c->jit, p == PLess ? JitLess : JitLessEqual, slot, jump_if,
+                label);
+      c->slot_count--;
+      return true;
+    }
+    case PNot:
+      return count == 1 && CompileBranch(c, CAR(args), !jump_if, label);
+    case PAnd:
+    case POr: {
+      if (count == 0 || count == SIZE_MAX) {
+        return false;
+      }
+      // `and` jumps when false as soon as one operand is false, and `or`
+      // jumps when true as soon as one is true. Otherwise, the last operand
+      // decides.
+      const bool early = p == POr;
+      const JitLabel skip = JitMakeLabel(c->jit);
+      for (; !FeIsNil(CDR(args)); args = CDR(args)) {
+        if (!CompileBranch(c, CAR(args), early,
+                           jump_if == early ? label : skip)) {
+          return false;
+        }
+      }
+      const bool ok = CompileBranch(c, CAR(args), jump_if, label);
+      JitBindLabel(c->jit, skip);
+      return ok;
+    }
+    default:
+      return false;
+  }
+}
+
+// `(if condition then ... [else])`, whose value is a number only if there is
+// an `else`.
+static bool CompileIf(Compiler* c, FeObject* args, bool value) {
+  if (CountForms(args) == SIZE_MAX) {
+    return false;
+  }
+  const JitLabel end = JitMakeLabel(c->jit);
+  while (!FeIsNil(args)) {
+    FeObject* condition = CAR(args);
+    args = CDR(args);
+    if (FeIsNil(args)) {
+      const bool ok =
+          value ? CompileNumber(c, condition) : CompileStatement(c, condition);
+      JitBindLabel(c->jit, end);
+      return ok;
+    }
+    const JitLabel next = JitMakeLabel(c->jit);
+    if (!CompileBranch(c, condition, false, next) ||
+        !(value ? CompileNumber(c, CAR(args))
+                : CompileStatement(c, CAR(args)))) {
+      return false;
+    }
+    args = CDR(args);
+    JitJump(c->jit, end);
+    JitBindLabel(c->jit, next);
+  }
+  JitBindLabel(c->jit, end);
+  return !value;
+}
+
+static bool CompileCall(Compiler* c, FeObject* x) {
+  FeObject* callee;
+  if (!ResolveCallee(c, CAR(x), &callee)) {
+    return false;
+  }
+  FeObject* args = CDR(x);
+  const size_t count = CountForms(args);
+  const FeType type = FeGetType(callee);
+  if (type == FeTPrimitive) {
+    switch (GetPrimitive(callee)) {
+      case PAdd:
+        return CompileArithmetic(c, JitAdd, args);
+      case PSub:
+        return CompileArithmetic(c, JitSubtract, args);
+      case PMul:
+        return CompileArithmetic(c, JitMultiply, args);
+      case PDiv:
+        return CompileArithmetic(c, JitDivide, args);
+      case PIf:
+        return CompileIf(c, args, true);
+      case PDo:
+        return CompileSequence(c, args, true);
+      default:
+        return false;
+    }
+  }
+
+  if (type == FeTDoubleFn) {
+    if (count != MIN_ARGC(callee) || !CompileNumber(c, CAR(args))) {
+      return false;
+    }
+    if (count == 1) {
+      JitCallUnary(c->jit, callee->cdr.d1);
+      return true;
+    }
+    const size_t slot = AllocateSlot(c);
+    JitStore(c->jit, slot);
+    if (!CompileNumber(c, CAR(CDR(args)))) {
+      return false;
+    }
+    JitCallBinary(c->jit, callee->cdr.d2, slot);
+    c->slot_count--;
+    return true;
+  }
+
+  // Of other functions, only the one being compiled can be called.
+  if (callee != c->fn || count != c->parameter_count) {
+    return false;
+  }
+  const size_t first = c->slot_count;
+  for (size_t i = 0; i < count; i++) {
+    (void)AllocateSlot(c);
+  }
+  for (size_t i = 0; i < count; i++, args = CDR(args)) {
+    if (!CompileNumber(c, CAR(args))) {
+      return false;
+    }
+    JitStore(c->jit, first + i);
+  }
+  JitCallSelf(c->jit, first);
+  c->slot_count = first;
+  return true;
+}
+
+// Compiles `x` so that its value, a number, is in the accumulator.
+static bool CompileNumber(Compiler* c, FeObject* x) {
+  const FeType type = FeGetType(x);
+  if (type == FeTDouble) {
+    JitLoadConstant(c->jit, GetDouble(x));
+    return true;
+  }
+  if (type == FeTSymbol) {
+    const Variable* v = FindVariable(c, x);
+    if (v != NULL) {
+      JitLoad(c->jit, v->slot);
+    }
+    return v != NULL;
+  }
+  return type == FeTPair && CompileCall(c, x);
+}
+
+// Compiles `x` for its effects, discarding its value.
+static bool CompileStatement(Compiler* c, FeObject* x) {
+  FeObject* args = FeGetType(x) == FeTPair ? CDR(x) : &nil;
+  switch (GetFormPrimitive(c, x)) {
+    case PSet: {
+      const Variable* v =
+          CountForms(args) == 2 ? FindVariable(c, CAR(args)) : NULL;
+      if (v == NULL || !CompileNumber(c, CAR(CDR(args)))) {
+        return false;
+      }
+      JitStore(c->jit, v->slot);
+      return true;
+    }
+    case PWhile: {
+      if (FeIsNil(args) || CountForms(args) == SIZE_MAX) {
+        return false;
+      }
+      const JitLabel top = JitMakeLabel(c->jit);
+      const JitLabel end = JitMakeLabel(c->jit);
+      JitBindLabel(c->jit, top);
+      if (!CompileBranch(c, CAR(args), false, end) ||
+          !CompileSequence(c, CDR(args), false)) {
+        return false;
+      }
+      JitLoop(c->jit, top);
+      JitBindLabel(c->jit, end);
+      return true;
+    }
+    case PIf:
+      return CompileIf(c, args, false);
+    case PDo:
+      return CompileSequence(c, args, false);
+    default:
+      return CompileNumber(c, x);
+  }
+}
+
+// Compiles a body, in which `let` binds a local for the forms after it. If
+// `value`, the last form's value must be a number, and is the result.
+static bool CompileSequence(Compiler* c, FeObject* list, bool value) {
+  if (CountForms(list) == SIZE_MAX) {
+    return false;
+  }
+  if (FeIsNil(list)) {
+    return !value;
+  }
+  const size_t variable_count = c->variable_count;
+  const size_t slot_count = c->slot_count;
+  for (; !FeIsNil(list); list = CDR(list)) {
+    FeObject* x = CAR(list);
+    const bool last = FeIsNil(CDR(list));
+    if (GetFormPrimitive(c, x) == PLet) {
+      FeObject* args = CDR(x);
+      if ((last && value) || CountForms(args) != 2 ||
+          !CompileNumber(c, CAR(CDR(args)))) {
+        return false;
+      }
+      const size_t slot = AllocateSlot(c);
+      JitStore(c->jit, slot);
+      if (!AddVariable(c, CAR(args), slot)) {
+        return false;
+      }
+    } else if (!(last && value ? CompileNumber(c, x)
+                               : CompileStatement(c, x))) {
+      return false;
+    }
+  }
+  c->variable_count = variable_count;
+  c->slot_count = slot_count;
+  return true;
+}
+
+static void ReleaseCompiled(Compiled* compiled) {
+  JitFree(compiled->code);
+  free(compiled->guards);
+  *compiled = (Compiled){0};
+}
+
+// Returns a `Compiled` for `fn`, or `NULL` if it cannot be compiled.
+static Compiled* Compile(FeContext* ctx, FeObject* fn) {
+  FeObject* va = CDR(fn);  // (env params ...)
+  FeObject* vb = CDR(va);  // (params ...)
+  const size_t parameter_count = CountForms(CAR(vb));
+  if (parameter_count > JitParameterLimit) {
+    return NULL;
+  }
+  Compiler c = {.fn = fn,
+                .env = CAR(va),
+                .parameter_count = parameter_count,
+                .jit = JitOpen(parameter_count)};
+  if (c.jit == NULL) {
+    return NULL;
+  }
+  for (FeObject* p = CAR(vb); !FeIsNil(p); p = CDR(p)) {
+    if (!AddVariable(&c, CAR(p), AllocateSlot(&c))) {
+      JitAbandon(c.jit);
+      return NULL;
+    }
+  }
+  if (!CompileSequence(&c, CDR(vb), true)) {
+    JitAbandon(c.jit);
+    return NULL;
+  }
+  JitCode* code = JitFinish(c.jit, c.max_slot_count);
+  Guard* guards = malloc(c.guard_count * sizeof(Guard) + 1);
+  if (code == NULL || guards == NULL) {
+    JitFree(code);
+    free(guards);
+    return NULL;
+  }
+  memcpy(guards, c.guards, c.guard_count * sizeof(Guard));
+
+  // Reuse the entry of a function that has been freed, if there is one:
+  size_t index = 0;
+  while (index < ctx->compiled_count && ctx->compiled[index].fn != NULL) {
+    index++;
+  }
+  if (index == ctx->compiled_count) {
+    Compiled* compiled =
+        index < UINT32_MAX
+            ? realloc(ctx->compiled, (index + 1) * sizeof(Compiled))
+            : NULL;
+    if (compiled == NULL) {
+      JitFree(code);
+      free(guards);
+      return NULL;
+    }
+    ctx->compiled = compiled;
+    ctx->compiled[ctx->compiled_count++] = (Compiled){0};
+  }
+  Compiled* compiled = &ctx->compiled[index];
+  ReleaseCompiled(compiled);
+  *compiled = (Compiled){.fn = fn,
+                         .code = code,
+                         .parameter_count = parameter_count,
+                         .guards = guards,
+                         .guard_count = c.guard_count};
+  SetJitCompiled(fn, (uint32_t)(index + 1));
+  return compiled;
+}
+
+// Counts a call of `fn`, and returns its `Compiled` if it has one whose guards
+// hold, compiling it if this call reaches the threshold.
+static const Compiled* GetCompiled(FeContext* ctx, FeObject* fn) {
+  if (ctx->jit_threshold == 0) {
+    return NULL;
+  }
+  const uint32_t index = GetJitCompiled(fn);
+  if (index != 0) {
+    Compiled* compiled =
+        index <= ctx->compiled_count ? &ctx->compiled[index - 1] : NULL;
+    if (compiled != NULL && compiled->fn == fn) {
+      bool hold = true;
+      for (size_t i = 0; i < compiled->guard_count && hold; i++) {
+        hold = CheckGuard(&compiled->guards[i]);
+      }
+      if (hold) {
+        return compiled;
+      }
+      // A callee was redefined, so count the calls afresh.
+      ReleaseCompiled(compiled);
+    }
+    SetJitCompiled(fn, 0);
+    SetJitCalls(fn, 0);
+    return NULL;
+  }
+  if (GetJitFailed(fn)) {
+    return NULL;
+  }
+  const uint16_t calls = (uint16_t)(GetJitCalls(fn) + 1);
+  if (calls < ctx->jit_threshold) {
+    SetJitCalls(fn, calls);
+    return NULL;
+  }
+  const Compiled* compiled = Compile(ctx, fn);
+  if (compiled == NULL) {
+    SetJitFailed(fn);
+  }
+  return compiled;
+}
+
+// Calls `compiled` with `argc` arguments, from `objects` if it is not `NULL`
+// or else from `doubles`. Returns false, without calling it, if the count is
+// wrong or an argument is not a number.
+static bool CallCompiled(FeContext* ctx,
+                         const Compiled* compiled,
+                         size_t argc,
+                         FeObject** objects,
+                         const FeDouble* doubles,
+                         FeDouble* result) {
+  if (argc != compiled->parameter_count) {
+    return false;
+  }
+  FeDouble arguments[JitParameterLimit];
+  for (size_t i = 0; i < argc; i++) {
+    if (objects == NULL) {
+      arguments[i] = doubles[i];
+    } else if (FeGetType(objects[i]) == FeTDouble) {
+      arguments[i] = GetDouble(objects[i]);
+    } else {
+      return false;
+    }
+  }
+  bool overflowed;
+  *result = JitCall(compiled->code, arguments, &overflowed);
+  if (overflowed) {
+    FeHandleError(ctx, "stack overflow");
+  }
+  return true;
+}
+
+void FeSetJITThreshold(FeContext* ctx, size_t threshold) {
+  ctx->jit_threshold =
+      threshold < JitThresholdLimit ? threshold : JitThresholdLimit;
+}
+
+enum {
+  // `bench` keeps at most this many times, as a uniform sample of them all.
+  BenchSampleLimit = 4096,
+};
+
+static FeDouble GetMonotonicNanoseconds(void) {
+  struct timespec t;
+  (void)clock_gettime(CLOCK_MONOTONIC, &t);
+  return (FeDouble)t.tv_sec * 1e9 + (FeDouble)t.tv_nsec;
+}
+
+static int CompareDoubles(const void* a, const void* b) {
+  const FeDouble x = *(const FeDouble*)a;
+  const FeDouble y = *(const FeDouble*)b;
+  return (x > y) - (x < y);
+}
+
+// `(bench count expression)` evaluates `expression` `count / 10 + 1` times to
+// warm up, and then `count` times more, timing each with the monotonic clock.
+// It returns the minimum, median, and 99th percentile times in nanoseconds,
+// and the counts of objects made and collections run during the timed runs.
+static FeObject* Bench(FeContext* ctx, FeObject* arg, FeObject* env) {
+  const FeDouble n = FeToDouble(ctx, EVAL_ARG());
+  if (!(n >= 1)) {
+    FeHandleError(ctx, "count must be at least 1");
+  }
+  const size_t count = (size_t)n;
+  FeObject* expression = FeGetNextArgument(ctx, &arg);
+  const size_t gc = FeSaveGC(ctx);
+  for (size_t i = 0; i < count / 10 + 1; i++) {
+    (void)Evaluate(ctx, expression, env, NULL);
+    FeRestoreGC(ctx, gc);
+  }
+
+  FeDouble samples[BenchSampleLimit];
+  size_t sample_count = 0;
+  FeDouble min = INFINITY;
+  uint64_t random = 0x9E3779B97F4A7C15u;
+  const size_t allocations = ctx->allocation_count;
+  const size_t collections = ctx->collection_count;
+  for (size_t i = 0; i < count; i++) {
+    const FeDouble start = GetMonotonicNanoseconds();
+    (void)Evaluate(ctx, expression, env, NULL);
+    const FeDouble time = GetMonotonicNanoseconds() - start;
+    FeRestoreGC(ctx, gc);
+    min = fmin(min, time);
+    if (sample_count < BenchSampleLimit) {
+      samples[sample_count++] = time;
+    } else {
+      // Reservoir sampling, with an xorshift generator:
+      random ^= random << 13;
+      random ^= random >> 7;
+      random ^= random << 17;
+      const uint64_t j = random % (i + 1);
+      if (j < BenchSampleLimit) {
+        samples[j] = time;
+      }
+    }
+  }
+  const FeDouble allocated = (FeDouble)(ctx->allocation_count - allocations);
+  const FeDouble collected = (FeDouble)(ctx->collection_count - collections);
+
+  qsort(samples, sample_count, sizeof(samples[0]), CompareDoubles);
+  const size_t middle = sample_count / 2;
+  const FeDouble median = sample_count % 2 == 1
+                              ? samples[middle]
+                              : (samples[middle - 1] + samples[middle]) / 2;
+  const FeDouble rank = ceil(0.99 * (FeDouble)sample_count);
+  const FeDouble p99 = samples[(size_t)rank - 1];
+  return FeMakeList(
+      ctx,
+      (FeObject*[]){FeMakeDouble(ctx, min), FeMakeDouble(ctx, median),
+                    FeMakeDouble(ctx, p99), FeMakeDouble(ctx, allocated),
+                    FeMakeDouble(ctx, collected)},
+      5);
+}
+
+static FeObject* EvaluatePrimitive(FeContext* ctx,
+                                   FeObject* obj,
+                                   FeObject* env,
+                                   FeObject** newenv,
+                                   FeObject* fn) {
+  FeObject* res = &nil;
+  FeObject* arg = CDR(obj);
+  FeObject* va;
+  switch (GetPrimitive(fn)) {
+    case PAssert:
+      va = EVAL_ARG();
+      if (FeIsNil(va)) {
+        FeHandleError(ctx, "assertion failure");
+      }
+      return res;
+    case PEnv:
       return ctx->symbol_list;
     case PLet:
       va = CheckType(ctx, FeGetNextArgument(ctx, &arg), FeTSymbol);
@@ -858,6 +2359,7 @@ static FeObject* EvaluatePrimitive(FeContext* ctx,
       FeGetNextArgument(ctx, &arg);
       res = MakeObject(ctx);
       SetType(res, GetPrimitive(fn) == PFn ? FeTFn : FeTMacro);
+      ResetJitState(res);
       CDR(res) = va;
       return res;
     case PWhile: {
@@ -869,6 +2371,8 @@ static FeObject* EvaluatePrimitive(FeContext* ctx,
       }
       return res;
     }
+    case PBench:
+      return Bench(ctx, arg, env);
     case PQuote:
       return FeGetNextArgument(ctx, &arg);
     case PAnd:
@@ -907,12 +2411,12 @@ static FeObject* EvaluatePrimitive(FeContext* ctx,
       return FeMakeBool(ctx, FeGetType(EVAL_ARG()) != FeTPair);
     case PPrint:
       while (!FeIsNil(arg)) {
-        FeWriteFile(ctx, EVAL_ARG(), stdout);
+        FeWriteFile(ctx, EVAL_ARG(), ctx->streams.output);
         if (!FeIsNil(arg)) {
-          printf(" ");
+          fputc(' ', ctx->streams.output);
         }
       }
-      printf("\n");
+      fputc('\n', ctx->streams.output);
       return res;
     case PLess:
       NUM_CMP_OP(<)
@@ -921,17 +2425,10 @@ static FeObject* EvaluatePrimitive(FeContext* ctx,
       NUM_CMP_OP(<=)
       return res;
     case PAdd:
-      ARITH_OP(+)
-      return res;
     case PSub:
-      ARITH_OP(-)
-      return res;
     case PMul:
-      ARITH_OP(*)
-      return res;
     case PDiv:
-      ARITH_OP(/)
-      return res;
+      return FeMakeDouble(ctx, Arithmetic(ctx, GetPrimitive(fn), arg, env));
   }
   abort();
 }
@@ -968,8 +2465,34 @@ static FeObject* Evaluate(FeContext* ctx,
       res = GetNativeFn(fn)(ctx, EvaluateList(ctx, arg, env));
       break;
 
+    case FeTNativeArrayFn: {
+      const size_t argc = EvaluateArguments(ctx, arg, env);
+      res = CallNativeArrayFn(ctx, fn, argc,
+                              &ctx->gc_stack[ctx->gc_stack_index - argc]);
+      break;
+    }
+
+    case FeTDoubleFn:
+      res = FeMakeDouble(ctx, CallDoubleFn(ctx, obj, fn, env));
+      break;
+
     case FeTFn:
-      arg = EvaluateList(ctx, arg, env);
+      if (ctx->jit_threshold == 0) {
+        arg = EvaluateList(ctx, arg, env);
+      } else {
+        // The arguments are evaluated first, since that may compile (and so
+        // move) other functions' `Compiled`s.
+        const size_t argc = EvaluateArguments(ctx, arg, env);
+        FeObject** argv = &ctx->gc_stack[ctx->gc_stack_index - argc];
+        const Compiled* compiled = GetCompiled(ctx, fn);
+        FeDouble d;
+        if (compiled != NULL &&
+            CallCompiled(ctx, compiled, argc, argv, NULL, &d)) {
+          res = FeMakeDouble(ctx, d);
+          break;
+        }
+        arg = FeMakeList(ctx, argv, argc);
+      }
       va = CDR(fn);  // (env params ...)
       vb = CDR(va);  // (params ...)
       res = DoList(ctx, CDR(vb), ArgsToEnv(ctx, CAR(vb), arg, CAR(va)));
@@ -994,6 +2517,11 @@ static FeObject* Evaluate(FeContext* ctx,
     case FeTFex0:
     case FeTFex1:
     case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
       FeHandleError(ctx, "tried to call non-callable value");
 
     case FeTSentinel:
@@ -1010,6 +2538,220 @@ FeObject* FeEvaluate(FeContext* ctx, FeObject* obj) {
   return Evaluate(ctx, obj, &nil, NULL);
 }
 
+FeObject* FePrepareCall(FeContext* ctx, FeObject* fn) {
+  if (FeGetType(fn) == FeTSymbol) {
+    fn = CDR(GetBound(fn, &nil));
+  }
+  switch (FeGetType(fn)) {
+    case FeTFn:
+    case FeTPrimitive:
+    case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
+      break;
+    case FeTPair:
+    case FeTFree:
+    case FeTNil:
+    case FeTDouble:
+    case FeTSymbol:
+    case FeTString:
+    case FeTMacro:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+      FeHandleError(ctx, "tried to prepare non-callable value");
+    case FeTSentinel:
+      abort();
+  }
+  FePin(ctx, fn);
+  return fn;
+}
+
+void FeReleaseCall(FeContext* ctx, FeObject* fn) {
+  FeUnpin(ctx, fn);
+}
+
+void FePin(FeContext* ctx, FeObject* obj) {
+  // As in `FeMakePtr`, read the list only after allocating.
+  FeObject* pin = FeCons(ctx, obj, &nil);
+  ctx->gc_stack_index--;
+  CDR(pin) = ctx->pinned;
+  ctx->pinned = pin;
+}
+
+void FeUnpin(FeContext* ctx, FeObject* obj) {
+  for (FeObject** link = &ctx->pinned; !FeIsNil(*link); link = &CDR(*link)) {
+    if (CAR(*link) == obj) {
+      *link = CDR(*link);
+      return;
+    }
+  }
+}
+
+static FeDouble CallDoubleFnWith(FeContext* ctx,
+                                 FeObject* fn,
+                                 size_t argc,
+                                 FeDouble x,
+                                 FeDouble y) {
+  if (argc < MIN_ARGC(fn)) {
+    FeHandleError(ctx, "too few arguments");
+  }
+  return MIN_ARGC(fn) == 1 ? fn->cdr.d1(x) : fn->cdr.d2(x, y);
+}
+
+// The arguments of an `FeInvoke*` call: either objects or unboxed doubles.
+typedef struct Arguments {
+  size_t count;
+  FeObject** objects;
+  const FeDouble* doubles;
+} Arguments;
+
+static FeObject* GetArgument(FeContext* ctx, const Arguments* args, size_t i) {
+  if (i >= args->count) {
+    return &nil;
+  }
+  return args->objects ? args->objects[i] : FeMakeDouble(ctx, args->doubles[i]);
+}
+
+static FeObject* ListArguments(FeContext* ctx,
+                               const Arguments* args,
+                               size_t begin,
+                               bool quote) {
+  FeObject* res = &nil;
+  FeObject** tail = &res;
+  for (size_t i = begin; i < args->count; i++) {
+    FeObject* arg = GetArgument(ctx, args, i);
+    if (quote) {
+      arg = FeCons(ctx, FeMakeSymbol(ctx, "quote"), FeCons(ctx, arg, &nil));
+    }
+    *tail = FeCons(ctx, arg, &nil);
+    tail = &CDR(*tail);
+  }
+  return res;
+}
+
+// Like the `FeTFn` case of `Evaluate`, but binds the parameters to the
+// arguments directly rather than to an evaluated argument list.
+static FeObject* Invoke(FeContext* ctx, FeObject* fn, const Arguments* args) {
+  FeObject cl;
+  CAR(&cl) = fn;
+  CDR(&cl) = ctx->call_list;
+  ctx->call_list = &cl;
+
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* res = &nil;
+  switch (FeGetType(fn)) {
+    case FeTFn: {
+      const Compiled* compiled = GetCompiled(ctx, fn);
+      FeDouble d;
+      if (compiled != NULL && CallCompiled(ctx, compiled, args->count,
+                                           args->objects, args->doubles, &d)) {
+        res = FeMakeDouble(ctx, d);
+        break;
+      }
+      FeObject* va = CDR(fn);  // (env params ...)
+      FeObject* vb = CDR(va);  // (params ...)
+      FeObject* env = CAR(va);
+      size_t i = 0;
+      for (FeObject* prm = CAR(vb); !FeIsNil(prm); prm = CDR(prm), i++) {
+        if (FeGetType(prm) != FeTPair) {
+          env = FeCons(
+              ctx, FeCons(ctx, prm, ListArguments(ctx, args, i, false)), env);
+          break;
+        }
+        env =
+            FeCons(ctx, FeCons(ctx, CAR(prm), GetArgument(ctx, args, i)), env);
+      }
+      res = DoList(ctx, CDR(vb), env);
+      break;
+    }
+
+    case FeTNativeFn:
+      res = GetNativeFn(fn)(ctx, ListArguments(ctx, args, 0, false));
+      break;
+
+    case FeTDoubleFn: {
+      FeDouble xy[2] = {0, 0};
+      for (size_t i = 0; i < args->count && i < MIN_ARGC(fn); i++) {
+        xy[i] = FeToDouble(ctx, GetArgument(ctx, args, i));
+      }
+      res = FeMakeDouble(ctx,
+                         CallDoubleFnWith(ctx, fn, args->count, xy[0], xy[1]));
+      break;
+    }
+
+    case FeTNativeArrayFn:
+      if (args->objects) {
+        res = CallNativeArrayFn(ctx, fn, args->count, args->objects);
+      } else {
+        // Each `FeMakeDouble` pushes its result onto the GC stack, so the
+        // boxed arguments end up in a row there.
+        for (size_t i = 0; i < args->count; i++) {
+          FeMakeDouble(ctx, args->doubles[i]);
+        }
+        res = CallNativeArrayFn(ctx, fn, args->count, &ctx->gc_stack[gc]);
+      }
+      break;
+
+    case FeTPrimitive:
+      // Primitives evaluate their own argument forms.
+      res = Evaluate(ctx, FeCons(ctx, fn, ListArguments(ctx, args, 0, true)),
+                     &nil, NULL);
+      break;
+
+    case FeTPair:
+    case FeTFree:
+    case FeTNil:
+    case FeTDouble:
+    case FeTSymbol:
+    case FeTString:
+    case FeTMacro:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+      FeHandleError(ctx, "tried to call non-callable value");
+
+    case FeTSentinel:
+      abort();
+  }
+
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, res);
+  ctx->call_list = CDR(&cl);
+  return res;
+}
+
+FeObject* FeInvoke(FeContext* ctx, FeObject* fn, size_t argc, FeObject** argv) {
+  return Invoke(ctx, fn, &(Arguments){.count = argc, .objects = argv});
+}
+
+FeDouble FeInvokeDoubles(FeContext* ctx,
+                         FeObject* fn,
+                         size_t argc,
+                         const FeDouble* argv) {
+  if (FeGetType(fn) == FeTDoubleFn) {
+    return CallDoubleFnWith(ctx, fn, argc, argc > 0 ? argv[0] : 0,
+                            argc > 1 ? argv[1] : 0);
+  }
+  const size_t gc = FeSaveGC(ctx);
+  const FeDouble res = FeToDouble(
+      ctx, Invoke(ctx, fn, &(Arguments){.count = argc, .doubles = argv}));
+  FeRestoreGC(ctx, gc);
+  return res;
+}
+
 FeContext* FeOpenContext(void* arena, size_t size) {
   if (size < sizeof(FeContext)) {
     fprintf(stderr, "arena size (%zu) < minimum context size (%zu); exiting\n",
@@ -1027,10 +2769,19 @@ FeContext* FeOpenContext(void* arena, size_t size) {
   ctx->objects = (FeObject*)arena;
   ctx->object_count = size / sizeof(FeObject);
 
+  // Initialize the per-context state:
+  ctx->streams = (FeStreams){.input = stdin, .output = stdout, .error = stderr};
+  ctx->gc_thread_count = 1;
+  ctx->gc_stack = ctx->gc_stack_storage;
+  ctx->gc_stack_size = GcStackSize;
+  memcpy(ctx->type_names, type_names, sizeof(type_names));
+
   // Initialize the lists:
   ctx->call_list = &nil;
   ctx->free_list = &nil;
   ctx->symbol_list = &nil;
+  ctx->finalizable = &nil;
+  ctx->pinned = &nil;
 
   // Populate the free_list:
   for (size_t i = 0; i < ctx->object_count; i++) {
@@ -1056,9 +2807,29 @@ FeContext* FeOpenContext(void* arena, size_t size) {
   return ctx;
 }
 
+size_t FeGetArenaSize(FeContext* ctx) {
+  return sizeof(FeContext) + ctx->object_count * sizeof(FeObject);
+}
+
 void FeCloseContext(FeContext* ctx) {
-  // Clear the GC stack and symbol list: this makes all objects unreachable:
+  // Clear the GC stacks and symbol list: this makes all objects unreachable:
+  ctx->gc_stack = ctx->gc_stack_storage;
+  ctx->gc_stack_size = GcStackSize;
   ctx->gc_stack_index = 0;
+  ctx->saved_stacks = NULL;
   ctx->symbol_list = &nil;
+  ctx->pinned = &nil;
   CollectGarbage(ctx);
+  for (size_t i = 0; i < FeTSentinel; i++) {
+    const FeTypeHooks* hooks = &ctx->type_hooks[i];
+    if (hooks->close != NULL) {
+      hooks->close(ctx, hooks->data);
+    }
+  }
+  for (size_t i = 0; i < ctx->compiled_count; i++) {
+    ReleaseCompiled(&ctx->compiled[i]);
+  }
+  free(ctx->compiled);
+  ctx->compiled = NULL;
+  ctx->compiled_count = 0;
 }
@@ -16,6 +16,15 @@ typedef double FeDouble;
 typedef struct FeObject FeObject;
 typedef struct FeContext FeContext;
 typedef FeObject* FeNativeFn(FeContext* ctx, FeObject* args);
+// A native function that receives its evaluated arguments as an array. `argv`
+// is valid, and its objects reachable, only until the function returns.
+typedef FeObject* FeNativeArrayFn(FeContext* ctx, size_t argc, FeObject** argv);
+// Pure numeric functions: the result depends only on the arguments, and there
+// are no side effects. Fe calls them with unboxed arguments, boxes the result
+// only when it escapes into an object, and `fe -c` calls them at compile time
+// for constant arguments, replacing the call with its result.
+typedef FeDouble FeUnaryDoubleFn(FeDouble x);
+typedef FeDouble FeBinaryDoubleFn(FeDouble x, FeDouble y);
 typedef void FeErrorFn(FeContext* ctx, const char* err, FeObject* cl);
 typedef void FeWriteFn(FeContext* ctx, void* udata, char chr);
 typedef char FeReadFn(FeContext* ctx, void* udata);
@@ -26,6 +35,40 @@ typedef struct FeHandlers {
   FeNativeFn* gc;
 } FeHandlers;
 
+typedef void FeMarkFn(FeContext* ctx, FeObject* obj);
+typedef void FeFinalizeFn(FeContext* ctx, FeObject* obj);
+typedef void FeWriteTypeFn(FeContext* ctx,
+                           FeObject* obj,
+                           FeWriteFn fn,
+                           void* udata);
+typedef void FeCloseTypeFn(FeContext* ctx, void* data);
+
+// Per-type behavior for `FePtr` and `FeTFex*` objects. `mark` is called when
+// an object of the type is reached during collection. `finalize` is called
+// once, when an object of the type becomes unreachable; the GC tracks only
+// the objects of types that have one, so the sweep does not visit the rest of
+// the arena on their behalf. `write`, if set, replaces the default `[name]`
+// form in `FeWrite`. `data` is state that the objects of the type share within
+// a context, which `FeGetTypeData` returns; `close` is called with it by
+// `FeCloseContext`, after the last objects have been finalized. Any hook may be
+// `NULL`.
+typedef struct FeTypeHooks {
+  FeMarkFn* mark;
+  FeFinalizeFn* finalize;
+  FeWriteTypeFn* write;
+  FeCloseTypeFn* close;
+  void* data;
+} FeTypeHooks;
+
+// The standard streams of a context. `print` writes to `output`, and the
+// default error handler writes to `error`. They default to `stdin`, `stdout`,
+// and `stderr`.
+typedef struct FeStreams {
+  FILE* input;
+  FILE* output;
+  FILE* error;
+} FeStreams;
+
 typedef enum FeType {
   FeTPair,
   FeTFree,
@@ -37,6 +80,8 @@ typedef enum FeType {
   FeTMacro,
   FeTPrimitive,
   FeTNativeFn,
+  FeTNativeArrayFn,
+  FeTDoubleFn,
   FeTPtr,
 
   // This is a disgusting/hilarious way to extend `FeType` in the Fex API: When
@@ -51,11 +96,16 @@ typedef enum FeType {
   FeTFex0,
   FeTFex1,
   FeTFex2,
+  FeTFex3,
+  FeTFex4,
+  FeTFex5,
+  FeTFex6,
+  FeTFex7,
   // Add more as needed:
   //   * add them here
   //   * add cases for them in all relevant `switch`/`case` statements
   //   * add a slot and default name for them in `type_names`
-  //   * assign your name for them in `FexInstallNativeFn`
+  //   * assign your name for them with `FeSetTypeName` in `FexInit`
   // TODO: Try to find a way to do this with less toil.
 
   FeTSentinel,
@@ -63,34 +113,105 @@ typedef enum FeType {
 
 static_assert(FeTFex0 > FeTPtr, "FeTFex* must be > FeTPtr");
 
-extern const char* type_names[];
-
 extern FeObject nil;
 
+// All interpreter state lives in the `FeContext` and its arena, and the shared
+// `nil` is never written to. Therefore, distinct contexts may be used
+// concurrently from different threads. A single context must be used by only
+// one thread at a time.
 FeContext* FeOpenContext(void* ptr, size_t size);
 void FeCloseContext(FeContext* ctx);
+size_t FeGetArenaSize(FeContext* ctx);
 FeHandlers* FeGetHandlers(FeContext* ctx);
+FeStreams* FeGetStreams(FeContext* ctx);
 void FeHandleError(FeContext* ctx, const char* msg);
 
 FeType FeGetType(FeObject* obj);
+const char* FeGetTypeName(FeContext* ctx, FeType type);
+void FeSetTypeName(FeContext* ctx, FeType type, const char* name);
+// Hooks apply to the objects made after the call, so set them before making any
+// objects of `type`.
+void FeSetTypeHooks(FeContext* ctx, FeType type, const FeTypeHooks* hooks);
+void* FeGetTypeData(FeContext* ctx, FeType type);
 bool FeIsNil(FeObject* obj);
+// Returns whether `a` and `b` are equal in the sense of `is`: the same object,
+// or numbers or strings with the same value.
+bool FeIsEqual(FeObject* a, FeObject* b);
 
 void FePushGC(FeContext* ctx, FeObject* obj);
 void FeRestoreGC(FeContext* ctx, size_t idx);
 size_t FeSaveGC(FeContext* ctx);
 void FeMark(FeContext* ctx, FeObject* obj);
 
+// The evaluation state of a computation running on its own C stack, such as a
+// coroutine: a GC stack of `size` entries, `index` of them in use, and the call
+// list that error handlers receive. `next` is for the context's use.
+typedef struct FeStack {
+  FeObject** objects;
+  size_t size;
+  size_t index;
+  FeObject* call_list;
+  struct FeStack* next;
+} FeStack;
+
+// Makes `stack` the context's GC stack and call list, saving the current ones
+// in `saved`, whose objects stay GC roots until the matching `FeLeaveStack`.
+// Calls nest: leave the most recently entered stack first.
+void FeEnterStack(FeContext* ctx, FeStack* saved, const FeStack* stack);
+// Saves the context's GC stack and call list in `stack`, and restores those
+// that `FeEnterStack` saved in `saved`. The caller must keep the objects of a
+// stack it leaves reachable, such as from a `mark` type hook.
+void FeLeaveStack(FeContext* ctx, FeStack* stack, FeStack* saved);
+
+// Collects garbage with up to `count` threads (including the calling thread)
+// when the arena is large. Then, the `mark` and `gc` handlers and the `mark`
+// type hooks may be called from the helper threads, though never concurrently.
+void FeSetGCThreads(FeContext* ctx, size_t count);
+// Compiles each `FeTFn` to machine code once it has been called `threshold`
+// times (at most 65535), if its body uses only numbers; see the language
+// documentation. 0, the default, disables compilation.
+void FeSetJITThreshold(FeContext* ctx, size_t threshold);
+
 FeObject* FeCons(FeContext* ctx, FeObject* car, FeObject* cdr);
 FeObject* FeMakeBool(FeContext* ctx, bool b);
 FeObject* FeMakeDouble(FeContext* ctx, FeDouble n);
 FeObject* FeMakeString(FeContext* ctx, const char* str);
+// Appends up to `size` bytes of `str`, stopping at any NUL, to a string, and
+// returns its new last chunk. `tail` must be the last chunk of the string: a
+// string from `FeMakeString("")`, or the result of an earlier append. Only the
+// first chunk of the string needs to be kept reachable from the GC stack.
+FeObject* FeAppendString(FeContext* ctx,
+                         FeObject* tail,
+                         const char* str,
+                         size_t size);
+// Strings are stored in chunks. Sets `*chunk` to the bytes of the first chunk
+// of `*str`, which are not NUL-terminated, returns their count, and advances
+// `*str` to the rest of the string, which is `nil` after the last chunk.
+size_t FeGetStringChunk(FeContext* ctx, FeObject** str, const char** chunk);
 FeObject* FeMakeSymbol(FeContext* ctx, const char* name);
 FeObject* FeMakeNativeFn(FeContext* ctx, FeNativeFn fn);
+// Calls to the result with fewer than `min_argc` (at most 255) arguments are
+// errors, so `fn` need not check for them.
+FeObject* FeMakeNativeArrayFn(FeContext* ctx,
+                              FeNativeArrayFn fn,
+                              size_t min_argc);
+FeObject* FeMakeUnaryDoubleFn(FeContext* ctx, FeUnaryDoubleFn fn);
+FeObject* FeMakeBinaryDoubleFn(FeContext* ctx, FeBinaryDoubleFn fn);
 FeObject* FeMakePtr(FeContext* ctx, FeType type, void* ptr);
 FeObject* FeMakeList(FeContext* ctx, FeObject** objs, size_t n);
 
+// Returns a deep copy, in `ctx`, of `obj`, which may belong to another context.
+// That context must not be in use by another thread during the copy. Handles
+// numbers, strings, symbols (by name), lists, and functions (including their
+// closures, and the global values they refer to that are unbound in `ctx`).
+// Shared structure is copied once per reference, and cyclic lists and `FePtr`s
+// are rejected with an error.
+FeObject* FeCopy(FeContext* ctx, FeObject* obj);
+
 FeObject* FeCar(FeContext* ctx, FeObject* obj);
 FeObject* FeCdr(FeContext* ctx, FeObject* obj);
+void FeSetCar(FeContext* ctx, FeObject* pair, FeObject* v);
+void FeSetCdr(FeContext* ctx, FeObject* pair, FeObject* v);
 
 void FeWrite(FeContext* ctx, FeObject* obj, FeWriteFn fn, void* udata, int qt);
 void FeWriteFile(FeContext* ctx, FeObject* obj, FILE* fp);
@@ -99,11 +220,35 @@ FeObject* FeRead(FeContext* ctx, FeReadFn fn, void* udata);
 FeObject* FeReadFile(FeContext* ctx, FILE* fp);
 
 size_t FeToString(FeContext* ctx, FeObject* obj, char* dst, size_t size);
+// Compares the strings `a` and `b` bytewise, returning a value less than, equal
+// to, or greater than 0, like `strcmp`.
+int FeCompareStrings(FeContext* ctx, FeObject* a, FeObject* b);
 FeDouble FeToDouble(FeContext* ctx, FeObject* obj);
 void* FeToPtr(FeContext* ctx, FeObject* obj);
+void FeSetPtr(FeContext* ctx, FeObject* obj, void* ptr);
 void FeSet(FeContext* ctx, FeObject* sym, FeObject* v);
 
 FeObject* FeGetNextArgument(FeContext* ctx, FeObject** arg);
 FeObject* FeEvaluate(FeContext* ctx, FeObject* obj);
 
+// Resolves `fn` (a callable, or a symbol whose global value is one) once, for
+// calling from C with `FeInvoke*`, and keeps it alive until `FeReleaseCall`.
+// Redefining the symbol later does not change the prepared callable.
+FeObject* FePrepareCall(FeContext* ctx, FeObject* fn);
+void FeReleaseCall(FeContext* ctx, FeObject* fn);
+// Keeps `obj` alive, as a GC root, until `FeUnpin`. An object pinned more than
+// once stays pinned until it is unpinned as many times.
+void FePin(FeContext* ctx, FeObject* obj);
+void FeUnpin(FeContext* ctx, FeObject* obj);
+// Calls a prepared `fn` with `argv`, binding its parameters directly rather
+// than building and evaluating a call form. Like `FeEvaluate`, it leaves only
+// its result on the GC stack.
+FeObject* FeInvoke(FeContext* ctx, FeObject* fn, size_t argc, FeObject** argv);
+// Like `FeInvoke`, but boxes each of `argv` only as the parameter is bound, and
+// returns the numeric result unboxed, leaving the GC stack as it found it.
+FeDouble FeInvokeDoubles(FeContext* ctx,
+                         FeObject* fn,
+                         size_t argc,
+                         const FeDouble* argv);
+
 #endif
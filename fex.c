@@ -1,50 +1,106 @@
 // Copyright 2024 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: MIT
 
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "fex.h"
+#include "fex_bytes.h"
+#include "fex_csv.h"
+#include "fex_event.h"
+#include "fex_generator.h"
+#include "fex_io.h"
 #include "fex_re.h"
 
 const char* FexVersion = "0.1";
 
-static FeObject* FexGC(FeContext* ctx, FeObject* o) {
-  switch (FeGetType(o)) {
-    case FeTPair:
-    case FeTFree:
-    case FeTNil:
-    case FeTDouble:
-    case FeTSymbol:
-    case FeTString:
-    case FeTFn:
-    case FeTMacro:
-    case FeTPrimitive:
-    case FeTNativeFn:
-    case FeTPtr:
-    case FexTFile:
-    case FeTFex2:
-      return &nil;
-    case FexTRE:
-      return FexGCRE(ctx, o);
-    case FeTSentinel:
-      abort();
-  }
-}
-
 void FexInit(FeContext* ctx) {
-  type_names[FexTFile] = "file";
-  type_names[FexTRE] = "regular-expression";
-  FeGetHandlers(ctx)->gc = FexGC;
+  FeSetTypeName(ctx, FexTBytes, "bytes");
+  FeSetTypeHooks(ctx, FexTBytes,
+                 &(FeTypeHooks){.mark = FexMarkBytes,
+                                .finalize = FexFinalizeBytes,
+                                .write = FexWriteBytes});
+  FeSetTypeName(ctx, FexTFile, "file");
+  FeSetTypeHooks(ctx, FexTFile, &(FeTypeHooks){.finalize = FexFinalizeFile});
+  FeSetTypeName(ctx, FexTRE, "regular-expression");
+  FeSetTypeHooks(ctx, FexTRE,
+                 &(FeTypeHooks){.finalize = FexFinalizeRE,
+                                .close = FexCloseRECache,
+                                .data = FexOpenRECache()});
+  FeSetTypeName(ctx, FexTCSVReader, "csv-reader");
+  FeSetTypeHooks(ctx, FexTCSVReader,
+                 &(FeTypeHooks){.mark = FexMarkCSVReader,
+                                .finalize = FexFinalizeCSVReader});
+  FeSetTypeName(ctx, FexTStream, "stream");
+  FeSetTypeHooks(ctx, FexTStream,
+                 &(FeTypeHooks){.mark = FexMarkStream,
+                                .finalize = FexFinalizeStream,
+                                .close = FexCloseEventLoop,
+                                .data = FexOpenEventLoop()});
+  FeSetTypeName(ctx, FexTGenerator, "generator");
+  FeSetTypeHooks(ctx, FexTGenerator,
+                 &(FeTypeHooks){.mark = FexMarkGenerator,
+                                .finalize = FexFinalizeGenerator,
+                                .close = FexCloseGenerators,
+                                .data = FexOpenGenerators()});
+  FeSetTypeName(ctx, FexTReader, "reader");
+  FeSetTypeHooks(
+      ctx, FexTReader,
+      &(FeTypeHooks){.mark = FexMarkReader, .finalize = FexFinalizeReader});
 }
 
 FeObject* BuildErrnoError(FeContext* ctx, int error) {
+  // `strerror` may use a static buffer; `strerror_r` is safe to call from
+  // concurrently running contexts.
+  char message[256];
+  if (strerror_r(error, message, sizeof(message)) != 0) {
+    message[0] = '\0';
+  }
   return FeMakeList(ctx,
                     (FeObject*[]){FeMakeDouble(ctx, (double)error),
-                                  FeMakeString(ctx, strerror(error))},
+                                  FeMakeString(ctx, message)},
                     2);
 }
 
+void FexHandleErrnoError(FeContext* ctx, int error) {
+  char message[256];
+  if (strerror_r(error, message, sizeof(message)) != 0) {
+    snprintf(message, sizeof(message), "error %d", error);
+  }
+  FeHandleError(ctx, message);
+}
+
 void FexInstallNativeFn(FeContext* ctx, const char* name, FeNativeFn fn) {
+  // The symbol table keeps the function alive, so it need not stay on the GC
+  // stack.
+  const size_t gc = FeSaveGC(ctx);
   FeSet(ctx, FeMakeSymbol(ctx, name), FeMakeNativeFn(ctx, fn));
+  FeRestoreGC(ctx, gc);
+}
+
+void FexInstallNativeArrayFn(FeContext* ctx,
+                             const char* name,
+                             FeNativeArrayFn fn,
+                             size_t min_argc) {
+  const size_t gc = FeSaveGC(ctx);
+  FeSet(ctx, FeMakeSymbol(ctx, name), FeMakeNativeArrayFn(ctx, fn, min_argc));
+  FeRestoreGC(ctx, gc);
+}
+
+void FexInstallUnaryDoubleFn(FeContext* ctx,
+                             const char* name,
+                             FeUnaryDoubleFn fn) {
+  const size_t gc = FeSaveGC(ctx);
+  FeSet(ctx, FeMakeSymbol(ctx, name), FeMakeUnaryDoubleFn(ctx, fn));
+  FeRestoreGC(ctx, gc);
+}
+
+void FexInstallBinaryDoubleFn(FeContext* ctx,
+                              const char* name,
+                              FeBinaryDoubleFn fn) {
+  const size_t gc = FeSaveGC(ctx);
+  FeSet(ctx, FeMakeSymbol(ctx, name), FeMakeBinaryDoubleFn(ctx, fn));
+  FeRestoreGC(ctx, gc);
 }
@@ -11,10 +11,27 @@ extern const char* FexVersion;
 enum {
   FexTFile = FeTFex0,
   FexTRE = FeTFex1,
+  FexTCSVReader = FeTFex2,
+  FexTReader = FeTFex3,
+  FexTBytes = FeTFex4,
+  FexTStream = FeTFex5,
+  FexTGenerator = FeTFex6,
 };
 
 void FexInit(FeContext* ctx);
 FeObject* BuildErrnoError(FeContext* ctx, int error);
+// Raises an error with the message for the `errno` value `error`.
+void FexHandleErrnoError(FeContext* ctx, int error);
 void FexInstallNativeFn(FeContext* ctx, const char* name, FeNativeFn fn);
+void FexInstallNativeArrayFn(FeContext* ctx,
+                             const char* name,
+                             FeNativeArrayFn fn,
+                             size_t min_argc);
+void FexInstallUnaryDoubleFn(FeContext* ctx,
+                             const char* name,
+                             FeUnaryDoubleFn fn);
+void FexInstallBinaryDoubleFn(FeContext* ctx,
+                              const char* name,
+                              FeBinaryDoubleFn fn);
 
 #endif
@@ -0,0 +1,223 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fex.h"
+#include "fex_bytes.h"
+
+// A bytes object is a read-only range of memory outside the arena: either a
+// whole mapped file, a buffer allocated along with it, or a view of part of
+// one of those. A view keeps its mapping alive, and the mapping is unmapped
+// when it and all its views are unreachable.
+typedef struct Bytes {
+  // The mapping that a view belongs to, or `NULL` for a mapping or a buffer.
+  FeObject* mapping;
+  const char* data;
+  size_t size;
+  // A buffer's data.
+  _Alignas(max_align_t) char buffer[];
+} Bytes;
+
+void FexInstallBytes(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "bytes->string", FexBytesToString, 1);
+  FexInstallNativeArrayFn(ctx, "bytes-advise", FexBytesAdvise, 2);
+  FexInstallNativeArrayFn(ctx, "bytes-length", FexBytesLength, 1);
+  FexInstallNativeArrayFn(ctx, "bytes-slice", FexBytesSlice, 2);
+  FexInstallNativeArrayFn(ctx, "map-file", FexMapFile, 1);
+}
+
+void FexMarkBytes(FeContext* ctx, FeObject* o) {
+  Bytes* b = FeToPtr(ctx, o);
+  if (b->mapping != NULL) {
+    FeMark(ctx, b->mapping);
+  }
+}
+
+void FexFinalizeBytes(FeContext* ctx, FeObject* o) {
+  Bytes* b = FeToPtr(ctx, o);
+  if (b->mapping == NULL && b->data != b->buffer && b->size > 0) {
+    (void)munmap((void*)(uintptr_t)b->data, b->size);
+  }
+  free(b);
+}
+
+void FexWriteBytes(FeContext* ctx, FeObject* o, FeWriteFn fn, void* udata) {
+  Bytes* b = FeToPtr(ctx, o);
+  for (size_t i = 0; i < b->size; i++) {
+    fn(ctx, udata, b->data[i]);
+  }
+}
+
+bool FexGetBytes(FeContext* ctx, FeObject* o, const char** data, size_t* size) {
+  if (FeGetType(o) != FexTBytes) {
+    return false;
+  }
+  Bytes* b = FeToPtr(ctx, o);
+  *data = b->data;
+  *size = b->size;
+  return true;
+}
+
+static Bytes* GetBytes(FeContext* ctx, FeObject* o) {
+  if (FeGetType(o) != FexTBytes) {
+    FeHandleError(ctx, "not bytes");
+  }
+  return FeToPtr(ctx, o);
+}
+
+static FeObject* MakeBytes(FeContext* ctx,
+                           FeObject* mapping,
+                           const char* data,
+                           size_t size) {
+  Bytes* b = malloc(sizeof(Bytes));
+  if (b == NULL) {
+    FeHandleError(ctx, "out of memory");
+  }
+  *b = (Bytes){.mapping = mapping, .data = data, .size = size};
+  return FeMakePtr(ctx, FexTBytes, b);
+}
+
+FeObject* FexMakeBytesView(FeContext* ctx,
+                           FeObject* o,
+                           size_t start,
+                           size_t end) {
+  Bytes* b = GetBytes(ctx, o);
+  if (end > b->size) {
+    end = b->size;
+  }
+  if (start > end) {
+    start = end;
+  }
+  return MakeBytes(ctx, b->mapping != NULL ? b->mapping : o, b->data + start,
+                   end - start);
+}
+
+FeObject* FexMakeBytesBuffer(FeContext* ctx, size_t size, char** data) {
+  if (size > SIZE_MAX - sizeof(Bytes)) {
+    FeHandleError(ctx, "out of memory");
+  }
+  Bytes* b = malloc(sizeof(Bytes) + size);
+  if (b == NULL) {
+    FeHandleError(ctx, "out of memory");
+  }
+  *b = (Bytes){.data = b->buffer, .size = size};
+  *data = b->buffer;
+  return FeMakePtr(ctx, FexTBytes, b);
+}
+
+// Returns the offset `n` into `b`, where negative offsets count back from the
+// end, clamped to `[0, b->size]`.
+static size_t GetOffset(FeContext* ctx, FeObject* n, const Bytes* b) {
+  FeDouble d = FeToDouble(ctx, n);
+  if (d < 0) {
+    d += (FeDouble)b->size;
+  }
+  if (!(d > 0)) {
+    return 0;
+  }
+  return d < (FeDouble)b->size ? (size_t)d : b->size;
+}
+
+// `(map-file pathname)` maps the file at `pathname` into memory, read-only, and
+// returns it as bytes, or an error list.
+FeObject* FexMapFile(FeContext* ctx, size_t, FeObject** argv) {
+  char pathname[PATH_MAX + 1];
+  (void)FeToString(ctx, argv[0], pathname, sizeof(pathname));
+  const int fd = open(pathname, O_RDONLY);
+  if (fd < 0) {
+    return BuildErrnoError(ctx, errno);
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0) {
+    const int error = errno;
+    (void)close(fd);
+    return BuildErrnoError(ctx, error);
+  }
+  const size_t size = (size_t)status.st_size;
+  // An empty file cannot be mapped; its bytes are an empty string instead.
+  const void* data = "";
+  if (size > 0) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      const int error = errno;
+      (void)close(fd);
+      return BuildErrnoError(ctx, error);
+    }
+  }
+  // The mapping outlives the descriptor.
+  (void)close(fd);
+  Bytes* b = malloc(sizeof(Bytes));
+  if (b == NULL) {
+    if (size > 0) {
+      (void)munmap((void*)(uintptr_t)data, size);
+    }
+    FeHandleError(ctx, "out of memory");
+  }
+  *b = (Bytes){.data = data, .size = size};
+  return FeMakePtr(ctx, FexTBytes, b);
+}
+
+// `(bytes-length bytes)` returns the number of bytes.
+FeObject* FexBytesLength(FeContext* ctx, size_t, FeObject** argv) {
+  return FeMakeDouble(ctx, (FeDouble)GetBytes(ctx, argv[0])->size);
+}
+
+// `(bytes-slice bytes start [end])` returns a view of `bytes` from `start` up
+// to `end` (default: the end), without copying. Negative offsets count back
+// from the end.
+FeObject* FexBytesSlice(FeContext* ctx, size_t argc, FeObject** argv) {
+  Bytes* b = GetBytes(ctx, argv[0]);
+  const size_t start = GetOffset(ctx, argv[1], b);
+  const size_t end = argc > 2 ? GetOffset(ctx, argv[2], b) : b->size;
+  return FexMakeBytesView(ctx, argv[0], start, end);
+}
+
+// `(bytes-advise bytes advice)` tells the system how `bytes` will be used:
+// `"sequential"`, `"random"`, `"willneed"`, or `"dontneed"`. It returns `nil`,
+// or an error list.
+FeObject* FexBytesAdvise(FeContext* ctx, size_t, FeObject** argv) {
+  Bytes* b = GetBytes(ctx, argv[0]);
+  char name[16];
+  (void)FeToString(ctx, argv[1], name, sizeof(name));
+  int advice = POSIX_MADV_NORMAL;
+  if (strcmp(name, "sequential") == 0) {
+    advice = POSIX_MADV_SEQUENTIAL;
+  } else if (strcmp(name, "random") == 0) {
+    advice = POSIX_MADV_RANDOM;
+  } else if (strcmp(name, "willneed") == 0) {
+    advice = POSIX_MADV_WILLNEED;
+  } else if (strcmp(name, "dontneed") == 0) {
+    advice = POSIX_MADV_DONTNEED;
+  } else {
+    FeHandleError(ctx, "unknown advice");
+  }
+  if (b->size == 0) {
+    return &nil;
+  }
+  // The range must start on a page boundary.
+  const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+  const uintptr_t start = (uintptr_t)b->data & ~(page - 1);
+  const size_t size = b->size + ((uintptr_t)b->data - start);
+  const int error = posix_madvise((void*)start, size, advice);
+  return error == 0 ? &nil : BuildErrnoError(ctx, error);
+}
+
+// `(bytes->string bytes)` copies `bytes` into a new string, which ends at the
+// first NUL, if any.
+FeObject* FexBytesToString(FeContext* ctx, size_t, FeObject** argv) {
+  Bytes* b = GetBytes(ctx, argv[0]);
+  FeObject* s = FeMakeString(ctx, "");
+  (void)FeAppendString(ctx, s, b->data, b->size);
+  return s;
+}
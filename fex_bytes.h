@@ -0,0 +1,36 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_BYTES_H
+#define FEX_BYTES_H
+
+#include <stdbool.h>
+
+#include "fe.h"
+
+void FexInstallBytes(FeContext* ctx);
+void FexMarkBytes(FeContext* ctx, FeObject* o);
+void FexFinalizeBytes(FeContext* ctx, FeObject* o);
+void FexWriteBytes(FeContext* ctx, FeObject* o, FeWriteFn fn, void* udata);
+
+// If `o` is bytes, stores its data and size and returns true. The data are
+// not NUL-terminated, and stay valid while `o` is reachable.
+bool FexGetBytes(FeContext* ctx, FeObject* o, const char** data, size_t* size);
+// Returns a view of `o[start, end)`, clamped to the size of `o`.
+FeObject* FexMakeBytesView(FeContext* ctx,
+                           FeObject* o,
+                           size_t start,
+                           size_t end);
+// Returns new bytes of `size` uninitialized bytes, and stores their data, which
+// the caller may fill in, in `*data`. Because the memory is freed only when the
+// bytes are collected, it is also a way for natives to hold scratch space that
+// an error, which unwinds past any cleanup code, cannot leak.
+FeObject* FexMakeBytesBuffer(FeContext* ctx, size_t size, char** data);
+
+FeObject* FexBytesAdvise(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexBytesLength(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexBytesSlice(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexBytesToString(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMapFile(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
@@ -0,0 +1,363 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fex.h"
+#include "fex_csv.h"
+#include "fex_io.h"
+
+// A CSV reader buffers a window of its file, which holds at least the record
+// being parsed. Records are scanned for their field boundaries first, and only
+// once a record is complete does the reader make any objects, so a record that
+// straddles the end of the window is rescanned after refilling rather than
+// half-built. Memory use is therefore bounded by the longest record.
+
+enum {
+  InitialBufferSize = 64 * 1024,
+  // Longer unquoted fields are read as strings even if they are numbers.
+  MaximumNumberLength = 128,
+};
+
+typedef struct Span {
+  size_t begin;
+  size_t end;
+  bool quoted;
+} Span;
+
+typedef struct CSVReader {
+  // The file object, which the reader keeps alive.
+  FeObject* file;
+  char* buffer;
+  size_t capacity;
+  // The unparsed bytes are `buffer[start, end)`.
+  size_t start;
+  size_t end;
+  bool eof;
+  char delimiter;
+  bool numbers;
+  Span* spans;
+  size_t span_capacity;
+} CSVReader;
+
+typedef enum ScanResult {
+  ScanComplete,
+  ScanNeedMore,
+  ScanEnd,
+} ScanResult;
+
+void FexInstallCSV(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "open-csv", FexOpenCSV, 1);
+  FexInstallNativeArrayFn(ctx, "read-csv", FexReadCSV, 1);
+}
+
+void FexMarkCSVReader(FeContext* ctx, FeObject* o) {
+  CSVReader* r = FeToPtr(ctx, o);
+  FeMark(ctx, r->file);
+}
+
+void FexFinalizeCSVReader(FeContext* ctx, FeObject* o) {
+  CSVReader* r = FeToPtr(ctx, o);
+  free(r->buffer);
+  free(r->spans);
+  free(r);
+}
+
+static CSVReader* GetReader(FeContext* ctx, FeObject* o) {
+  if (FeGetType(o) != FexTCSVReader) {
+    FeHandleError(ctx, "not a csv-reader");
+  }
+  return FeToPtr(ctx, o);
+}
+
+// Returns the index of the first of `p[0, n)` that is `delimiter`, `\n`, or
+// `\r`, or `n` if there is none. This tests 8 bytes at a time, using the
+// classic has-zero-byte bit trick on the word XORed with each target byte.
+static size_t FindSpecial(const char* p, size_t n, char delimiter) {
+  size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const uint64_t ones = 0x0101010101010101u;
+  const uint64_t highs = 0x8080808080808080u;
+  const uint64_t d = ones * (uint64_t)(unsigned char)delimiter;
+  const uint64_t lf = ones * '\n';
+  const uint64_t cr = ones * '\r';
+  for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+    uint64_t w;
+    memcpy(&w, p + i, sizeof(w));
+    const uint64_t a = w ^ d;
+    const uint64_t b = w ^ lf;
+    const uint64_t c = w ^ cr;
+    const uint64_t found =
+        ((a - ones) & ~a) | ((b - ones) & ~b) | ((c - ones) & ~c);
+    if (found & highs) {
+      // The lowest flagged byte is exact; borrows only affect higher ones.
+      return i + (size_t)__builtin_ctzll(found & highs) / 8;
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    if (p[i] == delimiter || p[i] == '\n' || p[i] == '\r') {
+      return i;
+    }
+  }
+  return n;
+}
+
+static bool AddSpan(CSVReader* r, size_t count, Span span) {
+  if (count == r->span_capacity) {
+    const size_t capacity = r->span_capacity ? 2 * r->span_capacity : 16;
+    Span* spans = realloc(r->spans, capacity * sizeof(Span));
+    if (spans == NULL) {
+      return false;
+    }
+    r->spans = spans;
+    r->span_capacity = capacity;
+  }
+  r->spans[count] = span;
+  return true;
+}
+
+// Scans the record at `r->start`, storing its fields' spans and the start of
+// the next record.
+static ScanResult Scan(FeContext* ctx,
+                       CSVReader* r,
+                       size_t* count,
+                       size_t* next) {
+  const char* b = r->buffer;
+  size_t pos = r->start;
+  if (pos == r->end) {
+    return r->eof ? ScanEnd : ScanNeedMore;
+  }
+  *count = 0;
+  for (;;) {
+    Span span = {.begin = pos};
+    size_t t;
+    if (pos < r->end && b[pos] == '"') {
+      span.quoted = true;
+      span.begin = ++pos;
+      for (;;) {
+        const char* q = memchr(b + pos, '"', r->end - pos);
+        if (q == NULL) {
+          if (!r->eof) {
+            return ScanNeedMore;
+          }
+          // An unterminated quote runs to the end of the file.
+          span.end = r->end;
+          pos = r->end;
+          break;
+        }
+        const size_t i = (size_t)(q - b);
+        if (i + 1 == r->end && !r->eof) {
+          return ScanNeedMore;
+        }
+        if (i + 1 < r->end && b[i + 1] == '"') {
+          pos = i + 2;
+          continue;
+        }
+        span.end = i;
+        pos = i + 1;
+        break;
+      }
+      // Anything between the closing quote and the terminator is ignored.
+      t = pos + FindSpecial(b + pos, r->end - pos, r->delimiter);
+    } else {
+      t = pos + FindSpecial(b + pos, r->end - pos, r->delimiter);
+      span.end = t;
+    }
+    if (t == r->end && !r->eof) {
+      return ScanNeedMore;
+    }
+    if (!AddSpan(r, (*count)++, span)) {
+      FeHandleError(ctx, "out of memory");
+    }
+
+    if (t == r->end) {
+      *next = t;
+      return ScanComplete;
+    }
+    if (b[t] == r->delimiter) {
+      pos = t + 1;
+      continue;
+    }
+    if (b[t] == '\r') {
+      if (t + 1 == r->end && !r->eof) {
+        return ScanNeedMore;
+      }
+      *next = t + 1 < r->end && b[t + 1] == '\n' ? t + 2 : t + 1;
+      return ScanComplete;
+    }
+    *next = t + 1;
+    return ScanComplete;
+  }
+}
+
+// Moves the unparsed bytes to the front of the buffer, growing it if they fill
+// it, and reads more. Returns false if reading fails.
+static bool Fill(FeContext* ctx, CSVReader* r) {
+  if (r->start > 0) {
+    memmove(r->buffer, r->buffer + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->start = 0;
+  }
+  if (r->end == r->capacity) {
+    char* buffer = realloc(r->buffer, 2 * r->capacity);
+    if (buffer == NULL) {
+      FeHandleError(ctx, "out of memory");
+    }
+    r->buffer = buffer;
+    r->capacity *= 2;
+  }
+  FILE* file = FexToFile(ctx, r->file);
+  const size_t n = fread(r->buffer + r->end, 1, r->capacity - r->end, file);
+  r->end += n;
+  if (n == 0) {
+    if (ferror(file)) {
+      return false;
+    }
+    r->eof = true;
+  }
+  return true;
+}
+
+// Returns how many decimal digits `field` begins with.
+static size_t CountDigits(const char* field, size_t size) {
+  size_t n = 0;
+  while (n < size && field[n] >= '0' && field[n] <= '9') {
+    n++;
+  }
+  return n;
+}
+
+// Returns whether `field` is a decimal number: an optional sign, digits with an
+// optional decimal point, and an optional exponent. `strtod` also reads hex,
+// `inf`, `nan`, and the like, which are left as strings.
+static bool IsDecimal(const char* field, size_t size) {
+  size_t i = field[0] == '+' || field[0] == '-' ? 1 : 0;
+  size_t digits = CountDigits(field + i, size - i);
+  i += digits;
+  if (i < size && field[i] == '.') {
+    i++;
+    const size_t fraction = CountDigits(field + i, size - i);
+    i += fraction;
+    digits += fraction;
+  }
+  if (digits == 0) {
+    return false;
+  }
+  if (i < size && (field[i] == 'e' || field[i] == 'E')) {
+    i++;
+    if (i < size && (field[i] == '+' || field[i] == '-')) {
+      i++;
+    }
+    const size_t exponent = CountDigits(field + i, size - i);
+    if (exponent == 0) {
+      return false;
+    }
+    i += exponent;
+  }
+  return i == size;
+}
+
+// Returns the field `span` as a string, or as a number if `r->numbers` is set
+// and it is a decimal one. The field is copied out rather than unescaped or
+// terminated in place, because an error while making it leaves the record in
+// the buffer to be read again.
+static FeObject* MakeField(FeContext* ctx, CSVReader* r, Span span) {
+  const char* field = r->buffer + span.begin;
+  const size_t size = span.end - span.begin;
+  if (r->numbers && !span.quoted && size > 0 && size < MaximumNumberLength &&
+      IsDecimal(field, size)) {
+    char number[MaximumNumberLength];
+    memcpy(number, field, size);
+    number[size] = '\0';
+    char* end;
+    const double n = strtod(number, &end);
+    if (end == number + size) {
+      return FeMakeDouble(ctx, n);
+    }
+  }
+  FeObject* s = FeMakeString(ctx, "");
+  FeObject* tail = s;
+  size_t copied = 0;
+  if (span.quoted) {
+    // Unescape `""`, appending the text up to and including the first `"`.
+    for (size_t i = 0; i + 1 < size; i++) {
+      if (field[i] == '"' && field[i + 1] == '"') {
+        tail = FeAppendString(ctx, tail, field + copied, i + 1 - copied);
+        copied = i + 2;
+        i++;
+      }
+    }
+  }
+  (void)FeAppendString(ctx, tail, field + copied, size - copied);
+  return s;
+}
+
+// `(open-csv file [delimiter] [numbers])` returns a reader of the records of
+// `file`, which are separated by `\n`, `\r\n`, or `\r`, and whose fields are
+// separated by `delimiter` (default `","`; use `"\t"` for TSV). Fields may be
+// quoted with `"`, in which case they may contain delimiters, newlines, and
+// `""` for `"`. If `numbers` is not `nil`, unquoted fields that are numbers
+// are read as numbers.
+FeObject* FexOpenCSV(FeContext* ctx, size_t argc, FeObject** argv) {
+  (void)FexToFile(ctx, argv[0]);
+  char delimiter[2] = ",";
+  if (argc > 1) {
+    char d[3];
+    if (FeToString(ctx, argv[1], d, sizeof(d)) != 1) {
+      FeHandleError(ctx, "delimiter must be 1 character");
+    }
+    delimiter[0] = d[0];
+  }
+  if (delimiter[0] == '"' || delimiter[0] == '\n' || delimiter[0] == '\r') {
+    FeHandleError(ctx, "invalid delimiter");
+  }
+
+  CSVReader* r = calloc(1, sizeof(CSVReader));
+  char* buffer = malloc(InitialBufferSize);
+  if (r == NULL || buffer == NULL) {
+    free(r);
+    free(buffer);
+    FeHandleError(ctx, "out of memory");
+  }
+  *r = (CSVReader){.file = argv[0],
+                   .buffer = buffer,
+                   .capacity = InitialBufferSize,
+                   .delimiter = delimiter[0],
+                   .numbers = argc > 2 && !FeIsNil(argv[2])};
+  return FeMakePtr(ctx, FexTCSVReader, r);
+}
+
+// `(read-csv reader)` returns the next record as a list of fields, or `nil` at
+// the end of the file.
+FeObject* FexReadCSV(FeContext* ctx, size_t, FeObject** argv) {
+  CSVReader* r = GetReader(ctx, argv[0]);
+  size_t count = 0;
+  size_t next = 0;
+  for (;;) {
+    const ScanResult result = Scan(ctx, r, &count, &next);
+    if (result == ScanComplete) {
+      break;
+    }
+    if (result == ScanEnd) {
+      return &nil;
+    }
+    if (!Fill(ctx, r)) {
+      return BuildErrnoError(ctx, errno);
+    }
+  }
+
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* record = &nil;
+  for (size_t i = count; i-- > 0;) {
+    record = FeCons(ctx, MakeField(ctx, r, r->spans[i]), record);
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, record);
+  }
+  r->start = next;
+  return record;
+}
@@ -0,0 +1,16 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_CSV_H
+#define FEX_CSV_H
+
+#include "fe.h"
+
+void FexInstallCSV(FeContext* ctx);
+void FexMarkCSVReader(FeContext* ctx, FeObject* o);
+void FexFinalizeCSVReader(FeContext* ctx, FeObject* o);
+
+FeObject* FexOpenCSV(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReadCSV(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
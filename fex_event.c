@@ -0,0 +1,844 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fex.h"
+#include "fex_event.h"
+#include "fex_io.h"
+#include "fex_process.h"
+
+void FexInstallEvent(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "close-stream", FexCloseStream, 1);
+  FexInstallNativeArrayFn(ctx, "connect-unix", FexConnectUnix, 1);
+  FexInstallNativeArrayFn(ctx, "listen-unix", FexListenUnix, 2);
+  FexInstallNativeArrayFn(ctx, "on-exit", FexOnExit, 2);
+  FexInstallNativeArrayFn(ctx, "on-read", FexOnRead, 2);
+  FexInstallNativeArrayFn(ctx, "on-signal", FexOnSignal, 2);
+  FexInstallNativeArrayFn(ctx, "open-stream", FexOpenStream, 1);
+  FexInstallNativeArrayFn(ctx, "run-events", FexRunEvents, 0);
+  FexInstallNativeArrayFn(ctx, "set-timer", FexSetTimer, 2);
+  FexInstallNativeArrayFn(ctx, "socket-pair", FexSocketPair, 0);
+  FexInstallNativeArrayFn(ctx, "spawn-process", FexSpawnProcess, 1);
+  FexInstallNativeArrayFn(ctx, "write-stream", FexWriteStream, 2);
+}
+
+enum {
+  // The most that one read passes to a callback, which keeps the strings
+  // small relative to the arena.
+  ReadSize = 4096,
+  // The most events handled per wait.
+  MaxEvents = 32,
+  // How often the loop checks for exited children even without `SIGCHLD`,
+  // which another thread may have taken, in milliseconds.
+  ChildPollInterval = 100,
+};
+
+typedef enum Kind {
+  KindStream,
+  KindListener,
+  KindTimer,
+  KindSignal,
+  KindProcess,
+} Kind;
+
+// A stream, or another source of events. It is active — registered with the
+// loop, and pinned so that the loop's callbacks can reach it — while it has
+// a callback to call or output to write, or, for a process, until the child
+// has been reaped, so that it does not linger as a zombie.
+typedef struct Handle {
+  Kind kind;
+  FeObject* object;
+  // -1 once closed, and for processes.
+  int fd;
+  // The signal, for `KindSignal`; the child, for `KindProcess`, or 0 once it
+  // has exited.
+  int signal;
+  pid_t pid;
+  // The callback, or `NULL`.
+  FeObject* fn;
+  // Output not yet written: `output[start, size)`.
+  char* output;
+  size_t start;
+  size_t size;
+  size_t capacity;
+  bool socket;
+  // Whether the descriptor is shared with a file, and so was left blocking.
+  bool blocking;
+  bool periodic;
+  // Whether the stream closes once its output has been written.
+  bool closing;
+  bool active;
+  // The events registered with epoll. Descriptors that epoll cannot watch,
+  // such as regular files, are always ready, and are not polled.
+  uint32_t events;
+  bool polled;
+  struct Handle* previous;
+  struct Handle* next;
+} Handle;
+
+// The event loop of a context, which is the data of the `stream` type.
+typedef struct Loop {
+  // -1 until first used.
+  int epoll;
+  // The `signalfd` for `SIGCHLD`, or -1.
+  int children;
+  Handle* active;
+  // The number of active handles that are not polled, and of processes.
+  size_t unpolled;
+  size_t processes;
+} Loop;
+
+void* FexOpenEventLoop(void) {
+  Loop* loop = calloc(1, sizeof(Loop));
+  if (loop != NULL) {
+    loop->epoll = -1;
+    loop->children = -1;
+  }
+  return loop;
+}
+
+void FexCloseEventLoop(FeContext*, void* data) {
+  Loop* loop = data;
+  if (loop == NULL) {
+    return;
+  }
+  if (loop->epoll != -1) {
+    (void)close(loop->epoll);
+  }
+  if (loop->children != -1) {
+    (void)close(loop->children);
+  }
+  free(loop);
+}
+
+static Loop* GetLoop(FeContext* ctx) {
+  Loop* loop = FeGetTypeData(ctx, FexTStream);
+  if (loop == NULL) {
+    FeHandleError(ctx, "no event loop");
+  }
+  if (loop->epoll == -1) {
+    loop->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll == -1) {
+      FeHandleError(ctx, "could not create event loop");
+    }
+  }
+  return loop;
+}
+
+static void Link(Loop* loop, Handle* h) {
+  h->previous = NULL;
+  h->next = loop->active;
+  if (loop->active != NULL) {
+    loop->active->previous = h;
+  }
+  loop->active = h;
+  loop->unpolled += h->polled ? 0 : 1;
+  loop->processes += h->kind == KindProcess ? 1 : 0;
+}
+
+static void Unlink(Loop* loop, Handle* h) {
+  *(h->previous != NULL ? &h->previous->next : &loop->active) = h->next;
+  if (h->next != NULL) {
+    h->next->previous = h->previous;
+  }
+  loop->unpolled -= h->polled ? 0 : 1;
+  loop->processes -= h->kind == KindProcess ? 1 : 0;
+}
+
+static void CloseHandle(Handle* h) {
+  if (h->fd != -1) {
+    (void)close(h->fd);
+    h->fd = -1;
+  }
+  if (h->kind == KindSignal && h->signal != 0) {
+    sigset_t mask;
+    (void)sigemptyset(&mask);
+    (void)sigaddset(&mask, h->signal);
+    (void)pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    h->signal = 0;
+  }
+}
+
+// Registers `h` with the loop for the events it now needs, activating or
+// deactivating it, and closes a closing stream whose output is all written.
+static void Update(FeContext* ctx, Loop* loop, Handle* h) {
+  const bool pending = h->start < h->size;
+  if (h->kind == KindStream && h->closing && !pending) {
+    h->fn = NULL;
+  }
+  uint32_t events = 0;
+  if (h->fd != -1 && h->fn != NULL) {
+    events |= EPOLLIN;
+  }
+  if (h->fd != -1 && pending) {
+    events |= EPOLLOUT;
+  }
+  if (h->fd != -1 && h->polled && events != h->events) {
+    struct epoll_event e = {.events = events, .data.ptr = h};
+    const int op = h->events == 0 ? EPOLL_CTL_ADD
+                   : events == 0  ? EPOLL_CTL_DEL
+                                  : EPOLL_CTL_MOD;
+    if (epoll_ctl(loop->epoll, op, h->fd, &e) != 0) {
+      if (errno != EPERM || op != EPOLL_CTL_ADD || h->active) {
+        FeHandleError(ctx, "could not watch stream");
+      }
+      h->polled = false;
+    }
+  }
+  h->events = events;
+  if (h->kind == KindStream && h->closing && !pending) {
+    CloseHandle(h);
+    h->events = 0;
+  }
+
+  const bool active = h->events != 0 || (h->kind == KindProcess && h->pid != 0);
+  if (active && !h->active) {
+    FePin(ctx, h->object);
+    Link(loop, h);
+  } else if (!active && h->active) {
+    Unlink(loop, h);
+    FeUnpin(ctx, h->object);
+  }
+  h->active = active;
+}
+
+void FexMarkStream(FeContext* ctx, FeObject* o) {
+  Handle* h = FeToPtr(ctx, o);
+  if (h->fn != NULL) {
+    FeMark(ctx, h->fn);
+  }
+}
+
+void FexFinalizeStream(FeContext* ctx, FeObject* o) {
+  Handle* h = FeToPtr(ctx, o);
+  // Active handles are pinned, so this is only when the context closes.
+  Loop* loop = FeGetTypeData(ctx, FexTStream);
+  if (h->active && loop != NULL) {
+    Unlink(loop, h);
+  }
+  CloseHandle(h);
+  if (h->pid != 0) {
+    (void)waitpid(h->pid, NULL, WNOHANG);
+  }
+  free(h->output);
+  free(h);
+}
+
+static Handle* GetHandle(FeContext* ctx, FeObject* o, Kind kind) {
+  if (FeGetType(o) != FexTStream) {
+    FeHandleError(ctx, "not a stream");
+  }
+  Handle* h = FeToPtr(ctx, o);
+  if (h->kind != kind) {
+    FeHandleError(ctx, kind == KindProcess ? "not a process" : "not a stream");
+  }
+  return h;
+}
+
+static FeObject* MakeHandle(FeContext* ctx, Kind kind, int fd) {
+  Handle* h = malloc(sizeof(Handle));
+  if (h == NULL) {
+    if (fd != -1) {
+      (void)close(fd);
+    }
+    FeHandleError(ctx, "out of memory");
+    return &nil;
+  }
+  *h = (Handle){.kind = kind, .fd = fd, .polled = true};
+  h->object = FeMakePtr(ctx, FexTStream, h);
+  return h->object;
+}
+
+static FeObject* MakeStream(FeContext* ctx, int fd, bool socket) {
+  FeObject* o = MakeHandle(ctx, KindStream, fd);
+  ((Handle*)FeToPtr(ctx, o))->socket = socket;
+  return o;
+}
+
+static bool SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static FeObject* GetCallback(FeContext*, FeObject* fn) {
+  return FeIsNil(fn) ? NULL : fn;
+}
+
+// Writes to a pipe or file without raising `SIGPIPE`, which would kill the
+// process, if the reader has gone: `write` fails with `EPIPE` instead.
+static ssize_t Write(int fd, const char* data, size_t size) {
+  sigset_t pipe;
+  sigset_t old;
+  (void)sigemptyset(&pipe);
+  (void)sigaddset(&pipe, SIGPIPE);
+  (void)pthread_sigmask(SIG_BLOCK, &pipe, &old);
+  const ssize_t written = write(fd, data, size);
+  const int error = errno;
+  if (written < 0 && error == EPIPE && !sigismember(&old, SIGPIPE)) {
+    // Consume the signal raised for this thread, before unblocking it.
+    const struct timespec zero = {0};
+    (void)sigtimedwait(&pipe, NULL, &zero);
+  }
+  (void)pthread_sigmask(SIG_SETMASK, &old, NULL);
+  errno = error;
+  return written;
+}
+
+// Writes as much of the pending output of `h` as it takes. Returns 0, or an
+// `errno` value, in which case the output is dropped.
+static int Flush(Handle* h) {
+  while (h->start < h->size) {
+    size_t n = h->size - h->start;
+    if (h->blocking && n > PIPE_BUF) {
+      // Only this much is sure not to block when the descriptor is writable.
+      n = PIPE_BUF;
+    }
+    const char* data = h->output + h->start;
+    const ssize_t written =
+        h->socket ? send(h->fd, data, n, MSG_NOSIGNAL) : Write(h->fd, data, n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      const int error = errno;
+      h->start = h->size = 0;
+      return error;
+    }
+    h->start += (size_t)written;
+    if (h->blocking) {
+      break;
+    }
+  }
+  if (h->start == h->size) {
+    h->start = h->size = 0;
+  }
+  return 0;
+}
+
+static FeObject* ErrorOrNil(FeContext* ctx, int error) {
+  return error == 0 ? &nil : BuildErrnoError(ctx, error);
+}
+
+// Reads what is available from a stream and passes it to the callback: a
+// string, `nil` at the end, or an error list.
+static void ReadStream(FeContext* ctx, Loop* loop, Handle* h) {
+  char buffer[ReadSize];
+  const ssize_t n = read(h->fd, buffer, sizeof(buffer));
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  FeObject* fn = h->fn;
+  FeObject* argument;
+  if (n > 0) {
+    argument = FeMakeString(ctx, "");
+    (void)FeAppendString(ctx, argument, buffer, (size_t)n);
+  } else {
+    argument = n == 0 ? &nil : BuildErrnoError(ctx, errno);
+    // That is the last call.
+    h->fn = NULL;
+    Update(ctx, loop, h);
+  }
+  (void)FeInvoke(ctx, fn, 1, &argument);
+}
+
+static void Accept(FeContext* ctx, Handle* h) {
+  const int fd = accept4(h->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  FeObject* stream = MakeStream(ctx, fd, true);
+  (void)FeInvoke(ctx, h->fn, 1, &stream);
+}
+
+static void Expire(FeContext* ctx, Loop* loop, Handle* h) {
+  uint64_t count;
+  if (read(h->fd, &count, sizeof(count)) != sizeof(count)) {
+    return;
+  }
+  FeObject* fn = h->fn;
+  if (!h->periodic) {
+    h->fn = NULL;
+    Update(ctx, loop, h);
+  }
+  (void)FeInvoke(ctx, fn, 0, NULL);
+}
+
+static void Deliver(FeContext* ctx, Handle* h) {
+  struct signalfd_siginfo info;
+  if (read(h->fd, &info, sizeof(info)) != sizeof(info)) {
+    return;
+  }
+  FeObject* number = FeMakeDouble(ctx, (FeDouble)info.ssi_signo);
+  (void)FeInvoke(ctx, h->fn, 1, &number);
+}
+
+// Handles the events of `h`. It stays reachable throughout, and the callbacks
+// may change it.
+static void Dispatch(FeContext* ctx, Loop* loop, Handle* h, uint32_t events) {
+  if (h->fd == -1) {
+    return;
+  }
+  // The callback stays reachable while it runs, even if it replaces itself.
+  const size_t gc = FeSaveGC(ctx);
+  if (h->fn != NULL) {
+    FePushGC(ctx, h->fn);
+  }
+  switch (h->kind) {
+    case KindStream:
+      if ((events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && h->start < h->size) {
+        (void)Flush(h);
+      }
+      if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && h->fn != NULL &&
+          h->fd != -1) {
+        ReadStream(ctx, loop, h);
+      }
+      break;
+    case KindListener:
+      if (h->fn != NULL) {
+        Accept(ctx, h);
+      }
+      break;
+    case KindTimer:
+      if (h->fn != NULL) {
+        Expire(ctx, loop, h);
+      }
+      break;
+    case KindSignal:
+      if (h->fn != NULL) {
+        Deliver(ctx, h);
+      }
+      break;
+    case KindProcess:
+      break;
+  }
+  Update(ctx, loop, h);
+  FeRestoreGC(ctx, gc);
+}
+
+static int GetStatus(int status) {
+  return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+// Reaps the children that have exited, and calls their `on-exit` callbacks.
+static void ReapChildren(FeContext* ctx, Loop* loop) {
+  if (loop->children != -1) {
+    struct signalfd_siginfo info;
+    while (read(loop->children, &info, sizeof(info)) == sizeof(info)) {
+    }
+  }
+  // The callbacks may change the list, so start over after each.
+  for (Handle* h = loop->active; h != NULL;) {
+    int status;
+    if (h->kind != KindProcess || waitpid(h->pid, &status, WNOHANG) <= 0) {
+      h = h->next;
+      continue;
+    }
+    FeObject* fn = h->fn;
+    h->pid = 0;
+    Update(ctx, loop, h);
+    if (fn == NULL) {
+      h = loop->active;
+      continue;
+    }
+    const size_t gc = FeSaveGC(ctx);
+    FePushGC(ctx, h->object);
+    FePushGC(ctx, fn);
+    const int code = GetStatus(status);
+    FeObject* argument = FeMakeDouble(ctx, (FeDouble)code);
+    (void)FeInvoke(ctx, fn, 1, &argument);
+    FeRestoreGC(ctx, gc);
+    h = loop->active;
+  }
+}
+
+static FeDouble Now(void) {
+  struct timespec t;
+  (void)clock_gettime(CLOCK_MONOTONIC, &t);
+  return (FeDouble)t.tv_sec + (FeDouble)t.tv_nsec / 1e9;
+}
+
+// `(run-events [timeout])` waits for events and calls their callbacks, until
+// no stream, timer, or signal has any left to call and every process has
+// exited, or until `timeout` seconds have passed. Callbacks may start and stop
+// others.
+FeObject* FexRunEvents(FeContext* ctx, size_t argc, FeObject** argv) {
+  Loop* loop = GetLoop(ctx);
+  const FeDouble deadline = argc > 0 && !FeIsNil(argv[0])
+                                ? Now() + FeToDouble(ctx, argv[0])
+                                : (FeDouble)INFINITY;
+  // Children may have exited before `SIGCHLD` was blocked.
+  ReapChildren(ctx, loop);
+  while (loop->active != NULL) {
+    int timeout = -1;
+    if (deadline < (FeDouble)INFINITY) {
+      const FeDouble left = deadline - Now();
+      if (left <= 0) {
+        break;
+      }
+      const FeDouble milliseconds = ceil(left * 1000);
+      timeout = milliseconds < INT_MAX ? (int)milliseconds : INT_MAX;
+    }
+    if (loop->processes > 0 && (timeout == -1 || timeout > ChildPollInterval)) {
+      timeout = ChildPollInterval;
+    }
+    if (loop->unpolled > 0) {
+      timeout = 0;
+    }
+
+    struct epoll_event events[MaxEvents];
+    const int n = epoll_wait(loop->epoll, events, MaxEvents, timeout);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      FeHandleError(ctx, "could not wait for events");
+    }
+
+    // Keep every handle with an event reachable until all have been handled,
+    // even if an earlier callback stops watching it.
+    const size_t gc = FeSaveGC(ctx);
+    bool children = n == 0 && loop->processes > 0;
+    for (int i = 0; i < n; i++) {
+      Handle* h = events[i].data.ptr;
+      if (h == NULL) {
+        children = true;
+      } else {
+        FePushGC(ctx, h->object);
+      }
+    }
+    for (int i = 0; i < n; i++) {
+      Handle* h = events[i].data.ptr;
+      if (h != NULL) {
+        Dispatch(ctx, loop, h, events[i].events);
+      }
+    }
+    if (loop->unpolled > 0) {
+      Handle* ready[MaxEvents];
+      size_t count = 0;
+      for (Handle* h = loop->active; h != NULL && count < MaxEvents;
+           h = h->next) {
+        if (!h->polled) {
+          ready[count++] = h;
+          FePushGC(ctx, h->object);
+        }
+      }
+      for (size_t i = 0; i < count; i++) {
+        Dispatch(ctx, loop, ready[i], ready[i]->events);
+      }
+    }
+    if (children) {
+      ReapChildren(ctx, loop);
+    }
+    FeRestoreGC(ctx, gc);
+  }
+  return &nil;
+}
+
+// `(on-read stream fn)` calls `(fn data)` with each string of data read from
+// `stream`, and then with `nil` at the end, or with an error list. If `fn` is
+// `nil`, it stops.
+FeObject* FexOnRead(FeContext* ctx, size_t, FeObject** argv) {
+  Handle* h = GetHandle(ctx, argv[0], KindStream);
+  if (h->fd == -1 || h->closing) {
+    FeHandleError(ctx, "stream is closed");
+  }
+  h->fn = GetCallback(ctx, argv[1]);
+  Update(ctx, GetLoop(ctx), h);
+  return &nil;
+}
+
+// `(write-stream stream string)` writes `string` to `stream`, or queues what
+// cannot be written yet, to be written as `run-events` runs. It returns `nil`,
+// or an error list.
+FeObject* FexWriteStream(FeContext* ctx, size_t, FeObject** argv) {
+  Handle* h = GetHandle(ctx, argv[0], KindStream);
+  if (h->fd == -1 || h->closing) {
+    FeHandleError(ctx, "stream is closed");
+  }
+  if (FeGetType(argv[1]) != FeTString) {
+    FeHandleError(ctx, "expected string");
+  }
+  for (FeObject* p = argv[1]; !FeIsNil(p);) {
+    const char* chunk;
+    const size_t n = FeGetStringChunk(ctx, &p, &chunk);
+    if (h->capacity - h->size < n) {
+      const size_t capacity =
+          h->capacity * 2 > h->size + n ? h->capacity * 2 : h->size + n + 256;
+      char* output = realloc(h->output, capacity);
+      if (output == NULL) {
+        FeHandleError(ctx, "out of memory");
+      }
+      h->output = output;
+      h->capacity = capacity;
+    }
+    memcpy(h->output + h->size, chunk, n);
+    h->size += n;
+  }
+  // A blocking descriptor is written only when it is ready.
+  const int error = h->blocking ? 0 : Flush(h);
+  Update(ctx, GetLoop(ctx), h);
+  return ErrorOrNil(ctx, error);
+}
+
+// `(close-stream stream)` stops `stream`, a timer, or a signal handler, and
+// closes it. A stream closes once its queued output has been written; a
+// process is no longer watched.
+FeObject* FexCloseStream(FeContext* ctx, size_t, FeObject** argv) {
+  if (FeGetType(argv[0]) != FexTStream) {
+    FeHandleError(ctx, "not a stream");
+  }
+  Handle* h = FeToPtr(ctx, argv[0]);
+  h->fn = NULL;
+  if (h->kind == KindStream) {
+    h->closing = true;
+  }
+  Loop* loop = GetLoop(ctx);
+  Update(ctx, loop, h);
+  if (h->kind != KindStream) {
+    CloseHandle(h);
+  }
+  return &nil;
+}
+
+// `(socket-pair)` returns a list of two connected streams.
+FeObject* FexSocketPair(FeContext* ctx, size_t, FeObject**) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) !=
+      0) {
+    return BuildErrnoError(ctx, errno);
+  }
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* a = MakeStream(ctx, fds[0], true);
+  FeObject* b = MakeStream(ctx, fds[1], true);
+  FeObject* result = FeMakeList(ctx, (FeObject*[]){a, b}, 2);
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, result);
+  return result;
+}
+
+static bool GetAddress(FeContext* ctx,
+                       FeObject* pathname,
+                       struct sockaddr_un* address) {
+  *address = (struct sockaddr_un){.sun_family = AF_UNIX};
+  const size_t n =
+      FeToString(ctx, pathname, address->sun_path, sizeof(address->sun_path));
+  return n < sizeof(address->sun_path) - 1;
+}
+
+// `(connect-unix pathname)` connects to the UNIX-domain socket at `pathname`
+// and returns a stream, or an error list.
+FeObject* FexConnectUnix(FeContext* ctx, size_t, FeObject** argv) {
+  struct sockaddr_un address;
+  if (!GetAddress(ctx, argv[0], &address)) {
+    return BuildErrnoError(ctx, ENAMETOOLONG);
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return BuildErrnoError(ctx, errno);
+  }
+  // Connecting to a local socket does not block for long, but connecting
+  // without blocking may fail when the listener is busy.
+  if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      !SetNonBlocking(fd)) {
+    const int error = errno;
+    (void)close(fd);
+    return BuildErrnoError(ctx, error);
+  }
+  return MakeStream(ctx, fd, true);
+}
+
+// `(listen-unix pathname fn)` listens on a new UNIX-domain socket at
+// `pathname`, and calls `(fn stream)` with each connection. It returns the
+// listener, which `close-stream` closes, or an error list.
+FeObject* FexListenUnix(FeContext* ctx, size_t, FeObject** argv) {
+  struct sockaddr_un address;
+  if (!GetAddress(ctx, argv[0], &address)) {
+    return BuildErrnoError(ctx, ENAMETOOLONG);
+  }
+  const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    return BuildErrnoError(ctx, errno);
+  }
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    const int error = errno;
+    (void)close(fd);
+    return BuildErrnoError(ctx, error);
+  }
+  FeObject* o = MakeHandle(ctx, KindListener, fd);
+  Handle* h = FeToPtr(ctx, o);
+  h->socket = true;
+  h->fn = GetCallback(ctx, argv[1]);
+  Update(ctx, GetLoop(ctx), h);
+  return o;
+}
+
+// `(open-stream file)` returns a stream that reads and writes the descriptor of
+// `file`, such as a pipe or a terminal. The descriptor is shared with `file`,
+// and so left blocking; the stream reads and writes it only when it is ready.
+FeObject* FexOpenStream(FeContext* ctx, size_t, FeObject** argv) {
+  FILE* file = FexToFile(ctx, argv[0]);
+  (void)fflush(file);
+  const int fd = fcntl(fileno(file), F_DUPFD_CLOEXEC, 0);
+  if (fd == -1) {
+    return BuildErrnoError(ctx, errno);
+  }
+  FeObject* o = MakeStream(ctx, fd, false);
+  ((Handle*)FeToPtr(ctx, o))->blocking = true;
+  return o;
+}
+
+// `(set-timer seconds fn [interval])` calls `(fn)` after `seconds`, and then
+// every `interval` seconds if given, until `close-stream` stops it. It returns
+// the timer, or an error list.
+FeObject* FexSetTimer(FeContext* ctx, size_t argc, FeObject** argv) {
+  const FeDouble seconds = FeToDouble(ctx, argv[0]);
+  const FeDouble interval = argc > 2 ? FeToDouble(ctx, argv[2]) : 0;
+  if (!(seconds >= 0) || !(interval >= 0) || seconds > 1e9 || interval > 1e9) {
+    FeHandleError(ctx, "invalid time");
+  }
+  const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd == -1) {
+    return BuildErrnoError(ctx, errno);
+  }
+  const FeDouble first = seconds > 0 ? seconds : 1e-9;
+  struct itimerspec spec = {
+      .it_value = {.tv_sec = (time_t)first,
+                   .tv_nsec = (long)((first - floor(first)) * 1e9)},
+      .it_interval = {.tv_sec = (time_t)interval,
+                      .tv_nsec = (long)((interval - floor(interval)) * 1e9)},
+  };
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+    const int error = errno;
+    (void)close(fd);
+    return BuildErrnoError(ctx, error);
+  }
+  FeObject* o = MakeHandle(ctx, KindTimer, fd);
+  Handle* h = FeToPtr(ctx, o);
+  h->periodic = interval > 0;
+  h->fn = GetCallback(ctx, argv[1]);
+  Update(ctx, GetLoop(ctx), h);
+  return o;
+}
+
+// `(on-signal signal fn)` calls `(fn signal)` whenever the process receives
+// the signal numbered `signal`, instead of its usual action, until
+// `close-stream` stops it. It returns the handler, or an error list.
+FeObject* FexOnSignal(FeContext* ctx, size_t, FeObject** argv) {
+  const FeDouble number = FeToDouble(ctx, argv[0]);
+  const int signo = number >= 1 && number <= SIGRTMAX ? (int)number : 0;
+  if (signo == 0 || signo == SIGKILL || signo == SIGSTOP || signo == SIGCHLD) {
+    FeHandleError(ctx, "invalid signal");
+  }
+  sigset_t mask;
+  (void)sigemptyset(&mask);
+  (void)sigaddset(&mask, signo);
+  const int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd == -1) {
+    return BuildErrnoError(ctx, errno);
+  }
+  (void)pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  FeObject* o = MakeHandle(ctx, KindSignal, fd);
+  Handle* h = FeToPtr(ctx, o);
+  h->signal = signo;
+  h->fn = GetCallback(ctx, argv[1]);
+  Update(ctx, GetLoop(ctx), h);
+  return o;
+}
+
+// Has the loop wake up when children exit, by way of a `signalfd` for
+// `SIGCHLD`.
+static void WatchChildren(Loop* loop) {
+  if (loop->children != -1) {
+    return;
+  }
+  sigset_t mask;
+  (void)sigemptyset(&mask);
+  (void)sigaddset(&mask, SIGCHLD);
+  (void)pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  loop->children = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  struct epoll_event e = {.events = EPOLLIN, .data.ptr = NULL};
+  if (loop->children == -1 ||
+      epoll_ctl(loop->epoll, EPOLL_CTL_ADD, loop->children, &e) != 0) {
+    // The loop still checks for exited children periodically.
+    if (loop->children != -1) {
+      (void)close(loop->children);
+      loop->children = -1;
+    }
+  }
+}
+
+// `(spawn-process program argument...)` starts `program`, as `execute` does,
+// and returns the list `(process input output error-output)`: a process for
+// `on-exit`, a stream that writes to its standard input, and streams that read
+// its standard output and error. It returns an error list if the program
+// cannot be started. `run-events` reaps the child once it exits, whether or not
+// it has an `on-exit` callback.
+FeObject* FexSpawnProcess(FeContext* ctx, size_t argc, FeObject** argv) {
+  FexCheckCommand(ctx, argc, argv);
+  Loop* loop = GetLoop(ctx);
+  WatchChildren(loop);
+  char** arguments = FexCopyArguments(ctx, argc, argv);
+  if (arguments == NULL) {
+    FeHandleError(ctx, "out of memory");
+    return &nil;
+  }
+  int fds[3];
+  pid_t pid;
+  const int error =
+      FexSpawn(ctx, arguments, (bool[]){true, true, true}, fds, &pid);
+  FexFreeArguments(arguments);
+  if (error != 0) {
+    return BuildErrnoError(ctx, error);
+  }
+  for (int i = 0; i < 3; i++) {
+    (void)SetNonBlocking(fds[i]);
+  }
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* process = MakeHandle(ctx, KindProcess, -1);
+  Handle* h = FeToPtr(ctx, process);
+  h->pid = pid;
+  Update(ctx, loop, h);
+  FeObject* result =
+      FeMakeList(ctx,
+                 (FeObject*[]){process, MakeStream(ctx, fds[0], false),
+                               MakeStream(ctx, fds[1], false),
+                               MakeStream(ctx, fds[2], false)},
+                 4);
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, result);
+  return result;
+}
+
+// `(on-exit process fn)` calls `(fn status)` when `process` exits, with its
+// exit status, or 128 plus the number of the signal that killed it.
+FeObject* FexOnExit(FeContext* ctx, size_t, FeObject** argv) {
+  Handle* h = GetHandle(ctx, argv[0], KindProcess);
+  h->fn = GetCallback(ctx, argv[1]);
+  Update(ctx, GetLoop(ctx), h);
+  return &nil;
+}
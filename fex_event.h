@@ -0,0 +1,29 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_EVENT_H
+#define FEX_EVENT_H
+
+#include "fe.h"
+
+void FexInstallEvent(FeContext* ctx);
+void FexMarkStream(FeContext* ctx, FeObject* o);
+void FexFinalizeStream(FeContext* ctx, FeObject* o);
+// The per-context event loop, which is the data of the `stream` type.
+void* FexOpenEventLoop(void);
+void FexCloseEventLoop(FeContext* ctx, void* data);
+
+FeObject* FexCloseStream(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexConnectUnix(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexListenUnix(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOnExit(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOnRead(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOnSignal(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOpenStream(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexRunEvents(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSetTimer(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSocketPair(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSpawnProcess(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexWriteStream(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
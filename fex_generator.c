@@ -0,0 +1,297 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "fex.h"
+#include "fex_generator.h"
+
+#if defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FEX_ASAN
+#endif
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define FEX_ASAN
+#endif
+#if defined(FEX_ASAN)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+void FexInstallGenerator(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "is-done", FexIsDone, 1);
+  FexInstallNativeArrayFn(ctx, "make-generator", FexMakeGenerator, 1);
+  FexInstallNativeArrayFn(ctx, "resume", FexResume, 1);
+  FexInstallNativeArrayFn(ctx, "yield", FexYield, 0);
+}
+
+enum {
+  // The C stack of each generator. Its pages are committed as they are
+  // touched, and a guard page below it turns an overflow into a fault.
+  StackSize = 1 << 20,
+  GcStackSize = 512,
+};
+
+typedef enum State {
+  Suspended,
+  Running,
+  Done,
+  Failed,
+} State;
+
+// A generator runs `fn` on its own C stack and GC stack, switching to and from
+// its resumer with `getcontext` and `setcontext`, so that `yield` can suspend
+// it from any depth of evaluation, including from within a native function's
+// callback.
+typedef struct Generator {
+  FeContext* ctx;
+  FeObject* fn;
+  // The value passed by the latest `resume` or `yield`, or the result of `fn`.
+  FeObject* value;
+  ucontext_t context;
+  ucontext_t resumer;
+  char* c_stack;
+  size_t c_stack_size;
+  // For AddressSanitizer, which must be told of each switch of C stacks.
+  void* fake_stack;
+  const void* resumer_bottom;
+  size_t resumer_size;
+  // The generator's GC stack, while it is suspended.
+  FeStack stack;
+  // The resumer's GC stack and error handler, while the generator runs.
+  FeStack saved;
+  FeErrorFn* error;
+  // The generator that was running when this one was resumed.
+  struct Generator* outer;
+  State state;
+  char message[128];
+} Generator;
+
+typedef struct Generators {
+  Generator* running;
+} Generators;
+
+static _Thread_local Generator* starting;
+
+void* FexOpenGenerators(void) {
+  return calloc(1, sizeof(Generators));
+}
+
+void FexCloseGenerators(FeContext*, void* data) {
+  free(data);
+}
+
+static Generators* GetGenerators(FeContext* ctx) {
+  Generators* generators = FeGetTypeData(ctx, FexTGenerator);
+  if (generators == NULL) {
+    FeHandleError(ctx, "no generator state");
+  }
+  return generators;
+}
+
+static Generator* GetGenerator(FeContext* ctx, FeObject* o) {
+  if (FeGetType(o) != FexTGenerator) {
+    FeHandleError(ctx, "not a generator");
+  }
+  return FeToPtr(ctx, o);
+}
+
+static void FreeCStack(Generator* g) {
+  if (g->c_stack != NULL) {
+    (void)munmap(g->c_stack, g->c_stack_size);
+    g->c_stack = NULL;
+  }
+}
+
+void FexMarkGenerator(FeContext* ctx, FeObject* o) {
+  Generator* g = FeToPtr(ctx, o);
+  FeMark(ctx, g->fn);
+  FeMark(ctx, g->value);
+  // While the generator runs, its GC stack is the context's, which the GC
+  // marks itself.
+  if (g->state == Suspended) {
+    for (size_t i = 0; i < g->stack.index; i++) {
+      FeMark(ctx, g->stack.objects[i]);
+    }
+  }
+}
+
+// A generator dropped while suspended is not unwound: its C stack is simply
+// released, along with the objects that only it referred to.
+void FexFinalizeGenerator(FeContext* ctx, FeObject* o) {
+  Generator* g = FeToPtr(ctx, o);
+  FreeCStack(g);
+  free(g->stack.objects);
+  free(g);
+}
+
+// `swapcontext` would do, but AddressSanitizer warns on every program that
+// calls it.
+static void Switch(ucontext_t* from, const ucontext_t* to) {
+  volatile bool switched = false;
+  (void)getcontext(from);
+  if (!switched) {
+    switched = true;
+    (void)setcontext(to);
+  }
+}
+
+static void StartSwitch(void** fake_stack, const void* bottom, size_t size) {
+#if defined(FEX_ASAN)
+  __sanitizer_start_switch_fiber(fake_stack, bottom, size);
+#else
+  (void)fake_stack;
+  (void)bottom;
+  (void)size;
+#endif
+}
+
+static void FinishSwitch(void* fake_stack, const void** bottom, size_t* size) {
+#if defined(FEX_ASAN)
+  __sanitizer_finish_switch_fiber(fake_stack, bottom, size);
+#else
+  (void)fake_stack;
+  (void)bottom;
+  (void)size;
+#endif
+}
+
+// Switches from the running generator `g` back to its resumer, which finds the
+// outcome in `g->state` and `g->value`.
+static void Suspend(FeContext* ctx, Generator* g, State state) {
+  g->state = state;
+  FeLeaveStack(ctx, &g->stack, &g->saved);
+  if (state == Suspended) {
+    StartSwitch(&g->fake_stack, g->resumer_bottom, g->resumer_size);
+    Switch(&g->context, &g->resumer);
+    FinishSwitch(g->fake_stack, &g->resumer_bottom, &g->resumer_size);
+  } else {
+    // The generator never runs again, so its context need not be saved.
+    StartSwitch(NULL, g->resumer_bottom, g->resumer_size);
+    (void)setcontext(&g->resumer);
+    abort();
+  }
+}
+
+// Errors in a generator end it, and `resume` raises them again in the
+// resumer, whose own handler and call list are then back in place.
+static void noreturn HandleGeneratorError(FeContext* ctx,
+                                          const char* message,
+                                          FeObject*) {
+  Generator* g = GetGenerators(ctx)->running;
+  snprintf(g->message, sizeof(g->message), "%s", message);
+  Suspend(ctx, g, Failed);
+  abort();
+}
+
+static void Start(void) {
+  Generator* g = starting;
+  FeContext* ctx = g->ctx;
+  FinishSwitch(NULL, &g->resumer_bottom, &g->resumer_size);
+  g->value = FeInvoke(ctx, g->fn, 0, NULL);
+  Suspend(ctx, g, Done);
+}
+
+// `(make-generator fn)` returns a generator that calls `fn`, with no
+// arguments, when it is first resumed.
+FeObject* FexMakeGenerator(FeContext* ctx, size_t, FeObject** argv) {
+  const long page = sysconf(_SC_PAGESIZE);
+  Generator* g = calloc(1, sizeof(Generator));
+  FeObject** objects = malloc(GcStackSize * sizeof(FeObject*));
+  const size_t size = StackSize + (size_t)page;
+  void* c_stack =
+      mmap(NULL, size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+  if (g == NULL || objects == NULL || c_stack == MAP_FAILED ||
+      mprotect(c_stack, (size_t)page, PROT_NONE) != 0 ||
+      getcontext(&g->context) != 0) {
+    if (c_stack != MAP_FAILED) {
+      (void)munmap(c_stack, size);
+    }
+    free(objects);
+    free(g);
+    FeHandleError(ctx, "out of memory");
+    return &nil;
+  }
+
+  g->ctx = ctx;
+  g->fn = argv[0];
+  g->value = &nil;
+  g->c_stack = c_stack;
+  g->c_stack_size = size;
+  g->stack =
+      (FeStack){.objects = objects, .size = GcStackSize, .call_list = &nil};
+  g->state = Suspended;
+  g->context.uc_stack.ss_sp = g->c_stack + page;
+  g->context.uc_stack.ss_size = StackSize;
+  g->context.uc_link = NULL;
+  makecontext(&g->context, Start, 0);
+  return FeMakePtr(ctx, FexTGenerator, g);
+}
+
+// `(resume generator [value])` runs `generator` until it yields or returns,
+// and returns the value it yielded or returned. `value`, which defaults to
+// `nil`, becomes the result of the `yield` that suspended it; the first
+// resume's value is discarded.
+FeObject* FexResume(FeContext* ctx, size_t argc, FeObject** argv) {
+  Generator* g = GetGenerator(ctx, argv[0]);
+  if (g->state == Running) {
+    FeHandleError(ctx, "generator is running");
+  }
+  if (g->state != Suspended) {
+    FeHandleError(ctx, "generator is done");
+  }
+
+  Generators* generators = GetGenerators(ctx);
+  FeHandlers* handlers = FeGetHandlers(ctx);
+  g->outer = generators->running;
+  generators->running = g;
+  g->error = handlers->error;
+  handlers->error = HandleGeneratorError;
+  g->value = argc > 1 ? argv[1] : &nil;
+  g->state = Running;
+  starting = g;
+  FeEnterStack(ctx, &g->saved, &g->stack);
+  void* fake_stack = NULL;
+  StartSwitch(&fake_stack, g->c_stack + (g->c_stack_size - StackSize),
+              StackSize);
+  Switch(&g->resumer, &g->context);
+  FinishSwitch(fake_stack, NULL, NULL);
+
+  handlers->error = g->error;
+  generators->running = g->outer;
+  if (g->state != Suspended) {
+    FreeCStack(g);
+  }
+  if (g->state == Failed) {
+    FeHandleError(ctx, g->message);
+  }
+  return g->value;
+}
+
+// `(yield [value])` suspends the running generator, making `value`, which
+// defaults to `nil`, the result of the `resume` that ran it, and returns the
+// value of the next `resume`.
+FeObject* FexYield(FeContext* ctx, size_t argc, FeObject** argv) {
+  Generator* g = GetGenerators(ctx)->running;
+  if (g == NULL) {
+    FeHandleError(ctx, "yield outside a generator");
+    return &nil;
+  }
+  g->value = argc > 0 ? argv[0] : &nil;
+  Suspend(ctx, g, Suspended);
+  return g->value;
+}
+
+// `(is-done generator)` returns whether `generator` has returned or failed, so
+// that it can no longer be resumed.
+FeObject* FexIsDone(FeContext* ctx, size_t, FeObject** argv) {
+  const Generator* g = GetGenerator(ctx, argv[0]);
+  return FeMakeBool(ctx, g->state == Done || g->state == Failed);
+}
@@ -0,0 +1,22 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_GENERATOR_H
+#define FEX_GENERATOR_H
+
+#include "fe.h"
+
+void FexInstallGenerator(FeContext* ctx);
+void FexMarkGenerator(FeContext* ctx, FeObject* o);
+void FexFinalizeGenerator(FeContext* ctx, FeObject* o);
+// The per-context record of the running generator, which is the data of the
+// `generator` type.
+void* FexOpenGenerators(void);
+void FexCloseGenerators(FeContext* ctx, void* data);
+
+FeObject* FexIsDone(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMakeGenerator(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexResume(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexYield(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
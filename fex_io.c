@@ -7,53 +7,81 @@
 #include <math.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "auto.h"
 #include "fex.h"
+#include "fex_bytes.h"
 #include "fex_io.h"
 
-static FeObject* GetFile(FeContext* ctx, FeObject** arg) {
-  FeObject* file = FeGetNextArgument(ctx, arg);
+static FeObject* GetFile(FeContext* ctx, FeObject* file) {
   if (FeGetType(file) != FexTFile) {
     FeHandleError(ctx, "not a file");
   }
+  if (FeToPtr(ctx, file) == NULL) {
+    FeHandleError(ctx, "file is closed");
+  }
   return file;
 }
 
+FILE* FexToFile(FeContext* ctx, FeObject* o) {
+  return FeToPtr(ctx, GetFile(ctx, o));
+}
+
 void FexInstallIO(FeContext* ctx) {
-  FexInstallNativeFn(ctx, "close-file", FexCloseFile);
-  FexInstallNativeFn(ctx, "open-file", FexOpenFile);
-  FexInstallNativeFn(ctx, "read-file", FexReadFile);
-  FexInstallNativeFn(ctx, "remove-file", FexRemoveFile);
-  FexInstallNativeFn(ctx, "write-file", FexWriteFile);
+  FexInstallNativeArrayFn(ctx, "close-file", FexCloseFile, 1);
+  FexInstallNativeArrayFn(ctx, "for-each-record", FexForEachRecord, 2);
+  FexInstallNativeArrayFn(ctx, "open-reader", FexOpenReader, 1);
+  FexInstallNativeArrayFn(ctx, "open-file", FexOpenFile, 2);
+  FexInstallNativeArrayFn(ctx, "read-file", FexReadFile, 2);
+  FexInstallNativeArrayFn(ctx, "read-record", FexReadRecord, 1);
+  FexInstallNativeArrayFn(ctx, "remove-file", FexRemoveFile, 1);
+  FexInstallNativeArrayFn(ctx, "write-all", FexWriteAll, 2);
+  FexInstallNativeArrayFn(ctx, "write-file", FexWriteFile, 2);
 
-  FeSet(ctx, FeMakeSymbol(ctx, "stdin"), FeMakePtr(ctx, FexTFile, stdin));
-  FeSet(ctx, FeMakeSymbol(ctx, "stdout"), FeMakePtr(ctx, FexTFile, stdout));
-  FeSet(ctx, FeMakeSymbol(ctx, "stderr"), FeMakePtr(ctx, FexTFile, stderr));
+  FeStreams* streams = FeGetStreams(ctx);
+  FeSet(ctx, FeMakeSymbol(ctx, "stdin"),
+        FeMakePtr(ctx, FexTFile, streams->input));
+  FeSet(ctx, FeMakeSymbol(ctx, "stdout"),
+        FeMakePtr(ctx, FexTFile, streams->output));
+  FeSet(ctx, FeMakeSymbol(ctx, "stderr"),
+        FeMakePtr(ctx, FexTFile, streams->error));
 }
 
-FeObject* FexCloseFile(FeContext* ctx, FeObject* arg) {
-  return fclose(FeToPtr(ctx, GetFile(ctx, &arg))) == 0
-             ? &nil
-             : BuildErrnoError(ctx, errno);
+// Closes files that the program dropped without calling `close-file`. The
+// context's standard streams belong to the embedder, so they stay open.
+void FexFinalizeFile(FeContext* ctx, FeObject* o) {
+  FILE* file = FeToPtr(ctx, o);
+  const FeStreams* streams = FeGetStreams(ctx);
+  if (file != NULL && file != streams->input && file != streams->output &&
+      file != streams->error) {
+    (void)fclose(file);
+  }
+}
+
+FeObject* FexCloseFile(FeContext* ctx, size_t, FeObject** argv) {
+  FeObject* file = GetFile(ctx, argv[0]);
+  FILE* f = FeToPtr(ctx, file);
+  // Even if `fclose` fails, the stream is gone.
+  FeSetPtr(ctx, file, NULL);
+  return fclose(f) == 0 ? &nil : BuildErrnoError(ctx, errno);
 }
 
-FeObject* FexOpenFile(FeContext* ctx, FeObject* arg) {
+FeObject* FexOpenFile(FeContext* ctx, size_t, FeObject** argv) {
   char pathname[PATH_MAX + 1];
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), pathname,
-                   sizeof(pathname));
+  (void)FeToString(ctx, argv[0], pathname, sizeof(pathname));
   char mode[8];
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), mode, sizeof(mode));
+  (void)FeToString(ctx, argv[1], mode, sizeof(mode));
   FILE* file = fopen(pathname, mode);
   return file != NULL ? FeMakePtr(ctx, FexTFile, file)
                       : BuildErrnoError(ctx, errno);
 }
 
-FeObject* FexReadFile(FeContext* ctx, FeObject* arg) {
-  FeObject* file = GetFile(ctx, &arg);
+FeObject* FexReadFile(FeContext* ctx, size_t, FeObject** argv) {
+  FeObject* file = GetFile(ctx, argv[0]);
   char delimiter[16];
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), delimiter,
-                   sizeof(delimiter));
+  (void)FeToString(ctx, argv[1], delimiter, sizeof(delimiter));
 
   AUTO(char*, record, NULL, FreeChar);
   size_t capacity = 0;
@@ -64,21 +92,264 @@ FeObject* FexReadFile(FeContext* ctx, FeObject* arg) {
   return result;
 }
 
-FeObject* FexRemoveFile(FeContext* ctx, FeObject* arg) {
+FeObject* FexRemoveFile(FeContext* ctx, size_t, FeObject** argv) {
   char pathname[PATH_MAX + 1];
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), pathname,
-                   sizeof(pathname));
+  (void)FeToString(ctx, argv[0], pathname, sizeof(pathname));
   return remove(pathname) == 0 ? &nil : BuildErrnoError(ctx, errno);
 }
 
-FeObject* FexWriteFile(FeContext* ctx, FeObject* arg) {
-  FeObject* file = GetFile(ctx, &arg);
-  const size_t arbitrary_limit = 4 * 1024 * 1024;  // TODO
-  AUTO(char*, buffer, malloc(arbitrary_limit), FreeChar);
-  const size_t size =
-      FeToString(ctx, FeGetNextArgument(ctx, &arg), buffer, arbitrary_limit);
-  const size_t written = fwrite(buffer, 1, size, FeToPtr(ctx, file));
-  FeObject* result = written == size ? FeMakeDouble(ctx, (double)written)
-                                     : BuildErrnoError(ctx, errno);
-  return result;
+// Objects are written through a small buffer on the stack: strings a chunk at a
+// time, and other objects as `FeWrite` prints them.
+typedef struct Writer {
+  FILE* file;
+  char buffer[4096];
+  size_t size;
+  size_t written;
+  bool failed;
+} Writer;
+
+static void Flush(Writer* w) {
+  if (w->size > 0 && !w->failed) {
+    const size_t n = fwrite(w->buffer, 1, w->size, w->file);
+    w->written += n;
+    w->failed = n != w->size;
+  }
+  w->size = 0;
+}
+
+static void Put(Writer* w, const char* bytes, size_t n) {
+  if (w->size + n > sizeof(w->buffer)) {
+    Flush(w);
+  }
+  memcpy(w->buffer + w->size, bytes, n);
+  w->size += n;
+}
+
+static void PutChar(FeContext*, void* udata, char chr) {
+  Put(udata, &chr, 1);
+}
+
+static void WriteObject(FeContext* ctx, Writer* w, FeObject* obj) {
+  const char* data;
+  size_t size;
+  if (FexGetBytes(ctx, obj, &data, &size)) {
+    // Write bytes straight from their mapping, rather than through the buffer.
+    Flush(w);
+    if (!w->failed) {
+      const size_t n = fwrite(data, 1, size, w->file);
+      w->written += n;
+      w->failed = n != size;
+    }
+    return;
+  }
+  if (FeGetType(obj) != FeTString) {
+    FeWrite(ctx, obj, PutChar, w, 0);
+    return;
+  }
+  while (!FeIsNil(obj)) {
+    const char* chunk;
+    const size_t n = FeGetStringChunk(ctx, &obj, &chunk);
+    Put(w, chunk, n);
+  }
+}
+
+static FeObject* FinishWriting(FeContext* ctx, Writer* w) {
+  Flush(w);
+  return w->failed ? BuildErrnoError(ctx, errno)
+                   : FeMakeDouble(ctx, (double)w->written);
+}
+
+// `(write-file file obj ...)` writes each `obj` to `file`, strings as their
+// bytes and other objects as `print` would, and returns the number of bytes
+// written.
+FeObject* FexWriteFile(FeContext* ctx, size_t argc, FeObject** argv) {
+  Writer w = {.file = FexToFile(ctx, argv[0])};
+  for (size_t i = 1; i < argc; i++) {
+    WriteObject(ctx, &w, argv[i]);
+  }
+  return FinishWriting(ctx, &w);
+}
+
+// `(write-all file list)` is like `write-file` with the elements of `list`.
+FeObject* FexWriteAll(FeContext* ctx, size_t, FeObject** argv) {
+  Writer w = {.file = FexToFile(ctx, argv[0])};
+  for (FeObject* p = argv[1]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    WriteObject(ctx, &w, FeCar(ctx, p));
+  }
+  return FinishWriting(ctx, &w);
+}
+
+// A reader splits a file into records, reading ahead into a buffer that it
+// keeps between calls and that grows only to hold the longest record.
+
+enum {
+  ReadAheadSize = 64 * 1024,
+};
+
+typedef struct Reader {
+  // The file object, which the reader keeps alive.
+  FeObject* file;
+  char* buffer;
+  size_t capacity;
+  // The unread bytes are `buffer[start, end)`, and none of
+  // `buffer[start, scanned)` begins a delimiter.
+  size_t start;
+  size_t scanned;
+  size_t end;
+  bool eof;
+  char* delimiter;
+  size_t delimiter_size;
+} Reader;
+
+void FexMarkReader(FeContext* ctx, FeObject* o) {
+  Reader* r = FeToPtr(ctx, o);
+  FeMark(ctx, r->file);
+}
+
+void FexFinalizeReader(FeContext* ctx, FeObject* o) {
+  Reader* r = FeToPtr(ctx, o);
+  free(r->buffer);
+  free(r->delimiter);
+  free(r);
+}
+
+static Reader* GetReader(FeContext* ctx, FeObject* o) {
+  if (FeGetType(o) != FexTReader) {
+    FeHandleError(ctx, "not a reader");
+  }
+  return FeToPtr(ctx, o);
+}
+
+// Returns the offset of the next delimiter in the unread bytes, or `end`.
+static size_t FindDelimiter(Reader* r) {
+  const char first = r->delimiter[0];
+  for (size_t i = r->scanned; i < r->end;) {
+    const char* p = memchr(r->buffer + i, first, r->end - i);
+    if (p == NULL) {
+      break;
+    }
+    i = (size_t)(p - r->buffer);
+    if (r->end - i < r->delimiter_size) {
+      // The delimiter may continue in the next read.
+      r->scanned = i;
+      return r->end;
+    }
+    if (memcmp(p, r->delimiter, r->delimiter_size) == 0) {
+      r->scanned = i;
+      return i;
+    }
+    i++;
+  }
+  r->scanned = r->end;
+  return r->end;
+}
+
+// Moves the unread bytes to the front of the buffer, growing it if they fill
+// it, and reads more. Returns false if reading fails.
+static bool FillReader(FeContext* ctx, Reader* r) {
+  if (r->start > 0) {
+    memmove(r->buffer, r->buffer + r->start, r->end - r->start);
+    r->end -= r->start;
+    r->scanned -= r->start;
+    r->start = 0;
+  }
+  if (r->end == r->capacity) {
+    char* buffer = realloc(r->buffer, 2 * r->capacity);
+    if (buffer == NULL) {
+      FeHandleError(ctx, "out of memory");
+    }
+    r->buffer = buffer;
+    r->capacity *= 2;
+  }
+  FILE* file = FexToFile(ctx, r->file);
+  const size_t n = fread(r->buffer + r->end, 1, r->capacity - r->end, file);
+  r->end += n;
+  if (n == 0) {
+    if (ferror(file)) {
+      return false;
+    }
+    r->eof = true;
+  }
+  return true;
+}
+
+// Reads the next record into `*record`, which is `nil` at the end of the file,
+// or returns false if reading fails.
+static bool NextRecord(FeContext* ctx, Reader* r, FeObject** record) {
+  size_t i;
+  while ((i = FindDelimiter(r)) == r->end) {
+    if (r->eof) {
+      if (r->start == r->end) {
+        *record = &nil;
+        return true;
+      }
+      break;
+    }
+    if (!FillReader(ctx, r)) {
+      return false;
+    }
+  }
+  *record = FeMakeString(ctx, "");
+  (void)FeAppendString(ctx, *record, r->buffer + r->start, i - r->start);
+  r->start = i < r->end ? i + r->delimiter_size : i;
+  r->scanned = r->start;
+  return true;
+}
+
+// `(open-reader file [delimiter])` returns a reader of the records of `file`,
+// which are separated by `delimiter` (default: `"\n"`), which may be more than
+// one byte long.
+FeObject* FexOpenReader(FeContext* ctx, size_t argc, FeObject** argv) {
+  (void)FexToFile(ctx, argv[0]);
+  char delimiter[64] = "\n";
+  size_t delimiter_size = 1;
+  if (argc > 1) {
+    delimiter_size = FeToString(ctx, argv[1], delimiter, sizeof(delimiter));
+    if (delimiter_size == 0 || delimiter_size == sizeof(delimiter) - 1) {
+      FeHandleError(ctx, "delimiter must be 1 to 62 bytes");
+    }
+  }
+  Reader* r = calloc(1, sizeof(Reader));
+  char* buffer = malloc(ReadAheadSize);
+  char* d = malloc(delimiter_size);
+  if (r == NULL || buffer == NULL || d == NULL) {
+    free(r);
+    free(buffer);
+    free(d);
+    FeHandleError(ctx, "out of memory");
+  }
+  memcpy(d, delimiter, delimiter_size);
+  *r = (Reader){.file = argv[0],
+                .buffer = buffer,
+                .capacity = ReadAheadSize,
+                .delimiter = d,
+                .delimiter_size = delimiter_size};
+  return FeMakePtr(ctx, FexTReader, r);
+}
+
+// `(read-record reader)` returns the next record, without its delimiter, or
+// `nil` at the end of the file.
+FeObject* FexReadRecord(FeContext* ctx, size_t, FeObject** argv) {
+  FeObject* record;
+  return NextRecord(ctx, GetReader(ctx, argv[0]), &record)
+             ? record
+             : BuildErrnoError(ctx, errno);
+}
+
+// `(for-each-record reader fn)` calls `(fn record)` for each remaining record.
+// It returns `nil`, or an error list if reading fails.
+FeObject* FexForEachRecord(FeContext* ctx, size_t, FeObject** argv) {
+  Reader* r = GetReader(ctx, argv[0]);
+  const size_t gc = FeSaveGC(ctx);
+  for (;;) {
+    FeObject* record;
+    if (!NextRecord(ctx, r, &record)) {
+      return BuildErrnoError(ctx, errno);
+    }
+    if (FeIsNil(record)) {
+      return &nil;
+    }
+    (void)FeInvoke(ctx, argv[1], 1, &record);
+    FeRestoreGC(ctx, gc);
+  }
 }
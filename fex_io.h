@@ -4,14 +4,25 @@
 #ifndef FEX_IO_H
 #define FEX_IO_H
 
+#include <stdio.h>
+
 #include "fe.h"
 
 void FexInstallIO(FeContext* ctx);
+void FexFinalizeFile(FeContext* ctx, FeObject* o);
+void FexMarkReader(FeContext* ctx, FeObject* o);
+void FexFinalizeReader(FeContext* ctx, FeObject* o);
+// Returns the `FILE*` of the open file `o`, or raises an error.
+FILE* FexToFile(FeContext* ctx, FeObject* o);
 
-FeObject* FexCloseFile(FeContext* ctx, FeObject* arg);
-FeObject* FexOpenFile(FeContext* ctx, FeObject* arg);
-FeObject* FexReadFile(FeContext* ctx, FeObject* arg);
-FeObject* FexRemoveFile(FeContext* ctx, FeObject* arg);
-FeObject* FexWriteFile(FeContext* ctx, FeObject* arg);
+FeObject* FexCloseFile(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexForEachRecord(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOpenReader(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexOpenFile(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReadFile(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReadRecord(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexRemoveFile(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexWriteAll(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexWriteFile(FeContext* ctx, size_t argc, FeObject** argv);
 
 #endif
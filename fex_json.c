@@ -0,0 +1,702 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fex.h"
+#include "fex_bytes.h"
+#include "fex_io.h"
+#include "fex_json.h"
+
+// JSON values map to Fe values as follows:
+//
+//   object:   the symbol `object` followed by `(key . value)` pairs, with
+//             string keys, in document order; `{}` is `(object)`
+//   array:    a list; `[]` is `nil`
+//   number:   a number
+//   string:   a string
+//   true:     `t`
+//   false:    `nil`, or the symbol `false` when parsing exactly
+//   null:     `nil`, or the symbol `null` when parsing exactly
+//
+// Writing reverses the mapping, writing the symbols `false` and `null` as
+// `false` and `null`, so that every value parsed exactly is written back as the
+// same JSON. Other symbols are written as strings, and so are the keys of
+// objects, which may be symbols.
+
+enum {
+  DepthLimit = 1024,
+  // `Source.next` holds no lookahead character.
+  Unread = -2,
+};
+
+void FexInstallJSON(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "parse-json", FexParseJSON, 1);
+  FexInstallNativeArrayFn(ctx, "write-json", FexWriteJSON, 2);
+}
+
+// Parsing
+
+// The file is not locked while parsing, since allocating may raise an error,
+// and that would leave it locked.
+typedef struct Source {
+  FILE* file;
+  int next;
+  const char* data;
+  size_t size;
+  size_t offset;
+} Source;
+
+typedef struct Parser {
+  FeContext* ctx;
+  Source* source;
+  // The symbol `object`, and the values of `false` and `null`:
+  FeObject* object;
+  FeObject* false_value;
+  FeObject* null_value;
+  // The bytes of the current string or number, in a bytes buffer (so that an
+  // error does not leak it) that the car of `holder` keeps reachable:
+  FeObject* holder;
+  char* text;
+  size_t text_size;
+  size_t text_capacity;
+  const char* error;
+} Parser;
+
+static int Peek(Source* s) {
+  if (s->file != NULL) {
+    if (s->next == Unread) {
+      s->next = getc(s->file);
+    }
+    return s->next;
+  }
+  return s->offset < s->size ? (unsigned char)s->data[s->offset] : EOF;
+}
+
+static int Next(Source* s) {
+  const int c = Peek(s);
+  if (s->file != NULL) {
+    s->next = Unread;
+  } else if (c != EOF) {
+    s->offset++;
+  }
+  return c;
+}
+
+static int SkipSpace(Source* s) {
+  for (;;) {
+    const int c = Peek(s);
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+      return c;
+    }
+    (void)Next(s);
+  }
+}
+
+static bool Fail(Parser* p, const char* error) {
+  if (p->error == NULL) {
+    p->error = error;
+  }
+  return false;
+}
+
+static bool Append(Parser* p, char c) {
+  if (p->text_size == p->text_capacity) {
+    const size_t capacity = p->text_capacity ? 2 * p->text_capacity : 256;
+    const size_t gc = FeSaveGC(p->ctx);
+    char* text;
+    FeSetCar(p->ctx, p->holder, FexMakeBytesBuffer(p->ctx, capacity, &text));
+    FeRestoreGC(p->ctx, gc);
+    if (p->text_size > 0) {
+      memcpy(text, p->text, p->text_size);
+    }
+    p->text = text;
+    p->text_capacity = capacity;
+  }
+  p->text[p->text_size++] = c;
+  return true;
+}
+
+static bool Expect(Parser* p, const char* literal) {
+  for (; *literal != '\0'; literal++) {
+    if (Next(p->source) != *literal) {
+      return Fail(p, "invalid json");
+    }
+  }
+  return true;
+}
+
+static bool ReadHex(Parser* p, uint32_t* code) {
+  *code = 0;
+  for (size_t i = 0; i < 4; i++) {
+    const int c = Next(p->source);
+    uint32_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = (uint32_t)(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      digit = (uint32_t)(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      digit = (uint32_t)(c - 'A' + 10);
+    } else {
+      return Fail(p, "invalid json");
+    }
+    *code = *code << 4 | digit;
+  }
+  return true;
+}
+
+static bool AppendUTF8(Parser* p, uint32_t code) {
+  if (code < 0x80) {
+    return Append(p, (char)code);
+  }
+  if (code < 0x800) {
+    return Append(p, (char)(0xc0 | code >> 6)) &&
+           Append(p, (char)(0x80 | (code & 0x3f)));
+  }
+  if (code < 0x10000) {
+    return Append(p, (char)(0xe0 | code >> 12)) &&
+           Append(p, (char)(0x80 | (code >> 6 & 0x3f))) &&
+           Append(p, (char)(0x80 | (code & 0x3f)));
+  }
+  return Append(p, (char)(0xf0 | code >> 18)) &&
+         Append(p, (char)(0x80 | (code >> 12 & 0x3f))) &&
+         Append(p, (char)(0x80 | (code >> 6 & 0x3f))) &&
+         Append(p, (char)(0x80 | (code & 0x3f)));
+}
+
+static bool ReadEscape(Parser* p) {
+  const int c = Next(p->source);
+  switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      return Append(p, (char)c);
+    case 'b':
+      return Append(p, '\b');
+    case 'f':
+      return Append(p, '\f');
+    case 'n':
+      return Append(p, '\n');
+    case 'r':
+      return Append(p, '\r');
+    case 't':
+      return Append(p, '\t');
+    case 'u': {
+      uint32_t code;
+      if (!ReadHex(p, &code)) {
+        return false;
+      }
+      if (code >= 0xd800 && code < 0xdc00) {
+        uint32_t low;
+        if (!Expect(p, "\\u") || !ReadHex(p, &low) || low < 0xdc00 ||
+            low >= 0xe000) {
+          return Fail(p, "invalid json");
+        }
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+      } else if (code >= 0xdc00 && code < 0xe000) {
+        return Fail(p, "invalid json");
+      } else if (code == 0) {
+        return Fail(p, "json strings cannot contain NUL");
+      }
+      return AppendUTF8(p, code);
+    }
+    default:
+      return Fail(p, "invalid json");
+  }
+}
+
+// Reads a string, after its opening quote, into `p->text`, NUL-terminated.
+static bool ReadString(Parser* p) {
+  p->text_size = 0;
+  for (;;) {
+    const int c = Next(p->source);
+    if (c == '"') {
+      return Append(p, '\0');
+    }
+    if (c == EOF || c < 0x20) {
+      return Fail(p, "invalid json");
+    }
+    if (c == '\\') {
+      if (!ReadEscape(p)) {
+        return false;
+      }
+    } else if (!Append(p, (char)c)) {
+      return false;
+    }
+  }
+}
+
+static bool AppendDigits(Parser* p) {
+  int c = Peek(p->source);
+  if (c < '0' || c > '9') {
+    return Fail(p, "invalid json");
+  }
+  do {
+    if (!Append(p, (char)Next(p->source))) {
+      return false;
+    }
+    c = Peek(p->source);
+  } while (c >= '0' && c <= '9');
+  return true;
+}
+
+// Reads a number, checking it against JSON's grammar, which is stricter than
+// `strtod`'s.
+static bool ReadNumber(Parser* p, FeDouble* n) {
+  p->text_size = 0;
+  if (Peek(p->source) == '-' && !Append(p, (char)Next(p->source))) {
+    return false;
+  }
+  if (Peek(p->source) == '0') {
+    if (!Append(p, (char)Next(p->source))) {
+      return false;
+    }
+  } else if (!AppendDigits(p)) {
+    return false;
+  }
+  if (Peek(p->source) == '.') {
+    if (!Append(p, (char)Next(p->source)) || !AppendDigits(p)) {
+      return false;
+    }
+  }
+  int c = Peek(p->source);
+  if (c == 'e' || c == 'E') {
+    if (!Append(p, (char)Next(p->source))) {
+      return false;
+    }
+    c = Peek(p->source);
+    if ((c == '+' || c == '-') && !Append(p, (char)Next(p->source))) {
+      return false;
+    }
+    if (!AppendDigits(p)) {
+      return false;
+    }
+  }
+  if (!Append(p, '\0')) {
+    return false;
+  }
+  *n = strtod(p->text, NULL);
+  return true;
+}
+
+static bool ParseValue(Parser* p, FeObject** result, size_t depth);
+
+// Appends `value` to the list whose first and last pairs are `*head` and
+// `*tail`, and leaves only `*head` on the GC stack above `gc`.
+static void AddElement(Parser* p,
+                       size_t gc,
+                       FeObject** head,
+                       FeObject** tail,
+                       FeObject* value) {
+  FeObject* pair = FeCons(p->ctx, value, &nil);
+  if (*tail == NULL) {
+    *head = pair;
+  } else {
+    FeSetCdr(p->ctx, *tail, pair);
+  }
+  *tail = pair;
+  FeRestoreGC(p->ctx, gc);
+  FePushGC(p->ctx, *head);
+}
+
+// Parses the elements of an array, after its `[`.
+static bool ParseArray(Parser* p, FeObject** result, size_t depth) {
+  const size_t gc = FeSaveGC(p->ctx);
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  if (SkipSpace(p->source) == ']') {
+    (void)Next(p->source);
+    *result = head;
+    return true;
+  }
+  for (;;) {
+    FeObject* value;
+    if (!ParseValue(p, &value, depth + 1)) {
+      return false;
+    }
+    AddElement(p, gc, &head, &tail, value);
+    const int c = SkipSpace(p->source);
+    (void)Next(p->source);
+    if (c == ']') {
+      *result = head;
+      return true;
+    }
+    if (c != ',') {
+      return Fail(p, "invalid json");
+    }
+  }
+}
+
+// Parses the members of an object, after its `{`.
+static bool ParseObject(Parser* p, FeObject** result, size_t depth) {
+  const size_t gc = FeSaveGC(p->ctx);
+  FeObject* head = FeCons(p->ctx, p->object, &nil);
+  FeObject* tail = head;
+  if (SkipSpace(p->source) == '}') {
+    (void)Next(p->source);
+    *result = head;
+    return true;
+  }
+  for (;;) {
+    if (Next(p->source) != '"' || !ReadString(p)) {
+      return Fail(p, "invalid json");
+    }
+    FeObject* key = FeMakeString(p->ctx, p->text);
+    if (SkipSpace(p->source) != ':') {
+      return Fail(p, "invalid json");
+    }
+    (void)Next(p->source);
+    FeObject* value;
+    if (!ParseValue(p, &value, depth + 1)) {
+      return false;
+    }
+    AddElement(p, gc, &head, &tail, FeCons(p->ctx, key, value));
+    const int c = SkipSpace(p->source);
+    (void)Next(p->source);
+    if (c == '}') {
+      *result = head;
+      return true;
+    }
+    if (c != ',' || SkipSpace(p->source) != '"') {
+      return Fail(p, "invalid json");
+    }
+  }
+}
+
+// Parses one value into `*result`, which is left on the GC stack if it was
+// allocated.
+static bool ParseValue(Parser* p, FeObject** result, size_t depth) {
+  if (depth >= DepthLimit) {
+    return Fail(p, "json is too deeply nested");
+  }
+  const int c = SkipSpace(p->source);
+  switch (c) {
+    case '{':
+      (void)Next(p->source);
+      return ParseObject(p, result, depth);
+    case '[':
+      (void)Next(p->source);
+      return ParseArray(p, result, depth);
+    case '"':
+      (void)Next(p->source);
+      if (!ReadString(p)) {
+        return false;
+      }
+      *result = FeMakeString(p->ctx, p->text);
+      return true;
+    case 't':
+      *result = FeMakeBool(p->ctx, true);
+      return Expect(p, "true");
+    case 'f':
+      *result = p->false_value;
+      return Expect(p, "false");
+    case 'n':
+      *result = p->null_value;
+      return Expect(p, "null");
+    case '-':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9': {
+      FeDouble n;
+      if (!ReadNumber(p, &n)) {
+        return false;
+      }
+      *result = FeMakeDouble(p->ctx, n);
+      return true;
+    }
+    default:
+      return Fail(p, c == EOF ? "unexpected end of json" : "invalid json");
+  }
+}
+
+static FeObject* Parse(FeContext* ctx,
+                       Source* source,
+                       FeObject* eof,
+                       bool exact) {
+  const size_t gc = FeSaveGC(ctx);
+  Parser p = {.ctx = ctx,
+              .source = source,
+              .object = FeMakeSymbol(ctx, "object"),
+              .false_value = exact ? FeMakeSymbol(ctx, "false") : &nil,
+              .null_value = exact ? FeMakeSymbol(ctx, "null") : &nil,
+              .holder = FeCons(ctx, &nil, &nil)};
+  FeObject* result = eof;
+  if (eof == NULL || SkipSpace(source) != EOF) {
+    if (ParseValue(&p, &result, 0) && source->file == NULL &&
+        SkipSpace(source) != EOF) {
+      (void)Fail(&p, "invalid json");
+    }
+  }
+  if (source->file != NULL) {
+    // Put back the character after the value, so that the next value in the
+    // file can be parsed.
+    if (source->next >= 0) {
+      (void)ungetc(source->next, source->file);
+    }
+  }
+  FeRestoreGC(ctx, gc);
+  if (p.error != NULL) {
+    FeHandleError(ctx, p.error);
+  }
+  FePushGC(ctx, result);
+  return result;
+}
+
+FeObject* FexParseJSONFromFile(FeContext* ctx,
+                               FILE* file,
+                               FeObject* eof,
+                               bool exact) {
+  Source source = {.file = file, .next = Unread};
+  return Parse(ctx, &source, eof, exact);
+}
+
+FeObject* FexParseJSONFromBuffer(FeContext* ctx,
+                                 const char* data,
+                                 size_t size,
+                                 bool exact) {
+  Source source = {.data = data, .size = size};
+  return Parse(ctx, &source, NULL, exact);
+}
+
+// Writing
+
+typedef struct Writer {
+  FeContext* ctx;
+  FILE* file;
+  FeObject* t;
+  FeObject* object;
+  FeObject* false_symbol;
+  FeObject* null;
+  bool failed;
+  const char* error;
+  char message[64];
+} Writer;
+
+static void Put(Writer* w, const char* s) {
+  if (!w->failed && fputs(s, w->file) == EOF) {
+    w->failed = true;
+  }
+}
+
+static void PutEscaped(FeContext*, void* udata, char chr) {
+  Writer* w = udata;
+  char escape[8] = {chr, '\0'};
+  switch (chr) {
+    case '"':
+      memcpy(escape, "\\\"", 3);
+      break;
+    case '\\':
+      memcpy(escape, "\\\\", 3);
+      break;
+    case '\b':
+      memcpy(escape, "\\b", 3);
+      break;
+    case '\f':
+      memcpy(escape, "\\f", 3);
+      break;
+    case '\n':
+      memcpy(escape, "\\n", 3);
+      break;
+    case '\r':
+      memcpy(escape, "\\r", 3);
+      break;
+    case '\t':
+      memcpy(escape, "\\t", 3);
+      break;
+    default:
+      if ((unsigned char)chr < 0x20) {
+        snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)chr);
+      }
+  }
+  Put(w, escape);
+}
+
+static void PutString(Writer* w, FeObject* obj) {
+  Put(w, "\"");
+  FeWrite(w->ctx, obj, PutEscaped, w, 0);
+  Put(w, "\"");
+}
+
+static void PutNumber(Writer* w, FeDouble n) {
+  if (!isfinite(n)) {
+    w->error = "cannot write non-finite numbers as json";
+    return;
+  }
+  // Use the shortest precision that reads back as the same number.
+  char text[32];
+  for (int precision = 15; precision <= 17; precision++) {
+    snprintf(text, sizeof(text), "%.*g", precision, n);
+    if (strtod(text, NULL) == n) {
+      break;
+    }
+  }
+  Put(w, text);
+}
+
+// A cyclic list would be written forever, so lists are limited to the length
+// that could fit in the arena.
+static size_t LengthLimit(Writer* w) {
+  return FeGetArenaSize(w->ctx) / (2 * sizeof(void*));
+}
+
+static bool IsKey(FeObject* key) {
+  const FeType type = FeGetType(key);
+  return type == FeTString || type == FeTSymbol;
+}
+
+static bool Emit(Writer* w, FeObject* obj, size_t depth) {
+  const FeType type = FeGetType(obj);
+  switch (type) {
+    case FeTNil:
+      Put(w, "[]");
+      return true;
+
+    case FeTDouble:
+      PutNumber(w, FeToDouble(w->ctx, obj));
+      return w->error == NULL;
+
+    case FeTSymbol:
+      if (obj == w->t) {
+        Put(w, "true");
+      } else if (obj == w->false_symbol) {
+        Put(w, "false");
+      } else if (obj == w->null) {
+        Put(w, "null");
+      } else {
+        PutString(w, obj);
+      }
+      return true;
+
+    case FeTString:
+      PutString(w, obj);
+      return true;
+
+    case FeTPair: {
+      if (depth >= DepthLimit) {
+        w->error = "cannot write deeply nested structure as json";
+        return false;
+      }
+      const bool object = FeCar(w->ctx, obj) == w->object;
+      if (object) {
+        obj = FeCdr(w->ctx, obj);
+      }
+      Put(w, object ? "{" : "[");
+      const size_t limit = LengthLimit(w);
+      for (size_t i = 0; FeGetType(obj) == FeTPair;
+           i++, obj = FeCdr(w->ctx, obj)) {
+        if (i == limit) {
+          w->error = "cannot write cyclic list as json";
+          return false;
+        }
+        if (i > 0) {
+          Put(w, ",");
+        }
+        FeObject* element = FeCar(w->ctx, obj);
+        if (object) {
+          if (FeGetType(element) != FeTPair || !IsKey(FeCar(w->ctx, element))) {
+            w->error = "json object members must be (key . value) pairs";
+            return false;
+          }
+          PutString(w, FeCar(w->ctx, element));
+          Put(w, ":");
+          element = FeCdr(w->ctx, element);
+        }
+        if (!Emit(w, element, depth + 1)) {
+          return false;
+        }
+      }
+      if (!FeIsNil(obj)) {
+        w->error = "cannot write dotted list as json";
+        return false;
+      }
+      Put(w, object ? "}" : "]");
+      return true;
+    }
+
+    case FeTFn:
+    case FeTMacro:
+    case FeTPrimitive:
+    case FeTNativeFn:
+    case FeTNativeArrayFn:
+    case FeTDoubleFn:
+    case FeTPtr:
+    case FeTFex0:
+    case FeTFex1:
+    case FeTFex2:
+    case FeTFex3:
+    case FeTFex4:
+    case FeTFex5:
+    case FeTFex6:
+    case FeTFex7:
+      snprintf(w->message, sizeof(w->message), "cannot write %s as json",
+               FeGetTypeName(w->ctx, type));
+      w->error = w->message;
+      return false;
+
+    case FeTFree:
+    case FeTSentinel:
+      abort();
+  }
+}
+
+bool FexWriteJSONToFile(FeContext* ctx, FeObject* obj, FILE* file) {
+  const size_t gc = FeSaveGC(ctx);
+  Writer w = {.ctx = ctx,
+              .file = file,
+              .t = FeMakeBool(ctx, true),
+              .object = FeMakeSymbol(ctx, "object"),
+              .false_symbol = FeMakeSymbol(ctx, "false"),
+              .null = FeMakeSymbol(ctx, "null")};
+  (void)Emit(&w, obj, 0);
+  FeRestoreGC(ctx, gc);
+  if (w.error != NULL) {
+    char message[64];
+    snprintf(message, sizeof(message), "%s", w.error);
+    FeHandleError(ctx, message);
+  }
+  return !w.failed;
+}
+
+// `(parse-json source [eof [exact]])` parses a JSON value from `source`, which
+// is a string holding exactly one value or a file. Successive calls on a file
+// parse successive values, and return `eof` at the end of the file; without
+// `eof`, the end of the file is an error. `false` and `null` parse to `nil`,
+// unless `exact` is not `nil`, in which case they parse to the symbols `false`
+// and `null`, so that the value is written back as the same JSON.
+FeObject* FexParseJSON(FeContext* ctx, size_t argc, FeObject** argv) {
+  const bool exact = argc > 2 && !FeIsNil(argv[2]);
+  if (FeGetType(argv[0]) == FeTString) {
+    size_t size = 0;
+    for (FeObject* s = argv[0]; !FeIsNil(s);) {
+      const char* chunk;
+      size += FeGetStringChunk(ctx, &s, &chunk);
+    }
+    char* text;
+    (void)FexMakeBytesBuffer(ctx, size + 1, &text);
+    (void)FeToString(ctx, argv[0], text, size + 1);
+    return FexParseJSONFromBuffer(ctx, text, size, exact);
+  }
+  return FexParseJSONFromFile(ctx, FexToFile(ctx, argv[0]),
+                              argc > 1 ? argv[1] : NULL, exact);
+}
+
+// `(write-json obj file)` writes `obj` to `file` as JSON.
+FeObject* FexWriteJSON(FeContext* ctx, size_t, FeObject** argv) {
+  return FexWriteJSONToFile(ctx, argv[0], FexToFile(ctx, argv[1]))
+             ? &nil
+             : BuildErrnoError(ctx, errno);
+}
@@ -0,0 +1,36 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_JSON_H
+#define FEX_JSON_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fe.h"
+
+void FexInstallJSON(FeContext* ctx);
+
+// Parses one JSON value. The `FromFile` form reads only as far as the end of
+// the value, so that successive calls parse successive values, and returns
+// `eof` if there is no value before the end of the file; if `eof` is `NULL`,
+// that is an error. The `FromBuffer` form requires `data` to hold exactly one
+// value. Invalid JSON is an error. `false` and `null` parse to `nil`, or, if
+// `exact` is true, to the symbols `false` and `null`.
+FeObject* FexParseJSONFromFile(FeContext* ctx,
+                               FILE* file,
+                               FeObject* eof,
+                               bool exact);
+FeObject* FexParseJSONFromBuffer(FeContext* ctx,
+                                 const char* data,
+                                 size_t size,
+                                 bool exact);
+
+// Writes `obj` as JSON. Objects that have no JSON form are errors. Returns
+// false, with `errno` set, if writing fails.
+bool FexWriteJSONToFile(FeContext* ctx, FeObject* obj, FILE* file);
+
+FeObject* FexParseJSON(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexWriteJSON(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
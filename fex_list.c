@@ -0,0 +1,340 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#include <stdlib.h>
+
+#include "fex.h"
+#include "fex_list.h"
+
+void FexInstallList(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "append", FexAppend, 0);
+  FexInstallNativeArrayFn(ctx, "assoc", FexAssoc, 2);
+  FexInstallNativeArrayFn(ctx, "filter", FexFilter, 2);
+  FexInstallNativeArrayFn(ctx, "last", FexLast, 1);
+  FexInstallNativeArrayFn(ctx, "length", FexLength, 1);
+  FexInstallNativeArrayFn(ctx, "map", FexMap, 2);
+  FexInstallNativeArrayFn(ctx, "member", FexMember, 2);
+  FexInstallNativeArrayFn(ctx, "nth", FexNth, 2);
+  FexInstallNativeArrayFn(ctx, "reduce", FexReduce, 2);
+  FexInstallNativeArrayFn(ctx, "reverse", FexReverse, 1);
+  FexInstallNativeArrayFn(ctx, "sort", FexSort, 1);
+}
+
+// A list under construction. Only `head` is kept on the GC stack, above `gc`.
+typedef struct Builder {
+  FeContext* ctx;
+  size_t gc;
+  FeObject* head;
+  FeObject* tail;
+} Builder;
+
+static Builder MakeBuilder(FeContext* ctx) {
+  return (Builder){.ctx = ctx, .gc = FeSaveGC(ctx), .head = &nil};
+}
+
+static void Add(Builder* b, FeObject* obj) {
+  FeObject* pair = FeCons(b->ctx, obj, &nil);
+  if (b->tail == NULL) {
+    b->head = pair;
+  } else {
+    FeSetCdr(b->ctx, b->tail, pair);
+  }
+  b->tail = pair;
+  FeRestoreGC(b->ctx, b->gc);
+  FePushGC(b->ctx, b->head);
+}
+
+// `(append list ...)` returns the concatenation of the lists. The last list is
+// shared, not copied.
+FeObject* FexAppend(FeContext* ctx, size_t argc, FeObject** argv) {
+  if (argc == 0) {
+    return &nil;
+  }
+  Builder b = MakeBuilder(ctx);
+  for (size_t i = 0; i + 1 < argc; i++) {
+    for (FeObject* p = argv[i]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+      Add(&b, FeCar(ctx, p));
+    }
+  }
+  if (b.tail == NULL) {
+    return argv[argc - 1];
+  }
+  FeSetCdr(ctx, b.tail, argv[argc - 1]);
+  return b.head;
+}
+
+// `(assoc key alist)` returns the first pair in `alist` whose `car` is `key`,
+// in the sense of `is`, or `nil`.
+FeObject* FexAssoc(FeContext* ctx, size_t, FeObject** argv) {
+  for (FeObject* p = argv[1]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    FeObject* pair = FeCar(ctx, p);
+    if (FeGetType(pair) == FeTPair && FeIsEqual(FeCar(ctx, pair), argv[0])) {
+      return pair;
+    }
+  }
+  return &nil;
+}
+
+// `(filter fn list)` returns the elements of `list` for which `(fn x)` is not
+// `nil`.
+FeObject* FexFilter(FeContext* ctx, size_t, FeObject** argv) {
+  Builder b = MakeBuilder(ctx);
+  for (FeObject* p = argv[1]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    FeObject* x = FeCar(ctx, p);
+    if (!FeIsNil(FeInvoke(ctx, argv[0], 1, &x))) {
+      Add(&b, x);
+    } else {
+      FeRestoreGC(ctx, b.gc);
+      FePushGC(ctx, b.head);
+    }
+  }
+  return b.head;
+}
+
+// `(last list)` returns the last pair of `list`, or `nil` if it is empty.
+FeObject* FexLast(FeContext* ctx, size_t, FeObject** argv) {
+  FeObject* p = argv[0];
+  if (FeIsNil(p)) {
+    return &nil;
+  }
+  for (FeObject* next = FeCdr(ctx, p); FeGetType(next) == FeTPair;
+       next = FeCdr(ctx, next)) {
+    p = next;
+  }
+  return p;
+}
+
+// `(length list)` returns the number of elements of `list`.
+FeObject* FexLength(FeContext* ctx, size_t, FeObject** argv) {
+  size_t n = 0;
+  for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    n++;
+  }
+  return FeMakeDouble(ctx, (FeDouble)n);
+}
+
+// `(map fn list)` returns the list of `(fn x)` for each element `x` of `list`.
+FeObject* FexMap(FeContext* ctx, size_t, FeObject** argv) {
+  Builder b = MakeBuilder(ctx);
+  for (FeObject* p = argv[1]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    FeObject* x = FeCar(ctx, p);
+    Add(&b, FeInvoke(ctx, argv[0], 1, &x));
+  }
+  return b.head;
+}
+
+// `(member x list)` returns the first tail of `list` whose `car` is `x`, in the
+// sense of `is`, or `nil`.
+FeObject* FexMember(FeContext* ctx, size_t, FeObject** argv) {
+  for (FeObject* p = argv[1]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    if (FeIsEqual(FeCar(ctx, p), argv[0])) {
+      return p;
+    }
+  }
+  return &nil;
+}
+
+// `(nth n list)` returns element `n`, counting from 0, of `list`, or `nil` if
+// there is none.
+FeObject* FexNth(FeContext* ctx, size_t, FeObject** argv) {
+  const FeDouble n = FeToDouble(ctx, argv[0]);
+  if (!(n >= 0)) {
+    return &nil;
+  }
+  FeObject* p = argv[1];
+  for (FeDouble i = 0; i + 1 <= n && !FeIsNil(p); i++) {
+    p = FeCdr(ctx, p);
+  }
+  return FeIsNil(p) ? &nil : FeCar(ctx, p);
+}
+
+// `(reduce fn list [initial])` combines the elements of `list` from the left
+// with `(fn accumulated x)`, starting with `initial` or, without it, the first
+// element. An empty list without `initial` reduces to `nil`.
+FeObject* FexReduce(FeContext* ctx, size_t argc, FeObject** argv) {
+  FeObject* p = argv[1];
+  FeObject* acc = &nil;
+  if (argc > 2) {
+    acc = argv[2];
+  } else if (!FeIsNil(p)) {
+    acc = FeCar(ctx, p);
+    p = FeCdr(ctx, p);
+  }
+  const size_t gc = FeSaveGC(ctx);
+  for (; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    FeObject* args[] = {acc, FeCar(ctx, p)};
+    acc = FeInvoke(ctx, argv[0], 2, args);
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, acc);
+  }
+  return acc;
+}
+
+// `(reverse list)` returns a new list of the elements of `list` in reverse
+// order.
+FeObject* FexReverse(FeContext* ctx, size_t, FeObject** argv) {
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* result = &nil;
+  for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    result = FeCons(ctx, FeCar(ctx, p), result);
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, result);
+  }
+  return result;
+}
+
+typedef enum Order {
+  OrderNumbers,
+  OrderStrings,
+  OrderFn,
+} Order;
+
+typedef struct Sorter {
+  FeContext* ctx;
+  Order order;
+  FeObject* less;
+  // While a comparison function runs, the GC must be able to reach every cell,
+  // so the pieces of the list are kept on the GC stack: the unsorted rest and
+  // the sorted runs from `gc`, and the two merge inputs and the merge output
+  // from `merge_gc`.
+  size_t gc;
+  size_t merge_gc;
+} Sorter;
+
+enum {
+  // Run `i` holds 2^i cells, so 64 runs are enough for any list.
+  RunCount = 64,
+};
+
+// Returns whether `b` sorts before `a`.
+static bool IsBefore(Sorter* s, FeObject* b, FeObject* a) {
+  FeContext* ctx = s->ctx;
+  b = FeCar(ctx, b);
+  a = FeCar(ctx, a);
+  switch (s->order) {
+    case OrderNumbers:
+      return FeToDouble(ctx, b) < FeToDouble(ctx, a);
+    case OrderStrings:
+      return FeCompareStrings(ctx, b, a) < 0;
+    case OrderFn: {
+      FeObject* argv[] = {b, a};
+      const bool before = !FeIsNil(FeInvoke(ctx, s->less, 2, argv));
+      FeRestoreGC(ctx, s->merge_gc);
+      return before;
+    }
+  }
+}
+
+// Merges the sorted lists `a` and `b`, where `a` holds the earlier cells, so
+// that equal cells keep their order.
+static FeObject* Merge(Sorter* s, FeObject* a, FeObject* b) {
+  FeContext* ctx = s->ctx;
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  while (!FeIsNil(a) && !FeIsNil(b)) {
+    if (s->order == OrderFn) {
+      FeRestoreGC(ctx, s->gc);
+      FePushGC(ctx, head);
+      FePushGC(ctx, a);
+      FePushGC(ctx, b);
+      s->merge_gc = FeSaveGC(ctx);
+    }
+    FeObject* next;
+    if (IsBefore(s, b, a)) {
+      next = b;
+      b = FeCdr(ctx, b);
+    } else {
+      next = a;
+      a = FeCdr(ctx, a);
+    }
+    if (tail == NULL) {
+      head = next;
+    } else {
+      FeSetCdr(ctx, tail, next);
+    }
+    tail = next;
+  }
+  FeObject* rest = FeIsNil(a) ? b : a;
+  if (tail == NULL) {
+    return rest;
+  }
+  FeSetCdr(ctx, tail, rest);
+  return head;
+}
+
+static void PushRuns(Sorter* s,
+                     size_t base,
+                     FeObject* list,
+                     FeObject** runs,
+                     size_t run_count) {
+  if (s->order != OrderFn) {
+    return;
+  }
+  FeRestoreGC(s->ctx, base);
+  FePushGC(s->ctx, list);
+  for (size_t i = 0; i < run_count; i++) {
+    FePushGC(s->ctx, runs[i]);
+  }
+  s->gc = FeSaveGC(s->ctx);
+}
+
+// Sorts `list` by relinking its cells, without allocating, using a bottom-up
+// merge sort: each cell is merged into a run of 1, and whenever there are two
+// runs of the same length, they are merged.
+static FeObject* Sort(Sorter* s, FeObject* list) {
+  FeContext* ctx = s->ctx;
+  const size_t base = FeSaveGC(ctx);
+  FeObject* runs[RunCount];
+  size_t run_count = 0;
+  while (!FeIsNil(list)) {
+    FeObject* run = list;
+    list = FeCdr(ctx, list);
+    FeSetCdr(ctx, run, &nil);
+    PushRuns(s, base, list, runs, run_count);
+    size_t i = 0;
+    for (; i < run_count && !FeIsNil(runs[i]); i++) {
+      run = Merge(s, runs[i], run);
+      runs[i] = &nil;
+    }
+    if (i == run_count) {
+      run_count++;
+    }
+    runs[i] = run;
+  }
+  FeObject* result = &nil;
+  for (size_t i = 0; i < run_count; i++) {
+    PushRuns(s, base, result, runs, run_count);
+    result = Merge(s, runs[i], result);
+    runs[i] = &nil;
+  }
+  FeRestoreGC(ctx, base);
+  return result;
+}
+
+// `(sort list [less])` sorts `list` in place, and returns its new first cell.
+// The sort is stable. Without `less`, `list` must be all numbers or all
+// strings, which are compared without calling back into Fe; otherwise,
+// `(less a b)` returns whether `a` sorts before `b`. Since the cells are
+// relinked as the sort goes, if `less` raises an error, what `list` refers to
+// afterward is undefined: it may hold only some of the elements, in any order.
+// Sort a copy of a list that must survive such an error.
+FeObject* FexSort(FeContext* ctx, size_t argc, FeObject** argv) {
+  Sorter s = {.ctx = ctx, .order = OrderFn};
+  if (argc > 1) {
+    s.less = argv[1];
+  } else if (!FeIsNil(argv[0])) {
+    const FeType type = FeGetType(FeCar(ctx, argv[0]));
+    if (type != FeTDouble && type != FeTString) {
+      FeHandleError(ctx, "sort needs a comparison function for this list");
+    }
+    s.order = type == FeTDouble ? OrderNumbers : OrderStrings;
+    // Check every element first, so that an error does not leave the list
+    // half-sorted.
+    for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+      if (FeGetType(FeCar(ctx, p)) != type) {
+        FeHandleError(ctx, "sort needs a comparison function for this list");
+      }
+    }
+  }
+  return Sort(&s, argv[0]);
+}
@@ -0,0 +1,23 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_LIST_H
+#define FEX_LIST_H
+
+#include "fe.h"
+
+void FexInstallList(FeContext* ctx);
+
+FeObject* FexAppend(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexAssoc(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexFilter(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexLast(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexLength(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMap(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMember(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexNth(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReduce(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReverse(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSort(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
@@ -8,26 +8,11 @@
 
 void FexInstallMath(FeContext* ctx);
 
-FeObject* FexAbs(FeContext* ctx, FeObject* arg);
-FeObject* FexCeiling(FeContext* ctx, FeObject* arg);
-FeObject* FexCubeRoot(FeContext* ctx, FeObject* arg);
-FeObject* FexFloor(FeContext* ctx, FeObject* arg);
-FeObject* FexHypotenuse(FeContext* ctx, FeObject* arg);
-FeObject* FexIsFinite(FeContext* ctx, FeObject* arg);
-FeObject* FexIsInfinite(FeContext* ctx, FeObject* arg);
-FeObject* FexIsNaN(FeContext* ctx, FeObject* arg);
-FeObject* FexIsNormal(FeContext* ctx, FeObject* arg);
-FeObject* FexLg(FeContext* ctx, FeObject* arg);
-FeObject* FexLog(FeContext* ctx, FeObject* arg);
-FeObject* FexMax(FeContext* ctx, FeObject* arg);
-FeObject* FexMin(FeContext* ctx, FeObject* arg);
-FeObject* FexModulus(FeContext* ctx, FeObject* arg);
-FeObject* FexNearbyInt(FeContext* ctx, FeObject* arg);
-FeObject* FexPow(FeContext* ctx, FeObject* arg);
-FeObject* FexRemainder(FeContext* ctx, FeObject* arg);
-FeObject* FexRound(FeContext* ctx, FeObject* arg);
-FeObject* FexRoundToInt(FeContext* ctx, FeObject* arg);
-FeObject* FexSquareRoot(FeContext* ctx, FeObject* arg);
-FeObject* FexTruncate(FeContext* ctx, FeObject* arg);
+FeObject* FexIsFinite(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexIsInfinite(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexIsNaN(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexIsNormal(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexNearbyInt(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexRoundToInt(FeContext* ctx, size_t argc, FeObject** argv);
 
 #endif
@@ -0,0 +1,269 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdnoreturn.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fex.h"
+#include "fex_parallel.h"
+
+void FexInstallParallel(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "pmap", FexParallelMap, 2);
+}
+
+// The state shared by the workers of one `pmap` call. The workers only read
+// the parent context (via `FeCopy`) while the parent waits for them.
+typedef struct Map {
+  FeObject* fn;
+  FeObject** items;
+  // Each result lives in the arena of the worker that computed it.
+  FeObject** results;
+  size_t count;
+  atomic_size_t next;
+  atomic_bool failed;
+} Map;
+
+typedef struct Worker {
+  Map* map;
+  char* arena;
+  FeContext* ctx;
+  pthread_t thread;
+  bool started;
+  bool failed;
+  char error[128];
+} Worker;
+
+static _Thread_local jmp_buf worker_top_level;
+static _Thread_local Worker* current_worker;
+
+static void noreturn HandleWorkerError(FeContext*,
+                                       const char* message,
+                                       FeObject*) {
+  snprintf(current_worker->error, sizeof(current_worker->error), "%s", message);
+  longjmp(worker_top_level, -1);
+}
+
+static void* RunWorker(void* w) {
+  Worker* worker = w;
+  Map* map = worker->map;
+  FeContext* ctx = worker->ctx;
+  current_worker = worker;
+  if (setjmp(worker_top_level) != 0) {
+    worker->failed = true;
+    atomic_store_explicit(&map->failed, true, memory_order_relaxed);
+    return NULL;
+  }
+
+  FeObject* fn = FePrepareCall(ctx, FeCopy(ctx, map->fn));
+  // Keeps this worker's results reachable until the parent copies them out:
+  FeObject* results = &nil;
+  const size_t gc = FeSaveGC(ctx);
+  while (!atomic_load_explicit(&map->failed, memory_order_relaxed)) {
+    const size_t i =
+        atomic_fetch_add_explicit(&map->next, 1, memory_order_relaxed);
+    if (i >= map->count) {
+      break;
+    }
+    FeObject* item = FeCopy(ctx, map->items[i]);
+    map->results[i] = FeInvoke(ctx, fn, 1, &item);
+    results = FeCons(ctx, map->results[i], results);
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, results);
+  }
+  return NULL;
+}
+
+static void CloseWorkers(Worker* workers, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (workers[i].ctx != NULL) {
+      FeCloseContext(workers[i].ctx);
+    }
+    free(workers[i].arena);
+  }
+  free(workers);
+}
+
+// Workers hold only the function, the globals it uses, and their share of the
+// elements and results, so by default they split the parent's arena size among
+// them, but no worker gets less than this.
+static const size_t MinimumWorkerArenaSize = 256 * 1024;
+
+// Where an error while copying the results back into the parent goes, so that
+// the workers can still be closed before it is raised.
+typedef struct CopyError {
+  jmp_buf jump;
+  char message[128];
+} CopyError;
+
+static _Thread_local CopyError* copy_error;
+
+static void noreturn HandleCopyError(FeContext*,
+                                     const char* message,
+                                     FeObject*) {
+  snprintf(copy_error->message, sizeof(copy_error->message), "%s", message);
+  longjmp(copy_error->jump, -1);
+}
+
+// Returns the list of the results, copied into `ctx`, or `NULL` with the error
+// in `message` if a result cannot be copied (such as an `FePtr`). The copy is
+// made on a GC stack of its own, so that an error leaves `ctx` as it was.
+static FeObject* CopyResults(FeContext* ctx,
+                             const Map* map,
+                             char* message,
+                             size_t size) {
+  FeObject* objects[16];
+  FeStack stack = {.objects = objects, .size = 16};
+  FeStack saved;
+  FeHandlers* handlers = FeGetHandlers(ctx);
+  FeErrorFn* const handler = handlers->error;
+  CopyError* const outer = copy_error;
+  CopyError error;
+  copy_error = &error;
+  handlers->error = HandleCopyError;
+  FeEnterStack(ctx, &saved, &stack);
+  FeObject* volatile result = NULL;
+  if (setjmp(error.jump) == 0) {
+    FeObject* list = &nil;
+    for (size_t i = map->count; i-- > 0;) {
+      list = FeCons(ctx, FeCopy(ctx, map->results[i]), list);
+      FeRestoreGC(ctx, 0);
+      FePushGC(ctx, list);
+    }
+    result = list;
+  } else {
+    snprintf(message, size, "%s", error.message);
+  }
+  FeLeaveStack(ctx, &stack, &saved);
+  handlers->error = handler;
+  copy_error = outer;
+  if (result != NULL) {
+    FePushGC(ctx, result);
+  }
+  return result;
+}
+
+static size_t GetDefaultThreadCount(void) {
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (size_t)n : 1;
+}
+
+// `(pmap fn list [threads [arena-size]])` calls `fn` on each element of
+// `list`, using a pool of worker threads that each have their own context and
+// arena. The elements and `fn` (with its closure, and the global functions and
+// values it uses) are copied into the workers, and the results are copied
+// back. `fn` must therefore not depend on side effects, and neither it nor the
+// elements may contain `FePtr`s such as files. Each worker is set up with
+// `FexInit`, so `fn` may make its own regular expressions and generators.
+FeObject* FexParallelMap(FeContext* ctx, size_t argc, FeObject** argv) {
+  FeObject* fn = argv[0];
+  FeObject* list = argv[1];
+  size_t thread_count = GetDefaultThreadCount();
+  if (argc > 2) {
+    const double n = FeToDouble(ctx, argv[2]);
+    if (!(n >= 1)) {
+      FeHandleError(ctx, "thread count must be at least 1");
+    }
+    thread_count = (size_t)n;
+  }
+  size_t arena_size = 0;
+  if (argc > 3) {
+    const double n = FeToDouble(ctx, argv[3]);
+    if (!(n >= (double)MinimumWorkerArenaSize)) {
+      FeHandleError(ctx, "worker arena size must be at least 256 KiB");
+    }
+    arena_size = (size_t)n;
+  }
+
+  size_t count = 0;
+  for (FeObject* o = list; !FeIsNil(o); o = FeCdr(ctx, o)) {
+    count++;
+  }
+  if (count == 0) {
+    return &nil;
+  }
+  if (thread_count > count) {
+    thread_count = count;
+  }
+
+  Map map = {.fn = fn,
+             .items = calloc(count, sizeof(FeObject*)),
+             .results = calloc(count, sizeof(FeObject*)),
+             .count = count};
+  atomic_init(&map.next, 0);
+  atomic_init(&map.failed, false);
+  Worker* workers = calloc(thread_count, sizeof(Worker));
+  if (map.items == NULL || map.results == NULL || workers == NULL) {
+    free(map.items);
+    free(map.results);
+    free(workers);
+    FeHandleError(ctx, "out of memory");
+  }
+  size_t i = 0;
+  for (FeObject* o = list; !FeIsNil(o); o = FeCdr(ctx, o)) {
+    map.items[i++] = FeCar(ctx, o);
+  }
+
+  if (arena_size == 0) {
+    arena_size = FeGetArenaSize(ctx) / thread_count;
+    if (arena_size < MinimumWorkerArenaSize) {
+      arena_size = MinimumWorkerArenaSize;
+    }
+  }
+  const char* error = NULL;
+  for (i = 0; i < thread_count; i++) {
+    Worker* worker = &workers[i];
+    worker->map = &map;
+    worker->arena = malloc(arena_size);
+    if (worker->arena == NULL) {
+      error = "out of memory";
+      break;
+    }
+    worker->ctx = FeOpenContext(worker->arena, arena_size);
+    *FeGetStreams(worker->ctx) = *FeGetStreams(ctx);
+    FeGetHandlers(worker->ctx)->error = HandleWorkerError;
+    FexInit(worker->ctx);
+    // Keeps the names of any types the embedder has added, too.
+    for (FeType t = FeTPair; t < FeTSentinel; t++) {
+      FeSetTypeName(worker->ctx, t, FeGetTypeName(ctx, t));
+    }
+    worker->started =
+        pthread_create(&worker->thread, NULL, RunWorker, worker) == 0;
+    if (!worker->started) {
+      error = "could not start thread";
+      atomic_store_explicit(&map.failed, true, memory_order_relaxed);
+      break;
+    }
+  }
+  for (i = 0; i < thread_count; i++) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    if (workers[i].failed && error == NULL) {
+      error = workers[i].error;
+    }
+  }
+
+  // The workers are closed only once their results are copied, and errors are
+  // raised only once they are closed.
+  char message[128];
+  FeObject* result = NULL;
+  if (error == NULL) {
+    result = CopyResults(ctx, &map, message, sizeof(message));
+  } else {
+    snprintf(message, sizeof(message), "%s", error);
+  }
+  CloseWorkers(workers, thread_count);
+  free(map.items);
+  free(map.results);
+  if (result == NULL) {
+    FeHandleError(ctx, message);
+  }
+  return result;
+}
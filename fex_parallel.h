@@ -0,0 +1,13 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_PARALLEL_H
+#define FEX_PARALLEL_H
+
+#include "fe.h"
+
+void FexInstallParallel(FeContext* ctx);
+
+FeObject* FexParallelMap(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
@@ -1,9 +1,15 @@
 // Copyright 2024 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: MIT
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,48 +18,525 @@
 #include "fex.h"
 #include "fex_process.h"
 
+extern char** environ;
+
 void FexInstallProcess(FeContext* ctx) {
-  FexInstallNativeFn(ctx, "execute", FexExecute);
+  FexInstallNativeArrayFn(ctx, "$", FexCaptureOutput, 1);
+  FexInstallNativeArrayFn(ctx, "capture", FexCapture, 1);
+  FexInstallNativeArrayFn(ctx, "execute", FexExecute, 1);
+  FexInstallNativeArrayFn(ctx, "run-jobs", FexRunJobs, 2);
+}
+
+typedef struct Buffer {
+  char* data;
+  size_t size;
+  size_t capacity;
+} Buffer;
+
+// A child process, and the output captured from it.
+typedef struct Job {
+  // The program and its arguments, terminated by `NULL`.
+  char** arguments;
+  pid_t pid;
+  // The read ends of the pipes from the child's standard output and error, or
+  // -1 if not captured or closed.
+  int fds[2];
+  Buffer output[2];
+  int status;
+  // The `errno` value if the job could not be run, or its output could not be
+  // stored.
+  int error;
+} Job;
+
+void FexFreeArguments(char** arguments) {
+  if (arguments == NULL) {
+    return;
+  }
+  for (char** a = arguments; *a != NULL; a++) {
+    free(*a);
+  }
+  free(arguments);
+}
+
+static void FreeJob(Job* j) {
+  FexFreeArguments(j->arguments);
+  free(j->output[0].data);
+  free(j->output[1].data);
+}
+
+// Jobs whose results are being built. Building them allocates, and so may
+// raise an error, which would unwind past the code that frees the jobs, so
+// while they are built, the error handler frees them before it goes on.
+typedef struct Results {
+  Job* jobs;
+  size_t count;
+  // Whether `jobs` was allocated, and is freed with them.
+  bool allocated;
+  FeErrorFn* handler;
+} Results;
+
+static _Thread_local Results* results;
+
+// Frees the jobs of `r`, and puts back the error handler.
+static void EndResults(FeContext* ctx, Results* r) {
+  FeGetHandlers(ctx)->error = r->handler;
+  results = NULL;
+  for (size_t i = 0; i < r->count; i++) {
+    FreeJob(&r->jobs[i]);
+  }
+  if (r->allocated) {
+    free(r->jobs);
+  }
+}
+
+static void HandleResultsError(FeContext* ctx,
+                               const char* message,
+                               FeObject* calls) {
+  Results* r = results;
+  EndResults(ctx, r);
+  if (r->handler != NULL) {
+    r->handler(ctx, message, calls);
+  }
+}
+
+static void BeginResults(FeContext* ctx, Results* r) {
+  FeHandlers* handlers = FeGetHandlers(ctx);
+  r->handler = handlers->error;
+  handlers->error = HandleResultsError;
+  results = r;
+}
+
+void FexCheckCommand(FeContext* ctx, size_t argc, FeObject** argv) {
+  for (size_t i = 0; i < argc; i++) {
+    if (FeGetType(argv[i]) != FeTString) {
+      FeHandleError(ctx, "not a string");
+    }
+  }
+}
+
+// Returns a copy of the string `o`, of any length, or `NULL`.
+static char* CopyString(FeContext* ctx, FeObject* o) {
+  size_t size = 0;
+  for (FeObject* p = o; !FeIsNil(p);) {
+    const char* chunk;
+    size += FeGetStringChunk(ctx, &p, &chunk);
+  }
+  char* s = malloc(size + 1);
+  if (s != NULL) {
+    (void)FeToString(ctx, o, s, size + 1);
+  }
+  return s;
+}
+
+char** FexCopyArguments(FeContext* ctx, size_t argc, FeObject** argv) {
+  char** arguments = calloc(argc + 1, sizeof(char*));
+  if (arguments == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < argc; i++) {
+    arguments[i] = CopyString(ctx, argv[i]);
+    if (arguments[i] == NULL) {
+      FexFreeArguments(arguments);
+      return NULL;
+    }
+  }
+  return arguments;
+}
+
+static int GetStatus(int status) {
+  if (WIFSIGNALED(status)) {
+    // As the shell reports it.
+    return 128 + WTERMSIG(status);
+  }
+  return WEXITSTATUS(status);
+}
+
+static int Wait(Job* j) {
+  int status;
+  while (waitpid(j->pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      return errno;
+    }
+  }
+  j->status = GetStatus(status);
+  return 0;
 }
 
-FeObject* FexExecute(FeContext* ctx, FeObject* arg) {
-  enum { MaxArgumentCount = 31 };
-  char* arguments[MaxArgumentCount + 1] = {NULL};
-  size_t i;
-  for (i = 0; i < MaxArgumentCount; i++) {
-    if (FeIsNil(arg)) {
+int FexSpawn(FeContext* ctx,
+             char** arguments,
+             const bool pipes[3],
+             int fds[3],
+             pid_t* pid) {
+  // Output that the program has buffered goes before the child's.
+  FeStreams* streams = FeGetStreams(ctx);
+  (void)fflush(streams->output);
+  (void)fflush(streams->error);
+
+  // The child reads standard input from the read end of its pipe, and writes
+  // the others to the write end.
+  int ends[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+  posix_spawn_file_actions_t actions;
+  int error = posix_spawn_file_actions_init(&actions);
+  if (error != 0) {
+    return error;
+  }
+  for (int i = 0; i < 3 && error == 0; i++) {
+    if (!pipes[i]) {
+      continue;
+    }
+    // The pipes are close-on-exec, so that children started later do not
+    // inherit them and keep them open; `dup2` clears the flag on the copy.
+    if (pipe2(ends[i], O_CLOEXEC) != 0) {
+      error = errno;
       break;
     }
-    FeObject* a = FeGetNextArgument(ctx, &arg);
-    const FeType type = FeGetType(a);
-    if (type != FeTString) {
-      FeHandleError(ctx, "not a string");
+    error = posix_spawn_file_actions_adddup2(&actions, ends[i][i == 0 ? 0 : 1],
+                                             STDIN_FILENO + i);
+  }
+  // Signals that Fe handles with the event loop are blocked, but the child
+  // starts with none blocked.
+  posix_spawnattr_t attributes;
+  if (error == 0) {
+    error = posix_spawnattr_init(&attributes);
+  }
+  if (error == 0) {
+    sigset_t mask;
+    (void)sigemptyset(&mask);
+    (void)posix_spawnattr_setsigmask(&attributes, &mask);
+    (void)posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+    error = posix_spawnp(pid, arguments[0], &actions, &attributes, arguments,
+                         environ);
+    (void)posix_spawnattr_destroy(&attributes);
+  }
+  (void)posix_spawn_file_actions_destroy(&actions);
+  for (int i = 0; i < 3; i++) {
+    const int child = ends[i][i == 0 ? 0 : 1];
+    const int parent = ends[i][i == 0 ? 1 : 0];
+    if (child != -1) {
+      (void)close(child);
+    }
+    if (error == 0) {
+      fds[i] = parent;
+    } else if (parent != -1) {
+      (void)close(parent);
+    }
+  }
+  return error;
+}
+
+// Starts `j`, with its standard output and error connected to pipes where
+// `capture[0]` and `capture[1]` are true. Returns 0 or an `errno` value.
+static int Spawn(FeContext* ctx, Job* j, const bool capture[2]) {
+  int fds[3];
+  const int error = FexSpawn(
+      ctx, j->arguments, (bool[]){false, capture[0], capture[1]}, fds, &j->pid);
+  j->fds[0] = error == 0 ? fds[1] : -1;
+  j->fds[1] = error == 0 ? fds[2] : -1;
+  return error;
+}
+
+// Reads what is available from pipe `i` of `j`, closing it at the end.
+static void Drain(Job* j, int i) {
+  Buffer* b = &j->output[i];
+  if (b->capacity - b->size < 4096 && j->error == 0) {
+    const size_t capacity = b->capacity < 4096 ? 8192 : 2 * b->capacity;
+    char* data = realloc(b->data, capacity);
+    if (data == NULL) {
+      j->error = ENOMEM;
+    } else {
+      b->data = data;
+      b->capacity = capacity;
+    }
+  }
+  // Once the output cannot be stored, keep reading it, so that the child does
+  // not block, but discard it.
+  char discard[4096];
+  const bool keep = j->error == 0;
+  const ssize_t n =
+      keep ? read(j->fds[i], b->data + b->size, b->capacity - b->size)
+           : read(j->fds[i], discard, sizeof(discard));
+  if (n > 0) {
+    b->size += keep ? (size_t)n : 0;
+  } else if (n == 0 || errno != EINTR) {
+    (void)close(j->fds[i]);
+    j->fds[i] = -1;
+  }
+}
+
+// Kills and reaps the jobs of the first `started` that are still running, and
+// marks them and the jobs not yet started as failed with `error`.
+static void FailJobs(Job* jobs, size_t started, size_t count, int error) {
+  for (size_t i = 0; i < count; i++) {
+    Job* j = &jobs[i];
+    if (i < started && j->pid == 0) {
+      // It has finished, or could not be started.
+      continue;
+    }
+    if (i < started) {
+      (void)kill(j->pid, SIGKILL);
+      for (int k = 0; k < 2; k++) {
+        if (j->fds[k] != -1) {
+          (void)close(j->fds[k]);
+          j->fds[k] = -1;
+        }
+      }
+      (void)Wait(j);
+      j->pid = 0;
+    }
+    if (j->error == 0) {
+      j->error = error;
+    }
+  }
+}
+
+// Runs the `count` jobs, at most `limit` at a time, capturing the outputs
+// selected by `capture`. Each job that finishes makes room for the next, and
+// the pipes of all the running jobs are read as their output arrives, so that
+// none blocks on a full pipe. Returns 0, or the `errno` value with which
+// `poll` failed, in which case the jobs have all been stopped and failed.
+static int RunJobs(FeContext* ctx,
+                   Job* jobs,
+                   size_t count,
+                   size_t limit,
+                   const bool capture[2],
+                   struct pollfd* fds,
+                   size_t* owners) {
+  size_t next = 0;
+  size_t running = 0;
+  while (next < count || running > 0) {
+    for (; next < count && running < limit; next++) {
+      Job* j = &jobs[next];
+      j->error = Spawn(ctx, j, capture);
+      if (j->error == 0) {
+        running++;
+      }
+    }
+
+    // Reap the jobs whose pipes are all closed, and watch the others.
+    size_t n = 0;
+    for (size_t i = 0; i < next; i++) {
+      Job* j = &jobs[i];
+      if (j->pid == 0) {
+        continue;
+      }
+      if (j->fds[0] == -1 && j->fds[1] == -1) {
+        const int error = Wait(j);
+        if (j->error == 0) {
+          j->error = error;
+        }
+        j->pid = 0;
+        running--;
+        continue;
+      }
+      for (int k = 0; k < 2; k++) {
+        if (j->fds[k] != -1) {
+          fds[n] = (struct pollfd){.fd = j->fds[k], .events = POLLIN};
+          owners[n++] = i * 2 + (size_t)k;
+        }
+      }
+    }
+    if (n == 0) {
+      continue;
+    }
+    if (poll(fds, n, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      const int error = errno;
+      FailJobs(jobs, next, count, error);
+      return error;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (fds[i].revents != 0) {
+        Drain(&jobs[owners[i] / 2], (int)(owners[i] % 2));
+      }
     }
-    char string[1024];
-    FeToString(ctx, a, string, sizeof(string));
-    arguments[i] = strdup(string);
   }
+  return 0;
+}
+
+static FeObject* MakeOutput(FeContext* ctx, const Buffer* b) {
+  FeObject* s = FeMakeString(ctx, "");
+  if (b->size > 0) {
+    (void)FeAppendString(ctx, s, b->data, b->size);
+  }
+  return s;
+}
+
+// Returns the `(status output error-output)` list of `j`, or an error list.
+static FeObject* BuildResult(FeContext* ctx, const Job* j) {
+  if (j->error != 0) {
+    return BuildErrnoError(ctx, j->error);
+  }
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* result =
+      FeMakeList(ctx,
+                 (FeObject*[]){FeMakeDouble(ctx, (FeDouble)j->status),
+                               MakeOutput(ctx, &j->output[0]),
+                               MakeOutput(ctx, &j->output[1])},
+                 3);
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, result);
+  return result;
+}
 
-  if (i == 0) {
-    FeHandleError(ctx, "not enough arguments");
+// Runs the single command `argv`, capturing the outputs selected by `capture`.
+// If the command cannot be waited for, frees `j` and raises an error.
+static void RunCommand(FeContext* ctx,
+                       size_t argc,
+                       FeObject** argv,
+                       const bool capture[2],
+                       Job* j) {
+  FexCheckCommand(ctx, argc, argv);
+  *j = (Job){.arguments = FexCopyArguments(ctx, argc, argv)};
+  if (j->arguments == NULL) {
+    FeHandleError(ctx, "out of memory");
+    return;
+  }
+  struct pollfd fds[2];
+  size_t owners[2];
+  const int error = RunJobs(ctx, j, 1, 1, capture, fds, owners);
+  if (error != 0) {
+    FreeJob(j);
+    FexHandleErrnoError(ctx, error);
   }
+}
+
+// `(execute program argument...)` runs `program`, found in `PATH` as by the
+// shell, with the standard streams of Fe, and returns its exit status (128 plus
+// the signal number, if a signal killed it), or an error list.
+FeObject* FexExecute(FeContext* ctx, size_t argc, FeObject** argv) {
+  Job j;
+  RunCommand(ctx, argc, argv, (bool[]){false, false}, &j);
+  Results r = {.jobs = &j, .count = 1};
+  BeginResults(ctx, &r);
+  FeObject* result = j.error != 0 ? BuildErrnoError(ctx, j.error)
+                                  : FeMakeDouble(ctx, (FeDouble)j.status);
+  EndResults(ctx, &r);
+  return result;
+}
+
+// `(capture program argument...)` runs `program` and returns the list
+// `(status output error-output)` of its exit status, and what it wrote to its
+// standard output and error, or an error list.
+FeObject* FexCapture(FeContext* ctx, size_t argc, FeObject** argv) {
+  Job j;
+  RunCommand(ctx, argc, argv, (bool[]){true, true}, &j);
+  Results r = {.jobs = &j, .count = 1};
+  BeginResults(ctx, &r);
+  FeObject* result = BuildResult(ctx, &j);
+  EndResults(ctx, &r);
+  return result;
+}
 
-  int status = -1;
-  const pid_t child = fork();
-  if (child == 0) {
-    execvp(arguments[0], arguments);
-  } else if (child == -1) {
-    perror("fork");
+// `($ program argument...)` runs `program` and returns what it wrote to its
+// standard output, without trailing newlines, like `$(...)` in the shell. Its
+// standard error is Fe's.
+FeObject* FexCaptureOutput(FeContext* ctx, size_t argc, FeObject** argv) {
+  Job j;
+  RunCommand(ctx, argc, argv, (bool[]){true, false}, &j);
+  Results r = {.jobs = &j, .count = 1};
+  BeginResults(ctx, &r);
+  FeObject* result;
+  if (j.error != 0) {
+    result = BuildErrnoError(ctx, j.error);
   } else {
-    if (waitpid(child, &status, 0) == -1) {
-      perror("waitpid");
-    } else {
-      status = WEXITSTATUS(status);
+    Buffer* b = &j.output[0];
+    while (b->size > 0 && b->data[b->size - 1] == '\n') {
+      b->size--;
+    }
+    result = MakeOutput(ctx, b);
+  }
+  EndResults(ctx, &r);
+  return result;
+}
+
+// `(run-jobs limit commands)` runs each command in the list `commands`, a list
+// of a program and its arguments, with at most `limit` running at once. It
+// returns the list of their results, in the order of `commands`, each a
+// `(status output error-output)` list as from `capture`, or an error list.
+FeObject* FexRunJobs(FeContext* ctx, size_t, FeObject** argv) {
+  const FeDouble limit = FeToDouble(ctx, argv[0]);
+  if (!(limit >= 1)) {
+    FeHandleError(ctx, "limit must be at least 1");
+    return &nil;
+  }
+
+  // Check every command before starting any.
+  size_t count = 0;
+  for (FeObject* c = argv[1]; !FeIsNil(c); c = FeCdr(ctx, c), count++) {
+    FeObject* command = FeCar(ctx, c);
+    if (FeIsNil(command)) {
+      FeHandleError(ctx, "empty command");
+    }
+    for (FeObject* a = command; !FeIsNil(a); a = FeCdr(ctx, a)) {
+      FeObject* argument = FeCar(ctx, a);
+      FexCheckCommand(ctx, 1, &argument);
     }
   }
+  if (count == 0) {
+    return &nil;
+  }
 
-  for (i = 0; i < MaxArgumentCount && arguments[i] != NULL; i++) {
-    free(arguments[i]);
+  Job* jobs = calloc(count, sizeof(Job));
+  struct pollfd* fds = calloc(2 * count, sizeof(struct pollfd));
+  size_t* owners = calloc(2 * count, sizeof(size_t));
+  bool ok = jobs != NULL && fds != NULL && owners != NULL;
+  size_t i = 0;
+  for (FeObject* c = argv[1]; ok && i < count; c = FeCdr(ctx, c), i++) {
+    FeObject* command = FeCar(ctx, c);
+    size_t argc = 0;
+    for (FeObject* a = command; !FeIsNil(a); a = FeCdr(ctx, a)) {
+      argc++;
+    }
+    FeObject** arguments = calloc(argc, sizeof(FeObject*));
+    ok = arguments != NULL;
+    if (ok) {
+      size_t k = 0;
+      for (FeObject* a = command; !FeIsNil(a); a = FeCdr(ctx, a)) {
+        arguments[k++] = FeCar(ctx, a);
+      }
+      jobs[i].arguments = FexCopyArguments(ctx, argc, arguments);
+      ok = jobs[i].arguments != NULL;
+    }
+    free(arguments);
+  }
+  int error = 0;
+  if (ok) {
+    const size_t n = limit < (FeDouble)count ? (size_t)limit : count;
+    error = RunJobs(ctx, jobs, count, n, (bool[]){true, true}, fds, owners);
+  }
+  free(fds);
+  free(owners);
+  if (!ok || error != 0) {
+    for (i = 0; jobs != NULL && i < count; i++) {
+      FreeJob(&jobs[i]);
+    }
+    free(jobs);
+    if (!ok) {
+      FeHandleError(ctx, "out of memory");
+    }
+    FexHandleErrnoError(ctx, error);
+  }
+
+  // All the children have finished, so errors from here on leave none behind,
+  // and free the jobs.
+  Results r = {.jobs = jobs, .count = count, .allocated = true};
+  BeginResults(ctx, &r);
+  FeObject* head = &nil;
+  FeObject* tail = &nil;
+  const size_t gc = FeSaveGC(ctx);
+  for (i = 0; i < count; i++) {
+    FeObject* pair = FeCons(ctx, BuildResult(ctx, &jobs[i]), &nil);
+    if (FeIsNil(head)) {
+      head = pair;
+    } else {
+      FeSetCdr(ctx, tail, pair);
+    }
+    tail = pair;
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, head);
   }
-  return FeMakeDouble(ctx, (double)status);
+  EndResults(ctx, &r);
+  return head;
 }
@@ -4,10 +4,32 @@
 #ifndef FEX_PROCESS_H
 #define FEX_PROCESS_H
 
+#include <stdbool.h>
+#include <sys/types.h>
+
 #include "fe.h"
 
 void FexInstallProcess(FeContext* ctx);
 
-FeObject* FexExecute(FeContext* ctx, FeObject* arg);
+// Raises an error unless all of `argv` are strings.
+void FexCheckCommand(FeContext* ctx, size_t argc, FeObject** argv);
+// Returns the `NULL`-terminated copy of the strings in `argv`, or `NULL`.
+char** FexCopyArguments(FeContext* ctx, size_t argc, FeObject** argv);
+void FexFreeArguments(char** arguments);
+// Starts the program `arguments[0]`, found in `PATH`, with the
+// `NULL`-terminated `arguments`. Where `pipes[i]` is true, connects its
+// standard input (`i` = 0), output (1), or error (2) to a new pipe, and stores
+// the other end in `fds[i]`; the others are Fe's. Returns 0, or an `errno`
+// value.
+int FexSpawn(FeContext* ctx,
+             char** arguments,
+             const bool pipes[3],
+             int fds[3],
+             pid_t* pid);
+
+FeObject* FexCapture(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexCaptureOutput(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexExecute(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexRunJobs(FeContext* ctx, size_t argc, FeObject** argv);
 
 #endif
@@ -1,25 +1,38 @@
 // Copyright 2024 Chris Palmer, https://noncombatant.org/
 // SPDX-License-Identifier: MIT
 
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
 #include <regex.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "auto.h"
+#include "dfa.h"
 #include "fex.h"
+#include "fex_bytes.h"
 #include "fex_re.h"
 
 void FexInstallRE(FeContext* ctx) {
-  FexInstallNativeFn(ctx, "compile-re", FexCompileRE);
-  FexInstallNativeFn(ctx, "match-re", FexMatchRE);
+  FexInstallNativeArrayFn(ctx, "compile-re", FexCompileRE, 1);
+  FexInstallNativeArrayFn(ctx, "compile-re-set", FexCompileRESet, 1);
+  FexInstallNativeArrayFn(ctx, "for-each-match", FexForEachMatch, 3);
+  FexInstallNativeArrayFn(ctx, "match-all", FexMatchAll, 2);
+  FexInstallNativeArrayFn(ctx, "match-re", FexMatchRE, 2);
+  FexInstallNativeArrayFn(ctx, "match-set", FexMatchSet, 2);
+  FexInstallNativeArrayFn(ctx, "re-cache-stats", FexRECacheStats, 0);
+  FexInstallNativeArrayFn(ctx, "replace-re", FexReplaceRE, 3);
 
   // TODO: Any constants
 }
 
 enum {
   ArbitraryRELengthLimit = 4096,
-  ArbitraryDataLengthLimit = 4 * 1024 * 1024,
-  ArbitraryMatchCount = 16,
+  // The number of compiled patterns that the cache keeps, and the number of
+  // its hash buckets, which must be a power of 2.
+  CacheCapacity = 64,
+  CacheBuckets = 128,
 };
 
 static FeObject* BuildError(FeContext* ctx, int error, regex_t* re) {
@@ -31,53 +44,624 @@ static FeObject* BuildError(FeContext* ctx, int error, regex_t* re) {
       2);
 }
 
-FeObject* FexCompileRE(FeContext* ctx, FeObject* arg) {
-  char pattern[ArbitraryRELengthLimit + 1];
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), pattern, sizeof(pattern));
+// A compiled regular expression, or set of them. regex.h compiles every
+// pattern, which checks its syntax. The DFA engine finds matches and their
+// submatches in linear time, for the patterns it supports, unless the program
+// asked for regex.h alone. It is shared by the `regular-expression`
+// objects compiled from the same patterns, and by the cache.
+typedef struct Regex {
+  size_t refs;
+  size_t count;
+  bool set;
+  regex_t* posix;
+  Dfa* dfa;
+} Regex;
+
+static void FreeRegex(Regex* re) {
+  for (size_t i = 0; i < re->count; i++) {
+    regfree(&re->posix[i]);
+  }
+  free(re->posix);
+  DfaFree(re->dfa);
+  free(re);
+}
 
-  regex_t* re = calloc(1, sizeof(regex_t));
-  const int error = regcomp(re, pattern, REG_EXTENDED);
-  return error == 0 ? FeMakePtr(ctx, FexTRE, re) : BuildError(ctx, error, re);
+static void ReleaseRegex(Regex* re) {
+  re->refs--;
+  if (re->refs == 0) {
+    FreeRegex(re);
+  }
 }
 
-static FeObject* BuildMatchResult(FeContext* ctx,
-                                  char* buffer,
-                                  regmatch_t* matches) {
-  FeObject* substrings[ArbitraryMatchCount] = {NULL};
+// The compiled patterns of a context, so that compiling a pattern again, as
+// scripts do in loops and functions, costs a hash lookup. The key is the
+// patterns, each followed by NUL, and the flags. When the cache is full, it
+// drops the least recently used entry.
+typedef struct CacheEntry {
+  struct CacheEntry* chain;
+  // The list of entries, most recently used first.
+  struct CacheEntry* newer;
+  struct CacheEntry* older;
+  uint64_t hash;
+  bool set;
+  bool dfa;
+  Regex* re;
+  size_t size;
+  char key[];
+} CacheEntry;
+
+typedef struct Cache {
+  CacheEntry* buckets[CacheBuckets];
+  CacheEntry* newest;
+  CacheEntry* oldest;
   size_t count;
-  for (count = 0; count < ArbitraryMatchCount; count++) {
-    const regmatch_t m = matches[count];
-    if (m.rm_so == -1 || m.rm_eo == -1) {
-      break;
+  size_t hits;
+  size_t misses;
+} Cache;
+
+void* FexOpenRECache(void) {
+  return calloc(1, sizeof(Cache));
+}
+
+static void Unlink(Cache* c, CacheEntry* e) {
+  *(e->newer != NULL ? &e->newer->older : &c->newest) = e->older;
+  *(e->older != NULL ? &e->older->newer : &c->oldest) = e->newer;
+}
+
+static void LinkNewest(Cache* c, CacheEntry* e) {
+  e->newer = NULL;
+  e->older = c->newest;
+  *(c->newest != NULL ? &c->newest->newer : &c->oldest) = e;
+  c->newest = e;
+}
+
+static void Evict(Cache* c, CacheEntry* e) {
+  CacheEntry** p = &c->buckets[e->hash & (CacheBuckets - 1)];
+  while (*p != e) {
+    p = &(*p)->chain;
+  }
+  *p = e->chain;
+  Unlink(c, e);
+  ReleaseRegex(e->re);
+  free(e);
+  c->count--;
+}
+
+void FexCloseRECache(FeContext*, void* data) {
+  Cache* c = data;
+  if (c == NULL) {
+    return;
+  }
+  while (c->oldest != NULL) {
+    Evict(c, c->oldest);
+  }
+  free(c);
+}
+
+static uint64_t Hash(const char* key, size_t size, bool set, bool dfa) {
+  // FNV-1a.
+  uint64_t h = 14695981039346656037u;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ (unsigned char)key[i]) * 1099511628211u;
+  }
+  return (h ^ (set ? 2u : 0u) ^ (dfa ? 1u : 0u)) * 1099511628211u;
+}
+
+static Regex* Lookup(Cache* c,
+                     const char* key,
+                     size_t size,
+                     bool set,
+                     bool dfa,
+                     uint64_t hash) {
+  for (CacheEntry* e = c->buckets[hash & (CacheBuckets - 1)]; e != NULL;
+       e = e->chain) {
+    if (e->hash == hash && e->size == size && e->set == set && e->dfa == dfa &&
+        memcmp(e->key, key, size) == 0) {
+      Unlink(c, e);
+      LinkNewest(c, e);
+      return e->re;
     }
-    AUTO(char*, s, strndup(buffer + m.rm_so, (size_t)(m.rm_eo - m.rm_so)),
-         FreeChar);
-    substrings[count] = FeMakeString(ctx, s);
   }
-  return FeMakeList(ctx, substrings, count);
+  return NULL;
+}
+
+static void Insert(Cache* c,
+                   const char* key,
+                   size_t size,
+                   bool set,
+                   bool dfa,
+                   uint64_t hash,
+                   Regex* re) {
+  CacheEntry* e = malloc(sizeof(CacheEntry) + size);
+  if (e == NULL) {
+    // The pattern is still compiled; it is just not cached.
+    return;
+  }
+  if (c->count == CacheCapacity) {
+    Evict(c, c->oldest);
+  }
+  *e = (CacheEntry){
+      .hash = hash, .set = set, .dfa = dfa, .re = re, .size = size};
+  memcpy(e->key, key, size);
+  CacheEntry** bucket = &c->buckets[hash & (CacheBuckets - 1)];
+  e->chain = *bucket;
+  *bucket = e;
+  LinkNewest(c, e);
+  re->refs++;
+  c->count++;
 }
 
-FeObject* FexMatchRE(FeContext* ctx, FeObject* arg) {
-  FeObject* o = FeGetNextArgument(ctx, &arg);
+static Regex* GetRegex(FeContext* ctx, FeObject* o) {
   if (FeGetType(o) != FexTRE) {
     FeHandleError(ctx, "not a regular-expression");
   }
-  regex_t* re = FeToPtr(ctx, o);
+  return FeToPtr(ctx, o);
+}
+
+// Returns whether `argv[i]`, if given, names the `"dfa"` engine (the default)
+// rather than `"posix"`.
+static bool UseDfa(FeContext* ctx, size_t argc, FeObject** argv, size_t i) {
+  if (argc <= i || FeIsNil(argv[i])) {
+    return true;
+  }
+  char engine[8];
+  (void)FeToString(ctx, argv[i], engine, sizeof(engine));
+  if (strcmp(engine, "posix") != 0 && strcmp(engine, "dfa") != 0) {
+    FeHandleError(ctx, "unknown regular-expression engine");
+  }
+  return strcmp(engine, "dfa") == 0;
+}
 
-  AUTO(char*, buffer, calloc(1, ArbitraryDataLengthLimit), FreeChar);
-  (void)FeToString(ctx, FeGetNextArgument(ctx, &arg), buffer,
-                   ArbitraryDataLengthLimit);
+// Compiles `count` patterns, which are also stored one after another in `key`,
+// each followed by NUL, and returns a `regular-expression` or an error list.
+static FeObject* Compile(FeContext* ctx,
+                         const char* const* patterns,
+                         size_t count,
+                         const char* key,
+                         size_t size,
+                         bool set,
+                         bool dfa) {
+  Cache* cache = FeGetTypeData(ctx, FexTRE);
+  const uint64_t hash = Hash(key, size, set, dfa);
+  if (cache != NULL) {
+    Regex* re = Lookup(cache, key, size, set, dfa, hash);
+    if (re != NULL) {
+      cache->hits++;
+      FeObject* o = FeMakePtr(ctx, FexTRE, re);
+      re->refs++;
+      return o;
+    }
+    cache->misses++;
+  }
 
-  regmatch_t matches[ArbitraryMatchCount];
-  const int error = regexec(re, buffer, ArbitraryMatchCount, matches, 0);
-  FeObject* result = error == 0 ? BuildMatchResult(ctx, buffer, matches)
-                                : BuildError(ctx, error, re);
-  return result;
+  Regex* re = calloc(1, sizeof(Regex));
+  regex_t* posix = calloc(count, sizeof(regex_t));
+  if (re == NULL || posix == NULL) {
+    free(re);
+    free(posix);
+    FeHandleError(ctx, "out of memory");
+    return &nil;
+  }
+  *re = (Regex){.set = set, .posix = posix};
+  for (; re->count < count; re->count++) {
+    const int error =
+        regcomp(&posix[re->count], patterns[re->count], REG_EXTENDED);
+    if (error != 0) {
+      FeObject* result = BuildError(ctx, error, &posix[re->count]);
+      FreeRegex(re);
+      return result;
+    }
+  }
+  if (dfa) {
+    re->dfa = set ? DfaCompileSet(patterns, count) : DfaCompile(patterns[0]);
+  }
+  FeObject* o = FeMakePtr(ctx, FexTRE, re);
+  re->refs = 1;
+  if (cache != NULL) {
+    Insert(cache, key, size, set, dfa, hash, re);
+  }
+  return o;
 }
 
-FeObject* FexGCRE(FeContext* ctx, FeObject* o) {
-  regex_t* re = FeToPtr(ctx, o);
-  regfree(re);
-  free(re);
+// `(compile-re pattern [engine])` compiles `pattern`, in the POSIX extended
+// syntax, and returns a `regular-expression` or an error list. The `"dfa"`
+// engine, the default, takes time linear in the subject; `"posix"` uses
+// regex.h, which also supports back-references and word boundaries, and which
+// the DFA engine falls back to for patterns that use them.
+FeObject* FexCompileRE(FeContext* ctx, size_t argc, FeObject** argv) {
+  char pattern[ArbitraryRELengthLimit + 1];
+  const size_t length = FeToString(ctx, argv[0], pattern, sizeof(pattern));
+  const char* patterns[] = {pattern};
+  return Compile(ctx, patterns, 1, pattern, length + 1, false,
+                 UseDfa(ctx, argc, argv, 1));
+}
+
+// `(compile-re-set patterns [engine])` compiles a list of patterns into a set,
+// which `match-set` matches all at once.
+FeObject* FexCompileRESet(FeContext* ctx, size_t argc, FeObject** argv) {
+  size_t count = 0;
+  for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    count++;
+  }
+  if (count == 0) {
+    FeHandleError(ctx, "empty set");
+    return &nil;
+  }
+  const size_t size = ArbitraryRELengthLimit + 1;
+  // A bytes buffer, rather than `malloc`, so that an error (such as a pattern
+  // that is not a string) does not leak it.
+  char* scratch;
+  (void)FexMakeBytesBuffer(ctx, count * (sizeof(char*) + size), &scratch);
+  const char** patterns = (const char**)(void*)scratch;
+  char* buffer = scratch + count * sizeof(char*);
+  // The patterns are stored one after another, which makes them the key.
+  size_t i = 0;
+  size_t n = 0;
+  for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p), i++) {
+    patterns[i] = buffer + n;
+    n += FeToString(ctx, FeCar(ctx, p), buffer + n, size) + 1;
+  }
+  return Compile(ctx, patterns, count, buffer, n, true,
+                 UseDfa(ctx, argc, argv, 1));
+}
+
+// A search for successive matches of a regular expression in a subject. Bytes
+// are searched in place. Strings are stored in chunks, so they are copied into
+// a single buffer first, once per search rather than once per match.
+//
+// The copy and the other scratch space live in a bytes buffer on the GC stack
+// rather than in memory the native frees on return, because an error in a
+// callback or while building a match unwinds past the native without running
+// its cleanup code. The buffer is then freed when it is collected.
+typedef struct Matcher {
+  FeContext* ctx;
+  Regex* re;
+  regex_t* posix;
+  FeObject* subject;
+  bool bytes;
+  const char* data;
+  size_t size;
+  // The whole match and each parenthesized submatch.
+  regmatch_t* matches;
+  size_t count;
+  // The bounds of the submatches that the DFA engine found.
+  size_t* submatches;
+  // Where the next search starts.
+  size_t offset;
+  // Which patterns of a set matched.
+  bool* matched;
+} Matcher;
+
+static Matcher MakeMatcher(FeContext* ctx,
+                           FeObject* re,
+                           FeObject* subject,
+                           bool set) {
+  Matcher m = {.ctx = ctx, .re = GetRegex(ctx, re), .subject = subject};
+  if (m.re->set != set) {
+    FeHandleError(ctx, set ? "not a set" : "not a single regular-expression");
+  }
+  m.posix = &m.re->posix[0];
+  m.count = set ? 1 : m.posix->re_nsub + 1;
+  m.bytes = FexGetBytes(ctx, subject, &m.data, &m.size);
+  if (!m.bytes) {
+    if (FeGetType(subject) != FeTString) {
+      FeHandleError(ctx, "expected string");
+    }
+    for (FeObject* p = subject; !FeIsNil(p);) {
+      const char* chunk;
+      m.size += FeGetStringChunk(ctx, &p, &chunk);
+    }
+  }
+  if (m.size >= (size_t)1 << (sizeof(regoff_t) * CHAR_BIT - 1)) {
+    FeHandleError(ctx, "subject too large");
+  }
+#ifdef REG_STARTEND
+  const bool copy = !m.bytes;
+#else
+  // Without `REG_STARTEND`, `regexec` needs a NUL-terminated subject.
+  const bool copy = true;
+#endif
+  const size_t submatches_size = 2 * (m.count - 1) * sizeof(size_t);
+  const size_t matches_size = m.count * sizeof(regmatch_t);
+  const size_t matched_size = set ? m.re->count * sizeof(bool) : 0;
+  char* scratch;
+  (void)FexMakeBytesBuffer(
+      ctx,
+      submatches_size + matches_size + matched_size + (copy ? m.size + 1 : 0),
+      &scratch);
+  m.submatches = (size_t*)(void*)scratch;
+  scratch += submatches_size;
+  m.matches = (regmatch_t*)(void*)scratch;
+  if (set) {
+    m.matched = (bool*)(scratch + matches_size);
+    memset(m.matched, 0, matched_size);
+  }
+  if (copy) {
+    char* data = scratch + matches_size + matched_size;
+    if (m.bytes) {
+      memcpy(data, m.data, m.size);
+    } else {
+      size_t n = 0;
+      for (FeObject* p = subject; !FeIsNil(p);) {
+        const char* chunk;
+        const size_t k = FeGetStringChunk(ctx, &p, &chunk);
+        memcpy(data + n, chunk, k);
+        n += k;
+      }
+    }
+    data[m.size] = '\0';
+    m.data = data;
+  }
+  return m;
+}
+
+// Runs `regexec` on `data[start, end)`, storing offsets from `data`. `^`
+// matches only at the beginning of `data`, and `$` only at the end.
+static int Exec(Matcher* m, size_t start, size_t end) {
+  const int flags = start > 0 ? REG_NOTBOL : 0;
+#ifdef REG_STARTEND
+  m->matches[0] =
+      (regmatch_t){.rm_so = (regoff_t)start, .rm_eo = (regoff_t)end};
+  return regexec(m->posix, m->data, m->count, m->matches,
+                 flags | REG_STARTEND | (end < m->size ? REG_NOTEOL : 0));
+#else
+  // Without `REG_STARTEND`, searches run to the end of the subject.
+  (void)end;
+  const int error =
+      regexec(m->posix, m->data + start, m->count, m->matches, flags);
+  for (size_t i = 0; error == 0 && i < m->count; i++) {
+    if (m->matches[i].rm_so != -1) {
+      m->matches[i].rm_so += (regoff_t)start;
+      m->matches[i].rm_eo += (regoff_t)start;
+    }
+  }
+  return error;
+#endif
+}
+
+// Finds the match, and then its submatches, with the DFA engine.
+static int ExecDfa(Matcher* m) {
+  size_t start;
+  size_t end;
+  switch (DfaSearch(m->re->dfa, m->data, m->size, m->offset, &start, &end)) {
+    case DfaNoMatch:
+      return REG_NOMATCH;
+    case DfaOutOfMemory:
+      return REG_ESPACE;
+    case DfaMatched:
+      break;
+  }
+  m->matches[0] =
+      (regmatch_t){.rm_so = (regoff_t)start, .rm_eo = (regoff_t)end};
+  if (m->count == 1) {
+    return 0;
+  }
+  if (DfaSubmatch(m->re->dfa, m->data, m->size, start, end, m->submatches) !=
+      DfaMatched) {
+    return REG_ESPACE;
+  }
+  for (size_t i = 1; i < m->count; i++) {
+    const size_t* bounds = &m->submatches[2 * (i - 1)];
+    m->matches[i] = bounds[0] == SIZE_MAX
+                        ? (regmatch_t){.rm_so = -1, .rm_eo = -1}
+                        : (regmatch_t){.rm_so = (regoff_t)bounds[0],
+                                       .rm_eo = (regoff_t)bounds[1]};
+  }
+  return 0;
+}
+
+// Finds the next match, returning 0 or a `regexec` error. Searches after the
+// first start in the middle of the subject, so `^` must not match there. After
+// an empty match, the next search starts a byte further on, so that it does not
+// find the same match again.
+static int Next(Matcher* m) {
+  if (m->offset > m->size) {
+    return REG_NOMATCH;
+  }
+  const int error =
+      m->re->dfa != NULL ? ExecDfa(m) : Exec(m, m->offset, m->size);
+  if (error == 0) {
+    const size_t start = (size_t)m->matches[0].rm_so;
+    const size_t end = (size_t)m->matches[0].rm_eo;
+    m->offset = end > start ? end : end + 1;
+  }
+  return error;
+}
+
+// Returns submatch `i` of the current match: `nil` if it did not participate,
+// its `(start end)` offsets if `offsets` is true, and otherwise its text, as a
+// view if the subject is bytes.
+static FeObject* BuildSubmatch(Matcher* m, size_t i, bool offsets) {
+  const regmatch_t r = m->matches[i];
+  if (r.rm_so == -1) {
+    return &nil;
+  }
+  const size_t start = (size_t)r.rm_so;
+  const size_t end = (size_t)r.rm_eo;
+  if (offsets) {
+    return FeMakeList(m->ctx,
+                      (FeObject*[]){FeMakeDouble(m->ctx, (FeDouble)start),
+                                    FeMakeDouble(m->ctx, (FeDouble)end)},
+                      2);
+  }
+  if (m->bytes) {
+    return FexMakeBytesView(m->ctx, m->subject, start, end);
+  }
+  FeObject* s = FeMakeString(m->ctx, "");
+  (void)FeAppendString(m->ctx, s, m->data + start, end - start);
+  return s;
+}
+
+// Appends `o` to the list that starts at `*head` and ends at `*tail`, keeping
+// only the head on the GC stack.
+static void Link(FeContext* ctx,
+                 size_t gc,
+                 FeObject** head,
+                 FeObject** tail,
+                 FeObject* o) {
+  FeObject* pair = FeCons(ctx, o, &nil);
+  if (*tail == NULL) {
+    *head = pair;
+  } else {
+    FeSetCdr(ctx, *tail, pair);
+  }
+  *tail = pair;
+  FeRestoreGC(ctx, gc);
+  FePushGC(ctx, *head);
+}
+
+static FeObject* BuildMatch(Matcher* m, bool offsets) {
+  const size_t gc = FeSaveGC(m->ctx);
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  for (size_t i = 0; i < m->count; i++) {
+    Link(m->ctx, gc, &head, &tail, BuildSubmatch(m, i, offsets));
+  }
+  return head;
+}
+
+// `(match-re re subject [offsets])` returns the list of the first match of `re`
+// in `subject` and its submatches, or an error list. Submatches that did not
+// participate are `nil`. If `offsets` is true, each is a `(start end)` list of
+// byte offsets rather than text.
+FeObject* FexMatchRE(FeContext* ctx, size_t argc, FeObject** argv) {
+  Matcher m = MakeMatcher(ctx, argv[0], argv[1], false);
+  const int error = Next(&m);
+  return error == 0 ? BuildMatch(&m, argc > 2 && !FeIsNil(argv[2]))
+                    : BuildError(ctx, error, m.posix);
+}
+
+// `(match-all re subject [offsets])` returns the list of all the matches of
+// `re` in `subject`, each as `match-re` would return it.
+FeObject* FexMatchAll(FeContext* ctx, size_t argc, FeObject** argv) {
+  Matcher m = MakeMatcher(ctx, argv[0], argv[1], false);
+  const bool offsets = argc > 2 && !FeIsNil(argv[2]);
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  while (Next(&m) == 0) {
+    Link(ctx, gc, &head, &tail, BuildMatch(&m, offsets));
+  }
+  return head;
+}
+
+// `(for-each-match re subject fn [offsets])` calls `fn` with each match of
+// `re` in `subject`, as `match-re` would return it, without building a list of
+// them all.
+FeObject* FexForEachMatch(FeContext* ctx, size_t argc, FeObject** argv) {
+  Matcher m = MakeMatcher(ctx, argv[0], argv[1], false);
+  const bool offsets = argc > 3 && !FeIsNil(argv[3]);
+  const size_t gc = FeSaveGC(ctx);
+  while (Next(&m) == 0) {
+    FeObject* match = BuildMatch(&m, offsets);
+    (void)FeInvoke(ctx, argv[2], 1, &match);
+    FeRestoreGC(ctx, gc);
+  }
   return &nil;
 }
+
+// Appends `replacement` for the current match to the string ending at `tail`,
+// expanding `\0` to `\9` to the submatches, and `\c` to `c` otherwise.
+static FeObject* AppendReplacement(Matcher* m,
+                                   FeObject* tail,
+                                   const char* replacement,
+                                   size_t size) {
+  size_t literal = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (replacement[i] != '\\' || i + 1 == size) {
+      continue;
+    }
+    tail = FeAppendString(m->ctx, tail, replacement + literal, i - literal);
+    const char c = replacement[++i];
+    literal = i + 1;
+    if (!isdigit((unsigned char)c)) {
+      literal = i;
+      continue;
+    }
+    const size_t group = (size_t)(c - '0');
+    if (group < m->count && m->matches[group].rm_so != -1) {
+      const regmatch_t r = m->matches[group];
+      tail = FeAppendString(m->ctx, tail, m->data + (size_t)r.rm_so,
+                            (size_t)(r.rm_eo - r.rm_so));
+    }
+  }
+  return FeAppendString(m->ctx, tail, replacement + literal, size - literal);
+}
+
+// `(replace-re re subject replacement [count])` returns `subject` as a string
+// with the first `count` (default: all) matches of `re` replaced by
+// `replacement`, in which `\1` to `\9` stand for submatches and `\0` for the
+// whole match.
+FeObject* FexReplaceRE(FeContext* ctx, size_t argc, FeObject** argv) {
+  Matcher m = MakeMatcher(ctx, argv[0], argv[1], false);
+  if (FeGetType(argv[2]) != FeTString) {
+    FeHandleError(ctx, "expected string");
+  }
+  size_t size = 0;
+  for (FeObject* p = argv[2]; !FeIsNil(p);) {
+    const char* chunk;
+    size += FeGetStringChunk(ctx, &p, &chunk);
+  }
+  char* replacement;
+  (void)FexMakeBytesBuffer(ctx, size + 1, &replacement);
+  (void)FeToString(ctx, argv[2], replacement, size + 1);
+
+  const FeDouble limit =
+      argc > 3 ? FeToDouble(ctx, argv[3]) : (FeDouble)INFINITY;
+  FeObject* head = FeMakeString(ctx, "");
+  FeObject* tail = head;
+  size_t copied = 0;
+  for (FeDouble n = 0; n < limit && Next(&m) == 0; n++) {
+    const size_t start = (size_t)m.matches[0].rm_so;
+    tail = FeAppendString(ctx, tail, m.data + copied, start - copied);
+    tail = AppendReplacement(&m, tail, replacement, size);
+    copied = (size_t)m.matches[0].rm_eo;
+  }
+  (void)FeAppendString(ctx, tail, m.data + copied, m.size - copied);
+  return head;
+}
+
+// `(match-set set subject)` returns the list of the indexes of the patterns in
+// `set` that match `subject`, in order. With the DFA engine, it finds them in a
+// single pass over `subject`.
+FeObject* FexMatchSet(FeContext* ctx, size_t, FeObject** argv) {
+  Matcher m = MakeMatcher(ctx, argv[0], argv[1], true);
+  if (m.re->dfa != NULL) {
+    if (DfaMatchSet(m.re->dfa, m.data, m.size, m.matched) == DfaOutOfMemory) {
+      FeHandleError(ctx, "out of memory");
+    }
+  } else {
+    for (size_t i = 0; i < m.re->count; i++) {
+      m.posix = &m.re->posix[i];
+      m.matched[i] = Exec(&m, 0, m.size) == 0;
+    }
+  }
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  for (size_t i = 0; i < m.re->count; i++) {
+    if (m.matched[i]) {
+      Link(ctx, gc, &head, &tail, FeMakeDouble(ctx, (FeDouble)i));
+    }
+  }
+  return head;
+}
+
+void FexFinalizeRE(FeContext* ctx, FeObject* o) {
+  ReleaseRegex(FeToPtr(ctx, o));
+}
+
+// `(re-cache-stats)` returns the list `(hits misses count)` of the compiled-
+// pattern cache: how many compilations it has answered, how many it has not,
+// and how many patterns it holds.
+FeObject* FexRECacheStats(FeContext* ctx, size_t, FeObject**) {
+  const Cache* c = FeGetTypeData(ctx, FexTRE);
+  if (c == NULL) {
+    return &nil;
+  }
+  return FeMakeList(ctx,
+                    (FeObject*[]){FeMakeDouble(ctx, (FeDouble)c->hits),
+                                  FeMakeDouble(ctx, (FeDouble)c->misses),
+                                  FeMakeDouble(ctx, (FeDouble)c->count)},
+                    3);
+}
@@ -7,9 +7,19 @@
 #include "fe.h"
 
 void FexInstallRE(FeContext* ctx);
-FeObject* FexGCRE(FeContext* ctx, FeObject* o);
+void FexFinalizeRE(FeContext* ctx, FeObject* o);
+// The per-context cache of compiled patterns, which is the data of the
+// `regular-expression` type.
+void* FexOpenRECache(void);
+void FexCloseRECache(FeContext* ctx, void* data);
 
-FeObject* FexCompileRE(FeContext* ctx, FeObject* arg);
-FeObject* FexMatchRE(FeContext* ctx, FeObject* arg);
+FeObject* FexCompileRE(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexCompileRESet(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexForEachMatch(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMatchAll(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMatchRE(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexMatchSet(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexRECacheStats(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexReplaceRE(FeContext* ctx, size_t argc, FeObject** argv);
 
 #endif
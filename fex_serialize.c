@@ -0,0 +1,534 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fex.h"
+#include "fex_io.h"
+#include "fex_serialize.h"
+
+// The format is a header (`Magic` and a version byte) followed by one encoded
+// value. A value is a tag byte and then:
+//
+//   TagNil:       nothing
+//   TagDouble:    the IEEE 754 binary64 bits, little-endian
+//   TagString:    the length as an unsigned LEB128 integer, then the bytes
+//   TagSymbol:    the name, encoded as for `TagString`
+//   TagPair:      the `car` value, then the `cdr` value
+//   TagReference: the index, as an unsigned LEB128 integer, of an earlier
+//                 string or pair
+//
+// Strings and pairs are numbered in the order they are first encoded, so that
+// shared and cyclic structure is encoded once and referred to after that.
+
+enum {
+  Version = 1,
+  DepthLimit = 1024,
+};
+
+enum {
+  TagNil,
+  TagDouble,
+  TagString,
+  TagSymbol,
+  TagPair,
+  TagReference,
+};
+
+static const char Magic[3] = {'F', 'e', 'S'};
+
+void FexInstallSerialize(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "serialize", FexSerialize, 2);
+  FexInstallNativeArrayFn(ctx, "deserialize", FexDeserialize, 1);
+}
+
+static bool Reserve(char** data, size_t* capacity, size_t size) {
+  if (size <= *capacity) {
+    return true;
+  }
+  size_t c = *capacity ? *capacity : 256;
+  while (c < size) {
+    c *= 2;
+  }
+  char* d = realloc(*data, c);
+  if (d == NULL) {
+    return false;
+  }
+  *data = d;
+  *capacity = c;
+  return true;
+}
+
+// Encoding
+
+typedef struct Sink {
+  FILE* file;
+  char* data;
+  size_t size;
+  size_t capacity;
+  bool failed;
+} Sink;
+
+typedef struct Encoder {
+  FeContext* ctx;
+  Sink* sink;
+  // An open-addressed hash table from the strings and pairs encoded so far to
+  // their indices:
+  FeObject** keys;
+  size_t* indices;
+  size_t capacity;
+  size_t count;
+  // The bytes of the current string or symbol name:
+  char* text;
+  size_t text_size;
+  size_t text_capacity;
+  const char* error;
+  char message[64];
+} Encoder;
+
+static void Write(Sink* s, const void* bytes, size_t n) {
+  if (s->failed || n == 0) {
+    return;
+  }
+  if (s->file != NULL) {
+    s->failed = fwrite(bytes, 1, n, s->file) != n;
+    return;
+  }
+  if (!Reserve(&s->data, &s->capacity, s->size + n)) {
+    s->failed = true;
+    return;
+  }
+  memcpy(s->data + s->size, bytes, n);
+  s->size += n;
+}
+
+static void WriteByte(Sink* s, unsigned char byte) {
+  Write(s, &byte, 1);
+}
+
+static void WriteSize(Sink* s, size_t n) {
+  unsigned char bytes[10];
+  size_t count = 0;
+  do {
+    bytes[count] = (unsigned char)(n & 0x7f);
+    n >>= 7;
+    if (n != 0) {
+      bytes[count] |= 0x80;
+    }
+    count++;
+  } while (n != 0);
+  Write(s, bytes, count);
+}
+
+static size_t Hash(const FeObject* obj, size_t capacity) {
+  return (size_t)(((uintptr_t)obj >> 4) * 0x9e3779b97f4a7c15u) & (capacity - 1);
+}
+
+// Returns true, and stores the index of `obj` in `*index`, if `obj` has been
+// encoded before. Otherwise, gives `obj` the next index and returns false.
+static bool Remember(Encoder* e, FeObject* obj, size_t* index) {
+  if (2 * (e->count + 1) > e->capacity) {
+    const size_t capacity = e->capacity ? 2 * e->capacity : 64;
+    FeObject** keys = calloc(capacity, sizeof(FeObject*));
+    size_t* indices = calloc(capacity, sizeof(size_t));
+    if (keys == NULL || indices == NULL) {
+      free(keys);
+      free(indices);
+      e->error = "out of memory";
+      return false;
+    }
+    for (size_t i = 0; i < e->capacity; i++) {
+      if (e->keys[i] != NULL) {
+        size_t j = Hash(e->keys[i], capacity);
+        while (keys[j] != NULL) {
+          j = (j + 1) & (capacity - 1);
+        }
+        keys[j] = e->keys[i];
+        indices[j] = e->indices[i];
+      }
+    }
+    free(e->keys);
+    free(e->indices);
+    e->keys = keys;
+    e->indices = indices;
+    e->capacity = capacity;
+  }
+
+  size_t i = Hash(obj, e->capacity);
+  for (; e->keys[i] != NULL; i = (i + 1) & (e->capacity - 1)) {
+    if (e->keys[i] == obj) {
+      *index = e->indices[i];
+      return true;
+    }
+  }
+  e->keys[i] = obj;
+  e->indices[i] = e->count++;
+  return false;
+}
+
+static void AppendText(FeContext*, void* udata, char chr) {
+  Encoder* e = udata;
+  if (!Reserve(&e->text, &e->text_capacity, e->text_size + 1)) {
+    e->error = "out of memory";
+    return;
+  }
+  e->text[e->text_size++] = chr;
+}
+
+static void WriteText(Encoder* e, unsigned char tag, FeObject* obj) {
+  e->text_size = 0;
+  FeWrite(e->ctx, obj, AppendText, e, 0);
+  WriteByte(e->sink, tag);
+  WriteSize(e->sink, e->text_size);
+  Write(e->sink, e->text, e->text_size);
+}
+
+static bool Encode(Encoder* e, FeObject* obj, size_t depth) {
+  for (;;) {
+    size_t index;
+    const FeType type = FeGetType(obj);
+    switch (type) {
+      case FeTNil:
+        WriteByte(e->sink, TagNil);
+        return true;
+
+      case FeTDouble: {
+        const FeDouble d = FeToDouble(e->ctx, obj);
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        unsigned char bytes[8];
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+          bytes[i] = (unsigned char)(bits >> (8 * i));
+        }
+        WriteByte(e->sink, TagDouble);
+        Write(e->sink, bytes, sizeof(bytes));
+        return true;
+      }
+
+      case FeTSymbol:
+        WriteText(e, TagSymbol, obj);
+        return e->error == NULL;
+
+      case FeTString:
+        if (Remember(e, obj, &index)) {
+          WriteByte(e->sink, TagReference);
+          WriteSize(e->sink, index);
+          return true;
+        }
+        WriteText(e, TagString, obj);
+        return e->error == NULL;
+
+      case FeTPair:
+        if (Remember(e, obj, &index)) {
+          WriteByte(e->sink, TagReference);
+          WriteSize(e->sink, index);
+          return true;
+        }
+        if (e->error != NULL) {
+          return false;
+        }
+        if (depth >= DepthLimit) {
+          e->error = "cannot serialize deeply nested structure";
+          return false;
+        }
+        WriteByte(e->sink, TagPair);
+        if (!Encode(e, FeCar(e->ctx, obj), depth + 1)) {
+          return false;
+        }
+        obj = FeCdr(e->ctx, obj);
+        break;
+
+      case FeTFn:
+      case FeTMacro:
+      case FeTPrimitive:
+      case FeTNativeFn:
+      case FeTNativeArrayFn:
+      case FeTDoubleFn:
+      case FeTPtr:
+      case FeTFex0:
+      case FeTFex1:
+      case FeTFex2:
+      case FeTFex3:
+      case FeTFex4:
+      case FeTFex5:
+      case FeTFex6:
+      case FeTFex7:
+        snprintf(e->message, sizeof(e->message), "cannot serialize %s",
+                 FeGetTypeName(e->ctx, type));
+        e->error = e->message;
+        return false;
+
+      case FeTFree:
+      case FeTSentinel:
+        abort();
+    }
+  }
+}
+
+// Encodes `obj` into `sink`. Raises an error, after freeing the encoder's
+// memory, if `obj` cannot be serialized.
+static void Serialize(FeContext* ctx, FeObject* obj, Sink* sink) {
+  Encoder e = {.ctx = ctx, .sink = sink};
+  Write(sink, Magic, sizeof(Magic));
+  WriteByte(sink, Version);
+  (void)Encode(&e, obj, 0);
+  free(e.keys);
+  free(e.indices);
+  free(e.text);
+  if (e.error != NULL) {
+    char message[64];
+    snprintf(message, sizeof(message), "%s", e.error);
+    free(sink->data);
+    sink->data = NULL;
+    FeHandleError(ctx, message);
+  }
+}
+
+bool FexSerializeToFile(FeContext* ctx, FeObject* obj, FILE* file) {
+  Sink sink = {.file = file};
+  Serialize(ctx, obj, &sink);
+  return !sink.failed;
+}
+
+void FexSerializeToBuffer(FeContext* ctx,
+                          FeObject* obj,
+                          char** data,
+                          size_t* size) {
+  Sink sink = {0};
+  Serialize(ctx, obj, &sink);
+  if (sink.failed) {
+    free(sink.data);
+    FeHandleError(ctx, "out of memory");
+  }
+  *data = sink.data;
+  *size = sink.size;
+}
+
+// Decoding
+
+typedef struct Source {
+  FILE* file;
+  const char* data;
+  size_t size;
+  size_t offset;
+} Source;
+
+// Where to store a decoded object: in the `car` or `cdr` of `pair`, or, if
+// `pair` is `NULL`, as the result.
+typedef struct Slot {
+  FeObject* pair;
+  bool car;
+} Slot;
+
+typedef struct Decoder {
+  FeContext* ctx;
+  Source* source;
+  // The strings and pairs decoded so far, by index. They are all reachable from
+  // `result`.
+  FeObject** objects;
+  size_t count;
+  size_t capacity;
+  char* text;
+  size_t text_capacity;
+  FeObject* result;
+  size_t gc;
+  const char* error;
+} Decoder;
+
+static bool Read(Source* s, void* bytes, size_t n) {
+  if (s->file != NULL) {
+    return fread(bytes, 1, n, s->file) == n;
+  }
+  if (n > s->size - s->offset) {
+    return false;
+  }
+  memcpy(bytes, s->data + s->offset, n);
+  s->offset += n;
+  return true;
+}
+
+static bool ReadSize(Source* s, size_t* n) {
+  *n = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    unsigned char byte;
+    if (!Read(s, &byte, 1)) {
+      return false;
+    }
+    *n |= (size_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool Invalid(Decoder* d) {
+  if (d->error == NULL) {
+    d->error = "invalid serialized data";
+  }
+  return false;
+}
+
+// Reads a length-prefixed string into `d->text`, NUL-terminated.
+static bool ReadText(Decoder* d) {
+  size_t size;
+  if (!ReadSize(d->source, &size)) {
+    return Invalid(d);
+  }
+  // Do not trust `size` with an allocation before the bytes have arrived:
+  const size_t chunk_size = 64 * 1024;
+  for (size_t done = 0; done < size;) {
+    const size_t n = size - done < chunk_size ? size - done : chunk_size;
+    if (!Reserve(&d->text, &d->text_capacity, done + n + 1)) {
+      d->error = "out of memory";
+      return false;
+    }
+    if (!Read(d->source, d->text + done, n)) {
+      return Invalid(d);
+    }
+    done += n;
+  }
+  if (!Reserve(&d->text, &d->text_capacity, size + 1)) {
+    d->error = "out of memory";
+    return false;
+  }
+  // Fe strings cannot contain NUL.
+  if (memchr(d->text, '\0', size) != NULL) {
+    return Invalid(d);
+  }
+  d->text[size] = '\0';
+  return true;
+}
+
+static bool Store(Decoder* d, Slot slot, FeObject* obj, bool remember) {
+  if (slot.pair == NULL) {
+    d->result = obj;
+    FeRestoreGC(d->ctx, d->gc);
+    FePushGC(d->ctx, obj);
+    d->gc = FeSaveGC(d->ctx);
+  } else if (slot.car) {
+    FeSetCar(d->ctx, slot.pair, obj);
+  } else {
+    FeSetCdr(d->ctx, slot.pair, obj);
+  }
+  FeRestoreGC(d->ctx, d->gc);
+
+  if (remember) {
+    if (d->count == d->capacity) {
+      const size_t capacity = d->capacity ? 2 * d->capacity : 64;
+      FeObject** objects = realloc(d->objects, capacity * sizeof(FeObject*));
+      if (objects == NULL) {
+        d->error = "out of memory";
+        return false;
+      }
+      d->objects = objects;
+      d->capacity = capacity;
+    }
+    d->objects[d->count++] = obj;
+  }
+  return true;
+}
+
+static bool Decode(Decoder* d, Slot slot, size_t depth) {
+  for (;;) {
+    unsigned char tag;
+    if (!Read(d->source, &tag, 1)) {
+      return Invalid(d);
+    }
+    switch (tag) {
+      case TagNil:
+        return Store(d, slot, &nil, false);
+
+      case TagDouble: {
+        unsigned char bytes[8];
+        if (!Read(d->source, bytes, sizeof(bytes))) {
+          return Invalid(d);
+        }
+        uint64_t bits = 0;
+        for (size_t i = 0; i < sizeof(bytes); i++) {
+          bits |= (uint64_t)bytes[i] << (8 * i);
+        }
+        FeDouble n;
+        memcpy(&n, &bits, sizeof(n));
+        return Store(d, slot, FeMakeDouble(d->ctx, n), false);
+      }
+
+      case TagString:
+        return ReadText(d) &&
+               Store(d, slot, FeMakeString(d->ctx, d->text), true);
+
+      case TagSymbol:
+        return ReadText(d) &&
+               Store(d, slot, FeMakeSymbol(d->ctx, d->text), false);
+
+      case TagReference: {
+        size_t index;
+        if (!ReadSize(d->source, &index) || index >= d->count) {
+          return Invalid(d);
+        }
+        return Store(d, slot, d->objects[index], false);
+      }
+
+      case TagPair: {
+        if (depth >= DepthLimit) {
+          return Invalid(d);
+        }
+        FeObject* pair = FeCons(d->ctx, &nil, &nil);
+        if (!Store(d, slot, pair, true) ||
+            !Decode(d, (Slot){.pair = pair, .car = true}, depth + 1)) {
+          return false;
+        }
+        slot = (Slot){.pair = pair, .car = false};
+        break;
+      }
+
+      default:
+        return Invalid(d);
+    }
+  }
+}
+
+static FeObject* Deserialize(FeContext* ctx, Source* source) {
+  Decoder d = {.ctx = ctx, .source = source, .gc = FeSaveGC(ctx)};
+  char header[sizeof(Magic) + 1];
+  if (!Read(source, header, sizeof(header)) ||
+      memcmp(header, Magic, sizeof(Magic)) != 0) {
+    (void)Invalid(&d);
+  } else if (header[sizeof(Magic)] != Version) {
+    d.error = "unsupported serialization version";
+  } else {
+    (void)Decode(&d, (Slot){0}, 0);
+  }
+  free(d.objects);
+  free(d.text);
+  if (d.error != NULL) {
+    FeHandleError(ctx, d.error);
+  }
+  return d.result;
+}
+
+FeObject* FexDeserializeFromFile(FeContext* ctx, FILE* file) {
+  Source source = {.file = file};
+  return Deserialize(ctx, &source);
+}
+
+FeObject* FexDeserializeFromBuffer(FeContext* ctx,
+                                   const char* data,
+                                   size_t size) {
+  Source source = {.data = data, .size = size};
+  return Deserialize(ctx, &source);
+}
+
+FeObject* FexSerialize(FeContext* ctx, size_t, FeObject** argv) {
+  return FexSerializeToFile(ctx, argv[0], FexToFile(ctx, argv[1]))
+             ? &nil
+             : BuildErrnoError(ctx, errno);
+}
+
+FeObject* FexDeserialize(FeContext* ctx, size_t, FeObject** argv) {
+  return FexDeserializeFromFile(ctx, FexToFile(ctx, argv[0]));
+}
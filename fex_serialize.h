@@ -0,0 +1,35 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_SERIALIZE_H
+#define FEX_SERIALIZE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fe.h"
+
+void FexInstallSerialize(FeContext* ctx);
+
+// Encodes `obj` in Fe's binary serialization format. `obj` may contain lists
+// (including shared and cyclic structure), strings, symbols, and numbers; other
+// types are errors. The `ToFile` form returns false, with `errno` set, if
+// writing fails. The `ToBuffer` form stores a buffer, which the caller must
+// `free`, in `*data`.
+bool FexSerializeToFile(FeContext* ctx, FeObject* obj, FILE* file);
+void FexSerializeToBuffer(FeContext* ctx,
+                          FeObject* obj,
+                          char** data,
+                          size_t* size);
+
+// Decodes one object that `FexSerialize*` encoded. Truncated or invalid data
+// are errors.
+FeObject* FexDeserializeFromFile(FeContext* ctx, FILE* file);
+FeObject* FexDeserializeFromBuffer(FeContext* ctx,
+                                   const char* data,
+                                   size_t size);
+
+FeObject* FexSerialize(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexDeserialize(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
@@ -0,0 +1,468 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fex.h"
+#include "fex_bytes.h"
+#include "fex_string.h"
+
+// Fe strings are stored in chunks, so these functions read them a chunk at a
+// time with `FeGetStringChunk`, and build their results with `FeAppendString`,
+// rather than copying whole strings into C buffers. Offsets and lengths are in
+// bytes. They also accept bytes objects, as a single chunk, and return views
+// rather than copies where their results are parts of their arguments.
+
+void FexInstallString(FeContext* ctx) {
+  FexInstallNativeArrayFn(ctx, "join-strings", FexJoinStrings, 1);
+  FexInstallNativeArrayFn(ctx, "number->string", FexNumberToString, 1);
+  FexInstallNativeArrayFn(ctx, "split-string", FexSplitString, 2);
+  FexInstallNativeArrayFn(ctx, "string->number", FexStringToNumber, 1);
+  FexInstallNativeArrayFn(ctx, "string-contains", FexStringContains, 2);
+  FexInstallNativeArrayFn(ctx, "string-downcase", FexStringDowncase, 1);
+  FexInstallNativeArrayFn(ctx, "string-ends-with", FexStringEndsWith, 2);
+  FexInstallNativeArrayFn(ctx, "string-index", FexStringIndex, 2);
+  FexInstallNativeArrayFn(ctx, "string-length", FexStringLength, 1);
+  FexInstallNativeArrayFn(ctx, "string-starts-with", FexStringStartsWith, 2);
+  FexInstallNativeArrayFn(ctx, "string-trim", FexStringTrim, 1);
+  FexInstallNativeArrayFn(ctx, "string-upcase", FexStringUpcase, 1);
+  FexInstallNativeArrayFn(ctx, "substring", FexSubstring, 2);
+}
+
+typedef struct Cursor {
+  FeContext* ctx;
+  FeObject* rest;
+  const char* chunk;
+  size_t size;
+  size_t offset;
+} Cursor;
+
+static Cursor MakeCursor(FeContext* ctx, FeObject* str) {
+  const char* data;
+  size_t size;
+  if (FexGetBytes(ctx, str, &data, &size)) {
+    return (Cursor){.ctx = ctx, .rest = &nil, .chunk = data, .size = size};
+  }
+  if (FeGetType(str) != FeTString) {
+    FeHandleError(ctx, "expected string");
+  }
+  return (Cursor){.ctx = ctx, .rest = str};
+}
+
+// Makes the next chunk current, if the current one is used up. Returns false at
+// the end of the string.
+static bool Fill(Cursor* c) {
+  while (c->offset == c->size) {
+    if (FeIsNil(c->rest)) {
+      return false;
+    }
+    c->size = FeGetStringChunk(c->ctx, &c->rest, &c->chunk);
+    c->offset = 0;
+  }
+  return true;
+}
+
+static int NextByte(Cursor* c) {
+  return Fill(c) ? (unsigned char)c->chunk[c->offset++] : EOF;
+}
+
+static size_t Length(FeContext* ctx, FeObject* str) {
+  Cursor c = MakeCursor(ctx, str);
+  size_t n = c.size;
+  while (!FeIsNil(c.rest)) {
+    n += FeGetStringChunk(ctx, &c.rest, &c.chunk);
+  }
+  return n;
+}
+
+// Skips `n` bytes, or to the end of the string.
+static void Skip(Cursor* c, size_t n) {
+  while (n > 0 && Fill(c)) {
+    const size_t k = c->size - c->offset < n ? c->size - c->offset : n;
+    c->offset += k;
+    n -= k;
+  }
+}
+
+// Copies the rest of `c` to `buffer`, which must be large enough, and returns
+// the number of bytes copied.
+static size_t CopyFrom(Cursor* c, char* buffer) {
+  size_t n = 0;
+  while (Fill(c)) {
+    memcpy(buffer + n, c->chunk + c->offset, c->size - c->offset);
+    n += c->size - c->offset;
+    c->offset = c->size;
+  }
+  return n;
+}
+
+// A string under construction, whose first chunk is kept on the GC stack.
+typedef struct Builder {
+  FeContext* ctx;
+  FeObject* head;
+  FeObject* tail;
+} Builder;
+
+static Builder MakeBuilder(FeContext* ctx) {
+  FeObject* head = FeMakeString(ctx, "");
+  return (Builder){.ctx = ctx, .head = head, .tail = head};
+}
+
+static void Append(Builder* b, const char* bytes, size_t size) {
+  b->tail = FeAppendString(b->ctx, b->tail, bytes, size);
+}
+
+// Appends `n` bytes from `c`, or the rest of the string, a chunk at a time.
+static void AppendFrom(Builder* b, Cursor* c, size_t n) {
+  while (n > 0 && Fill(c)) {
+    const size_t k = c->size - c->offset < n ? c->size - c->offset : n;
+    Append(b, c->chunk + c->offset, k);
+    c->offset += k;
+    n -= k;
+  }
+}
+
+static FeObject* Substring(FeContext* ctx,
+                           FeObject* str,
+                           size_t start,
+                           size_t end) {
+  if (FeGetType(str) == FexTBytes) {
+    return FexMakeBytesView(ctx, str, start, end);
+  }
+  Cursor c = MakeCursor(ctx, str);
+  Skip(&c, start);
+  Builder b = MakeBuilder(ctx);
+  if (end > start) {
+    AppendFrom(&b, &c, end - start);
+  }
+  return b.head;
+}
+
+// Returns the offset `n` into a string of `length` bytes, where negative
+// offsets count back from the end, clamped to `[0, length]`.
+static size_t GetOffset(FeContext* ctx, FeObject* n, size_t length) {
+  FeDouble d = FeToDouble(ctx, n);
+  if (d < 0) {
+    d += (FeDouble)length;
+  }
+  if (!(d > 0)) {
+    return 0;
+  }
+  return d < (FeDouble)length ? (size_t)d : length;
+}
+
+// A needle, copied out of its string, and its Knuth-Morris-Pratt failure
+// table, so that a haystack can be searched a byte at a time without backing
+// up.
+typedef struct Needle {
+  char* bytes;
+  size_t size;
+  size_t* fail;
+} Needle;
+
+static void FreeNeedle(Needle* n) {
+  free(n->bytes);
+  free(n->fail);
+}
+
+static void MakeNeedle(FeContext* ctx, FeObject* str, Needle* n) {
+  const size_t size = Length(ctx, str);
+  *n = (Needle){.bytes = malloc(size + 1),
+                .size = size,
+                .fail = malloc((size + 1) * sizeof(size_t))};
+  if (n->bytes == NULL || n->fail == NULL) {
+    FreeNeedle(n);
+    FeHandleError(ctx, "out of memory");
+  }
+  Cursor c = MakeCursor(ctx, str);
+  (void)CopyFrom(&c, n->bytes);
+  n->fail[0] = 0;
+  for (size_t i = 1, k = 0; i < size; i++) {
+    while (k > 0 && n->bytes[i] != n->bytes[k]) {
+      k = n->fail[k - 1];
+    }
+    if (n->bytes[i] == n->bytes[k]) {
+      k++;
+    }
+    n->fail[i] = k;
+  }
+}
+
+// Feeds `byte` to a search for `n` that has matched `*k` bytes so far. Returns
+// true when the whole needle has matched.
+static bool Match(const Needle* n, size_t* k, char byte) {
+  while (*k > 0 && byte != n->bytes[*k]) {
+    *k = n->fail[*k - 1];
+  }
+  if (byte == n->bytes[*k]) {
+    (*k)++;
+  }
+  if (*k == n->size) {
+    *k = n->fail[*k - 1];
+    return true;
+  }
+  return false;
+}
+
+// Returns the offset of the first `needle` in `c` at or after its position,
+// relative to that position, or -1.
+static long long Find(Cursor* c, const Needle* needle) {
+  if (needle->size == 0) {
+    return 0;
+  }
+  if (Fill(c) && FeIsNil(c->rest)) {
+    // The rest is contiguous, as bytes are, so test only where the first byte
+    // of the needle occurs.
+    const char* start = c->chunk + c->offset;
+    const char* end = c->chunk + c->size;
+    const char* p = start;
+    while ((size_t)(end - p) >= needle->size &&
+           (p = memchr(p, needle->bytes[0],
+                       (size_t)(end - p) - needle->size + 1)) != NULL) {
+      if (memcmp(p, needle->bytes, needle->size) == 0) {
+        c->offset += (size_t)(p - start) + needle->size;
+        return (long long)(p - start);
+      }
+      p++;
+    }
+    c->offset = c->size;
+    return -1;
+  }
+  size_t skipped = 0;
+  if (needle->size == 1) {
+    while (Fill(c)) {
+      const char* chunk = c->chunk + c->offset;
+      const size_t n = c->size - c->offset;
+      const char* p = memchr(chunk, needle->bytes[0], n);
+      if (p != NULL) {
+        c->offset += (size_t)(p - chunk) + 1;
+        return (long long)(skipped + (size_t)(p - chunk));
+      }
+      c->offset = c->size;
+      skipped += n;
+    }
+    return -1;
+  }
+  size_t k = 0;
+  for (int byte; (byte = NextByte(c)) != EOF; skipped++) {
+    if (Match(needle, &k, (char)byte)) {
+      return (long long)(skipped + 1 - needle->size);
+    }
+  }
+  return -1;
+}
+
+// `(string-length s)` returns the number of bytes in `s`.
+FeObject* FexStringLength(FeContext* ctx, size_t, FeObject** argv) {
+  const size_t length = Length(ctx, argv[0]);
+  return FeMakeDouble(ctx, (FeDouble)length);
+}
+
+// `(substring s start [end])` returns the bytes of `s` from `start` up to `end`
+// (default: the end of `s`). Negative offsets count back from the end.
+FeObject* FexSubstring(FeContext* ctx, size_t argc, FeObject** argv) {
+  const size_t length = Length(ctx, argv[0]);
+  const size_t start = GetOffset(ctx, argv[1], length);
+  const size_t end = argc > 2 ? GetOffset(ctx, argv[2], length) : length;
+  return Substring(ctx, argv[0], start, end);
+}
+
+// `(string-index s needle [start])` returns the offset of the first `needle` in
+// `s` at or after `start`, or `nil`.
+FeObject* FexStringIndex(FeContext* ctx, size_t argc, FeObject** argv) {
+  Cursor c = MakeCursor(ctx, argv[0]);
+  size_t start = 0;
+  if (argc > 2) {
+    start = GetOffset(ctx, argv[2], Length(ctx, argv[0]));
+    Skip(&c, start);
+  }
+  Needle needle;
+  MakeNeedle(ctx, argv[1], &needle);
+  const long long i = Find(&c, &needle);
+  FreeNeedle(&needle);
+  return i < 0 ? &nil : FeMakeDouble(ctx, (FeDouble)start + (FeDouble)i);
+}
+
+// `(string-contains s needle)` returns whether `needle` occurs in `s`.
+FeObject* FexStringContains(FeContext* ctx, size_t, FeObject** argv) {
+  Cursor c = MakeCursor(ctx, argv[0]);
+  Needle needle;
+  MakeNeedle(ctx, argv[1], &needle);
+  const long long i = Find(&c, &needle);
+  FreeNeedle(&needle);
+  return FeMakeBool(ctx, i >= 0);
+}
+
+// `(split-string s delimiter)` returns the list of the pieces of `s` between
+// occurrences of `delimiter`, which must not be empty.
+FeObject* FexSplitString(FeContext* ctx, size_t, FeObject** argv) {
+  Cursor c = MakeCursor(ctx, argv[0]);
+  Needle needle;
+  MakeNeedle(ctx, argv[1], &needle);
+  if (needle.size == 0) {
+    FreeNeedle(&needle);
+    FeHandleError(ctx, "empty delimiter");
+  }
+  const bool bytes = FeGetType(argv[0]) == FexTBytes;
+  const size_t length = bytes ? Length(ctx, argv[0]) : 0;
+  const size_t gc = FeSaveGC(ctx);
+  FeObject* head = &nil;
+  FeObject* tail = NULL;
+  Cursor start = c;
+  size_t position = 0;
+  for (;;) {
+    const long long i = Find(&c, &needle);
+    const size_t n = i < 0 ? SIZE_MAX : (size_t)i;
+    FeObject* piece;
+    if (bytes) {
+      // The last piece runs to the end of the view.
+      piece = FexMakeBytesView(ctx, argv[0], position,
+                               i < 0 ? length : position + n);
+      position += n + needle.size;
+    } else {
+      Builder b = MakeBuilder(ctx);
+      AppendFrom(&b, &start, n);
+      piece = b.head;
+    }
+    FeObject* pair = FeCons(ctx, piece, &nil);
+    if (tail == NULL) {
+      head = pair;
+    } else {
+      FeSetCdr(ctx, tail, pair);
+    }
+    tail = pair;
+    FeRestoreGC(ctx, gc);
+    FePushGC(ctx, head);
+    if (i < 0) {
+      break;
+    }
+    start = c;
+  }
+  FreeNeedle(&needle);
+  return head;
+}
+
+// `(join-strings list [separator])` returns the strings of `list` joined by
+// `separator` (default: `""`).
+FeObject* FexJoinStrings(FeContext* ctx, size_t argc, FeObject** argv) {
+  Builder b = MakeBuilder(ctx);
+  bool first = true;
+  for (FeObject* p = argv[0]; !FeIsNil(p); p = FeCdr(ctx, p)) {
+    if (!first && argc > 1) {
+      Cursor c = MakeCursor(ctx, argv[1]);
+      AppendFrom(&b, &c, SIZE_MAX);
+    }
+    Cursor c = MakeCursor(ctx, FeCar(ctx, p));
+    AppendFrom(&b, &c, SIZE_MAX);
+    first = false;
+  }
+  return b.head;
+}
+
+// `(string-trim s)` returns `s` without leading and trailing white space.
+FeObject* FexStringTrim(FeContext* ctx, size_t, FeObject** argv) {
+  Cursor c = MakeCursor(ctx, argv[0]);
+  size_t start = 0;
+  size_t end = 0;
+  bool seen = false;
+  size_t i = 0;
+  for (int byte; (byte = NextByte(&c)) != EOF; i++) {
+    if (!isspace(byte)) {
+      if (!seen) {
+        start = i;
+        seen = true;
+      }
+      end = i + 1;
+    }
+  }
+  return Substring(ctx, argv[0], start, end);
+}
+
+static bool StartsWith(Cursor* c, FeContext* ctx, FeObject* prefix) {
+  Cursor p = MakeCursor(ctx, prefix);
+  for (int byte; (byte = NextByte(&p)) != EOF;) {
+    if (NextByte(c) != byte) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// `(string-starts-with s prefix)` returns whether `s` begins with `prefix`.
+FeObject* FexStringStartsWith(FeContext* ctx, size_t, FeObject** argv) {
+  Cursor c = MakeCursor(ctx, argv[0]);
+  return FeMakeBool(ctx, StartsWith(&c, ctx, argv[1]));
+}
+
+// `(string-ends-with s suffix)` returns whether `s` ends with `suffix`.
+FeObject* FexStringEndsWith(FeContext* ctx, size_t, FeObject** argv) {
+  const size_t length = Length(ctx, argv[0]);
+  const size_t suffix_length = Length(ctx, argv[1]);
+  if (suffix_length > length) {
+    return &nil;
+  }
+  Cursor c = MakeCursor(ctx, argv[0]);
+  Skip(&c, length - suffix_length);
+  return FeMakeBool(ctx, StartsWith(&c, ctx, argv[1]));
+}
+
+static FeObject* MapBytes(FeContext* ctx, FeObject* str, int (*fn)(int)) {
+  Cursor c = MakeCursor(ctx, str);
+  Builder b = MakeBuilder(ctx);
+  while (Fill(&c)) {
+    char chunk[256];
+    const size_t available = c.size - c.offset;
+    const size_t n = available < sizeof(chunk) ? available : sizeof(chunk);
+    for (size_t i = 0; i < n; i++) {
+      chunk[i] = (char)fn((unsigned char)c.chunk[c.offset + i]);
+    }
+    Append(&b, chunk, n);
+    c.offset += n;
+  }
+  return b.head;
+}
+
+// `(string-upcase s)` and `(string-downcase s)` convert the ASCII letters of
+// `s` to upper or lower case.
+FeObject* FexStringUpcase(FeContext* ctx, size_t, FeObject** argv) {
+  return MapBytes(ctx, argv[0], toupper);
+}
+
+FeObject* FexStringDowncase(FeContext* ctx, size_t, FeObject** argv) {
+  return MapBytes(ctx, argv[0], tolower);
+}
+
+// `(string->number s)` returns the number that all of `s` spells, or `nil`.
+FeObject* FexStringToNumber(FeContext* ctx, size_t, FeObject** argv) {
+  char buffer[64];
+  const size_t length = Length(ctx, argv[0]);
+  if (length == 0 || length >= sizeof(buffer)) {
+    return &nil;
+  }
+  Cursor c = MakeCursor(ctx, argv[0]);
+  buffer[CopyFrom(&c, buffer)] = '\0';
+  char* end;
+  const FeDouble n = strtod(buffer, &end);
+  return end == buffer + length && !isspace((unsigned char)buffer[0])
+             ? FeMakeDouble(ctx, n)
+             : &nil;
+}
+
+// `(number->string n)` returns the shortest decimal form of `n` that reads back
+// as `n`.
+FeObject* FexNumberToString(FeContext* ctx, size_t, FeObject** argv) {
+  const FeDouble n = FeToDouble(ctx, argv[0]);
+  char text[32];
+  for (int precision = 15; precision <= 17; precision++) {
+    snprintf(text, sizeof(text), "%.*g", precision, n);
+    if (isnan(n) || strtod(text, NULL) == n) {
+      break;
+    }
+  }
+  return FeMakeString(ctx, text);
+}
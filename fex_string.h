@@ -0,0 +1,25 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef FEX_STRING_H
+#define FEX_STRING_H
+
+#include "fe.h"
+
+void FexInstallString(FeContext* ctx);
+
+FeObject* FexJoinStrings(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexNumberToString(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSplitString(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringContains(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringDowncase(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringEndsWith(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringIndex(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringLength(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringStartsWith(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringToNumber(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringTrim(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexStringUpcase(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexSubstring(FeContext* ctx, size_t argc, FeObject** argv);
+
+#endif
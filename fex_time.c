@@ -9,10 +9,35 @@
 #include "fex_time.h"
 
 void FexInstallTime(FeContext* ctx) {
-  FexInstallNativeFn(ctx, "get-time", FexGetTime);
+  FexInstallNativeArrayFn(ctx, "get-cpu-time", FexGetCPUTime, 0);
+  FexInstallNativeArrayFn(ctx, "get-monotonic-time", FexGetMonotonicTime, 0);
+  FexInstallNativeArrayFn(ctx, "get-time", FexGetTime, 0);
 }
 
-FeObject* FexGetTime(FeContext* ctx, FeObject*) {
+// Returns the time of `clock` as a single number of nanoseconds, which is
+// exact for the first 104 days of the clock.
+static FeObject* GetNanoseconds(FeContext* ctx, clockid_t clock) {
+  struct timespec time;
+  if (clock_gettime(clock, &time) != 0) {
+    return BuildErrnoError(ctx, errno);
+  }
+  return FeMakeDouble(ctx, (double)time.tv_sec * 1e9 + (double)time.tv_nsec);
+}
+
+// `(get-cpu-time)` returns the CPU time that the calling thread has used, in
+// nanoseconds.
+FeObject* FexGetCPUTime(FeContext* ctx, size_t, FeObject**) {
+  return GetNanoseconds(ctx, CLOCK_THREAD_CPUTIME_ID);
+}
+
+// `(get-monotonic-time)` returns the time since an arbitrary point, in
+// nanoseconds, from a clock that setting the system time does not change.
+// Differences between its values measure elapsed time.
+FeObject* FexGetMonotonicTime(FeContext* ctx, size_t, FeObject**) {
+  return GetNanoseconds(ctx, CLOCK_MONOTONIC);
+}
+
+FeObject* FexGetTime(FeContext* ctx, size_t, FeObject**) {
   struct timespec time;
   return clock_gettime(CLOCK_REALTIME, &time) == 0
              ? FeMakeList(
@@ -8,6 +8,8 @@
 
 void FexInstallTime(FeContext* ctx);
 
-FeObject* FexGetTime(FeContext* ctx, FeObject*);
+FeObject* FexGetCPUTime(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexGetMonotonicTime(FeContext* ctx, size_t argc, FeObject** argv);
+FeObject* FexGetTime(FeContext* ctx, size_t argc, FeObject** argv);
 
 #endif
@@ -0,0 +1,362 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "jit.h"
+
+enum {
+  // Calls deeper than this, or whose frames would take more than
+  // `StackBudget` bytes, end the outermost one with `*overflowed` set, well
+  // before they could exhaust a generator's C stack.
+  DepthLimit = 4096,
+  StackBudget = 256 * 1024,
+  Unbound = -1,
+};
+
+typedef double
+JitFn(double, double, double, double, double, double, double, double);
+
+struct JitCode {
+  JitFn* fn;
+  void* memory;
+  size_t size;
+  size_t parameter_count;
+  int64_t depth_limit;
+  // The code of recursive calls counts down `depth_left`, and sets
+  // `overflowed` when it reaches 0:
+  int64_t depth_left;
+  int64_t overflowed;
+};
+
+typedef struct Fixup {
+  size_t offset;
+  JitLabel label;
+} Fixup;
+
+struct Jit {
+  JitCode* code;
+  uint8_t* bytes;
+  size_t size;
+  size_t capacity;
+  size_t parameter_count;
+  // Where the frame size goes in the prologue:
+  size_t frame_offset;
+  JitLabel overflow;
+  // The offsets of the labels, or `Unbound`:
+  ptrdiff_t* labels;
+  size_t label_count;
+  Fixup* fixups;
+  size_t fixup_count;
+  bool failed;
+};
+
+// Emission
+
+static void Emit(Jit* jit, const uint8_t* bytes, size_t count) {
+  if (jit->size + count > jit->capacity) {
+    const size_t capacity = 2 * (jit->size + count);
+    uint8_t* b = realloc(jit->bytes, capacity);
+    if (b == NULL) {
+      jit->failed = true;
+      return;
+    }
+    jit->bytes = b;
+    jit->capacity = capacity;
+  }
+  memcpy(jit->bytes + jit->size, bytes, count);
+  jit->size += count;
+}
+
+#define EMIT(...)                           \
+  Emit(jit, (const uint8_t[]){__VA_ARGS__}, \
+       sizeof((const uint8_t[]){__VA_ARGS__}))
+
+static void Emit32(Jit* jit, int32_t value) {
+  uint8_t bytes[4];
+  memcpy(bytes, &value, sizeof(bytes));
+  Emit(jit, bytes, sizeof(bytes));
+}
+
+static void Emit64(Jit* jit, uint64_t value) {
+  uint8_t bytes[8];
+  memcpy(bytes, &value, sizeof(bytes));
+  Emit(jit, bytes, sizeof(bytes));
+}
+
+// mov rax, value
+static void EmitMoveRax(Jit* jit, uint64_t value) {
+  EMIT(0x48, 0xB8);
+  Emit64(jit, value);
+}
+
+// Slots are below the frame pointer.
+static int32_t GetDisplacement(size_t slot) {
+  return -8 * (int32_t)(slot + 1);
+}
+
+// movsd xmm<reg>, [rbp + slot]
+static void EmitLoadSlot(Jit* jit, uint8_t reg, size_t slot) {
+  EMIT(0xF2, 0x0F, 0x10, (uint8_t)(0x85 | reg << 3));
+  Emit32(jit, GetDisplacement(slot));
+}
+
+// movapd xmm1, xmm0
+static void EmitCopyToXmm1(Jit* jit) {
+  EMIT(0x66, 0x0F, 0x28, 0xC8);
+}
+
+static void EmitJump(Jit* jit, const uint8_t* opcode, size_t size, JitLabel l) {
+  Emit(jit, opcode, size);
+  Fixup* f = realloc(jit->fixups, (jit->fixup_count + 1) * sizeof(Fixup));
+  if (f == NULL) {
+    jit->failed = true;
+    return;
+  }
+  jit->fixups = f;
+  jit->fixups[jit->fixup_count++] = (Fixup){.offset = jit->size, .label = l};
+  Emit32(jit, 0);
+}
+
+// Jcc rel32, where `condition` is the low nibble of the opcode:
+static void EmitJumpIf(Jit* jit, uint8_t condition, JitLabel label) {
+  EmitJump(jit, (const uint8_t[]){0x0F, (uint8_t)(0x80 | condition)}, 2, label);
+}
+
+enum {
+  ConditionBelow = 0x2,
+  ConditionAboveEqual = 0x3,
+  ConditionBelowEqual = 0x6,
+  ConditionAbove = 0x7,
+  ConditionLess = 0xC,
+  ConditionLessEqual = 0xE,
+};
+
+// Building
+
+JitLabel JitMakeLabel(Jit* jit) {
+  ptrdiff_t* l =
+      realloc(jit->labels, (jit->label_count + 1) * sizeof(ptrdiff_t));
+  if (l == NULL) {
+    jit->failed = true;
+    return 0;
+  }
+  jit->labels = l;
+  jit->labels[jit->label_count] = Unbound;
+  return jit->label_count++;
+}
+
+void JitBindLabel(Jit* jit, JitLabel label) {
+  if (!jit->failed) {
+    jit->labels[label] = (ptrdiff_t)jit->size;
+  }
+}
+
+void JitJump(Jit* jit, JitLabel label) {
+  EmitJump(jit, (const uint8_t[]){0xE9}, 1, label);
+}
+
+void JitLoop(Jit* jit, JitLabel label) {
+  // mov rax, &depth_left; cmp qword [rax], 0; jl overflow
+  EmitMoveRax(jit, (uint64_t)(uintptr_t)&jit->code->depth_left);
+  EMIT(0x48, 0x83, 0x38, 0x00);
+  EmitJumpIf(jit, ConditionLess, jit->overflow);
+  JitJump(jit, label);
+}
+
+Jit* JitOpen(size_t parameter_count) {
+#if !defined(__x86_64__)
+  (void)parameter_count;
+  return NULL;
+#else
+  if (parameter_count > JitParameterLimit) {
+    return NULL;
+  }
+  Jit* jit = calloc(1, sizeof(Jit));
+  JitCode* code = calloc(1, sizeof(JitCode));
+  if (jit == NULL || code == NULL) {
+    free(jit);
+    free(code);
+    return NULL;
+  }
+  jit->code = code;
+  jit->parameter_count = parameter_count;
+  code->parameter_count = parameter_count;
+  jit->overflow = JitMakeLabel(jit);
+
+  // push rbp; mov rbp, rsp; sub rsp, frame
+  EMIT(0x55, 0x48, 0x89, 0xE5, 0x48, 0x81, 0xEC);
+  jit->frame_offset = jit->size;
+  Emit32(jit, 0);
+  // mov rax, &depth_left; cmp qword [rax], 0; jle overflow; dec qword [rax]
+  EmitMoveRax(jit, (uint64_t)(uintptr_t)&code->depth_left);
+  EMIT(0x48, 0x83, 0x38, 0x00);
+  EmitJumpIf(jit, ConditionLessEqual, jit->overflow);
+  EMIT(0x48, 0xFF, 0x08);
+  for (size_t i = 0; i < parameter_count; i++) {
+    // movsd [rbp + slot], xmm<i>
+    EMIT(0xF2, 0x0F, 0x11, (uint8_t)(0x85 | i << 3));
+    Emit32(jit, GetDisplacement(i));
+  }
+  return jit;
+#endif
+}
+
+void JitAbandon(Jit* jit) {
+  free(jit->code);
+  free(jit->bytes);
+  free(jit->labels);
+  free(jit->fixups);
+  free(jit);
+}
+
+JitCode* JitFinish(Jit* jit, size_t slot_count) {
+  // mov rax, &depth_left; inc qword [rax]; leave; ret
+  EmitMoveRax(jit, (uint64_t)(uintptr_t)&jit->code->depth_left);
+  EMIT(0x48, 0xFF, 0x00, 0xC9, 0xC3);
+  // overflow: mov qword [rax + 8], 1; mov qword [rax], INT32_MIN;
+  // pxor xmm0, xmm0; leave; ret. Leaving `depth_left` far below 0 makes every
+  // call still to come return at once, too.
+  JitBindLabel(jit, jit->overflow);
+  EMIT(0x48, 0xC7, 0x40, 0x08, 0x01, 0x00, 0x00, 0x00);
+  EMIT(0x48, 0xC7, 0x00, 0x00, 0x00, 0x00, 0x80);
+  EMIT(0x66, 0x0F, 0xEF, 0xC0, 0xC9, 0xC3);
+  if (jit->failed || slot_count > INT32_MAX / 16) {
+    JitAbandon(jit);
+    return NULL;
+  }
+
+  // Keep the stack 16-byte aligned for calls:
+  const int32_t frame = (int32_t)((slot_count * 8 + 15) & ~(size_t)15);
+  memcpy(jit->bytes + jit->frame_offset, &frame, sizeof(frame));
+  // Each call also pushes its return address and frame pointer:
+  const int64_t depth_limit = StackBudget / (frame + 16);
+  jit->code->depth_limit = depth_limit < DepthLimit ? depth_limit : DepthLimit;
+  for (size_t i = 0; i < jit->fixup_count; i++) {
+    const Fixup* f = &jit->fixups[i];
+    const int32_t rel =
+        (int32_t)(jit->labels[f->label] - (ptrdiff_t)(f->offset + 4));
+    memcpy(jit->bytes + f->offset, &rel, sizeof(rel));
+  }
+
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t size = (jit->size + page - 1) / page * page;
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    JitAbandon(jit);
+    return NULL;
+  }
+  memcpy(memory, jit->bytes, jit->size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    (void)munmap(memory, size);
+    JitAbandon(jit);
+    return NULL;
+  }
+
+  JitCode* code = jit->code;
+  jit->code = NULL;
+  JitAbandon(jit);
+  code->memory = memory;
+  code->size = size;
+  static_assert(sizeof(code->fn) == sizeof(memory), "code pointer size");
+  memcpy(&code->fn, &memory, sizeof(memory));
+  return code;
+}
+
+void JitFree(JitCode* code) {
+  if (code != NULL) {
+    (void)munmap(code->memory, code->size);
+    free(code);
+  }
+}
+
+double JitCall(JitCode* code, const double* arguments, bool* overflowed) {
+  // The code reads only as many registers as it has parameters.
+  double a[JitParameterLimit] = {0};
+  for (size_t i = 0; i < code->parameter_count; i++) {
+    a[i] = arguments[i];
+  }
+  code->depth_left = code->depth_limit;
+  code->overflowed = 0;
+  const double result =
+      code->fn(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]);
+  *overflowed = code->overflowed != 0;
+  return result;
+}
+
+// Templates
+
+void JitLoadConstant(Jit* jit, double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  EmitMoveRax(jit, bits);
+  // movq xmm0, rax
+  EMIT(0x66, 0x48, 0x0F, 0x6E, 0xC0);
+}
+
+void JitLoad(Jit* jit, size_t slot) {
+  EmitLoadSlot(jit, 0, slot);
+}
+
+void JitStore(Jit* jit, size_t slot) {
+  // movsd [rbp + slot], xmm0
+  EMIT(0xF2, 0x0F, 0x11, 0x85);
+  Emit32(jit, GetDisplacement(slot));
+}
+
+void JitArithmetic(Jit* jit, JitOperator operator, size_t slot) {
+  static const uint8_t opcodes[] = {
+      [JitAdd] = 0x58,
+      [JitSubtract] = 0x5C,
+      [JitMultiply] = 0x59,
+      [JitDivide] = 0x5E,
+  };
+  EmitCopyToXmm1(jit);
+  EmitLoadSlot(jit, 0, slot);
+  // <op>sd xmm0, xmm1
+  EMIT(0xF2, 0x0F, opcodes[operator], 0xC1);
+}
+
+void JitBranch(Jit* jit,
+               JitComparison comparison,
+               size_t slot,
+               bool jump_if,
+               JitLabel label) {
+  EmitLoadSlot(jit, 1, slot);
+  // ucomisd xmm0, xmm1, which compares the accumulator (the right operand) to
+  // the slot (the left). An unordered result sets CF and ZF, as for `below`.
+  EMIT(0x66, 0x0F, 0x2E, 0xC1);
+  const uint8_t condition =
+      comparison == JitLess ? (jump_if ? ConditionAbove : ConditionBelowEqual)
+                            : (jump_if ? ConditionAboveEqual : ConditionBelow);
+  EmitJumpIf(jit, condition, label);
+}
+
+void JitCallUnary(Jit* jit, double (*fn)(double)) {
+  // mov rax, fn; call rax
+  EmitMoveRax(jit, (uint64_t)(uintptr_t)fn);
+  EMIT(0xFF, 0xD0);
+}
+
+void JitCallBinary(Jit* jit, double (*fn)(double, double), size_t slot) {
+  EmitCopyToXmm1(jit);
+  EmitLoadSlot(jit, 0, slot);
+  EmitMoveRax(jit, (uint64_t)(uintptr_t)fn);
+  EMIT(0xFF, 0xD0);
+}
+
+void JitCallSelf(Jit* jit, size_t first) {
+  for (size_t i = 0; i < jit->parameter_count; i++) {
+    EmitLoadSlot(jit, (uint8_t)i, first + i);
+  }
+  // call rel32, to the start of the code
+  EMIT(0xE8);
+  Emit32(jit, -(int32_t)(jit->size + 4));
+}
@@ -0,0 +1,75 @@
+// Copyright 2024 Chris Palmer, https://noncombatant.org/
+// SPDX-License-Identifier: MIT
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A template assembler that emits x86-64 machine code for numeric functions of
+// up to `JitParameterLimit` doubles. The code works on an accumulator (the
+// result of the last template) and numbered stack slots, the first of which
+// hold the parameters; it calls nothing but C math functions and itself, and
+// refers to no memory but its own stack frame and `JitCode`.
+typedef struct Jit Jit;
+typedef struct JitCode JitCode;
+typedef size_t JitLabel;
+
+enum {
+  JitParameterLimit = 8,
+};
+
+typedef enum JitOperator {
+  JitAdd,
+  JitSubtract,
+  JitMultiply,
+  JitDivide,
+} JitOperator;
+
+typedef enum JitComparison {
+  JitLess,
+  JitLessEqual,
+} JitComparison;
+
+// Returns `NULL` if the platform is not x86-64, `parameter_count` is more than
+// `JitParameterLimit`, or memory is short.
+Jit* JitOpen(size_t parameter_count);
+// Frees `jit` without finishing it.
+void JitAbandon(Jit* jit);
+// Makes executable code of the templates emitted so far, which use slots
+// `[0, slot_count)`, and frees `jit`. The accumulator is the result. Returns
+// `NULL` if memory is short.
+JitCode* JitFinish(Jit* jit, size_t slot_count);
+void JitFree(JitCode* code);
+
+// Calls `code` with `arguments`, one per parameter. If the function recursed
+// too deeply, sets `*overflowed`, and the result is meaningless.
+double JitCall(JitCode* code, const double* arguments, bool* overflowed);
+
+void JitLoadConstant(Jit* jit, double value);
+void JitLoad(Jit* jit, size_t slot);
+void JitStore(Jit* jit, size_t slot);
+// Sets the accumulator to `slot` `operator` the accumulator.
+void JitArithmetic(Jit* jit, JitOperator operator, size_t slot);
+// Jumps to `label` if `slot` `comparison` the accumulator is `jump_if`. As in
+// C, comparisons with NaN are false.
+void JitBranch(Jit* jit,
+               JitComparison comparison,
+               size_t slot,
+               bool jump_if,
+               JitLabel label);
+JitLabel JitMakeLabel(Jit* jit);
+void JitBindLabel(Jit* jit, JitLabel label);
+void JitJump(Jit* jit, JitLabel label);
+// Like `JitJump`, for the back edges of loops: if a recursive call overflowed,
+// returns instead, since the loop may wait on results that never come.
+void JitLoop(Jit* jit, JitLabel label);
+// Sets the accumulator to `fn(accumulator)`, or `fn(slot, accumulator)`.
+void JitCallUnary(Jit* jit, double (*fn)(double));
+void JitCallBinary(Jit* jit, double (*fn)(double, double), size_t slot);
+// Sets the accumulator to the result of calling the function being compiled
+// with the values of the slots from `first`, one per parameter.
+void JitCallSelf(Jit* jit, size_t first);
+
+#endif
@@ -4,7 +4,9 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <getopt.h>
+#include <pthread.h>
 #include <setjmp.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,27 +14,39 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "aot.h"
 #include "auto.h"
 #include "fe.h"
 #include "fex.h"
+#include "fex_bytes.h"
+#include "fex_csv.h"
+#include "fex_event.h"
+#include "fex_generator.h"
 #include "fex_io.h"
+#include "fex_json.h"
+#include "fex_list.h"
 #include "fex_math.h"
+#include "fex_parallel.h"
 #include "fex_process.h"
 #include "fex_re.h"
+#include "fex_serialize.h"
+#include "fex_string.h"
 #include "fex_time.h"
 
 static const char* InterpreterVersion = "1.0";
 
-static jmp_buf top_level;
+// Each thread running a context has its own top level to return to on error.
+static _Thread_local jmp_buf top_level;
 
 static void noreturn HandleError(FeContext* ctx,
                                  const char* message,
                                  FeObject* stack) {
-  fprintf(stderr, "error: %s\n", message);
+  FILE* error = FeGetStreams(ctx)->error;
+  fprintf(error, "error: %s\n", message);
   while (!FeIsNil(stack)) {
     char fn[1024];
     FeToString(ctx, FeCar(ctx, stack), fn, sizeof(fn));
-    fprintf(stderr, "%s\n", fn);
+    fprintf(error, "%s\n", fn);
     stack = FeCdr(ctx, stack);
   }
   longjmp(top_level, -1);
@@ -59,11 +73,25 @@ static void noreturn PrintHelp(int status) {
           "fe — Fe language interpreter\n\n"
           "Usage:\n\n"
           "  fe -h\n"
-          "  fe [-i] [-s size] [program-file ...]\n\n"
+          "  fe [-i] [-g threads] [-J calls] [-s size] [program-file ...]\n"
+          "  fe -j jobs [-g threads] [-J calls] [-s size] program-file ...\n"
+          "  fe -c [-s size] [-x] program-file ... [-o output-file]\n\n"
           "Options:\n\n"
+          "  -c    Compile the program files' functions to C, which builds\n"
+          "        into fe with `make fe-compiled COMPILED=output-file`\n"
           "  -d    Verbose debugging\n"
+          "  -g <threads>\n"
+          "        Collect garbage using up to `threads` threads\n"
           "  -h    Print this help message and exit\n"
           "  -i    Interactive mode (read from stdin)\n"
+          "  -j <jobs>\n"
+          "        Run each program file in its own context, using up to\n"
+          "        `jobs` threads. Output is printed in program file order.\n"
+          "  -J <calls>\n"
+          "        Compile numeric functions to machine code after `calls`\n"
+          "        calls\n"
+          "  -o <output-file>\n"
+          "        Write the C of -c to `output-file` (default stdout)\n"
           "  -s <size>\n"
           "        Set arena size\n"
           "  -v    Print the version and exit\n"
@@ -89,6 +117,177 @@ static size_t ReadEvaluatePrint(FeContext* context, FILE* input, size_t gc) {
   }
 }
 
+static void InstallExtensions(FeContext* context) {
+  FexInit(context);
+  FexInstallBytes(context);
+  FexInstallCSV(context);
+  FexInstallEvent(context);
+  FexInstallGenerator(context);
+  FexInstallIO(context);
+  FexInstallJSON(context);
+  FexInstallList(context);
+  FexInstallMath(context);
+  FexInstallParallel(context);
+  FexInstallProcess(context);
+  FexInstallRE(context);
+  FexInstallSerialize(context);
+  FexInstallString(context);
+  FexInstallTime(context);
+}
+
+typedef struct Job {
+  const char* pathname;
+  char* output;
+  size_t output_size;
+  char* error;
+  size_t error_size;
+  bool failed;
+} Job;
+
+typedef struct JobQueue {
+  Job* jobs;
+  size_t count;
+  atomic_size_t next;
+  size_t arena_size;
+  size_t gc_threads;
+  size_t jit_threshold;
+  bool extensions;
+} JobQueue;
+
+// Runs one program file in a fresh context whose output and error streams are
+// buffered in memory, so that concurrent jobs do not interleave their output.
+static void RunJob(JobQueue* queue, Job* job) {
+  AUTO(char*, arena, malloc(queue->arena_size), FreeChar);
+  AUTO(FILE*, output, open_memstream(&job->output, &job->output_size),
+       CloseFile);
+  AUTO(FILE*, error, open_memstream(&job->error, &job->error_size), CloseFile);
+  AUTO(FILE*, input, fopen(job->pathname, "rb"), CloseFile);
+  if (arena == NULL || output == NULL || error == NULL) {
+    job->failed = true;
+    return;
+  }
+  if (input == NULL) {
+    fprintf(error, "error: could not open input file\n");
+    job->failed = true;
+    return;
+  }
+
+  AUTO(FeContext*, context, FeOpenContext(arena, queue->arena_size),
+       CloseContext);
+  *FeGetStreams(context) =
+      (FeStreams){.input = stdin, .output = output, .error = error};
+  FeSetGCThreads(context, queue->gc_threads);
+  FeSetJITThreshold(context, queue->jit_threshold);
+  if (queue->extensions) {
+    InstallExtensions(context);
+  }
+  FeGetHandlers(context)->error = HandleError;
+  if (setjmp(top_level) != 0) {
+    job->failed = true;
+    return;
+  }
+#if defined(FE_COMPILED)
+  FexInstallCompiled(context);
+#endif
+  ReadEvaluatePrint(context, input, FeSaveGC(context));
+}
+
+static void* RunJobs(void* q) {
+  JobQueue* queue = q;
+  while (true) {
+    const size_t i =
+        atomic_fetch_add_explicit(&queue->next, 1, memory_order_relaxed);
+    if (i >= queue->count) {
+      return NULL;
+    }
+    RunJob(queue, &queue->jobs[i]);
+  }
+}
+
+static int RunParallel(size_t thread_count,
+                       char* pathnames[],
+                       size_t count,
+                       size_t arena_size,
+                       size_t gc_threads,
+                       size_t jit_threshold,
+                       bool extensions) {
+  Job* jobs = calloc(count, sizeof(Job));
+  pthread_t* threads = calloc(thread_count, sizeof(pthread_t));
+  if (jobs == NULL || threads == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  JobQueue queue = {.jobs = jobs,
+                    .count = count,
+                    .arena_size = arena_size,
+                    .gc_threads = gc_threads,
+                    .jit_threshold = jit_threshold,
+                    .extensions = extensions};
+  atomic_init(&queue.next, 0);
+  for (size_t i = 0; i < count; i++) {
+    jobs[i].pathname = pathnames[i];
+  }
+
+  size_t started = 0;
+  for (; started < thread_count && started < count; started++) {
+    if (pthread_create(&threads[started], NULL, RunJobs, &queue) != 0) {
+      perror("pthread_create");
+      break;
+    }
+  }
+  if (started == 0) {
+    RunJobs(&queue);
+  }
+  for (size_t i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  int status = EXIT_SUCCESS;
+  for (size_t i = 0; i < count; i++) {
+    Job* job = &jobs[i];
+    if (job->output != NULL) {
+      fwrite(job->output, 1, job->output_size, stdout);
+    }
+    if (job->error != NULL) {
+      fwrite(job->error, 1, job->error_size, stderr);
+    }
+    if (job->failed) {
+      status = EXIT_FAILURE;
+    }
+    free(job->output);
+    free(job->error);
+  }
+  free(threads);
+  free(jobs);
+  return status;
+}
+
+// Translates the program files to C, with a context that has the globals that
+// they will run with.
+static int Compile(char* pathnames[],
+                   size_t count,
+                   const char* output_pathname,
+                   size_t arena_size,
+                   bool extensions) {
+  AUTO(char*, arena, malloc(arena_size), FreeChar);
+  AUTO(FeContext*, context, FeOpenContext(arena, arena_size), CloseContext);
+  if (extensions) {
+    InstallExtensions(context);
+  }
+  FILE* output =
+      output_pathname == NULL ? stdout : fopen(output_pathname, "wb");
+  if (output == NULL) {
+    perror(output_pathname);
+    return EXIT_FAILURE;
+  }
+  const bool compiled = AotCompile(context, pathnames, count, output);
+  if (output != stdout && fclose(output) != 0) {
+    perror(output_pathname);
+    return EXIT_FAILURE;
+  }
+  return compiled ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int count, char* arguments[]) {
   // Parse command line options:
   size_t arena_size = 64 * 1024;
@@ -96,23 +295,58 @@ int main(int count, char* arguments[]) {
   bool program_literal = false;
   bool interactive = false;
   bool extensions = true;
+  bool compiling = false;
+  const char* output_pathname = NULL;
+  size_t jobs = 0;
+  size_t gc_threads = 1;
+  size_t jit_threshold = 0;
   while (true) {
-    int ch = getopt(count, arguments, "dehis:vx");
+    int ch = getopt(count, arguments, "cdeg:hij:J:o:s:vx");
     if (ch == -1) {
       break;
     }
     switch (ch) {
+      case 'c':
+        compiling = true;
+        break;
       case 'd':
         debugging = true;
         break;
       case 'e':
         program_literal = true;
         break;
+      case 'g': {
+        char* end = NULL;
+        gc_threads = strtoul(optarg, &end, 0);
+        if (end == optarg) {
+          PrintHelp(EXIT_FAILURE);
+        }
+        break;
+      }
       case 'h':
         PrintHelp(EXIT_SUCCESS);
       case 'i':
         interactive = true;
         break;
+      case 'j': {
+        char* end = NULL;
+        jobs = strtoul(optarg, &end, 0);
+        if (end == optarg || jobs == 0) {
+          PrintHelp(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'J': {
+        char* end = NULL;
+        jit_threshold = strtoul(optarg, &end, 0);
+        if (end == optarg) {
+          PrintHelp(EXIT_FAILURE);
+        }
+        break;
+      }
+      case 'o':
+        output_pathname = optarg;
+        break;
       case 's': {
         char* end = NULL;
         arena_size = strtoul(optarg, &end, 0);
@@ -134,19 +368,33 @@ int main(int count, char* arguments[]) {
   }
   count -= optind;
   arguments += optind;
+  if (compiling) {
+    if (interactive || program_literal || jobs != 0 || count == 0) {
+      PrintHelp(EXIT_FAILURE);
+    }
+    return Compile(arguments, (size_t)count, output_pathname, arena_size,
+                   extensions);
+  }
+  if (jobs != 0) {
+    if (interactive || program_literal || debugging || count == 0) {
+      PrintHelp(EXIT_FAILURE);
+    }
+    return RunParallel(jobs, arguments, (size_t)count, arena_size, gc_threads,
+                       jit_threshold, extensions);
+  }
   interactive = interactive || count == 0;
 
   // Initialize the context:
   AUTO(char*, arena, malloc(arena_size), FreeChar);
   AUTO(FeContext*, context, FeOpenContext(arena, arena_size), CloseContext);
+  FeSetGCThreads(context, gc_threads);
+  FeSetJITThreshold(context, jit_threshold);
   if (extensions) {
-    FexInit(context);
-    FexInstallIO(context);
-    FexInstallMath(context);
-    FexInstallProcess(context);
-    FexInstallRE(context);
-    FexInstallTime(context);
+    InstallExtensions(context);
   }
+#if defined(FE_COMPILED)
+  FexInstallCompiled(context);
+#endif
   if (debugging) {
     FeGetHandlers(context)->mark = HandleMark;
     FeGetHandlers(context)->gc = HandleGC;
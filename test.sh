@@ -25,7 +25,17 @@ run_test() {
   done
   ./fe -e '(print "hello, world!")' > out 2> err
   check_results "tests/one-liner.out" "tests/one-liner.err" "one-liner"
-  rm out err
+  ./fe -j 2 scripts/life.fe scripts/macros.fe > out 2> err
+  check_results "tests/parallel.out" "tests/parallel.err" "parallel"
+  ./fe -g 4 -s 1100000 scripts/assert.fe scripts/life.fe > out 2> err
+  check_results "tests/life.fe.out" "tests/life.fe.err" "parallel GC"
+  ./fe -J 2 scripts/assert.fe scripts/jit.fe > out 2> err
+  check_results "tests/jit.fe.out" "tests/jit.fe.err" "JIT"
+  ./fe -c scripts/assert.fe scripts/compiled.fe -o compiled.c
+  make fe-compiled COMPILED=compiled.c
+  ./fe-compiled -e 'nil' > out 2> err
+  check_results "tests/compiled.fe.out" "tests/compiled.fe.err" "compiled"
+  rm out err compiled.c fe-compiled
 }
 
 make clean